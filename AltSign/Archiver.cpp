@@ -4,8 +4,16 @@
 //
 //
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #include "Archiver.hpp"
 #include "Error.hpp"
@@ -34,6 +42,7 @@ extern "C" {
 #include <cstdint>
 
 const int ALTReadBufferSize = 8192;
+const int ALTUnzipBufferSize = 1024 * 1024;
 const int ALTMaxFilenameLength = 512;
 
 #include <sstream>
@@ -67,6 +76,68 @@ extern std::string replace_all(
 	const std::string& replace //      by 'replace'
 );
 
+struct UnzipEntry
+{
+    unz_file_pos position;
+    unz_file_info info;
+    fs::path filepath;
+};
+
+static void ExtractZipEntry(unzFile zipFile, const UnzipEntry& entry, std::vector<char>& buffer)
+{
+    unz_file_pos position = entry.position;
+    if (unzGoToFilePos(zipFile, &position) != UNZ_OK || unzOpenCurrentFile(zipFile) != UNZ_OK)
+    {
+        throw ArchiveError(ArchiveErrorCode::Unknown);
+    }
+
+    std::string narrowFilepath = StringFromWideString(entry.filepath.c_str());
+
+    FILE* outputFile = fopen(narrowFilepath.c_str(), "wb");
+    if (outputFile == NULL)
+    {
+        unzCloseCurrentFile(zipFile);
+        throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+    }
+
+    // Let stdio write straight from our buffer rather than through its own small one.
+    setvbuf(outputFile, NULL, _IONBF, 0);
+
+    int result = UNZ_OK;
+
+    do
+    {
+        result = unzReadCurrentFile(zipFile, buffer.data(), (unsigned int)buffer.size());
+
+        if (result < 0)
+        {
+            fclose(outputFile);
+            unzCloseCurrentFile(zipFile);
+            throw ArchiveError(ArchiveErrorCode::Unknown);
+        }
+
+        size_t count = fwrite(buffer.data(), result, 1, outputFile);
+        if (result > 0 && count != 1)
+        {
+            fclose(outputFile);
+            unzCloseCurrentFile(zipFile);
+            throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+        }
+
+    } while (result > 0);
+
+    fclose(outputFile);
+
+    // Also verifies the CRC now that the whole entry has been read.
+    if (unzCloseCurrentFile(zipFile) != UNZ_OK)
+    {
+        throw ArchiveError(ArchiveErrorCode::CorruptFile);
+    }
+
+    short permissions = (entry.info.external_fa >> 16) & 0x01FF;
+    _chmod(narrowFilepath.c_str(), permissions);
+}
+
 void UnzipArchive(std::string archivePath, std::string outputDirectory)
 {
 	if (outputDirectory[outputDirectory.size() - 1] != ALTDirectoryDeliminator)
@@ -80,129 +151,115 @@ void UnzipArchive(std::string archivePath, std::string outputDirectory)
 		throw ArchiveError(ArchiveErrorCode::NoSuchFile);
 	}
 
-	FILE* outputFile = nullptr;
+	// Read the central directory once, collecting every file along with the directories they need.
+	std::vector<UnzipEntry> entries;
+	std::set<fs::path> directories;
 
-	auto finish = [&outputFile, &zipFile](void)
+	for (int result = unzGoToFirstFile(zipFile); result != UNZ_END_OF_LIST_OF_FILE; result = unzGoToNextFile(zipFile))
 	{
-		if (outputFile != nullptr)
-		{
-			fclose(outputFile);
-		}
-
-		unzCloseCurrentFile(zipFile);
-		unzClose(zipFile);
-	};
-
-	unz_global_info zipInfo;
-	if (unzGetGlobalInfo(zipFile, &zipInfo) != UNZ_OK)
-	{
-		finish();
-		throw ArchiveError(ArchiveErrorCode::CorruptFile);
-	}
-
-	char buffer[ALTReadBufferSize];
-
-	for (int i = 0; i < zipInfo.number_entry; i++)
-	{
-		unz_file_info info;
+		UnzipEntry entry;
 		char cFilename[ALTMaxFilenameLength];
 
-		if (unzGetCurrentFileInfo(zipFile, &info, cFilename, ALTMaxFilenameLength, NULL, 0, NULL, 0) != UNZ_OK)
+		if (result != UNZ_OK ||
+			unzGetCurrentFileInfo(zipFile, &entry.info, cFilename, ALTMaxFilenameLength, NULL, 0, NULL, 0) != UNZ_OK ||
+			unzGetFilePos(zipFile, &entry.position) != UNZ_OK)
 		{
-			finish();
+			unzClose(zipFile);
 			throw ArchiveError(ArchiveErrorCode::Unknown);
 		}
 
 		std::string filename(cFilename);
-		if (startsWith(filename, "__MACOSX"))
+		if (filename.empty() || startsWith(filename, "__MACOSX"))
 		{
-			if (i + 1 < zipInfo.number_entry)
-			{
-				if (unzGoToNextFile(zipFile) != UNZ_OK)
-				{
-					finish();
-					throw ArchiveError(ArchiveErrorCode::Unknown);
-				}
-			}
-
 			continue;
 		}
 
 		std::replace(filename.begin(), filename.end(), '/', ALTDirectoryDeliminator);
 		filename = replace_all(filename, ":", "__colon__");
 
-		fs::path filepath = fs::path(outputDirectory).append(filename);
-		fs::path parentDirectory = (filename[filename.size() - 1] == ALTDirectoryDeliminator) ? filepath.parent_path().parent_path() : filepath.parent_path();
-
-		if (!fs::exists(parentDirectory))
-		{
-			fs::create_directories(parentDirectory);
-		}
+		entry.filepath = fs::path(outputDirectory).append(filename);
 
 		if (filename[filename.size() - 1] == ALTDirectoryDeliminator)
 		{
 			// Directory
-			fs::create_directories(filepath);
+			directories.insert(entry.filepath);
+			continue;
 		}
-		else
-		{
-			// File
-			if (unzOpenCurrentFile(zipFile) != UNZ_OK)
-			{
-				finish();
-				throw ArchiveError(ArchiveErrorCode::Unknown);
-			}
-
-			std::string narrowFilepath = StringFromWideString(filepath.c_str());
 
-			outputFile = fopen(narrowFilepath.c_str(), "wb");
-			if (outputFile == NULL)
-			{
-				finish();
-				throw ArchiveError(ArchiveErrorCode::UnknownWrite);
-			}
+		directories.insert(entry.filepath.parent_path());
+		entries.push_back(entry);
+	}
 
-			int result = UNZ_OK;
+	unzClose(zipFile);
 
-			do
-			{
-				result = unzReadCurrentFile(zipFile, buffer, ALTReadBufferSize);
+	// create_directories() is a no-op for anything an earlier, nested path already created.
+	for (auto it = directories.rbegin(); it != directories.rend(); ++it)
+	{
+		fs::create_directories(*it);
+	}
 
-				if (result < 0)
-				{
-					finish();
-					throw ArchiveError(ArchiveErrorCode::Unknown);
-				}
+	// Inflate on several threads, each with its own unzFile since they aren't thread safe.
+	unsigned int threadCount = std::max(1u, std::min<unsigned int>(std::thread::hardware_concurrency(), (unsigned int)entries.size()));
 
-				size_t count = fwrite(buffer, result, 1, outputFile);
-				if (result > 0 && count != 1)
-				{
-					finish();
-					throw ArchiveError(ArchiveErrorCode::UnknownWrite);
-				}
+	std::atomic<size_t> nextEntry(0);
+	std::atomic<bool> isCancelled(false);
 
-			} while (result > 0);
+	std::mutex errorMutex;
+	std::exception_ptr error;
 
-			short permissions = (info.external_fa >> 16) & 0x01FF;
-			_chmod(narrowFilepath.c_str(), permissions);
+	auto extract = [&]()
+	{
+		unzFile threadZipFile = nullptr;
 
-			fclose(outputFile);
-			outputFile = NULL;
-		}
+		try
+		{
+			threadZipFile = unzOpen(archivePath.c_str());
+			if (threadZipFile == NULL)
+			{
+				throw ArchiveError(ArchiveErrorCode::NoSuchFile);
+			}
 
-		unzCloseCurrentFile(zipFile);
+			std::vector<char> buffer(ALTUnzipBufferSize);
 
-		if (i + 1 < zipInfo.number_entry)
+			for (size_t i = nextEntry++; i < entries.size() && !isCancelled; i = nextEntry++)
+			{
+				ExtractZipEntry(threadZipFile, entries[i], buffer);
+			}
+		}
+		catch (...)
 		{
-			if (unzGoToNextFile(zipFile) != UNZ_OK)
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if (!error)
 			{
-				finish();
-				throw ArchiveError(ArchiveErrorCode::Unknown);
+				error = std::current_exception();
 			}
+
+			isCancelled = true;
+		}
+
+		if (threadZipFile != nullptr)
+		{
+			unzClose(threadZipFile);
 		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < threadCount; i++)
+	{
+		threads.emplace_back(extract);
 	}
 
-	finish();
+	extract();
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
 }
 
 std::string UnzipAppBundle(std::string ipaPath, std::string outputDirectory)
@@ -239,76 +296,626 @@ std::string UnzipAppBundle(std::string ipaPath, std::string outputDirectory)
 }
 
 
-void WriteFileToZipFile(zipFile *zipFile, fs::path filepath, fs::path relativePath)
+AppArchive::AppArchive(std::string archivePath) : _zipFile(NULL)
 {
-    bool isDirectory = fs::is_directory(filepath);
-    
-    std::string filename = relativePath.string();
-    
+    unzFile zipFile = unzOpen(archivePath.c_str());
+    if (zipFile == NULL)
+    {
+        throw ArchiveError(ArchiveErrorCode::NoSuchFile);
+    }
+
+    _zipFile = zipFile;
+
+    struct ArchiveEntry
+    {
+        std::string name;
+        uint64_t size;
+        unz_file_pos position;
+    };
+
+    std::vector<ArchiveEntry> archiveEntries;
+    std::set<std::string> appBundleNames;
+
+    for (int result = unzGoToFirstFile(zipFile); result != UNZ_END_OF_LIST_OF_FILE; result = unzGoToNextFile(zipFile))
+    {
+        ArchiveEntry entry;
+        unz_file_info info;
+        char cFilename[ALTMaxFilenameLength];
+
+        if (result != UNZ_OK ||
+            unzGetCurrentFileInfo(zipFile, &info, cFilename, ALTMaxFilenameLength, NULL, 0, NULL, 0) != UNZ_OK ||
+            unzGetFilePos(zipFile, &entry.position) != UNZ_OK)
+        {
+            unzClose(zipFile);
+            throw ArchiveError(ArchiveErrorCode::CorruptFile);
+        }
+
+        entry.name = cFilename;
+        entry.size = info.uncompressed_size;
+
+        if (!startsWith(entry.name, "Payload/"))
+        {
+            continue;
+        }
+
+        auto separator = entry.name.find('/', 8);
+        if (separator == std::string::npos)
+        {
+            continue;
+        }
+
+        auto appBundleName = entry.name.substr(8, separator - 8);
+
+        auto lowercaseFilename = appBundleName;
+        std::transform(lowercaseFilename.begin(), lowercaseFilename.end(), lowercaseFilename.begin(), [](unsigned char c) {
+            return std::tolower(c);
+        });
+
+        if (endsWith(lowercaseFilename, ".app"))
+        {
+            appBundleNames.insert(appBundleName);
+            archiveEntries.push_back(entry);
+        }
+    }
+
+    if (appBundleNames.empty())
+    {
+        unzClose(zipFile);
+        throw SignError(SignErrorCode::MissingAppBundle);
+    }
+
+    if (appBundleNames.size() > 1)
+    {
+        // Which one gets installed would be up to archive order.
+        unzClose(zipFile);
+        throw SignError(SignErrorCode::InvalidApp);
+    }
+
+    _appBundleName = *appBundleNames.begin();
+
+    auto prefix = "Payload/" + _appBundleName + "/";
+
+    for (auto& archiveEntry : archiveEntries)
+    {
+        if (!startsWith(archiveEntry.name, prefix) || archiveEntry.name.size() == prefix.size())
+        {
+            continue;
+        }
+
+        auto path = archiveEntry.name.substr(prefix.size());
+        if (path[path.size() - 1] == '/')
+        {
+            // Directory
+            path.pop_back();
+            _directories.insert(path);
+        }
+        else
+        {
+            Entry entry;
+            entry.path = path;
+            entry.size = archiveEntry.size;
+            _entries.push_back(entry);
+
+            _positions[path] = std::make_pair(archiveEntry.position.pos_in_zip_directory, archiveEntry.position.num_of_file);
+        }
+
+        for (auto separator = path.rfind('/'); separator != std::string::npos && separator > 0; separator = path.rfind('/', separator - 1))
+        {
+            _directories.insert(path.substr(0, separator));
+        }
+    }
+}
+
+AppArchive::~AppArchive()
+{
+    if (_isEntryOpen != nullptr)
+    {
+        // Readers that outlive the archive must not touch the closed handle.
+        *_isEntryOpen = false;
+    }
+
+    if (_zipFile != NULL)
+    {
+        unzClose((unzFile)_zipFile);
+    }
+}
+
+std::string AppArchive::appBundleName() const
+{
+    return _appBundleName;
+}
+
+const std::vector<AppArchive::Entry>& AppArchive::entries() const
+{
+    return _entries;
+}
+
+const std::set<std::string>& AppArchive::directories() const
+{
+    return _directories;
+}
+
+bool AppArchive::HasEntry(const std::string& path) const
+{
+    return _positions.count(path) != 0;
+}
+
+std::vector<unsigned char> AppArchive::ReadEntry(const std::string& path)
+{
+    auto read = this->OpenEntry(path);
+
+    std::vector<unsigned char> data;
+    std::vector<char> buffer(ALTReadBufferSize);
+
+    while (true)
+    {
+        size_t count = read(buffer.data(), buffer.size());
+        if (count == 0)
+        {
+            break;
+        }
+
+        data.insert(data.end(), buffer.data(), buffer.data() + count);
+    }
+
+    return data;
+}
+
+std::function<size_t(char*, size_t)> AppArchive::OpenEntry(const std::string& path)
+{
+    auto iterator = _positions.find(path);
+    if (iterator == _positions.end())
+    {
+        throw ArchiveError(ArchiveErrorCode::NoSuchFile);
+    }
+
+    unzFile zipFile = (unzFile)_zipFile;
+
+    unz_file_pos position;
+    position.pos_in_zip_directory = iterator->second.first;
+    position.num_of_file = iterator->second.second;
+
+    // unzGoToFilePos would close the previous entry too, but without checking it.
+    this->CloseEntry();
+
+    unz_file_info info;
+    if (unzGoToFilePos(zipFile, &position) != UNZ_OK ||
+        unzGetCurrentFileInfo(zipFile, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK ||
+        unzOpenCurrentFile(zipFile) != UNZ_OK)
+    {
+        throw ArchiveError(ArchiveErrorCode::CorruptFile);
+    }
+
+    auto isOpen = std::make_shared<bool>(true);
+    _isEntryOpen = isOpen;
+
+    if (info.uncompressed_size == 0)
+    {
+        // Callers that copy the entry's size never read an empty entry, so check it now.
+        this->CloseEntry();
+    }
+
+    return [zipFile, isOpen](char* buffer, size_t length) -> size_t {
+        if (!*isOpen)
+        {
+            return 0;
+        }
+
+        int count = unzReadCurrentFile(zipFile, buffer, (unsigned int)std::min<size_t>(length, ALTUnzipBufferSize));
+        if (count < 0)
+        {
+            *isOpen = false;
+            unzCloseCurrentFile(zipFile);
+            throw ArchiveError(ArchiveErrorCode::CorruptFile);
+        }
+
+        if (count == 0 || unzeof(zipFile))
+        {
+            *isOpen = false;
+
+            // Verifies the CRC now that the whole entry has been read.
+            if (unzCloseCurrentFile(zipFile) != UNZ_OK)
+            {
+                throw ArchiveError(ArchiveErrorCode::CorruptFile);
+            }
+        }
+
+        return (size_t)count;
+    };
+}
+
+void AppArchive::CloseEntry()
+{
+    if (_isEntryOpen == nullptr || !*_isEntryOpen)
+    {
+        return;
+    }
+
+    *_isEntryOpen = false;
+
+    if (unzCloseCurrentFile((unzFile)_zipFile) != UNZ_OK)
+    {
+        throw ArchiveError(ArchiveErrorCode::CorruptFile);
+    }
+}
+
+void CopyZipEntry(unzFile sourceFile, zipFile destinationFile, std::string filename, const zip_fileinfo& fileInfo)
+{
+    unz_file_info info;
+    if (unzGetCurrentFileInfo(sourceFile, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK)
+    {
+        throw ArchiveError(ArchiveErrorCode::CorruptFile);
+    }
+
+    int method = 0;
+    int level = 0;
+
+    // Open raw so the compressed stream is passed through untouched.
+    if (unzOpenCurrentFile2(sourceFile, &method, &level, 1) != UNZ_OK)
+    {
+        throw ArchiveError(ArchiveErrorCode::CorruptFile);
+    }
+
+    if (zipOpenNewFileInZip2(destinationFile, filename.c_str(), &fileInfo, NULL, 0, NULL, 0, NULL, method, level, 1) != ZIP_OK)
+    {
+        unzCloseCurrentFile(sourceFile);
+        throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+    }
+
+    std::vector<char> buffer(ALTReadBufferSize * 16);
+    int result = UNZ_OK;
+
+    do
+    {
+        result = unzReadCurrentFile(sourceFile, buffer.data(), (unsigned int)buffer.size());
+        if (result < 0)
+        {
+            unzCloseCurrentFile(sourceFile);
+            zipCloseFileInZipRaw(destinationFile, info.uncompressed_size, info.crc);
+            throw ArchiveError(ArchiveErrorCode::CorruptFile);
+        }
+
+        if (result > 0 && zipWriteInFileInZip(destinationFile, buffer.data(), result) != ZIP_OK)
+        {
+            unzCloseCurrentFile(sourceFile);
+            zipCloseFileInZipRaw(destinationFile, info.uncompressed_size, info.crc);
+            throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+        }
+    } while (result > 0);
+
+    unzCloseCurrentFile(sourceFile);
+
+    if (zipCloseFileInZipRaw(destinationFile, info.uncompressed_size, info.crc) != ZIP_OK)
+    {
+        throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+    }
+}
+
+struct ZipSourceEntry
+{
+    unz_file_pos position;
+    unz_file_info info;
+};
+
+// Entries are read and deflated on worker threads, then appended to the archive in bundle order.
+// Large files are split into chunks that are deflated independently and concatenated.
+const size_t ALTZipChunkSize = 1024 * 1024;
+const size_t ALTZipMaxBytesInFlight = 256 * 1024 * 1024;
+
+struct ZipPackedEntry
+{
+    fs::path filepath;
+    std::string filename;
     zip_fileinfo fileInfo = {};
-    
-    char *bytes = nullptr;
-    unsigned int fileSize = 0;
-    
-    if (isDirectory)
+    bool isDirectory = false;
+    uintmax_t fileSize = 0;
+
+    // Filled in by the workers.
+    const ZipSourceEntry *sourceEntry = nullptr;
+    int method = Z_DEFLATED;
+    uLong crc = 0;
+    std::vector<char> bytes;
+    std::vector<std::vector<char>> chunks;
+    std::vector<uLong> chunkCRCs;
+    // Guarded by the packer.
+    size_t pendingJobs = 0;
+    std::exception_ptr error;
+};
+
+class ZipPacker
+{
+public:
+    ZipPacker(unsigned int threadCount) : _stopping(false)
     {
-        // Remove leading directory slash.
-        if (filename[0] == ALTDirectoryDeliminator)
+        for (unsigned int i = 0; i < threadCount; i++)
         {
-            filename = std::string(filename.begin() + 1, filename.end());
+            _threads.emplace_back([this]() {
+                this->Run();
+            });
         }
-        
-        // Add trailing directory slash.
-        if (filename[filename.size() - 1] != ALTDirectoryDeliminator)
+    }
+
+    // Jobs that haven't started yet are dropped; running ones are waited for.
+    ~ZipPacker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+
+        _jobsCondition.notify_all();
+
+        for (auto& thread : _threads)
+        {
+            thread.join();
+        }
+    }
+
+    // Queues work on behalf of entry. Chunks of an entry already being packed jump the queue,
+    // since the writer is most likely waiting on them.
+    void Post(ZipPackedEntry& entry, bool isChunk, std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            entry.pendingJobs += 1;
+
+            auto wrapper = [this, &entry, job]() {
+                std::exception_ptr error;
+
+                try
+                {
+                    job();
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+
+                this->Finish(entry, error);
+            };
+
+            if (isChunk)
+            {
+                _jobs.push_front(wrapper);
+            }
+            else
+            {
+                _jobs.push_back(wrapper);
+            }
+        }
+
+        _jobsCondition.notify_one();
+    }
+
+    // Blocks until every job posted for entry has run, then rethrows the first error they hit.
+    void Wait(ZipPackedEntry& entry)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _completionCondition.wait(lock, [&entry]() {
+            return entry.pendingJobs == 0;
+        });
+
+        if (entry.error)
+        {
+            std::rethrow_exception(entry.error);
+        }
+    }
+
+private:
+    std::vector<std::thread> _threads;
+    std::deque<std::function<void()>> _jobs;
+
+    std::mutex _mutex;
+    std::condition_variable _jobsCondition;
+    std::condition_variable _completionCondition;
+    bool _stopping;
+
+    void Finish(ZipPackedEntry& entry, std::exception_ptr error)
+    {
+        bool isFinished = false;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            if (error && !entry.error)
+            {
+                entry.error = error;
+            }
+
+            isFinished = (--entry.pendingJobs == 0);
+        }
+
+        if (isFinished)
+        {
+            _completionCondition.notify_all();
+        }
+    }
+
+    void Run()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _jobsCondition.wait(lock, [this]() {
+                    return _stopping || !_jobs.empty();
+                });
+
+                if (_stopping)
+                {
+                    return;
+                }
+
+                job = std::move(_jobs.front());
+                _jobs.pop_front();
+            }
+
+            job();
+        }
+    }
+};
+
+static void DeflateZipChunk(const char *bytes, size_t size, int compressionLevel, bool isLastChunk, std::vector<char>& output)
+{
+    z_stream stream = {};
+
+    // Raw deflate; the local header written by zipOpenNewFileInZip2 takes the place of a zlib wrapper.
+    if (deflateInit2(&stream, compressionLevel, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        throw ArchiveError(ArchiveErrorCode::Unknown);
+    }
+
+    output.resize(deflateBound(&stream, (uLong)size) + 16);
+
+    stream.next_in = (Bytef *)bytes;
+    stream.avail_in = (uInt)size;
+    stream.next_out = (Bytef *)output.data();
+    stream.avail_out = (uInt)output.size();
+
+    // Every chunk but the last ends on a byte boundary without the final block bit, so chunks can be concatenated.
+    int result = deflate(&stream, isLastChunk ? Z_FINISH : Z_SYNC_FLUSH);
+    size_t outputSize = output.size() - stream.avail_out;
+
+    deflateEnd(&stream);
+
+    if (result != (isLastChunk ? Z_STREAM_END : Z_OK) || stream.avail_in != 0)
+    {
+        throw ArchiveError(ArchiveErrorCode::Unknown);
+    }
+
+    output.resize(outputSize);
+}
+
+static void PrepareZipEntry(ZipPacker& packer, ZipPackedEntry& entry, int compressionLevel, const std::map<std::string, ZipSourceEntry>& sourceEntries)
+{
+    if (entry.isDirectory)
+    {
+        entry.method = 0;
+        return;
+    }
+
+	std::fstream f(entry.filepath.c_str(), std::ios::binary | std::ios::in);
+	entry.bytes.resize((size_t)entry.fileSize);
+	if (entry.fileSize > 0 && !f.read(entry.bytes.data(), entry.bytes.size()))
+	{
+		throw ArchiveError(ArchiveErrorCode::Unknown);
+	}
+
+    size_t chunkCount = std::max<size_t>(1, (entry.bytes.size() + ALTZipChunkSize - 1) / ALTZipChunkSize);
+    entry.chunks.resize(chunkCount);
+    entry.chunkCRCs.resize(chunkCount);
+
+    auto processChunk = [&entry, compressionLevel, chunkCount](size_t index)
+    {
+        size_t offset = index * ALTZipChunkSize;
+        size_t size = std::min(ALTZipChunkSize, entry.bytes.size() - offset);
+        const char *bytes = entry.bytes.data() + offset;
+
+        entry.chunkCRCs[index] = crc32(0, (const Bytef *)bytes, (uInt)size);
+
+        if (compressionLevel != Z_NO_COMPRESSION)
         {
-            filename = filename + ALTDirectoryDeliminator;
+            DeflateZipChunk(bytes, size, compressionLevel, index + 1 == chunkCount, entry.chunks[index]);
+        }
+    };
+
+    if (compressionLevel == Z_NO_COMPRESSION)
+    {
+        entry.method = 0;
+    }
+
+    if (!sourceEntries.empty())
+    {
+        // Undo the renaming UnzipArchive applies on extraction to find the original entry.
+        auto sourceEntry = sourceEntries.find(replace_all(entry.filename, "__colon__", ":"));
+        // A store-only archive can only reuse entries that were stored in the source too.
+        if (sourceEntry != sourceEntries.end() && sourceEntry->second.info.uncompressed_size == entry.bytes.size() &&
+            (compressionLevel != Z_NO_COMPRESSION || sourceEntry->second.info.compression_method == 0) &&
+            sourceEntry->second.info.crc == crc32(0, (const Bytef *)entry.bytes.data(), (uInt)entry.bytes.size()))
+        {
+            // Unchanged, so it will be copied over compressed as it is.
+            entry.sourceEntry = &sourceEntry->second;
+            entry.bytes = std::vector<char>();
+            entry.chunks.clear();
+            return;
+        }
+    }
+
+    if (chunkCount == 1 || compressionLevel == Z_NO_COMPRESSION)
+    {
+        for (size_t i = 0; i < chunkCount; i++)
+        {
+            processChunk(i);
+        }
+        return;
+    }
+
+    // Hand the remaining chunks to other workers.
+    for (size_t i = 1; i < chunkCount; i++)
+    {
+        packer.Post(entry, true, [processChunk, i]() {
+            processChunk(i);
+        });
+    }
+
+    processChunk(0);
+}
+
+static void WriteZipEntry(zipFile zipFile, unzFile sourceFile, ZipPackedEntry& entry, int compressionLevel)
+{
+    if (entry.sourceEntry != nullptr)
+    {
+        unz_file_pos position = entry.sourceEntry->position;
+        if (unzGoToFilePos(sourceFile, &position) != UNZ_OK)
+        {
+            throw ArchiveError(ArchiveErrorCode::CorruptFile);
+        }
+
+        CopyZipEntry(sourceFile, zipFile, entry.filename, entry.fileInfo);
+        return;
+    }
+
+    uLong crc = 0;
+    for (size_t i = 0; i < entry.chunkCRCs.size(); i++)
+    {
+        size_t size = std::min(ALTZipChunkSize, entry.bytes.size() - i * ALTZipChunkSize);
+        crc = (i == 0) ? entry.chunkCRCs[i] : crc32_combine(crc, entry.chunkCRCs[i], (z_off_t)size);
+    }
+
+    if (zipOpenNewFileInZip2(zipFile, entry.filename.c_str(), &entry.fileInfo, NULL, 0, NULL, 0, NULL, entry.method, compressionLevel, 1) != ZIP_OK)
+    {
+        throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+    }
+
+    int result = ZIP_OK;
+
+    if (entry.method == 0)
+    {
+        if (!entry.bytes.empty())
+        {
+            result = zipWriteInFileInZip(zipFile, entry.bytes.data(), (unsigned int)entry.bytes.size());
         }
     }
     else
     {
-        fs::file_status status = fs::status(filepath);
-        
-        short permissions = (short)status.permissions();
-        long shiftedPermissions = 0100000 + permissions;
-        
-        uLong permissionsLong = (uLong)shiftedPermissions;
-        
-        fileInfo.external_fa = (unsigned int)(permissionsLong << 16L);
-        
-        // std::ifstream ifs(filepath.string());
-        // std::vector<char> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-        // bytes = data.data();
-        // fileSize = (unsigned int)data.size();
-
-		 std::fstream f(filepath.c_str(),std::ios::binary | std::ios::in);
-		 f.seekg(0, std::ios::end);
-		 fileSize = f.tellg();
-		 f.seekg(0, std::ios::beg);
-		 if ( fileSize <= 0 )
-		 {
-		 	 zipWriteInFileInZip(*zipFile, NULL, 0);
-             return;
-		 }
-         bytes = new char[fileSize];
-		 f.read(bytes, fileSize);
-    }
-
-	std::replace(filename.begin(), filename.end(), ALTDirectoryDeliminator, '/');
-    
-     if (zipOpenNewFileInZip(*zipFile, (const char *)filename.c_str(), &fileInfo, NULL, 0, NULL, 0, NULL, Z_DEFLATED, Z_DEFAULT_COMPRESSION) != ZIP_OK)
-     {
-         throw ArchiveError(ArchiveErrorCode::UnknownWrite);
-     }
-    
-    if (zipWriteInFileInZip(*zipFile, bytes, fileSize) != ZIP_OK)
+        for (auto& chunk : entry.chunks)
+        {
+            if (result == ZIP_OK && !chunk.empty())
+            {
+                result = zipWriteInFileInZip(zipFile, chunk.data(), (unsigned int)chunk.size());
+            }
+        }
+    }
+
+    if (zipCloseFileInZipRaw(zipFile, (uLong)entry.bytes.size(), crc) != ZIP_OK || result != ZIP_OK)
     {
-        zipCloseFileInZip(*zipFile);
         throw ArchiveError(ArchiveErrorCode::UnknownWrite);
     }
-	delete[] bytes;
 }
 
-std::string ZipAppBundle(std::string appBundleFilePath)
+std::string ZipAppBundle(std::string appBundleFilePath, std::string sourceArchivePath, int compressionLevel)
 {
     fs::path appBundlePath = appBundleFilePath;
     
@@ -321,31 +928,143 @@ std::string ZipAppBundle(std::string appBundleFilePath)
     {
         fs::remove(ipaPath);
     }
+
+    unzFile sourceFile = nullptr;
+    std::map<std::string, ZipSourceEntry> sourceEntries;
+
+    if (!sourceArchivePath.empty())
+    {
+        sourceFile = unzOpen(sourceArchivePath.c_str());
+        if (sourceFile == nullptr)
+        {
+            throw ArchiveError(ArchiveErrorCode::NoSuchFile);
+        }
+
+        for (int result = unzGoToFirstFile(sourceFile); result != UNZ_END_OF_LIST_OF_FILE; result = unzGoToNextFile(sourceFile))
+        {
+            ZipSourceEntry entry;
+            char cFilename[ALTMaxFilenameLength];
+
+            if (result != UNZ_OK ||
+                unzGetCurrentFileInfo(sourceFile, &entry.info, cFilename, ALTMaxFilenameLength, NULL, 0, NULL, 0) != UNZ_OK ||
+                unzGetFilePos(sourceFile, &entry.position) != UNZ_OK)
+            {
+                unzClose(sourceFile);
+                throw ArchiveError(ArchiveErrorCode::CorruptFile);
+            }
+
+            sourceEntries[cFilename] = entry;
+        }
+    }
+    
+	fs::path payloadAbsDirectory = appBundlePath.parent_path().parent_path();
+
+    // Walk the bundle up front so entries can be handed out to workers in a fixed order.
+    std::deque<ZipPackedEntry> entries;
+
+    for (auto& directoryEntry: fs::recursive_directory_iterator(appBundleFilePath))
+    {
+        entries.emplace_back();
+
+        auto& entry = entries.back();
+        entry.filepath = directoryEntry.path();
+        entry.isDirectory = fs::is_directory(entry.filepath);
+
+        std::string filename = fs::relative(entry.filepath, payloadAbsDirectory).string();
+
+        if (entry.isDirectory)
+        {
+            // Remove leading directory slash.
+            if (filename[0] == ALTDirectoryDeliminator)
+            {
+                filename = std::string(filename.begin() + 1, filename.end());
+            }
+
+            // Add trailing directory slash.
+            if (filename[filename.size() - 1] != ALTDirectoryDeliminator)
+            {
+                filename = filename + ALTDirectoryDeliminator;
+            }
+        }
+        else
+        {
+            fs::file_status status = fs::status(entry.filepath);
+
+            short permissions = (short)status.permissions();
+            long shiftedPermissions = 0100000 + permissions;
+
+            uLong permissionsLong = (uLong)shiftedPermissions;
+
+            entry.fileInfo.external_fa = (unsigned int)(permissionsLong << 16L);
+            entry.fileSize = fs::file_size(entry.filepath);
+        }
+
+        std::replace(filename.begin(), filename.end(), ALTDirectoryDeliminator, '/');
+        entry.filename = filename;
+    }
     
     zipFile zipFile = zipOpen((const char *)ipaPath.string().c_str(), APPEND_STATUS_CREATE);
     if (zipFile == nullptr)
     {
+        if (sourceFile != nullptr)
+        {
+            unzClose(sourceFile);
+        }
+
         throw ArchiveError(ArchiveErrorCode::UnknownWrite);
     }
-    
-    fs::path payloadDirectory = "Payload";
-    fs::path appBundleDirectory = payloadDirectory.append(appBundleFilename.string());
-	fs::path payloadAbsDirectory = appBundlePath.parent_path().parent_path();
-    
-    for (auto& entry: fs::recursive_directory_iterator(appBundleFilePath))
+
+    auto finish = [&zipFile, &sourceFile](void)
     {
-        auto filepath = entry.path();
-        auto relativePath = fs::relative(filepath, payloadAbsDirectory);
-        
-        WriteFileToZipFile(&zipFile, filepath, relativePath);
+        zipClose(zipFile, NULL);
+
+        if (sourceFile != nullptr)
+        {
+            unzClose(sourceFile);
+        }
+    };
+
+    try
+    {
+        unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+        ZipPacker packer(threadCount);
+
+        // Bound how far the workers may read ahead of the writer.
+        size_t maxEntriesInFlight = threadCount * 4;
+        size_t bytesInFlight = 0;
+        size_t nextEntry = 0;
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            while (nextEntry < entries.size() && (nextEntry == i || (nextEntry - i < maxEntriesInFlight && bytesInFlight + entries[nextEntry].fileSize <= ALTZipMaxBytesInFlight)))
+            {
+                auto& entry = entries[nextEntry++];
+                bytesInFlight += (size_t)entry.fileSize;
+
+                packer.Post(entry, false, [&packer, &entry, compressionLevel, &sourceEntries]() {
+                    PrepareZipEntry(packer, entry, compressionLevel, sourceEntries);
+                });
+            }
+
+            auto& entry = entries[i];
+            packer.Wait(entry);
+
+            WriteZipEntry(zipFile, sourceFile, entry, compressionLevel);
+
+            bytesInFlight -= (size_t)entry.fileSize;
+            entry.bytes = std::vector<char>();
+            entry.chunks = std::vector<std::vector<char>>();
+        }
+    }
+    catch (...)
+    {
+        finish();
+        throw;
     }
     
-   /* WriteFileToZipFile(&zipFile, payloadDirectory, payloadDirectory);
-    WriteFileToZipFile(&zipFile, appBundleDirectory, appBundleDirectory);*/
-    
-    zipClose(zipFile, NULL);
+    finish();
 
     
     return ipaPath.string();
 }
-
@@ -8,11 +8,67 @@
 #define Archiver_hpp
 
 #include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <functional>
+#include <memory>
+#include <cstdint>
 
 void UnzipArchive(std::string archivePath, std::string outputDirectory);
 
 std::string UnzipAppBundle(std::string filepath, std::string outputDirectory);
-std::string ZipAppBundle(std::string filepath);
 
+// When sourceArchivePath names the archive the bundle was extracted from, files whose size and
+// CRC still match their original entry are copied over compressed instead of being deflated again.
+// compressionLevel follows zlib (-1 default, 1-9); 0 stores every entry without compressing it,
+// so only source entries that were stored are copied over.
+std::string ZipAppBundle(std::string filepath, std::string sourceArchivePath = "", int compressionLevel = -1);
+
+// The app bundle inside an .ipa, read in place so it can be inspected and streamed without extracting it.
+// Paths are '/' separated and relative to Payload/<Name>.app/. Archives with more than one app bundle are rejected.
+// Entries are read through a single handle, so only one may be read at a time.
+class AppArchive
+{
+public:
+    struct Entry
+    {
+        std::string path;
+        uint64_t size;
+    };
+
+    AppArchive(std::string archivePath) /* throws */;
+    ~AppArchive();
+
+    std::string appBundleName() const;
+
+    // Files in archive order, followed by every directory they (or empty directory entries) imply.
+    const std::vector<Entry>& entries() const;
+    const std::set<std::string>& directories() const;
+
+    bool HasEntry(const std::string& path) const;
+    std::vector<unsigned char> ReadEntry(const std::string& path) /* throws */;
+
+    // Returns a function that copies up to length bytes of the entry into buffer and returns the number copied.
+    // The entry's CRC is checked once all of it has been read, or right away for empty entries.
+    std::function<size_t(char* buffer, size_t length)> OpenEntry(const std::string& path) /* throws */;
+
+    // Closes the open entry, if any. Opening another entry does this too.
+    // Throws if the entry is corrupt, which for a partly read entry can only be told by its compressed data.
+    void CloseEntry() /* throws */;
+
+private:
+    void* _zipFile;
+    std::string _appBundleName;
+
+    // Shared with the function returned by OpenEntry, which stops reading once another entry is opened.
+    std::shared_ptr<bool> _isEntryOpen;
+
+    std::vector<Entry> _entries;
+    std::set<std::string> _directories;
+
+    // unz_file_pos of each entry, by path.
+    std::map<std::string, std::pair<unsigned long, unsigned long>> _positions;
+};
 
 #endif /* Archiver_hpp */
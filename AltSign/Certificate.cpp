@@ -12,63 +12,28 @@
 
 #include <cpprest/http_client.h>
 
+#include "libplist/src/base64.h"
+
 extern std::string StringFromWideString(std::wstring wideString);
 extern std::wstring WideStringFromString(std::string string);
 
 std::string kCertificatePEMPrefix = "-----BEGIN CERTIFICATE-----";
 std::string kCertificatePEMSuffix = "-----END CERTIFICATE-----";
 
-static const std::string base64_chars =
-"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-"abcdefghijklmnopqrstuvwxyz"
-"0123456789+/";
-
-static inline bool is_base64(unsigned char c) {
-	return (isalnum(c) || (c == '+') || (c == '/'));
-}
-
-std::vector<unsigned char> base64_decode(std::string const& encoded_string) {
-	int in_len = encoded_string.size();
-	int i = 0;
-	int j = 0;
-	int in_ = 0;
-	unsigned char char_array_4[4], char_array_3[3];
+std::vector<unsigned char> base64_decode(std::string const& encoded_string)
+{
 	std::vector<unsigned char> ret;
-
-	while (in_len-- && (encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-		char_array_4[i++] = encoded_string[in_]; in_++;
-		if (i == 4) {
-			for (i = 0; i < 4; i++)
-				char_array_4[i] = base64_chars.find(char_array_4[i]);
-
-			char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-			char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-			char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-			for (i = 0; (i < 3); i++)
-			{
-				ret.push_back(char_array_3[i]);
-			}
-				
-			i = 0;
-		}
+	if (encoded_string.empty())
+	{
+		return ret;
 	}
 
-	if (i) {
-		for (j = i; j < 4; j++)
-			char_array_4[j] = 0;
-
-		for (j = 0; j < 4; j++)
-			char_array_4[j] = base64_chars.find(char_array_4[j]);
-
-		char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-		char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-		char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-		for (j = 0; (j < i - 1); j++)
-		{
-			ret.push_back(char_array_3[j]);
-		}
+	size_t size = encoded_string.size();
+	unsigned char* decoded = base64decode(encoded_string.c_str(), &size);
+	if (decoded != nullptr)
+	{
+		ret.assign(decoded, decoded + size);
+		free(decoded);
 	}
 
 	return ret;
@@ -255,10 +220,11 @@ void Certificate::ParseData(std::vector<unsigned char>& data)
     if (prefix != kCertificatePEMPrefix)
     {
         // Convert to proper PEM format before storing.
-        utility::string_t base64Data = utility::conversions::to_base64(data);
+        std::string base64Data((data.size() + 2) / 3 * 4 + 1, '\0');
+        base64Data.resize(base64encode(&base64Data[0], data.data(), data.size()));
         
         std::stringstream ss;
-        ss << kCertificatePEMPrefix << std::endl << StringFromWideString(base64Data) << std::endl << kCertificatePEMSuffix;
+        ss << kCertificatePEMPrefix << std::endl << base64Data << std::endl << kCertificatePEMSuffix;
         
         auto content = ss.str();
         pemData = std::vector<unsigned char>(content.begin(), content.end());
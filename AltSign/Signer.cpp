@@ -7,6 +7,7 @@
 #include "Error.hpp"
 #include "Archiver.hpp"
 #include "Application.hpp"
+#include "ZipFolder.hpp"
 
 #include "ldid.hpp"
 
@@ -126,7 +127,7 @@ std::string entitlementsToXMLKeyValue(const std::map<std::string, std::string>&
 #define stdoutlog(msg) {  std::cout << msg << std::endl; }
 #define stderrlog(msg) {  std::cerr << msg << std::endl; }
 
-std::string CertificatesContent(std::shared_ptr<Certificate> altCertificate)
+std::shared_ptr<ldid::Identity> SigningIdentity(std::shared_ptr<Certificate> altCertificate)
 {
     auto altCertificateP12Data = altCertificate->p12Data();
     if (!altCertificateP12Data.has_value())
@@ -143,6 +144,17 @@ std::string CertificatesContent(std::shared_ptr<Certificate> altCertificate)
     EVP_PKEY *key = nullptr;
     X509 *certificate = nullptr;
     PKCS12_parse(inputP12, "", &key, &certificate, NULL);
+
+    PKCS12_free(inputP12);
+    BIO_free(inputP12Buffer);
+
+    if (key == nullptr || certificate == nullptr)
+    {
+        EVP_PKEY_free(key);
+        X509_free(certificate);
+
+        throw SignError(SignErrorCode::InvalidCertificate);
+    }
     
 	// Prepare certificate chain of trust.
 	auto* certificates = sk_X509_new(NULL);
@@ -173,31 +185,12 @@ std::string CertificatesContent(std::shared_ptr<Certificate> altCertificate)
 	{
 		sk_X509_push(certificates, wwdrCertificate);
 	}
-    
-    // Create new .p12 in memory with private key and certificate chain.
-    char emptyString[] = "";
-    auto outputP12 = PKCS12_create(emptyString, emptyString, key, certificate, certificates, 0, 0, 0, 0, 0);
-    
-    BIO *outputP12Buffer = BIO_new(BIO_s_mem());
-    i2d_PKCS12_bio(outputP12Buffer, outputP12);
-    
-    char *buffer = NULL;
-    int size = (int)BIO_get_mem_data(outputP12Buffer, &buffer);
-
-	// Create string before freeing memory.
-	std::string output((const char*)buffer, size);
-
-    // Free .p12 structures
-    PKCS12_free(inputP12);
-    PKCS12_free(outputP12);
 
 	BIO_free(wwdrCertificateBuffer);
 	BIO_free(rootCertificateBuffer);
-    
-    BIO_free(inputP12Buffer);
-    BIO_free(outputP12Buffer);
-    
-    return output;
+
+    // Identity takes ownership of the key, certificate and chain.
+    return std::make_shared<ldid::Identity>(key, certificate, certificates);
 }
 
 Signer::Signer(std::shared_ptr<Certificate> certificate) : _certificate(certificate)
@@ -209,6 +202,62 @@ Signer::~Signer()
 	int i = 0;
 }
 
+std::string EntitlementsForProfile(std::shared_ptr<ProvisioningProfile> profile, std::map<std::string, std::string>& customEntitlements)
+{
+    plist_t entitlements = profile->entitlements();
+    
+    char *entitlementsString = nullptr;
+    uint32_t entitlementsSize = 0;
+    plist_to_xml(entitlements, &entitlementsString, &entitlementsSize);
+
+    std::string result(entitlementsString);
+    free(entitlementsString);
+
+    if (!customEntitlements.empty()) {
+        for (auto it = customEntitlements.begin(); it != customEntitlements.end();) {
+            if (result.find(it->first) == std::string::npos) {
+                it = customEntitlements.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        std::string customEntitlementsXml = entitlementsToXMLKeyValue(customEntitlements);
+        size_t pos = result.rfind("</dict>");
+        if (pos != std::string::npos) {
+            result.insert(pos, customEntitlementsXml);
+        }
+    }
+
+    return result;
+}
+
+std::shared_ptr<ProvisioningProfile> ProfileForBundleIdentifier(const std::vector<std::shared_ptr<ProvisioningProfile>>& profiles, const std::string& bundleIdentifier)
+{
+    for (auto& profile : profiles)
+    {
+        if (profile->bundleIdentifier() == bundleIdentifier)
+        {
+            return profile;
+        }
+    }
+    
+    return nullptr;
+}
+
+std::string ReadFolderFile(const ldid::Folder& folder, const std::string& path)
+{
+    std::string contents;
+    folder.Open(path, ldid::fun([&](std::streambuf& buffer, size_t length, const void* flag) {
+        contents.resize(length);
+        if (length > 0 && buffer.sgetn(&contents[0], length) != length)
+        {
+            throw SignError(SignErrorCode::InvalidApp);
+        }
+    }));
+    return contents;
+}
+
 void Signer::SignApp(std::string path, std::vector<std::shared_ptr<ProvisioningProfile>> profiles, std::map<std::string, std::string> customEntitlements)
 {   
     fs::path appPath = fs::path(path);
@@ -218,143 +267,194 @@ void Signer::SignApp(std::string path, std::vector<std::shared_ptr<ProvisioningP
 		return std::tolower(c);
 	});
     
-    std::optional<fs::path> ipaPath;
-    fs::path appBundlePath;
+    if (pathExtension == ".ipa")
+    {
+        // Sign straight out of the archive instead of extracting it to disk first.
+        SignArchive(path, profiles, customEntitlements);
+        return;
+    }
+
+    std::map<std::string, std::string> entitlementsByFilepath;
+    
+    auto prepareApp = [&profiles, &entitlementsByFilepath, &customEntitlements](Application &app)
+    {
+        auto profile = ProfileForBundleIdentifier(profiles, app.bundleIdentifier());
+        if (profile == nullptr)
+        {
+            throw SignError(SignErrorCode::MissingProvisioningProfile);
+        }
+        
+        fs::path profilePath = fs::path(app.path()).append("embedded.mobileprovision");
+        
+		std::ofstream fout(profilePath.string(), std::ios::out | std::ios::binary);
+		fout.write((char*)& profile->data()[0], profile->data().size() * sizeof(char));
+		fout.close();
+        
+        entitlementsByFilepath[app.path()] = EntitlementsForProfile(profile, customEntitlements);
+    };
     
-    try
+    Application app(appPath.string());
+    prepareApp(app);
+
+	for (auto appExtension : app.appExtensions())
+	{
+		prepareApp(*appExtension);
+	}
+    
+    // Sign application
+    ldid::DiskFolder appBundle(app.path());
+
+    // Parsed once per signer and shared by every binary it signs.
+    if (_identity == nullptr)
     {
-        if (pathExtension == ".ipa")
+        _identity = SigningIdentity(this->certificate());
+    }
+    
+    ldid::Sign("", appBundle, *_identity, "",
+               ldid::fun([&](const std::string &path, const std::string &binaryEntitlements) -> std::string {
+        std::string filepath;
+        
+        if (path.size() == 0)
         {
-            ipaPath = appPath;
-            
-            auto uuid = make_uuid();
-            auto outputDirectoryPath = appPath.remove_filename().append(uuid);
-            
-            fs::create_directory(outputDirectoryPath);
-            
-            appBundlePath = UnzipAppBundle(appPath.string(), outputDirectoryPath.string());
+            filepath = app.path();
         }
         else
         {
-            appBundlePath = appPath;
+            filepath = fs::canonical(fs::path(app.path()).append(path)).string();
         }
-        
-        std::map<std::string, std::string> entitlementsByFilepath;
-        
-        auto profileForApp = [&profiles](Application &app) -> std::shared_ptr<ProvisioningProfile> {
-            for (auto& profile : profiles)
+
+        auto entitlements = entitlementsByFilepath[filepath];
+        return entitlements;
+    }),
+               ldid::fun([&](const std::string &string) {
+		// stdoutlog("Signing: " << string);
+//            progress.completedUnitCount += 1;
+    }),
+               ldid::fun([&](const double signingProgress) {
+		// stdoutlog("Signing Progress: " << signingProgress);
+    }));
+}
+
+void Signer::SignArchive(std::string archivePath, std::vector<std::shared_ptr<ProvisioningProfile>> profiles, std::map<std::string, std::string> customEntitlements)
+{
+    auto signedArchivePath = archivePath + "." + make_uuid();
+
+    try
+    {
+        ZipFolder archive(archivePath);
+
+        // Payload/<Name>.app, chosen the same way UnzipAppBundle does.
+        std::string appBundlePath;
+        archive.Find("Payload\\", ldid::fun([&](const std::string &name) {
+            auto separator = name.find('\\');
+            if (!appBundlePath.empty() || separator == std::string::npos || name.substr(separator + 1) != "Info.plist")
             {
-                if (profile->bundleIdentifier() == app.bundleIdentifier())
-                {
-                    return profile;
-                }
+                return;
             }
-            
-            return nullptr;
-        };
-        
-        auto prepareApp = [&profileForApp, &entitlementsByFilepath, &customEntitlements](Application &app)
+
+            auto lowercaseFilename = name.substr(0, separator);
+            std::transform(lowercaseFilename.begin(), lowercaseFilename.end(), lowercaseFilename.begin(), [](unsigned char c) {
+                return std::tolower(c);
+            });
+
+            if (lowercaseFilename.size() > 4 && lowercaseFilename.compare(lowercaseFilename.size() - 4, 4, ".app") == 0)
+            {
+                appBundlePath = "Payload\\" + name.substr(0, separator + 1);
+            }
+        }), ldid::fun([&](const std::string &name, const ldid::Functor<std::string ()> &read) {
+        }));
+
+        if (appBundlePath.empty())
         {
-            auto profile = profileForApp(app);
-            if (profile == nullptr)
+            throw SignError(SignErrorCode::MissingAppBundle);
+        }
+
+        ldid::SubFolder appBundle(archive, appBundlePath);
+
+        // The app itself, followed by each PlugIns/<Name>.appex, keyed the way ldid passes them to alter.
+        std::vector<std::string> bundlePaths = { "" };
+        appBundle.Find("PlugIns\\", ldid::fun([&](const std::string &name) {
+            auto separator = name.find('\\');
+            if (separator != std::string::npos && name.substr(separator + 1) == "Info.plist" && fs::path(name.substr(0, separator)).extension() == ".appex")
             {
-                throw SignError(SignErrorCode::MissingProvisioningProfile);
+                bundlePaths.push_back("PlugIns\\" + name.substr(0, separator + 1));
             }
-            
-            fs::path profilePath = fs::path(app.path()).append("embedded.mobileprovision");
-            
-			std::ofstream fout(profilePath.string(), std::ios::out | std::ios::binary);
-			fout.write((char*)& profile->data()[0], profile->data().size() * sizeof(char));
-			fout.close();
-            
-            plist_t entitlements = profile->entitlements();
-            
-            char *entitlementsString = nullptr;
-            uint32_t entitlementsSize = 0;
-            plist_to_xml(entitlements, &entitlementsString, &entitlementsSize);
-
-            if (!customEntitlements.empty()) {
-                std::string tempEntitlementsString(entitlementsString);
-                for (auto it = customEntitlements.begin(); it != customEntitlements.end();) {
-                    if (tempEntitlementsString.find(it->first) == std::string::npos) {
-                        it = customEntitlements.erase(it);
-                    }
-                    else {
-                        ++it;
-                    }
-                }
-                std::string customEntitlementsXml = entitlementsToXMLKeyValue(customEntitlements);
-                std::string oldEntitlementsString(entitlementsString);
-                size_t pos = oldEntitlementsString.rfind("</dict>");
-                if (pos != std::string::npos) {
-                    oldEntitlementsString.insert(pos, customEntitlementsXml);
-                }
-                entitlementsByFilepath[app.path()] = oldEntitlementsString.c_str();
+        }), ldid::fun([&](const std::string &name, const ldid::Functor<std::string ()> &read) {
+        }));
+
+        std::map<std::string, std::string> entitlementsByBundlePath;
+
+        for (auto& bundlePath : bundlePaths)
+        {
+            if (!appBundle.Look(bundlePath + "Info.plist"))
+            {
+                throw SignError(SignErrorCode::MissingInfoPlist);
             }
-            else {
-                entitlementsByFilepath[app.path()] = entitlementsString;
+
+            auto infoPlist = ReadFolderFile(appBundle, bundlePath + "Info.plist");
+
+            plist_t plist = nullptr;
+            plist_from_memory(infoPlist.data(), (uint32_t)infoPlist.size(), &plist);
+            if (plist == nullptr)
+            {
+                throw SignError(SignErrorCode::InvalidInfoPlist);
             }
-        };
-        
-        Application app(appBundlePath.string());
-        prepareApp(app);
 
-		for (auto appExtension : app.appExtensions())
-		{
-			prepareApp(*appExtension);
-		}
-        
-        // Sign application
-        ldid::DiskFolder appBundle(app.path());
-        std::string key = CertificatesContent(this->certificate());
-        
-        ldid::Sign("", appBundle, key, "",
-                   ldid::fun([&](const std::string &path, const std::string &binaryEntitlements) -> std::string {
-            std::string filepath;
-            
-            if (path.size() == 0)
+            std::string bundleIdentifier;
+
+            auto bundleIdentifierNode = plist_dict_get_item(plist, "CFBundleIdentifier");
+            if (bundleIdentifierNode != nullptr && plist_get_node_type(bundleIdentifierNode) == PLIST_STRING)
             {
-                filepath = app.path();
+                char* bundleIdentifierString = nullptr;
+                plist_get_string_val(bundleIdentifierNode, &bundleIdentifierString);
+                bundleIdentifier = bundleIdentifierString;
+                free(bundleIdentifierString);
             }
-            else
+
+            plist_free(plist);
+
+            auto profile = ProfileForBundleIdentifier(profiles, bundleIdentifier);
+            if (profile == nullptr)
             {
-                filepath = fs::canonical(fs::path(app.path()).append(path)).string();
+                throw SignError(SignErrorCode::MissingProvisioningProfile);
             }
 
-            auto entitlements = entitlementsByFilepath[filepath];
-            return entitlements;
+            appBundle.Save(bundlePath + "embedded.mobileprovision", true, NULL, ldid::fun([&](std::streambuf &buffer) {
+                buffer.sputn((const char *)profile->data().data(), profile->data().size());
+            }));
+
+            entitlementsByBundlePath[bundlePath] = EntitlementsForProfile(profile, customEntitlements);
+        }
+
+        if (_identity == nullptr)
+        {
+            _identity = SigningIdentity(this->certificate());
+        }
+
+        ldid::Sign("", appBundle, *_identity, "",
+                   ldid::fun([&](const std::string &path, const std::string &binaryEntitlements) -> std::string {
+            auto entitlements = entitlementsByBundlePath.find(path);
+            return entitlements != entitlementsByBundlePath.end() ? entitlements->second : "";
         }),
                    ldid::fun([&](const std::string &string) {
-			// stdoutlog("Signing: " << string);
-//            progress.completedUnitCount += 1;
         }),
                    ldid::fun([&](const double signingProgress) {
-			// stdoutlog("Signing Progress: " << signingProgress);
         }));
-        
-        // Zip app back up.
-        if (ipaPath.has_value())
-        {
-            auto resignedPath = ZipAppBundle(appBundlePath.string());
-            
-            if (fs::exists(*ipaPath))
-            {
-                fs::remove(*ipaPath);
-            }
-            
-            fs::rename(*ipaPath, resignedPath);
-        }
-		return;
+
+        archive.Commit(signedArchivePath);
     }
     catch (std::exception& e)
     {
-        if (ipaPath.has_value())
+        if (fs::exists(signedArchivePath))
         {
-            fs::remove(*ipaPath);
-        }        
-        
+            fs::remove(signedArchivePath);
+        }
+
         throw;
     }
+
+    // The source archive is closed by now, so it can be replaced.
+    fs::rename(signedArchivePath, archivePath);
 }
 
 std::shared_ptr<Certificate> Signer::certificate() const
@@ -17,6 +17,11 @@
 #include "Certificate.hpp"
 #include "ProvisioningProfile.hpp"
 
+namespace ldid
+{
+    class Identity;
+}
+
 class Signer
 {
 public:
@@ -29,8 +34,12 @@ public:
     void SignApp(std::string appPath, std::vector<std::shared_ptr<ProvisioningProfile>> profiles, std::map<std::string, std::string> customEntitlements);
     
 private:
+    // Signs an .ipa in place without extracting it; only the files that change are held in memory.
+    void SignArchive(std::string archivePath, std::vector<std::shared_ptr<ProvisioningProfile>> profiles, std::map<std::string, std::string> customEntitlements);
+
     std::shared_ptr<Team> _team;
     std::shared_ptr<Certificate> _certificate;
+    std::shared_ptr<ldid::Identity> _identity;
 };
 
 #pragma GCC visibility pop
@@ -0,0 +1,376 @@
+//
+//  ZipFolder.cpp
+//  AltSign-Windows
+//
+//
+
+#include "ZipFolder.hpp"
+#include "Error.hpp"
+
+extern "C" {
+#include "zip.h"
+}
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <sstream>
+
+extern void CopyZipEntry(unzFile sourceFile, zipFile destinationFile, std::string filename, const zip_fileinfo& fileInfo);
+
+const int ALTZipFolderBufferSize = 1024 * 1024;
+const int ALTZipFolderMaxFilenameLength = 512;
+
+static bool startsWith(const std::string& str, const std::string& prefix)
+{
+    return str.size() >= prefix.size() && 0 == str.compare(0, prefix.size(), prefix);
+}
+
+static std::string ZipName(std::string path)
+{
+    std::replace(path.begin(), path.end(), '\\', '/');
+    return path;
+}
+
+static bool IsSymlink(const unz_file_info& info)
+{
+    return ((info.external_fa >> 16) & 0170000) == 0120000;
+}
+
+namespace
+{
+    // Inflates the current entry of an unzFile as it is read.
+    class EntryBuffer : public std::streambuf
+    {
+    public:
+        EntryBuffer(unzFile file) : _file(file), _buffer(ALTZipFolderBufferSize)
+        {
+        }
+
+    protected:
+        virtual int_type underflow()
+        {
+            int count = unzReadCurrentFile(_file, _buffer.data(), (unsigned int)_buffer.size());
+            if (count < 0)
+            {
+                throw ArchiveError(ArchiveErrorCode::CorruptFile);
+            }
+
+            if (count == 0)
+            {
+                return traits_type::eof();
+            }
+
+            setg(_buffer.data(), _buffer.data(), _buffer.data() + count);
+            return traits_type::to_int_type(_buffer[0]);
+        }
+
+    private:
+        unzFile _file;
+        std::vector<char> _buffer;
+    };
+
+    class DiscardBuffer : public std::streambuf
+    {
+    protected:
+        virtual std::streamsize xsputn(const char_type* data, std::streamsize size)
+        {
+            return size;
+        }
+
+        virtual int_type overflow(int_type next)
+        {
+            return next;
+        }
+    };
+}
+
+ZipFolder::ZipFolder(std::string archivePath) : _archivePath(archivePath)
+{
+    // The destructor doesn't run if reading the central directory throws, so own the handle until then.
+    std::unique_ptr<std::remove_pointer<unzFile>::type, decltype(&unzClose)> handle(unzOpen(archivePath.c_str()), &unzClose);
+    if (handle == nullptr)
+    {
+        throw ArchiveError(ArchiveErrorCode::NoSuchFile);
+    }
+
+    unzFile zipFile = handle.get();
+
+    for (int result = unzGoToFirstFile(zipFile); result != UNZ_END_OF_LIST_OF_FILE; result = unzGoToNextFile(zipFile))
+    {
+        if (result != UNZ_OK)
+        {
+            throw ArchiveError(ArchiveErrorCode::CorruptFile);
+        }
+
+        Entry entry;
+        char cFilename[ALTZipFolderMaxFilenameLength];
+
+        if (unzGetCurrentFileInfo(zipFile, &entry.info, cFilename, ALTZipFolderMaxFilenameLength, NULL, 0, NULL, 0) != UNZ_OK ||
+            unzGetFilePos(zipFile, &entry.position) != UNZ_OK)
+        {
+            throw ArchiveError(ArchiveErrorCode::CorruptFile);
+        }
+
+        entry.name = cFilename;
+        _entries.push_back(entry);
+
+        if (entry.name.empty() || entry.name[entry.name.size() - 1] == '/' || startsWith(entry.name, "__MACOSX"))
+        {
+            // Directories are implied by the files inside them.
+            continue;
+        }
+
+        std::string path = entry.name;
+        std::replace(path.begin(), path.end(), '/', '\\');
+        _entriesByPath[path] = _entries.size() - 1;
+    }
+
+    // Keep the handle that read the central directory around for Open().
+    _handles.push_back(handle.release());
+}
+
+ZipFolder::~ZipFolder()
+{
+    for (auto handle : _handles)
+    {
+        unzClose(handle);
+    }
+}
+
+unzFile ZipFolder::AcquireHandle() const
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_handles.empty())
+        {
+            auto handle = _handles.back();
+            _handles.pop_back();
+            return handle;
+        }
+    }
+
+    // unzFile isn't thread safe, so concurrent readers each get their own.
+    unzFile handle = unzOpen(_archivePath.c_str());
+    if (handle == NULL)
+    {
+        throw ArchiveError(ArchiveErrorCode::NoSuchFile);
+    }
+
+    return handle;
+}
+
+void ZipFolder::ReleaseHandle(unzFile handle) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _handles.push_back(handle);
+}
+
+void ZipFolder::Save(const std::string &path, bool edit, const void *flag, const ldid::Functor<void (std::streambuf &)> &code)
+{
+    if (!edit)
+    {
+        DiscardBuffer buffer;
+        code(buffer);
+        return;
+    }
+
+    std::stringbuf buffer;
+    code(buffer);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _changes[path] = buffer.str();
+}
+
+bool ZipFolder::Look(const std::string &path) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entriesByPath.count(path) != 0 || _changes.count(path) != 0;
+}
+
+void ZipFolder::Open(const std::string &path, const ldid::Functor<void (std::streambuf &, size_t, const void *)> &code) const
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        auto change = _changes.find(path);
+        if (change != _changes.end())
+        {
+            std::stringbuf buffer(change->second, std::ios::in);
+            lock.unlock();
+
+            code(buffer, buffer.str().size(), NULL);
+            return;
+        }
+    }
+
+    auto iterator = _entriesByPath.find(path);
+    if (iterator == _entriesByPath.end())
+    {
+        throw ArchiveError(ArchiveErrorCode::NoSuchFile);
+    }
+
+    auto entry = _entries[iterator->second];
+
+    unzFile handle = AcquireHandle();
+
+    if (unzGoToFilePos(handle, &entry.position) != UNZ_OK || unzOpenCurrentFile(handle) != UNZ_OK)
+    {
+        unzClose(handle);
+        throw ArchiveError(ArchiveErrorCode::CorruptFile);
+    }
+
+    try
+    {
+        EntryBuffer buffer(handle);
+        code(buffer, entry.info.uncompressed_size, NULL);
+    }
+    catch (...)
+    {
+        unzClose(handle);
+        throw;
+    }
+
+    // This is where minizip reports a CRC mismatch, so a corrupt entry must not be signed.
+    if (unzCloseCurrentFile(handle) != UNZ_OK)
+    {
+        unzClose(handle);
+        throw ArchiveError(ArchiveErrorCode::CorruptFile);
+    }
+
+    ReleaseHandle(handle);
+}
+
+void ZipFolder::Find(const std::string &path, const ldid::Functor<void (const std::string &)> &code, const ldid::Functor<void (const std::string &, const ldid::Functor<std::string ()> &)> &link) const
+{
+    std::set<std::string> files;
+    std::set<std::string> links;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (auto iterator = _entriesByPath.lower_bound(path); iterator != _entriesByPath.end() && startsWith(iterator->first, path); ++iterator)
+        {
+            if (IsSymlink(_entries[iterator->second].info))
+            {
+                links.insert(iterator->first);
+            }
+            else
+            {
+                files.insert(iterator->first);
+            }
+        }
+
+        for (auto iterator = _changes.lower_bound(path); iterator != _changes.end() && startsWith(iterator->first, path); ++iterator)
+        {
+            files.insert(iterator->first);
+        }
+    }
+
+    for (auto& file : files)
+    {
+        code(file.substr(path.size()));
+    }
+
+    for (auto& file : links)
+    {
+        link(file.substr(path.size()), ldid::fun([&]() -> std::string {
+            std::string destination;
+            this->Open(file, ldid::fun([&](std::streambuf& buffer, size_t length, const void* flag) {
+                destination.resize(length);
+                buffer.sgetn(&destination[0], length);
+            }));
+            return destination;
+        }));
+    }
+}
+
+void ZipFolder::Commit(std::string archivePath)
+{
+    zipFile outputFile = zipOpen(archivePath.c_str(), APPEND_STATUS_CREATE);
+    if (outputFile == nullptr)
+    {
+        throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+    }
+
+    unzFile inputFile = nullptr;
+
+    auto finish = [&outputFile, &inputFile, this]()
+    {
+        if (inputFile != nullptr)
+        {
+            ReleaseHandle(inputFile);
+            inputFile = nullptr;
+        }
+
+        zipClose(outputFile, NULL);
+    };
+
+    auto writeEntry = [&](const std::string& name, zip_fileinfo& fileInfo, const char* bytes, size_t size)
+    {
+        if (zipOpenNewFileInZip(outputFile, name.c_str(), &fileInfo, NULL, 0, NULL, 0, NULL, Z_DEFLATED, Z_DEFAULT_COMPRESSION) != ZIP_OK ||
+            zipWriteInFileInZip(outputFile, bytes, (unsigned int)size) != ZIP_OK ||
+            zipCloseFileInZip(outputFile) != ZIP_OK)
+        {
+            finish();
+            throw ArchiveError(ArchiveErrorCode::UnknownWrite);
+        }
+    };
+
+    std::map<std::string, std::string> additions = _changes;
+
+    inputFile = AcquireHandle();
+
+    for (auto& entry : _entries)
+    {
+        zip_fileinfo fileInfo = {};
+        fileInfo.tmz_date.tm_sec = entry.info.tmu_date.tm_sec;
+        fileInfo.tmz_date.tm_min = entry.info.tmu_date.tm_min;
+        fileInfo.tmz_date.tm_hour = entry.info.tmu_date.tm_hour;
+        fileInfo.tmz_date.tm_mday = entry.info.tmu_date.tm_mday;
+        fileInfo.tmz_date.tm_mon = entry.info.tmu_date.tm_mon;
+        fileInfo.tmz_date.tm_year = entry.info.tmu_date.tm_year;
+        fileInfo.dosDate = entry.info.dosDate;
+        fileInfo.internal_fa = entry.info.internal_fa;
+        fileInfo.external_fa = entry.info.external_fa;
+
+        std::string path = entry.name;
+        std::replace(path.begin(), path.end(), '/', '\\');
+
+        auto change = additions.find(path);
+        if (change != additions.end())
+        {
+            writeEntry(entry.name, fileInfo, change->second.data(), change->second.size());
+            additions.erase(change);
+            continue;
+        }
+
+        if (unzGoToFilePos(inputFile, &entry.position) != UNZ_OK)
+        {
+            finish();
+            throw ArchiveError(ArchiveErrorCode::CorruptFile);
+        }
+
+        try
+        {
+            // Untouched entries keep their original compressed stream and CRC.
+            CopyZipEntry(inputFile, outputFile, entry.name, fileInfo);
+        }
+        catch (...)
+        {
+            finish();
+            throw;
+        }
+    }
+
+    // Files that didn't exist in the original archive, such as a first-time CodeResources.
+    for (auto& addition : additions)
+    {
+        zip_fileinfo fileInfo = {};
+        fileInfo.external_fa = (unsigned int)(0100644 << 16L);
+
+        writeEntry(ZipName(addition.first), fileInfo, addition.second.data(), addition.second.size());
+    }
+
+    finish();
+}
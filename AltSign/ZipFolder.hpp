@@ -0,0 +1,63 @@
+//
+//  ZipFolder.hpp
+//  AltSign-Windows
+//
+//
+
+#ifndef ZipFolder_hpp
+#define ZipFolder_hpp
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ldid.hpp"
+
+extern "C" {
+#include "unzip.h"
+}
+
+// An ldid::Folder backed by a zip archive, so a bundle can be signed without extracting it.
+// Entries are streamed out of the archive on demand; only files the signer saves are kept,
+// in memory, until Commit() writes them to a new archive, copying every untouched entry over
+// without recompressing it.
+// Paths use ldid's backslash separators and are relative to the root of the archive.
+class ZipFolder : public ldid::Folder
+{
+public:
+    ZipFolder(std::string archivePath) /* throws */;
+    ~ZipFolder();
+
+    virtual void Save(const std::string &path, bool edit, const void *flag, const ldid::Functor<void (std::streambuf &)> &code);
+    virtual bool Look(const std::string &path) const;
+    virtual void Open(const std::string &path, const ldid::Functor<void (std::streambuf &, size_t, const void *)> &code) const;
+    virtual void Find(const std::string &path, const ldid::Functor<void (const std::string &)> &code, const ldid::Functor<void (const std::string &, const ldid::Functor<std::string ()> &)> &link) const;
+
+    // Writes the archive, with all saved changes applied, to archivePath (which must differ from the source).
+    void Commit(std::string archivePath) /* throws */;
+
+private:
+    struct Entry
+    {
+        std::string name;
+        unz_file_pos position;
+        unz_file_info info;
+    };
+
+    std::string _archivePath;
+
+    // Central directory order, which Commit() preserves.
+    std::vector<Entry> _entries;
+    std::map<std::string, size_t> _entriesByPath;
+
+    std::map<std::string, std::string> _changes;
+
+    mutable std::mutex _mutex;
+    mutable std::vector<unzFile> _handles;
+
+    unzFile AcquireHandle() const;
+    void ReleaseHandle(unzFile handle) const;
+};
+
+#endif /* ZipFolder_hpp */
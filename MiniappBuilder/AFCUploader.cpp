@@ -0,0 +1,672 @@
+#include "AFCUploader.h"
+#include "ServerError.hpp"
+
+#include <plist/plist.h>
+
+#include <corecrypto/ccdigest.h>
+#include <corecrypto/ccsha2.h>
+
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+extern std::string replace_all(const std::string& str, const std::string& find, const std::string& replace);
+
+AFCUploader::AFCUploader(afc_client_t client, size_t chunkSize) : _client(client), _chunkSize(std::max<size_t>(chunkSize, 1))
+{
+}
+
+AFCUploader::~AFCUploader()
+{
+}
+
+void AFCUploader::AddDirectory(std::string destinationPath)
+{
+	std::replace(destinationPath.begin(), destinationPath.end(), '\\', '/');
+	_directories.push_back(destinationPath);
+}
+
+void AFCUploader::AddFile(std::string filepath, std::string destinationPath)
+{
+	File file;
+	file.identifier = filepath;
+	file.destinationPath = destinationPath;
+	file.size = fs::file_size(filepath);
+	file.open = [filepath]() -> ReadFunction {
+		auto stream = std::make_shared<std::ifstream>(fs::path(filepath), std::ios::binary);
+		if (!stream->is_open())
+		{
+			throw ServerError(ServerErrorCode::DeviceWriteFailed, { { NSLocalizedFailureReasonErrorKey, "Could not open " + filepath } });
+		}
+
+		return [stream](char* buffer, size_t length) -> size_t {
+			stream->read(buffer, length);
+			return (size_t)stream->gcount();
+		};
+	};
+
+	this->AddFile(std::move(file));
+}
+
+void AFCUploader::AddFile(File file)
+{
+	std::replace(file.destinationPath.begin(), file.destinationPath.end(), '\\', '/');
+	file.destinationPath = replace_all(file.destinationPath, "__colon__", ":");
+
+	_files.push_back(std::move(file));
+}
+
+void AFCUploader::AddDirectoryContents(std::string directoryPath, std::string destinationPath)
+{
+	this->AddDirectory(destinationPath);
+
+	for (auto& file : fs::directory_iterator(directoryPath))
+	{
+		auto filepath = file.path();
+		auto destinationFilepath = fs::path(destinationPath).append(filepath.filename().string());
+
+		if (fs::is_directory(filepath))
+		{
+			this->AddDirectoryContents(filepath.string(), destinationFilepath.string());
+		}
+		else
+		{
+			this->AddFile(filepath.string(), destinationFilepath.string());
+		}
+	}
+}
+
+size_t AFCUploader::numberOfFiles() const
+{
+	return _files.size();
+}
+
+void AFCUploader::Upload(std::function<void(std::string)> wroteFileCallback)
+{
+	this->WriteFiles(_directories, _files, wroteFileCallback);
+}
+
+void AFCUploader::UploadChanges(std::string rootPath, std::function<void(std::string)> wroteFileCallback)
+{
+	std::replace(rootPath.begin(), rootPath.end(), '\\', '/');
+
+	std::string manifestPath = rootPath + ".manifest";
+	std::string rootPrefix = rootPath + "/";
+
+	auto previousManifest = this->ReadManifest(manifestPath);
+
+	// Remove manifest before touching staged files, so an interrupted upload is never mistaken for a complete one.
+	afc_remove_path(_client, manifestPath.c_str());
+
+	std::set<std::string> directories(_directories.begin(), _directories.end());
+
+	std::map<std::string, size_t> fileIndexes;
+	for (size_t i = 0; i < _files.size(); i++)
+	{
+		fileIndexes[_files[i].destinationPath] = i;
+	}
+
+	// Walk what's staged, keeping entries we're about to upload and removing everything else.
+	// Entries are classified by what we're uploading, which avoids a stat round trip per file.
+	std::set<std::string> stagedDirectories;
+	std::set<std::string> stagedFiles;
+
+	std::function<void(std::string)> walkDirectory = [&](std::string directoryPath) {
+		char** list = NULL;
+		if (afc_read_directory(_client, directoryPath.c_str(), &list) != AFC_E_SUCCESS || list == NULL)
+		{
+			if (directoryPath != rootPath)
+			{
+				// Exists, but isn't a directory.
+				this->RemovePath(directoryPath);
+			}
+
+			return;
+		}
+
+		stagedDirectories.insert(directoryPath);
+
+		std::vector<std::string> names;
+		for (int i = 0; list[i]; i++)
+		{
+			names.push_back(list[i]);
+			free(list[i]);
+		}
+
+		free(list);
+
+		for (auto& name : names)
+		{
+			if (name == "." || name == "..")
+			{
+				continue;
+			}
+
+			auto path = directoryPath + "/" + name;
+
+			if (directories.count(path) > 0)
+			{
+				walkDirectory(path);
+			}
+			else if (fileIndexes.count(path) > 0)
+			{
+				stagedFiles.insert(path);
+			}
+			else
+			{
+				this->RemovePath(path);
+			}
+		}
+	};
+
+	walkDirectory(rootPath);
+
+	std::map<std::string, ManifestEntry> manifest;
+
+	std::vector<std::string> changedDirectories;
+	std::vector<File> changedFiles;
+	std::vector<std::string> changedRelativePaths;
+	std::vector<std::string> unchangedFiles;
+
+	for (auto& directoryPath : _directories)
+	{
+		if (stagedDirectories.count(directoryPath) == 0)
+		{
+			changedDirectories.push_back(directoryPath);
+		}
+	}
+
+	for (auto& file : _files)
+	{
+		if (file.destinationPath.compare(0, rootPrefix.size(), rootPrefix) != 0)
+		{
+			// Outside rootPath, so it can't be tracked by the manifest.
+			changedFiles.push_back(file);
+			changedRelativePaths.push_back("");
+			continue;
+		}
+
+		auto relativePath = file.destinationPath.substr(rootPrefix.size());
+		auto previousEntry = previousManifest.find(relativePath);
+
+		// Missing or resized files have changed whatever their contents, so don't read them twice.
+		bool mayBeUnchanged = stagedFiles.count(file.destinationPath) > 0 && previousEntry != previousManifest.end() &&
+			previousEntry->second.size == file.size;
+
+		if (mayBeUnchanged)
+		{
+			ManifestEntry entry;
+			entry.size = file.size;
+			entry.hash = this->HashFile(file);
+
+			if (entry.hash == previousEntry->second.hash)
+			{
+				manifest[relativePath] = entry;
+				unchangedFiles.push_back(file.identifier);
+				continue;
+			}
+		}
+
+		changedFiles.push_back(file);
+		changedRelativePaths.push_back(relativePath);
+	}
+
+	for (auto& identifier : unchangedFiles)
+	{
+		wroteFileCallback(identifier);
+	}
+
+	std::vector<std::vector<unsigned char>> hashes;
+	this->WriteFiles(changedDirectories, changedFiles, wroteFileCallback, &hashes);
+
+	for (size_t i = 0; i < changedFiles.size(); i++)
+	{
+		if (changedRelativePaths[i].empty())
+		{
+			continue;
+		}
+
+		ManifestEntry entry;
+		entry.size = changedFiles[i].size;
+		entry.hash = hashes[i];
+
+		manifest[changedRelativePaths[i]] = entry;
+	}
+
+	this->WriteManifest(manifestPath, manifest);
+}
+
+void AFCUploader::WriteFiles(const std::vector<std::string>& directories, const std::vector<File>& files, std::function<void(std::string)> wroteFileCallback,
+	std::vector<std::vector<unsigned char>>* hashes)
+{
+	for (auto& directoryPath : directories)
+	{
+		// Fails harmlessly if the directory already exists.
+		afc_make_directory(_client, directoryPath.c_str());
+	}
+
+	if (hashes != nullptr)
+	{
+		hashes->assign(files.size(), std::vector<unsigned char>());
+	}
+
+	if (files.empty())
+	{
+		return;
+	}
+
+	Chunk chunks[2];
+	for (auto& chunk : chunks)
+	{
+		chunk.buffer.resize(_chunkSize);
+		chunk.length = 0;
+	}
+
+	std::mutex mutex;
+	std::condition_variable cv;
+
+	std::deque<Chunk*> emptyChunks = { &chunks[0], &chunks[1] };
+	std::deque<Chunk*> filledChunks;
+
+	bool didFinishReading = false;
+	bool isCancelled = false;
+	std::exception_ptr readError = nullptr;
+
+	auto readAhead = [&]() {
+		try
+		{
+			Chunk* chunk = nullptr;
+
+			const struct ccdigest_info* di_info = ccsha256_di();
+
+			std::vector<unsigned char> context(ccdigest_di_size(di_info));
+			struct ccdigest_ctx* di_ctx = (struct ccdigest_ctx*)context.data();
+
+			auto submitChunk = [&]() {
+				std::lock_guard<std::mutex> lock(mutex);
+				filledChunks.push_back(chunk);
+				chunk = nullptr;
+				cv.notify_all();
+			};
+
+			for (size_t i = 0; i < files.size(); i++)
+			{
+				auto& file = files[i];
+				auto read = file.open();
+
+				if (hashes != nullptr)
+				{
+					ccdigest_init(di_info, di_ctx);
+				}
+
+				uint64_t offset = 0;
+
+				do
+				{
+					if (chunk == nullptr)
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						cv.wait(lock, [&] { return isCancelled || !emptyChunks.empty(); });
+
+						if (isCancelled)
+						{
+							return;
+						}
+
+						chunk = emptyChunks.front();
+						emptyChunks.pop_front();
+
+						chunk->length = 0;
+						chunk->segments.clear();
+					}
+
+					Segment segment;
+					segment.fileIndex = i;
+					segment.offset = chunk->length;
+					segment.length = (size_t)std::min<uint64_t>(chunk->buffer.size() - chunk->length, file.size - offset);
+					segment.opensFile = (offset == 0);
+
+					size_t bytesRead = 0;
+					while (bytesRead < segment.length)
+					{
+						size_t count = read(chunk->buffer.data() + segment.offset + bytesRead, segment.length - bytesRead);
+						if (count == 0)
+						{
+							// File is shorter than it was when it was added.
+							throw ServerError(ServerErrorCode::DeviceWriteFailed, { { NSLocalizedFailureReasonErrorKey, "Could not read " + file.identifier } });
+						}
+
+						bytesRead += count;
+					}
+
+					offset += segment.length;
+					segment.closesFile = (offset == file.size);
+
+					if (hashes != nullptr)
+					{
+						ccdigest_update(di_info, di_ctx, segment.length, chunk->buffer.data() + segment.offset);
+
+						if (segment.closesFile)
+						{
+							// Only read by the calling thread once this thread has been joined.
+							(*hashes)[i].resize(di_info->output_size);
+							ccdigest_final(di_info, di_ctx, (*hashes)[i].data());
+						}
+					}
+
+					chunk->length += segment.length;
+					chunk->segments.push_back(segment);
+
+					if (chunk->length == chunk->buffer.size())
+					{
+						submitChunk();
+					}
+				} while (offset < file.size);
+			}
+
+			if (chunk != nullptr)
+			{
+				submitChunk();
+			}
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			readError = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		didFinishReading = true;
+		cv.notify_all();
+	};
+
+	std::thread readThread(readAhead);
+
+	uint64_t af = 0;
+
+	try
+	{
+		while (true)
+		{
+			Chunk* chunk = nullptr;
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&] { return didFinishReading || !filledChunks.empty(); });
+
+				if (filledChunks.empty())
+				{
+					break;
+				}
+
+				chunk = filledChunks.front();
+				filledChunks.pop_front();
+			}
+
+			for (auto& segment : chunk->segments)
+			{
+				auto& file = files[segment.fileIndex];
+
+				if (segment.opensFile)
+				{
+					if ((afc_file_open(_client, file.destinationPath.c_str(), AFC_FOPEN_WRONLY, &af) != AFC_E_SUCCESS) || af == 0)
+					{
+						af = 0;
+						throw ServerError(ServerErrorCode::DeviceWriteFailed);
+					}
+				}
+
+				size_t bytesWritten = 0;
+				while (bytesWritten < segment.length)
+				{
+					uint32_t count = 0;
+
+					if (afc_file_write(_client, af, chunk->buffer.data() + segment.offset + bytesWritten, (uint32_t)(segment.length - bytesWritten), &count) != AFC_E_SUCCESS || count == 0)
+					{
+						throw ServerError(ServerErrorCode::DeviceWriteFailed);
+					}
+
+					bytesWritten += count;
+				}
+
+				if (segment.closesFile)
+				{
+					afc_file_close(_client, af);
+					af = 0;
+
+					wroteFileCallback(file.identifier);
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			emptyChunks.push_back(chunk);
+			cv.notify_all();
+		}
+	}
+	catch (...)
+	{
+		if (af != 0)
+		{
+			afc_file_close(_client, af);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			isCancelled = true;
+			cv.notify_all();
+		}
+
+		readThread.join();
+		throw;
+	}
+
+	readThread.join();
+
+	if (af != 0)
+	{
+		// Read-ahead thread failed partway through a file.
+		afc_file_close(_client, af);
+	}
+
+	if (readError)
+	{
+		std::rethrow_exception(readError);
+	}
+}
+
+std::vector<unsigned char> AFCUploader::HashFile(const File& file) const
+{
+	const struct ccdigest_info* di_info = ccsha256_di();
+
+	std::vector<unsigned char> context(ccdigest_di_size(di_info));
+	struct ccdigest_ctx* di_ctx = (struct ccdigest_ctx*)context.data();
+	ccdigest_init(di_info, di_ctx);
+
+	std::vector<char> buffer((size_t)std::max<uint64_t>(std::min<uint64_t>(_chunkSize, file.size), 1));
+
+	auto read = file.open();
+
+	uint64_t offset = 0;
+	while (offset < file.size)
+	{
+		size_t count = read(buffer.data(), (size_t)std::min<uint64_t>(buffer.size(), file.size - offset));
+		if (count == 0)
+		{
+			throw ServerError(ServerErrorCode::DeviceWriteFailed, { { NSLocalizedFailureReasonErrorKey, "Could not read " + file.identifier } });
+		}
+
+		ccdigest_update(di_info, di_ctx, count, buffer.data());
+		offset += count;
+	}
+
+	std::vector<unsigned char> hash(di_info->output_size);
+	ccdigest_final(di_info, di_ctx, hash.data());
+
+	return hash;
+}
+
+void AFCUploader::RemovePath(std::string path)
+{
+	if (afc_remove_path(_client, path.c_str()) == AFC_E_SUCCESS)
+	{
+		return;
+	}
+
+	// Directories must be emptied before they can be removed.
+	char** list = NULL;
+	if (afc_read_directory(_client, path.c_str(), &list) != AFC_E_SUCCESS || list == NULL)
+	{
+		return;
+	}
+
+	for (int i = 0; list[i]; i++)
+	{
+		std::string name(list[i]);
+		if (name != "." && name != "..")
+		{
+			this->RemovePath(path + "/" + name);
+		}
+
+		free(list[i]);
+	}
+
+	free(list);
+
+	afc_remove_path(_client, path.c_str());
+}
+
+std::map<std::string, AFCUploader::ManifestEntry> AFCUploader::ReadManifest(std::string manifestPath)
+{
+	std::map<std::string, ManifestEntry> manifest;
+
+	uint64_t af = 0;
+	if (afc_file_open(_client, manifestPath.c_str(), AFC_FOPEN_RDONLY, &af) != AFC_E_SUCCESS || af == 0)
+	{
+		// No manifest, so nothing staged can be trusted.
+		return manifest;
+	}
+
+	std::vector<char> data;
+	char buffer[65536];
+
+	while (true)
+	{
+		uint32_t count = 0;
+		if (afc_file_read(_client, af, buffer, sizeof(buffer), &count) != AFC_E_SUCCESS || count == 0)
+		{
+			break;
+		}
+
+		data.insert(data.end(), buffer, buffer + count);
+	}
+
+	afc_file_close(_client, af);
+
+	if (data.empty())
+	{
+		return manifest;
+	}
+
+	plist_t plist = NULL;
+	plist_from_bin(data.data(), (uint32_t)data.size(), &plist);
+
+	plist_t files = (plist != NULL) ? plist_dict_get_item(plist, "Files") : NULL;
+	if (files == NULL || plist_get_node_type(files) != PLIST_DICT)
+	{
+		plist_free(plist);
+		return manifest;
+	}
+
+	plist_dict_iter it = NULL;
+	plist_dict_new_iter(files, &it);
+
+	char* key = NULL;
+	plist_t node = NULL;
+	plist_dict_next_item(files, it, &key, &node);
+
+	while (node != NULL)
+	{
+		plist_t sizeNode = plist_dict_get_item(node, "Size");
+		plist_t hashNode = plist_dict_get_item(node, "SHA256");
+
+		if (sizeNode != NULL && plist_get_node_type(sizeNode) == PLIST_UINT && hashNode != NULL && plist_get_node_type(hashNode) == PLIST_DATA)
+		{
+			ManifestEntry entry;
+			plist_get_uint_val(sizeNode, &entry.size);
+
+			char* hash = NULL;
+			uint64_t hashLength = 0;
+			plist_get_data_val(hashNode, &hash, &hashLength);
+
+			entry.hash.assign((unsigned char*)hash, (unsigned char*)hash + hashLength);
+			free(hash);
+
+			manifest[key] = entry;
+		}
+
+		free(key);
+		key = NULL;
+		node = NULL;
+
+		plist_dict_next_item(files, it, &key, &node);
+	}
+
+	free(it);
+	plist_free(plist);
+
+	return manifest;
+}
+
+void AFCUploader::WriteManifest(std::string manifestPath, const std::map<std::string, ManifestEntry>& manifest)
+{
+	plist_t files = plist_new_dict();
+	for (auto& pair : manifest)
+	{
+		plist_t entry = plist_new_dict();
+		plist_dict_set_item(entry, "Size", plist_new_uint(pair.second.size));
+		plist_dict_set_item(entry, "SHA256", plist_new_data((const char*)pair.second.hash.data(), pair.second.hash.size()));
+
+		plist_dict_set_item(files, pair.first.c_str(), entry);
+	}
+
+	plist_t plist = plist_new_dict();
+	plist_dict_set_item(plist, "Files", files);
+
+	char* data = NULL;
+	uint32_t length = 0;
+	plist_to_bin(plist, &data, &length);
+	plist_free(plist);
+
+	// Failing to write the manifest only means the next upload can't skip anything.
+	uint64_t af = 0;
+	if (data != NULL && afc_file_open(_client, manifestPath.c_str(), AFC_FOPEN_WRONLY, &af) == AFC_E_SUCCESS && af != 0)
+	{
+		uint32_t bytesWritten = 0;
+		while (bytesWritten < length)
+		{
+			uint32_t count = 0;
+			if (afc_file_write(_client, af, data + bytesWritten, length - bytesWritten, &count) != AFC_E_SUCCESS || count == 0)
+			{
+				break;
+			}
+
+			bytesWritten += count;
+		}
+
+		afc_file_close(_client, af);
+
+		if (bytesWritten != length)
+		{
+			afc_remove_path(_client, manifestPath.c_str());
+		}
+	}
+
+	free(data);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <libimobiledevice/afc.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Streams files to a device over AFC.
+//
+// A read-ahead thread fills fixed-size chunks while the calling thread writes the previous
+// chunk to the device, so local reads overlap AFC round trips. Two chunks are in flight at
+// most (double buffering), so memory use is bounded regardless of file size. Files smaller
+// than a chunk are packed together, so a bundle of thousands of small files is handed over
+// in a few large batches and the AFC connection never waits on the disk between files.
+class AFCUploader
+{
+public:
+	// Copies up to length bytes of a file into buffer and returns the number of bytes copied.
+	using ReadFunction = std::function<size_t(char* buffer, size_t length)>;
+
+	struct File
+	{
+		// Passed to the wrote-file callback, usually the local path.
+		std::string identifier;
+
+		std::string destinationPath;
+		uint64_t size;
+
+		// Called on the read-ahead thread, in the order files were added.
+		std::function<ReadFunction()> open;
+	};
+
+	static const size_t DefaultChunkSize = 1024 * 1024;
+
+	AFCUploader(afc_client_t client, size_t chunkSize = DefaultChunkSize);
+	~AFCUploader();
+
+	void AddDirectory(std::string destinationPath);
+	void AddFile(std::string filepath, std::string destinationPath);
+	void AddFile(File file);
+
+	// Recursively adds the contents of directoryPath, creating destinationPath itself too.
+	void AddDirectoryContents(std::string directoryPath, std::string destinationPath);
+
+	size_t numberOfFiles() const;
+
+	// Creates the added directories, then writes the added files in order.
+	// wroteFileCallback is called on the calling thread once each file has been closed on the device.
+	void Upload(std::function<void(std::string)> wroteFileCallback);
+
+	// Like Upload, but only writes files that changed since the last upload to rootPath.
+	// The size and SHA-256 of every staged file is kept in a manifest on the device next to rootPath.
+	// Staged entries that are no longer part of the upload are removed, and unchanged files are
+	// reported to wroteFileCallback up front. Only files staged with the size they have now are read
+	// to compare hashes, everything else is hashed while it's being uploaded.
+	void UploadChanges(std::string rootPath, std::function<void(std::string)> wroteFileCallback);
+
+private:
+	afc_client_t _client;
+	size_t _chunkSize;
+
+	std::vector<std::string> _directories;
+	std::vector<File> _files;
+
+	struct ManifestEntry
+	{
+		uint64_t size;
+		std::vector<unsigned char> hash;
+	};
+
+	// If hashes isn't null, it's filled with the SHA-256 of each file as read for the upload.
+	void WriteFiles(const std::vector<std::string>& directories, const std::vector<File>& files, std::function<void(std::string)> wroteFileCallback,
+		std::vector<std::vector<unsigned char>>* hashes = nullptr);
+
+	std::vector<unsigned char> HashFile(const File& file) const;
+	void RemovePath(std::string path);
+
+	std::map<std::string, ManifestEntry> ReadManifest(std::string manifestPath);
+	void WriteManifest(std::string manifestPath, const std::map<std::string, ManifestEntry>& manifest);
+
+	struct Segment
+	{
+		size_t fileIndex;
+		size_t offset;
+		size_t length;
+
+		bool opensFile;
+		bool closesFile;
+	};
+
+	struct Chunk
+	{
+		std::vector<char> buffer;
+		size_t length;
+
+		std::vector<Segment> segments;
+	};
+};
@@ -26,6 +26,7 @@
 #include "Application.hpp"
 
 #include "ConnectionError.hpp"
+#include "AFCUploader.h"
 
 #include <WinSock2.h>
 
@@ -45,7 +46,6 @@ ssize_t DeviceManagerUploadFile(void* buffer, size_t size, void* user_data);
 namespace fs = std::filesystem;
 
 extern std::string make_uuid();
-extern std::string temporary_directory();
 extern std::vector<unsigned char> readFile(const char* filename);
 
 /// Returns a version of 'str' where every occurrence of
@@ -103,40 +103,27 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 		strncpy(uuidString, (const char*)UUID.c_str(), UUID.size());
 		uuidString[UUID.size()] = '\0';
 
-		idevice_t device = nullptr;
-		lockdownd_client_t client = NULL;
-		instproxy_client_t ipc = NULL;
-		afc_client_t afc = NULL;
-		misagent_client_t mis = NULL;
-		lockdownd_service_descriptor_t service = NULL;
-
-		fs::path temporaryDirectory(temporary_directory());
-		temporaryDirectory.append(make_uuid());
-
-		fs::create_directory(temporaryDirectory);
+		std::shared_ptr<ServiceClient<instproxy_client_t>> ipc;
+		std::shared_ptr<ServiceClient<afc_client_t>> afc;
+		std::shared_ptr<ServiceClient<misagent_client_t>> mis;
 
 		auto installedProfiles = std::make_shared<std::vector<std::shared_ptr<ProvisioningProfile>>>();
 		auto cachedProfiles = std::make_shared<std::map<std::string, std::shared_ptr<ProvisioningProfile>>>();
 
-		auto finish = [this, installedProfiles, cachedProfiles, activeProfiles, temporaryDirectory, &uuidString]
-		(idevice_t device, lockdownd_client_t client, instproxy_client_t ipc, afc_client_t afc, misagent_client_t mis, lockdownd_service_descriptor_t service)
+		auto finish = [this, installedProfiles, cachedProfiles, activeProfiles, &uuidString]
+		(std::shared_ptr<ServiceClient<misagent_client_t>> misagent)
 		{
+			// Service clients are handed back to the device's session when their leases are released.
 			auto cleanUp = [=]() {
-				instproxy_client_free(ipc);
-				afc_client_free(afc);
-				lockdownd_client_free(client);
-				misagent_client_free(mis);
-				idevice_free(device);
-				lockdownd_service_descriptor_free(service);
-
 				free(uuidString);
 
 				this->_mutex.unlock();
-				fs::remove_all(temporaryDirectory);
 			};
 
 			try
 			{
+				misagent_client_t mis = (misagent != nullptr) ? misagent->client() : NULL;
+
 				if (activeProfiles.has_value())
 				{
 					// Remove installed provisioning profiles if they're not active.
@@ -189,103 +176,120 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 				return std::tolower(c);
 				});
 
-			fs::path appBundlePath;
+			std::string appBundleName;
+			std::string bundleIdentifier;
+			std::shared_ptr<ProvisioningProfile> provisioningProfile;
+
+			// .ipa files are read in place and streamed to the device, rather than unzipped to a temporary directory first.
+			std::shared_ptr<AppArchive> appArchive;
 
 			if (extension == ".app")
 			{
-				appBundlePath = filepath;
+				std::shared_ptr<Application> application = std::make_shared<Application>(filepath.string());
+				if (application == NULL)
+				{
+					throw SignError(SignErrorCode::InvalidApp);
+				}
+
+				appBundleName = filepath.filename().string();
+				bundleIdentifier = application->bundleIdentifier();
+				provisioningProfile = application->provisioningProfile();
+
+				for (auto& appExtension : application->appExtensions())
+				{
+					if (appExtension->provisioningProfile())
+					{
+						installedProfiles->push_back(appExtension->provisioningProfile());
+					}
+				}
 			}
 			else if (extension == ".ipa")
 			{
-				std::cout << "Unzipping .ipa..." << std::endl;
-				appBundlePath = UnzipAppBundle(filepath.string(), temporaryDirectory.string());
-			}
-			else
-			{
-				throw SignError(SignErrorCode::InvalidApp);
-			}
+				appArchive = std::make_shared<AppArchive>(filepath.string());
+				appBundleName = appArchive->appBundleName();
 
-			std::shared_ptr<Application> application = std::make_shared<Application>(appBundlePath.string());
-			if (application == NULL)
-			{
-				throw SignError(SignErrorCode::InvalidApp);
-			}
+				if (!appArchive->HasEntry("Info.plist"))
+				{
+					throw SignError(SignErrorCode::MissingInfoPlist);
+				}
 
-			if (application->provisioningProfile())
-			{
-				installedProfiles->push_back(application->provisioningProfile());
-			}
+				auto infoPlistData = appArchive->ReadEntry("Info.plist");
 
-			for (auto& appExtension : application->appExtensions())
-			{
-				if (appExtension->provisioningProfile())
+				plist_t infoPlist = nullptr;
+				plist_from_memory((const char*)infoPlistData.data(), (int)infoPlistData.size(), &infoPlist);
+				if (infoPlist == nullptr)
 				{
-					installedProfiles->push_back(appExtension->provisioningProfile());
+					throw SignError(SignErrorCode::InvalidInfoPlist);
 				}
-			}
 
-			/* Find Device */
+				auto bundleIdentifierNode = plist_dict_get_item(infoPlist, "CFBundleIdentifier");
+				if (bundleIdentifierNode == nullptr || plist_get_node_type(bundleIdentifierNode) != PLIST_STRING)
+				{
+					plist_free(infoPlist);
+					throw SignError(SignErrorCode::InvalidApp);
+				}
 
-			if (idevice_new_with_options(&device, deviceUDID.c_str(), (enum idevice_options)((int)IDEVICE_LOOKUP_NETWORK | (int)IDEVICE_LOOKUP_USBMUX)) != IDEVICE_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::DeviceNotFound);
-			}
+				char* bundleIdentifierString = nullptr;
+				plist_get_string_val(bundleIdentifierNode, &bundleIdentifierString);
+				bundleIdentifier = bundleIdentifierString;
+				free(bundleIdentifierString);
 
-			/* Connect to Device */
-			if (lockdownd_client_new_with_handshake(device, &client, "miniappBuilder") != LOCKDOWN_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
+				plist_free(infoPlist);
 
-			/* Connect to Installation Proxy */
-			if ((lockdownd_start_service(client, "com.apple.mobile.installation_proxy", &service) != LOCKDOWN_E_SUCCESS) || service == NULL)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
+				if (appArchive->HasEntry("embedded.mobileprovision"))
+				{
+					auto data = appArchive->ReadEntry("embedded.mobileprovision");
+					provisioningProfile = std::make_shared<ProvisioningProfile>(data);
+				}
+
+				// PlugIns/<Name>.appex/embedded.mobileprovision
+				for (auto& entry : appArchive->entries())
+				{
+					auto separator = entry.path.find('/', 8);
+					if (entry.path.compare(0, 8, "PlugIns/") != 0 || separator == std::string::npos || entry.path.substr(separator) != "/embedded.mobileprovision")
+					{
+						continue;
+					}
+
+					if (fs::path(entry.path.substr(8, separator - 8)).extension() != ".appex")
+					{
+						continue;
+					}
 
-			if (instproxy_client_new(device, service, &ipc) != INSTPROXY_E_SUCCESS)
+					auto data = appArchive->ReadEntry(entry.path);
+					installedProfiles->push_back(std::make_shared<ProvisioningProfile>(data));
+				}
+			}
+			else
 			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
+				throw SignError(SignErrorCode::InvalidApp);
 			}
 
-			if (service)
+			if (provisioningProfile)
 			{
-				lockdownd_service_descriptor_free(service);
-				service = NULL;
+				installedProfiles->insert(installedProfiles->begin(), provisioningProfile);
 			}
 
+			/* Connect to Device */
+			auto session = this->SessionForDevice(deviceUDID);
+
+			/* Connect to Installation Proxy */
+			ipc = session->StartInstallationProxy();
 
 			/* Connect to Misagent */
 			// Must connect now, since if we take too long writing files to device, connecting may fail later when managing profiles.
-			if (lockdownd_start_service(client, "com.apple.misagent", &service) != LOCKDOWN_E_SUCCESS || service == NULL)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
-
-			if (misagent_client_new(device, service, &mis) != MISAGENT_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
-
+			mis = session->StartMisagent();
 
 			/* Connect to AFC service */
-			if ((lockdownd_start_service(client, "com.apple.afc", &service) != LOCKDOWN_E_SUCCESS) || service == NULL)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
-
-			if (afc_client_new(device, service, &afc) != AFC_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
+			afc = session->StartAFC();
 
 			fs::path stagingPath("PublicStaging");
 
 			/* Prepare for installation */
 			char** files = NULL;
-			if (afc_get_file_info(afc, (const char*)stagingPath.c_str(), &files) != AFC_E_SUCCESS)
+			if (afc_get_file_info(afc->client(), (const char*)stagingPath.c_str(), &files) != AFC_E_SUCCESS)
 			{
-				if (afc_make_directory(afc, (const char*)stagingPath.c_str()) != AFC_E_SUCCESS)
+				if (afc_make_directory(afc->client(), (const char*)stagingPath.c_str()) != AFC_E_SUCCESS)
 				{
 					throw ServerError(ServerErrorCode::DeviceWriteFailed);
 				}
@@ -309,22 +313,49 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 			plist_t options = instproxy_client_options_new();
 			instproxy_client_options_add(options, "PackageType", "Developer", NULL);
 
-			fs::path destinationPath = stagingPath.append(appBundlePath.filename().string());
-
-			int numberOfFiles = 0;
-			for (auto& item : fs::recursive_directory_iterator(appBundlePath))
-			{
-				if (item.is_regular_file())
-				{
-					numberOfFiles++;
-				}				
-			}
+			fs::path destinationPath = stagingPath.append(appBundleName);
 
 			int writtenFiles = 0;
 
 			try
 			{
-				this->WriteDirectory(afc, appBundlePath.string(), destinationPath.string(), [numberOfFiles, &writtenFiles, &progressCompletionHandler](std::string filepath) {
+				AFCUploader uploader(afc->client());
+
+				if (appArchive != nullptr)
+				{
+					std::string destinationDirectoryPath = destinationPath.string();
+					std::replace(destinationDirectoryPath.begin(), destinationDirectoryPath.end(), '\\', '/');
+
+					uploader.AddDirectory(destinationDirectoryPath);
+
+					// Parent directories sort before their contents.
+					for (auto& directory : appArchive->directories())
+					{
+						uploader.AddDirectory(destinationDirectoryPath + "/" + directory);
+					}
+
+					for (auto& entry : appArchive->entries())
+					{
+						AFCUploader::File file;
+						file.identifier = entry.path;
+						file.destinationPath = destinationDirectoryPath + "/" + entry.path;
+						file.size = entry.size;
+						file.open = [appArchive, entry]() {
+							return appArchive->OpenEntry(entry.path);
+						};
+
+						uploader.AddFile(file);
+					}
+				}
+				else
+				{
+					uploader.AddDirectoryContents(filepath.string(), destinationPath.string());
+				}
+
+				int numberOfFiles = (int)uploader.numberOfFiles();
+
+				// Only upload files that changed since this app was last staged on the device.
+				uploader.UploadChanges(destinationPath.string(), [numberOfFiles, &writtenFiles, &progressCompletionHandler](std::string filepath) {
 					writtenFiles++;
 
 					double progress = (double)writtenFiles / (double)numberOfFiles;
@@ -334,7 +365,7 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 			}
 			catch (ServerError& e)
 			{
-				if (application->bundleIdentifier().find("science.xnu.undecimus") != std::string::npos)
+				if (bundleIdentifier.find("science.xnu.undecimus") != std::string::npos)
 				{
 					auto userInfo = e.userInfo();
 					userInfo["NSLocalizedRecoverySuggestion"] = "Make sure Windows real-time protection is disabled on your computer then try again.";
@@ -348,7 +379,7 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 			}
 			catch (std::exception& exception)
 			{
-				if (application->bundleIdentifier().find("science.xnu.undecimus") != std::string::npos)
+				if (bundleIdentifier.find("science.xnu.undecimus") != std::string::npos)
 				{
 					std::map<std::string, std::string> userInfo = {
 						{ "NSLocalizedDescription", exception.what() },
@@ -374,21 +405,14 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 
 			std::cout << "Finished writing to device." << std::endl;
 
-
-			if (service)
-			{
-				lockdownd_service_descriptor_free(service);
-				service = NULL;
-			}
-
 			/* Provisioning Profiles */			
-			bool shouldManageProfiles = (activeProfiles.has_value() || (application->provisioningProfile() != NULL && application->provisioningProfile()->isFreeProvisioningProfile()));
+			bool shouldManageProfiles = (activeProfiles.has_value() || (provisioningProfile != NULL && provisioningProfile->isFreeProvisioningProfile()));
 			if (shouldManageProfiles)
 			{				
 				// Free developer account was used to sign this app, so we need to remove all
 				// provisioning profiles in order to remain under sideloaded app limit.
 
-				auto removedProfiles = this->RemoveAllFreeProvisioningProfilesExcludingBundleIdentifiers({}, mis);
+				auto removedProfiles = this->RemoveAllFreeProvisioningProfilesExcludingBundleIdentifiers({}, mis->client());
 				for (auto& pair : removedProfiles)
 				{
 					if (activeProfiles.has_value())
@@ -407,9 +431,6 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 				}				
 			}
 
-			lockdownd_client_free(client);
-			client = NULL;
-
 			std::mutex waitingMutex;
 			std::condition_variable cv;
 
@@ -420,7 +441,7 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 			bool didFinishInstalling = false;
 
 			// Capture &finish by reference to avoid implicit copies of installedProfiles and cachedProfiles, resulting in memory leaks.
-			this->_installationProgressHandlers[UUID] = [device, client, ipc, afc, mis, service, &finish, &progressCompletionHandler, 
+			this->_installationProgressHandlers[UUID] = [&finish, &progressCompletionHandler, 
 				&waitingMutex, &cv, &didBeginInstalling, &didFinishInstalling, &serverError, &localizedError](double progress, int resultCode, char *name, char *description) {
 				double weightedProgress = progress * 0.25;
 				double adjustedProgress = weightedProgress + 0.75;
@@ -466,7 +487,7 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 			auto narrowDestinationPath = StringFromWideString(destinationPath.c_str());
 			std::replace(narrowDestinationPath.begin(), narrowDestinationPath.end(), '\\', '/');
 
-			instproxy_install(ipc, narrowDestinationPath.c_str(), options, DeviceManagerUpdateStatus, uuidString);
+			instproxy_install(ipc->client(), narrowDestinationPath.c_str(), options, DeviceManagerUpdateStatus, uuidString);
 			instproxy_client_options_free(options);
 
 			// Wait until we're finished installing;
@@ -487,10 +508,21 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 		}
 		catch (std::exception& exception)
 		{
+			// Don't hand possibly broken connections back to the session.
+			if (ipc != nullptr)
+			{
+				ipc->Invalidate();
+			}
+
+			if (afc != nullptr)
+			{
+				afc->Invalidate();
+			}
+
 			try
 			{
 				// MUST finish so we restore provisioning profiles.
-				finish(device, client, ipc, afc, mis, service);
+				finish(mis);
 			}
 			catch (std::exception& e)
 			{
@@ -502,17 +534,15 @@ pplx::task<void> DeviceManager::InstallApp(std::string appFilepath, std::string
 
 		// Call finish outside try-block so if an exception is thrown, we don't
 		// catch it ourselves and "finish" again.
-		finish(device, client, ipc, afc, mis, service);
+		finish(mis);
 	});
 }
 
 pplx::task<void> DeviceManager::LaunchApp(std::string bundleIdentifier, std::string deviceUDID)
 {
 	return pplx::task<void>([=] {
-		idevice_t device = NULL;
-		lockdownd_client_t client = NULL;
-		instproxy_client_t ipc = NULL;
-		lockdownd_service_descriptor_t service = NULL;
+		std::shared_ptr<DeviceSession> session;
+		std::shared_ptr<ServiceClient<instproxy_client_t>> ipc;
 		debugserver_client_t debugserver_client;
 		char* path = NULL;
     	char* working_directory = NULL;
@@ -521,56 +551,19 @@ pplx::task<void> DeviceManager::LaunchApp(std::string bundleIdentifier, std::str
 		debugserver_error_t dres = DEBUGSERVER_E_UNKNOWN_ERROR;
 
 		auto cleanUp = [&]() {
-			if (service) {
-				lockdownd_service_descriptor_free(service);
-			}
-
-			if (ipc) {
-				instproxy_client_free(ipc);
-			}
-
-			if (client) {
-				lockdownd_client_free(client);
-			}
-
-			if (device) {
-				idevice_free(device);
-			}
+			ipc = nullptr;
 		};
 
 		try 
 		{
-			/* Find Device */
-			if (idevice_new_with_options(&device, deviceUDID.c_str(), (enum idevice_options)((int)IDEVICE_LOOKUP_NETWORK | (int)IDEVICE_LOOKUP_USBMUX)) != IDEVICE_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::DeviceNotFound);
-			}
-
 			/* Connect to Device */
-			if (lockdownd_client_new_with_handshake(device, &client, "miniappBuilder") != LOCKDOWN_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
+			session = this->SessionForDevice(deviceUDID);
 
 			/* Connect to Installation Proxy */
-			if ((lockdownd_start_service(client, "com.apple.mobile.installation_proxy", &service) != LOCKDOWN_E_SUCCESS) || service == NULL)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
-
-			if (instproxy_client_new(device, service, &ipc) != INSTPROXY_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
-
-			if (service)
-			{
-				lockdownd_service_descriptor_free(service);
-				service = NULL;
-			}
+			ipc = session->StartInstallationProxy();
 
 			// start debugserver
-			if (debugserver_client_start_service(device, &debugserver_client, "miniapp-builder") != DEBUGSERVER_E_SUCCESS) {
+			if (debugserver_client_start_service(session->device(), &debugserver_client, "miniapp-builder") != DEBUGSERVER_E_SUCCESS) {
 				stderrlog(
 					"Could not start com.apple.debugserver!\n\
 					Please make sure to mount the developer disk image first:\n\
@@ -581,7 +574,7 @@ pplx::task<void> DeviceManager::LaunchApp(std::string bundleIdentifier, std::str
 			}
 
 			// get app path
-			instproxy_client_get_path_for_bundle_identifier(ipc, bundleIdentifier.c_str(), &path);
+			instproxy_client_get_path_for_bundle_identifier(ipc->client(), bundleIdentifier.c_str(), &path);
 
 			/* set working directory */
 			char* working_dir[2] = {working_directory, NULL};
@@ -617,130 +610,34 @@ pplx::task<void> DeviceManager::LaunchApp(std::string bundleIdentifier, std::str
 			cleanUp();
 		}
 		catch (std::exception& exception) {
+			if (ipc != nullptr)
+			{
+				ipc->Invalidate();
+			}
+
 			cleanUp();
 			throw;
 		}
 	});
 }
 
-void DeviceManager::WriteDirectory(afc_client_t client, std::string directoryPath, std::string destinationPath, std::function<void(std::string)> wroteFileCallback)
-{
-	std::replace(destinationPath.begin(), destinationPath.end(), '\\', '/');
-
-    afc_make_directory(client, destinationPath.c_str());
-    
-    for (auto& file : fs::directory_iterator(directoryPath))
-    {
-        auto filepath = file.path();
-        
-        if (fs::is_directory(filepath))
-        {
-            auto destinationDirectoryPath = fs::path(destinationPath).append(filepath.filename().string());
-            this->WriteDirectory(client, filepath.string(), destinationDirectoryPath.string(), wroteFileCallback);
-        }
-        else
-        {
-            auto destinationFilepath = fs::path(destinationPath).append(filepath.filename().string());
-            this->WriteFile(client, filepath.string(), destinationFilepath.string(), wroteFileCallback);
-        }
-    }
-}
-
-void DeviceManager::WriteFile(afc_client_t client, std::string filepath, std::string destinationPath, std::function<void(std::string)> wroteFileCallback)
-{
-	std::replace(destinationPath.begin(), destinationPath.end(), '\\', '/');
-	destinationPath = replace_all(destinationPath, "__colon__", ":");
-
-	// stdoutlog("Writing File: " << filepath.c_str() << " to: " << destinationPath.c_str());
-    
-    auto data = readFile(filepath.c_str());
-    
-    uint64_t af = 0;
-    if ((afc_file_open(client, destinationPath.c_str(), AFC_FOPEN_WRONLY, &af) != AFC_E_SUCCESS) || af == 0)
-    {
-        throw ServerError(ServerErrorCode::DeviceWriteFailed);
-    }
-    
-    uint32_t bytesWritten = 0;
-    
-    while (bytesWritten < data.size())
-    {
-        uint32_t count = 0;
-        
-        if (afc_file_write(client, af, (const char *)data.data() + bytesWritten, (uint32_t)data.size() - bytesWritten, &count) != AFC_E_SUCCESS)
-        {
-            throw ServerError(ServerErrorCode::DeviceWriteFailed);
-        }
-        
-        bytesWritten += count;
-    }
-    
-    if (bytesWritten != data.size())
-    {
-        throw ServerError(ServerErrorCode::DeviceWriteFailed);
-    }
-    
-    afc_file_close(client, af);
-
-	wroteFileCallback(filepath);
-}
-
 pplx::task<void> DeviceManager::RemoveApp(std::string bundleIdentifier, std::string deviceUDID)
 {
 	return pplx::task<void>([=] {
-		idevice_t device = NULL;
-		lockdownd_client_t client = NULL;
-		instproxy_client_t ipc = NULL;
-		lockdownd_service_descriptor_t service = NULL;
+		std::shared_ptr<DeviceSession> session;
+		std::shared_ptr<ServiceClient<instproxy_client_t>> ipc;
 
 		auto cleanUp = [&]() {
-			if (service) {
-				lockdownd_service_descriptor_free(service);
-			}
-
-			if (ipc) {
-				instproxy_client_free(ipc);
-			}
-
-			if (client) {
-				lockdownd_client_free(client);
-			}
-
-			if (device) {
-				idevice_free(device);
-			}
+			ipc = nullptr;
 		};
 
 		try 
 		{
-			/* Find Device */
-			if (idevice_new_with_options(&device, deviceUDID.c_str(), (enum idevice_options)((int)IDEVICE_LOOKUP_NETWORK | (int)IDEVICE_LOOKUP_USBMUX)) != IDEVICE_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::DeviceNotFound);
-			}
-
 			/* Connect to Device */
-			if (lockdownd_client_new_with_handshake(device, &client, "miniappBuilder") != LOCKDOWN_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
+			session = this->SessionForDevice(deviceUDID);
 
 			/* Connect to Installation Proxy */
-			if ((lockdownd_start_service(client, "com.apple.mobile.installation_proxy", &service) != LOCKDOWN_E_SUCCESS) || service == NULL)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
-
-			if (instproxy_client_new(device, service, &ipc) != INSTPROXY_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
-
-			if (service)
-			{
-				lockdownd_service_descriptor_free(service);
-				service = NULL;
-			}
+			ipc = session->StartInstallationProxy();
 
 			auto UUID = make_uuid();
 
@@ -773,7 +670,7 @@ pplx::task<void> DeviceManager::RemoveApp(std::string bundleIdentifier, std::str
 				free(uuidString);
 			};
 
-			instproxy_uninstall(ipc, bundleIdentifier.c_str(), NULL, DeviceManagerUpdateAppDeletionStatus, uuidString);
+			instproxy_uninstall(ipc->client(), bundleIdentifier.c_str(), NULL, DeviceManagerUpdateAppDeletionStatus, uuidString);
 
 			// Wait until we're finished installing;
 			std::unique_lock<std::mutex> lock(waitingMutex);
@@ -789,6 +686,11 @@ pplx::task<void> DeviceManager::RemoveApp(std::string bundleIdentifier, std::str
 			cleanUp();
 		}
 		catch (std::exception& exception) {
+			if (ipc != nullptr)
+			{
+				ipc->Invalidate();
+			}
+
 			cleanUp();
 			throw;
 		}
@@ -837,60 +739,22 @@ pplx::task<void> DeviceManager::InstallProvisioningProfiles(std::vector<std::sha
 		// Enforce only one installation at a time.
 		this->_mutex.lock();
 
-		idevice_t device = NULL;
-		lockdownd_client_t client = NULL;
-		afc_client_t afc = NULL;
-		misagent_client_t mis = NULL;
-		lockdownd_service_descriptor_t service = NULL;
+		std::shared_ptr<ServiceClient<misagent_client_t>> misagent;
 
 		auto cleanUp = [&]() {
-			if (service) {
-				lockdownd_service_descriptor_free(service);
-			}
-
-			if (mis) {
-				misagent_client_free(mis);
-			}
-
-			if (afc) {
-				afc_client_free(afc);
-			}
-
-			if (client) {
-				lockdownd_client_free(client);
-			}
-
-			if (device) {
-				idevice_free(device);
-			}
+			misagent = nullptr;
 
 			this->_mutex.unlock();
 		};
 
 		try
 		{
-			/* Find Device */
-			if (idevice_new_with_options(&device, deviceUDID.c_str(), (enum idevice_options)((int)IDEVICE_LOOKUP_NETWORK | (int)IDEVICE_LOOKUP_USBMUX)) != IDEVICE_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::DeviceNotFound);
-			}
-
 			/* Connect to Device */
-			if (lockdownd_client_new_with_handshake(device, &client, "miniappBuilder") != LOCKDOWN_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
+			auto session = this->SessionForDevice(deviceUDID);
 
 			/* Connect to Misagent */
-			if (lockdownd_start_service(client, "com.apple.misagent", &service) != LOCKDOWN_E_SUCCESS || service == NULL)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
-
-			if (misagent_client_new(device, service, &mis) != MISAGENT_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
+			misagent = session->StartMisagent();
+			misagent_client_t mis = misagent->client();
 
 			if (activeProfiles.has_value())
 			{
@@ -927,6 +791,11 @@ pplx::task<void> DeviceManager::InstallProvisioningProfiles(std::vector<std::sha
 		}
 		catch (std::exception &exception)
 		{
+			if (misagent != nullptr)
+			{
+				misagent->Invalidate();
+			}
+
 			cleanUp();
 			throw;
 		}
@@ -939,60 +808,22 @@ pplx::task<void> DeviceManager::RemoveProvisioningProfiles(std::set<std::string>
 		// Enforce only one removal at a time.
 		this->_mutex.lock();
 
-		idevice_t device = NULL;
-		lockdownd_client_t client = NULL;
-		afc_client_t afc = NULL;
-		misagent_client_t mis = NULL;
-		lockdownd_service_descriptor_t service = NULL;
+		std::shared_ptr<ServiceClient<misagent_client_t>> misagent;
 
 		auto cleanUp = [&]() {
-			if (service) {
-				lockdownd_service_descriptor_free(service);
-			}
-
-			if (mis) {
-				misagent_client_free(mis);
-			}
-
-			if (afc) {
-				afc_client_free(afc);
-			}
-
-			if (client) {
-				lockdownd_client_free(client);
-			}
-
-			if (device) {
-				idevice_free(device);
-			}
+			misagent = nullptr;
 
 			this->_mutex.unlock();
 		};
 
 		try
 		{
-			/* Find Device */
-			if (idevice_new_with_options(&device, deviceUDID.c_str(), (enum idevice_options)((int)IDEVICE_LOOKUP_NETWORK | (int)IDEVICE_LOOKUP_USBMUX)) != IDEVICE_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::DeviceNotFound);
-			}
-
 			/* Connect to Device */
-			if (lockdownd_client_new_with_handshake(device, &client, "miniappBuilder") != LOCKDOWN_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
+			auto session = this->SessionForDevice(deviceUDID);
 
 			/* Connect to Misagent */
-			if (lockdownd_start_service(client, "com.apple.misagent", &service) != LOCKDOWN_E_SUCCESS || service == NULL)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
-
-			if (misagent_client_new(device, service, &mis) != MISAGENT_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
+			misagent = session->StartMisagent();
+			misagent_client_t mis = misagent->client();
 
 			this->RemoveProvisioningProfiles(bundleIdentifiers, mis);
 
@@ -1000,6 +831,11 @@ pplx::task<void> DeviceManager::RemoveProvisioningProfiles(std::set<std::string>
 		}
 		catch (std::exception& exception)
 		{
+			if (misagent != nullptr)
+			{
+				misagent->Invalidate();
+			}
+
 			cleanUp();
 			throw;
 		}
@@ -1239,73 +1075,24 @@ std::vector<std::shared_ptr<ProvisioningProfile>> DeviceManager::CopyProvisionin
 pplx::task<bool> DeviceManager::IsDeveloperDiskImageMounted(std::shared_ptr<Device> altDevice)
 {
 	return pplx::create_task([=]() -> bool {
-		idevice_t device = NULL;
-		instproxy_client_t ipc = NULL;
-		lockdownd_client_t client = NULL;
-		lockdownd_service_descriptor_t service = NULL;
-		mobile_image_mounter_client_t mim = NULL;
+		std::shared_ptr<ServiceClient<mobile_image_mounter_client_t>> imageMounter;
 
 		auto cleanUp = [&]() {
-			if (mim) {
-				if (device != NULL && device->conn_type == CONNECTION_USBMUXD)
-				{
-					// For some reason, calling this method over WiFi may freeze MiniappBuilder.
-					// Nothing bad *seems* to happen if we don't call it though, so just limit it to wired connections.
-					mobile_image_mounter_hangup(mim);
-				}
-
-				mobile_image_mounter_free(mim);
-			}
-
-			if (service) {
-				lockdownd_service_descriptor_free(service);
-			}
-
-			if (client) {
-				lockdownd_client_free(client);
-			}
-
-			if (ipc) {
-				instproxy_client_free(ipc);
-			}
-
-			if (device) {
-				idevice_free(device);
-			}
+			// Hands the service client back to the device's session, which hangs up wired clients when freeing them.
+			imageMounter = nullptr;
 		};
 
 		try
 		{
-			/* Find Device */
-			if (idevice_new_with_options(&device, altDevice->identifier().c_str(), (enum idevice_options)((int)IDEVICE_LOOKUP_NETWORK | (int)IDEVICE_LOOKUP_USBMUX)) != IDEVICE_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::DeviceNotFound);
-			}
-
 			/* Connect to Device */
-			if (lockdownd_client_new_with_handshake(device, &client, "miniappBuilder") != LOCKDOWN_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
+			auto session = this->SessionForDevice(altDevice->identifier());
 
 			/* Connect to Mobile Image Mounter Proxy */
-			if ((lockdownd_start_service(client, "com.apple.mobile.mobile_image_mounter", &service) != LOCKDOWN_E_SUCCESS) || service == NULL)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
-
-			mobile_image_mounter_error_t err = mobile_image_mounter_new(device, service, &mim);
-			if (err != MOBILE_IMAGE_MOUNTER_E_SUCCESS)
-			{
-				auto error = ConnectionError::errorForMobileImageMounterError(err, altDevice);
-				if (error.has_value())
-				{
-					throw* error;
-				}
-			}
+			imageMounter = session->StartMobileImageMounter(altDevice);
+			mobile_image_mounter_client_t mim = imageMounter->client();
 
 			plist_t result = NULL;
-			err = mobile_image_mounter_lookup_image(mim, "Developer", &result);
+			mobile_image_mounter_error_t err = mobile_image_mounter_lookup_image(mim, "Developer", &result);
 			if (err != MOBILE_IMAGE_MOUNTER_E_SUCCESS)
 			{
 				auto error = ConnectionError::errorForMobileImageMounterError(err, altDevice);
@@ -1354,6 +1141,11 @@ pplx::task<bool> DeviceManager::IsDeveloperDiskImageMounted(std::shared_ptr<Devi
 		}
 		catch (std::exception& exception)
 		{
+			if (imageMounter != nullptr)
+			{
+				imageMounter->Invalidate();
+			}
+
 			cleanUp();
 			throw;
 		}
@@ -1363,76 +1155,27 @@ pplx::task<bool> DeviceManager::IsDeveloperDiskImageMounted(std::shared_ptr<Devi
 pplx::task<void> DeviceManager::InstallDeveloperDiskImage(std::string diskPath, std::string signaturePath, std::shared_ptr<Device> altDevice)
 {
 	return pplx::create_task([=]() -> pplx::task<void> {
-		idevice_t device = NULL;
-		instproxy_client_t ipc = NULL;
-		lockdownd_client_t client = NULL;
-		lockdownd_service_descriptor_t service = NULL;
-		mobile_image_mounter_client_t mim = NULL;
+		std::shared_ptr<ServiceClient<mobile_image_mounter_client_t>> imageMounter;
 
 		auto cleanUp = [&]() {
-			if (mim) {
-				if (device != NULL && device->conn_type == CONNECTION_USBMUXD)
-				{
-					// For some reason, calling this method over WiFi may freeze MiniappBuilder.
-					// Nothing bad *seems* to happen if we don't call it though, so just limit it to wired connections.
-					mobile_image_mounter_hangup(mim);
-				}
-
-				mobile_image_mounter_free(mim);
-			}
-
-			if (service) {
-				lockdownd_service_descriptor_free(service);
-			}
-
-			if (client) {
-				lockdownd_client_free(client);
-			}
-
-			if (ipc) {
-				instproxy_client_free(ipc);
-			}
-
-			if (device) {
-				idevice_free(device);
-			}
+			// Hands the service client back to the device's session, which hangs up wired clients when freeing them.
+			imageMounter = nullptr;
 		};
 
 		try
 		{
-			/* Find Device */
-			if (idevice_new_with_options(&device, altDevice->identifier().c_str(), (enum idevice_options)((int)IDEVICE_LOOKUP_NETWORK | (int)IDEVICE_LOOKUP_USBMUX)) != IDEVICE_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::DeviceNotFound);
-			}
-
 			/* Connect to Device */
-			if (lockdownd_client_new_with_handshake(device, &client, "miniappBuilder") != LOCKDOWN_E_SUCCESS)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
+			auto session = this->SessionForDevice(altDevice->identifier());
 
 			/* Connect to Mobile Image Mounter Proxy */
-			if ((lockdownd_start_service(client, "com.apple.mobile.mobile_image_mounter", &service) != LOCKDOWN_E_SUCCESS) || service == NULL)
-			{
-				throw ServerError(ServerErrorCode::ConnectionFailed);
-			}
-
-			mobile_image_mounter_error_t err = mobile_image_mounter_new(device, service, &mim);
-			if (err != MOBILE_IMAGE_MOUNTER_E_SUCCESS)
-			{
-				auto error = ConnectionError::errorForMobileImageMounterError(err, altDevice);
-				if (error.has_value())
-				{
-					throw* error;
-				}
-			}
+			imageMounter = session->StartMobileImageMounter(altDevice);
+			mobile_image_mounter_client_t mim = imageMounter->client();
 
 			size_t diskSize = std::filesystem::file_size(diskPath.c_str());
 			auto signature = readFile(signaturePath.c_str());
 
 			FILE* file = fopen(diskPath.c_str(), "rb");
-			err = mobile_image_mounter_upload_image(mim, "Developer", diskSize, (const char*)signature.data(), (size_t)signature.size(), DeviceManagerUploadFile, file);
+			mobile_image_mounter_error_t err = mobile_image_mounter_upload_image(mim, "Developer", diskSize, (const char*)signature.data(), (size_t)signature.size(), DeviceManagerUploadFile, file);
 			fclose(file);
 
 			if (err != MOBILE_IMAGE_MOUNTER_E_SUCCESS)
@@ -1520,6 +1263,11 @@ pplx::task<void> DeviceManager::InstallDeveloperDiskImage(std::string diskPath,
 		}
 		catch (std::exception& exception)
 		{
+			if (imageMounter != nullptr)
+			{
+				imageMounter->Invalidate();
+			}
+
 			cleanUp();
 			throw;
 		}
@@ -1542,69 +1290,23 @@ pplx::task<void> DeviceManager::InstallDeveloperDiskImage(std::string diskPath,
 pplx::task<std::vector<InstalledApp>> DeviceManager::FetchInstalledApps(std::shared_ptr<Device> altDevice)
 {
 	return pplx::create_task([=] {
-		idevice_t device = NULL;
-		instproxy_client_t ipc = NULL;
-		lockdownd_client_t client = NULL;
-		lockdownd_service_descriptor_t service = NULL;
-		plist_t options = NULL;
-
-		auto cleanUp = [&]() {
-			if (options) {
-				instproxy_client_options_free(options);
-			}
-
-			if (service) {
-				lockdownd_service_descriptor_free(service);
-			}
-
-			if (client) {
-				lockdownd_client_free(client);
-			}
-
-			if (ipc) {
-				instproxy_client_free(ipc);
-			}
-
-			if (device) {
-				idevice_free(device);
-			}
-		};
-
-		/* Find Device */
-		if (idevice_new_with_options(&device, altDevice->identifier().c_str(), (enum idevice_options)((int)IDEVICE_LOOKUP_NETWORK | (int)IDEVICE_LOOKUP_USBMUX)) != IDEVICE_E_SUCCESS)
-		{
-			throw ServerError(ServerErrorCode::DeviceNotFound);
-		}
-
 		/* Connect to Device */
-		if (lockdownd_client_new_with_handshake(device, &client, "MiniappBuilder") != LOCKDOWN_E_SUCCESS)
-		{
-			throw ServerError(ServerErrorCode::ConnectionFailed);
-		}
+		auto session = this->SessionForDevice(altDevice->identifier());
 
 		/* Connect to Installation Proxy */
-		if ((lockdownd_start_service(client, "com.apple.mobile.installation_proxy", &service) != LOCKDOWN_E_SUCCESS) || service == NULL)
-		{
-			throw ServerError(ServerErrorCode::ConnectionFailed);
-		}
-
-		instproxy_error_t err = instproxy_client_new(device, service, &ipc);
-		if (err != INSTPROXY_E_SUCCESS)
-		{
-			auto error = ConnectionError::errorForInstallationProxyError(err, altDevice);
-			if (error.has_value())
-			{
-				throw* error;
-			}
-		}
+		auto ipc = session->StartInstallationProxy(altDevice);
 
-		options = instproxy_client_options_new();
+		plist_t options = instproxy_client_options_new();
 		instproxy_client_options_add(options, "ApplicationType", "User", NULL);
 
 		plist_t plist = NULL;
-		err = instproxy_browse(ipc, options, &plist);
+		instproxy_error_t err = instproxy_browse(ipc->client(), options, &plist);
+		instproxy_client_options_free(options);
+
 		if (err != INSTPROXY_E_SUCCESS)
 		{
+			ipc->Invalidate();
+
 			auto error = ConnectionError::errorForInstallationProxyError(err, altDevice);
 			if (error.has_value())
 			{
@@ -1641,46 +1343,69 @@ pplx::task<std::vector<InstalledApp>> DeviceManager::FetchInstalledApps(std::sha
 pplx::task<std::shared_ptr<NotificationConnection>> DeviceManager::StartNotificationConnection(std::shared_ptr<Device> altDevice)
 {
 	return pplx::create_task([=]() -> std::shared_ptr<NotificationConnection> {
-		idevice_t device = NULL;
-		lockdownd_client_t lockdownClient = NULL;
-		lockdownd_service_descriptor_t service = NULL;
 		np_client_t client = NULL;
 
-		/* Find Device */
-		if (idevice_new_with_options(&device, altDevice->identifier().c_str(), IDEVICE_LOOKUP_USBMUX) != IDEVICE_E_SUCCESS)
-		{
-			throw ServerError(ServerErrorCode::DeviceNotFound);
-		}
-
 		/* Connect to Device */
-		if (lockdownd_client_new_with_handshake(device, &lockdownClient, "miniappBuilder") != LOCKDOWN_E_SUCCESS)
-		{
-			idevice_free(device);
-			throw ServerError(ServerErrorCode::ConnectionFailed);
-		}
+		auto session = this->SessionForDevice(altDevice->identifier());
 
-		/* Connect to Notification Proxy */
-		if ((lockdownd_start_service(lockdownClient, "com.apple.mobile.notification_proxy", &service) != LOCKDOWN_E_SUCCESS) || service == NULL)
+		if (!session->isWired())
 		{
+			// Notification connections are only made over USB, so connect over USB on its own instead of through the WiFi session.
+			idevice_t device = NULL;
+			lockdownd_client_t lockdownClient = NULL;
+			lockdownd_service_descriptor_t service = NULL;
+
+			/* Find Device */
+			if (idevice_new_with_options(&device, altDevice->identifier().c_str(), IDEVICE_LOOKUP_USBMUX) != IDEVICE_E_SUCCESS)
+			{
+				throw ServerError(ServerErrorCode::DeviceNotFound);
+			}
+
+			/* Connect to Device */
+			if (lockdownd_client_new_with_handshake(device, &lockdownClient, "miniappBuilder") != LOCKDOWN_E_SUCCESS)
+			{
+				idevice_free(device);
+				throw ServerError(ServerErrorCode::ConnectionFailed);
+			}
+
+			/* Connect to Notification Proxy */
+			if ((lockdownd_start_service(lockdownClient, "com.apple.mobile.notification_proxy", &service) != LOCKDOWN_E_SUCCESS) || service == NULL)
+			{
+				lockdownd_client_free(lockdownClient);
+				idevice_free(device);
+
+				throw ServerError(ServerErrorCode::ConnectionFailed);
+			}
+
+			/* Connect to Client */
+			if (np_client_new(device, service, &client) != NP_E_SUCCESS)
+			{
+				lockdownd_service_descriptor_free(service);
+				lockdownd_client_free(lockdownClient);
+				idevice_free(device);
+
+				throw ServerError(ServerErrorCode::ConnectionFailed);
+			}
+
+			lockdownd_service_descriptor_free(service);
 			lockdownd_client_free(lockdownClient);
 			idevice_free(device);
 
-			throw ServerError(ServerErrorCode::ConnectionFailed);
+			return std::make_shared<NotificationConnection>(altDevice, client);
 		}
 
+		/* Connect to Notification Proxy */
+		// Not pooled, since the returned connection owns its client for as long as it's observing.
+		lockdownd_service_descriptor_t service = session->StartService("com.apple.mobile.notification_proxy");
+
 		/* Connect to Client */
-		if (np_client_new(device, service, &client) != NP_E_SUCCESS)
+		if (np_client_new(session->device(), service, &client) != NP_E_SUCCESS)
 		{
 			lockdownd_service_descriptor_free(service);
-			lockdownd_client_free(lockdownClient);
-			idevice_free(device);
-
 			throw ServerError(ServerErrorCode::ConnectionFailed);
 		}
 
 		lockdownd_service_descriptor_free(service);
-		lockdownd_client_free(lockdownClient);
-		idevice_free(device);
 
 		auto notificationConnection = std::make_shared<NotificationConnection>(altDevice, client);
 		return notificationConnection;
@@ -1712,153 +1437,236 @@ std::vector<std::shared_ptr<Device>> DeviceManager::availableDevices(bool includ
         return availableDevices;
     }
 
+    // Devices connected over both USB and WiFi are listed twice.
+    std::vector<std::string> identifiers;
+    std::set<std::string> listedIdentifiers;
+
     for (int i = 0; i < count; i++)
     {
         idevice_info_t device_info = devices[i];
-        char* udid = device_info->udid;
-
-        idevice_t device = NULL;
-        lockdownd_client_t client = NULL;
 
-        char* device_name = NULL;
-        char* device_type_string = NULL;
-        char* device_version_string = NULL;
-
-        plist_t device_type_plist = NULL;
-        plist_t device_version_plist = NULL;
-
-        auto cleanUp = [&]() {
-            if (device_version_plist) {
-                plist_free(device_version_plist);
-            }
+        if (!includeNetworkDevices && device_info->conn_type != CONNECTION_USBMUXD)
+        {
+            continue;
+        }
 
-            if (device_type_plist) {
-                plist_free(device_type_plist);
-            }
+        if (listedIdentifiers.insert(device_info->udid).second)
+        {
+            identifiers.push_back(device_info->udid);
+        }
+    }
 
-            if (device_version_string) {
-                free(device_version_string);
-            }
+    idevice_device_list_extended_free(devices);
 
-            if (device_type_string) {
-                free(device_type_string);
-            }
+    std::map<std::string, std::shared_ptr<Device>> listedDevices;
+    std::map<std::string, uint64_t> generations;
+    std::vector<pplx::task<std::shared_ptr<Device>>> tasks;
 
-            if (device_name) {
-                free(device_name);
-            }
+    {
+        std::lock_guard<std::mutex> lock(_cachedDevicesMutex);
 
-            if (client) {
-                lockdownd_client_free(client);
+        for (auto& identifier : identifiers)
+        {
+            auto iterator = _cachedDevices.find(identifier);
+            if (iterator != _cachedDevices.end())
+            {
+                listedDevices[identifier] = iterator->second;
             }
-
-            if (device) {
-                idevice_free(device);
+            else
+            {
+                generations[identifier] = _cachedDeviceGenerations[identifier];
             }
-        };
-
-        if (includeNetworkDevices)
-        {
-            idevice_new_with_options(&device, udid, (enum idevice_options)((int)IDEVICE_LOOKUP_NETWORK | (int)IDEVICE_LOOKUP_USBMUX));
-        }
-        else
-        {
-            idevice_new_with_options(&device, udid, IDEVICE_LOOKUP_USBMUX);
         }
+    }
 
-        if (!device)
+    // Each lookup blocks on a lockdown round trip, so query uncached devices concurrently.
+    for (auto& identifier : identifiers)
+    {
+        if (listedDevices.count(identifier) > 0)
         {
             continue;
         }
 
-        int result = lockdownd_client_new(device, &client, "miniappBuilder");
-        if (result != LOCKDOWN_E_SUCCESS)
-        {
-            fprintf(stderr, "ERROR: Connecting to device %s failed! (%d)\n", udid, result);
-
-            cleanUp();
-            continue;
-        }
+        tasks.push_back(pplx::create_task([this, identifier, includeNetworkDevices]() {
+            return this->FetchDevice(identifier, includeNetworkDevices);
+        }));
+    }
 
-        if (lockdownd_get_device_name(client, &device_name) != LOCKDOWN_E_SUCCESS || device_name == NULL)
+    for (auto& task : tasks)
+    {
+        auto device = task.get();
+        if (device == nullptr)
         {
-            fprintf(stderr, "ERROR: Could not get device name!\n");
-
-            cleanUp();
             continue;
         }
 
-        if (lockdownd_get_value(client, NULL, "ProductType", &device_type_plist) != LOCKDOWN_E_SUCCESS)
-        {
-            stdoutlog("ERROR: Could not get device type for " << device_name);
+        std::lock_guard<std::mutex> lock(_cachedDevicesMutex);
 
-            cleanUp();
+        // The device was added or removed while it was being looked up, so what we read may be stale or gone.
+        // Drop it rather than caching it, or it would outlive the event that invalidated it.
+        auto generation = generations.find(device->identifier());
+        if (generation == generations.end() || generation->second != _cachedDeviceGenerations[device->identifier()])
+        {
             continue;
         }
 
-        plist_get_string_val(device_type_plist, &device_type_string);
+        listedDevices[device->identifier()] = device;
+        _cachedDevices[device->identifier()] = device;
+    }
 
-        Device::Type deviceType = Device::Type::iPhone;
-        if (std::string(device_type_string).find("iPhone") != std::string::npos ||
-            std::string(device_type_string).find("iPod") != std::string::npos)
+    for (auto& identifier : identifiers)
+    {
+        auto iterator = listedDevices.find(identifier);
+        if (iterator != listedDevices.end())
         {
-            deviceType = Device::Type::iPhone;
+            availableDevices.push_back(iterator->second);
         }
-        else if (std::string(device_type_string).find("iPad") != std::string::npos)
-        {
-            deviceType = Device::Type::iPad;
+    }
+
+    return availableDevices;
+}
+
+std::shared_ptr<Device> DeviceManager::FetchDevice(std::string udid, bool includeNetworkDevices) const
+{
+    idevice_t device = NULL;
+    lockdownd_client_t client = NULL;
+
+    plist_t values = NULL;
+
+    auto cleanUp = [&]() {
+        if (values) {
+            plist_free(values);
         }
-        else if (std::string(device_type_string).find("AppleTV") != std::string::npos)
-        {
-            deviceType = Device::Type::AppleTV;
+
+        if (client) {
+            lockdownd_client_free(client);
         }
-        else
-        {
-            stdoutlog("Unknown device type " << device_type_string << " for " << device_name);
 
-            cleanUp();
-            continue;
+        if (device) {
+            idevice_free(device);
         }
+    };
 
-        if (lockdownd_get_value(client, NULL, "ProductVersion", &device_version_plist) != LOCKDOWN_E_SUCCESS)
-        {
-            stdoutlog("ERROR: Could not get device type for " << device_name);
+    if (includeNetworkDevices)
+    {
+        idevice_new_with_options(&device, udid.c_str(), (enum idevice_options)((int)IDEVICE_LOOKUP_NETWORK | (int)IDEVICE_LOOKUP_USBMUX));
+    }
+    else
+    {
+        idevice_new_with_options(&device, udid.c_str(), IDEVICE_LOOKUP_USBMUX);
+    }
 
-            cleanUp();
-            continue;
+    if (!device)
+    {
+        return nullptr;
+    }
+
+    int result = lockdownd_client_new(device, &client, "miniappBuilder");
+    if (result != LOCKDOWN_E_SUCCESS)
+    {
+        fprintf(stderr, "ERROR: Connecting to device %s failed! (%d)\n", udid.c_str(), result);
+
+        cleanUp();
+        return nullptr;
+    }
+
+    // A NULL key returns every value lockdownd shares without a session, so one round trip covers them all.
+    if (lockdownd_get_value(client, NULL, NULL, &values) != LOCKDOWN_E_SUCCESS || plist_get_node_type(values) != PLIST_DICT)
+    {
+        if (values) {
+            plist_free(values);
         }
 
-        plist_get_string_val(device_version_plist, &device_version_string);
-        OperatingSystemVersion osVersion(device_version_string);
+        values = plist_new_dict();
+    }
 
-        bool isDuplicate = false;
+    auto copyValue = [&](const char* key) -> std::optional<std::string> {
+        plist_t node = plist_dict_get_item(values, key);
 
-        for (auto& device : availableDevices)
+        if (node == NULL || plist_get_node_type(node) != PLIST_STRING)
         {
-            if (device->identifier() == udid)
+            // Fall back to asking for the value by itself.
+            plist_t value = NULL;
+            if (lockdownd_get_value(client, NULL, key, &value) != LOCKDOWN_E_SUCCESS || value == NULL)
             {
-                // Duplicate.
-                isDuplicate = true;
-                break;
+                return std::nullopt;
             }
-        }
 
-        if (isDuplicate)
-        {
-            cleanUp();
-            continue;
+            plist_dict_set_item(values, key, value);
+            node = value;
+
+            if (plist_get_node_type(node) != PLIST_STRING)
+            {
+                return std::nullopt;
+            }
         }
 
-        auto altDevice = std::make_shared<Device>(device_name, udid, deviceType);
-        altDevice->setOSVersion(osVersion);
-        availableDevices.push_back(altDevice);
+        char* string = NULL;
+        plist_get_string_val(node, &string);
+
+        std::string value(string);
+        free(string);
+
+        return value;
+    };
+
+    auto deviceName = copyValue("DeviceName");
+    if (!deviceName.has_value())
+    {
+        fprintf(stderr, "ERROR: Could not get device name!\n");
 
         cleanUp();
+        return nullptr;
     }
 
-    idevice_device_list_extended_free(devices);
+    auto deviceTypeString = copyValue("ProductType");
+    if (!deviceTypeString.has_value())
+    {
+        stdoutlog("ERROR: Could not get device type for " << *deviceName);
 
-    return availableDevices;
+        cleanUp();
+        return nullptr;
+    }
+
+    Device::Type deviceType = Device::Type::iPhone;
+    if (deviceTypeString->find("iPhone") != std::string::npos ||
+        deviceTypeString->find("iPod") != std::string::npos)
+    {
+        deviceType = Device::Type::iPhone;
+    }
+    else if (deviceTypeString->find("iPad") != std::string::npos)
+    {
+        deviceType = Device::Type::iPad;
+    }
+    else if (deviceTypeString->find("AppleTV") != std::string::npos)
+    {
+        deviceType = Device::Type::AppleTV;
+    }
+    else
+    {
+        stdoutlog("Unknown device type " << *deviceTypeString << " for " << *deviceName);
+
+        cleanUp();
+        return nullptr;
+    }
+
+    auto deviceVersionString = copyValue("ProductVersion");
+    if (!deviceVersionString.has_value())
+    {
+        stdoutlog("ERROR: Could not get device type for " << *deviceName);
+
+        cleanUp();
+        return nullptr;
+    }
+
+    OperatingSystemVersion osVersion(*deviceVersionString);
+
+    auto altDevice = std::make_shared<Device>(*deviceName, udid, deviceType);
+    altDevice->setOSVersion(osVersion);
+
+    cleanUp();
+
+    return altDevice;
 }
 
 std::function<void(std::shared_ptr<Device>)> DeviceManager::connectedDeviceCallback() const
@@ -1881,9 +1689,66 @@ void DeviceManager::setDisconnectedDeviceCallback(std::function<void(std::shared
 	_disconnectedDeviceCallback = callback;
 }
 
-std::map<std::string, std::shared_ptr<Device>>& DeviceManager::cachedDevices()
+void DeviceManager::InvalidateCachedDevice(std::string udid)
+{
+	std::lock_guard<std::mutex> lock(_cachedDevicesMutex);
+	_cachedDevices.erase(udid);
+	_cachedDeviceGenerations[udid]++;
+}
+
+std::shared_ptr<DeviceSession> DeviceManager::SessionForDevice(std::string udid)
+{
+	std::shared_ptr<DeviceSession> session;
+
+	{
+		std::lock_guard<std::mutex> lock(_sessionsMutex);
+
+		auto iterator = _sessions.find(udid);
+		if (iterator != _sessions.end())
+		{
+			session = iterator->second;
+		}
+	}
+
+	// Only ping lockdownd when the session sat idle, so back-to-back calls don't pay an extra round trip.
+	if (session != nullptr && session->IsHealthy(std::chrono::seconds(10)))
+	{
+		return session;
+	}
+
+	if (session != nullptr)
+	{
+		session->Invalidate();
+	}
+
+	// Throws if the device can't be found or paired with, in which case no session is kept.
+	auto newSession = std::make_shared<DeviceSession>(udid);
+
+	std::lock_guard<std::mutex> lock(_sessionsMutex);
+	_sessions[udid] = newSession;
+
+	return newSession;
+}
+
+void DeviceManager::InvalidateSession(std::string udid)
 {
-	return _cachedDevices;
+	std::shared_ptr<DeviceSession> session;
+
+	{
+		std::lock_guard<std::mutex> lock(_sessionsMutex);
+
+		auto iterator = _sessions.find(udid);
+		if (iterator == _sessions.end())
+		{
+			return;
+		}
+
+		session = iterator->second;
+		_sessions.erase(iterator);
+	}
+
+	// Calls still holding the session finish with it; it's freed once they release it.
+	session->Invalidate();
 }
 
 #pragma mark - Callbacks -
@@ -1952,6 +1817,12 @@ void DeviceManagerUpdateAppDeletionStatus(plist_t command, plist_t status, void*
 
 void DeviceDidChangeConnectionStatus(const idevice_event_t* event, void* user_data)
 {
+	// Device was plugged in, unplugged or changed connection, so its pooled session may point at a stale connection.
+	DeviceManager::instance()->InvalidateSession(event->udid);
+
+	// It may also have been renamed or updated in the meantime.
+	DeviceManager::instance()->InvalidateCachedDevice(event->udid);
+
 	switch (event->event)
 	{
 	case IDEVICE_DEVICE_ADD:
@@ -1973,15 +1844,19 @@ void DeviceDidChangeConnectionStatus(const idevice_event_t* event, void* user_da
 			return;
 		}
 
-		if (DeviceManager::instance()->cachedDevices().count(device->identifier()) > 0)
 		{
-			return;
+			std::lock_guard<std::mutex> lock(DeviceManager::instance()->_announcedDevicesMutex);
+
+			if (DeviceManager::instance()->_announcedDevices.count(device->identifier()) > 0)
+			{
+				return;
+			}
+
+			DeviceManager::instance()->_announcedDevices[device->identifier()] = device;
 		}
 
 		stdoutlog("Detected device:" << device->name().c_str());
 
-		DeviceManager::instance()->cachedDevices()[device->identifier()] = device;
-
 		if (DeviceManager::instance()->connectedDeviceCallback() != NULL)
 		{
 			DeviceManager::instance()->connectedDeviceCallback()(device);
@@ -1991,15 +1866,20 @@ void DeviceDidChangeConnectionStatus(const idevice_event_t* event, void* user_da
 	}
 	case IDEVICE_DEVICE_REMOVE:
 	{
-		auto devices = DeviceManager::instance()->cachedDevices();
-		std::shared_ptr<Device> device = DeviceManager::instance()->cachedDevices()[event->udid];
+		std::shared_ptr<Device> device = NULL;
 
-		if (device == NULL)
 		{
-			return;
-		}
+			std::lock_guard<std::mutex> lock(DeviceManager::instance()->_announcedDevicesMutex);
 
-		DeviceManager::instance()->cachedDevices().erase(device->identifier());
+			auto iterator = DeviceManager::instance()->_announcedDevices.find(event->udid);
+			if (iterator == DeviceManager::instance()->_announcedDevices.end())
+			{
+				return;
+			}
+
+			device = iterator->second;
+			DeviceManager::instance()->_announcedDevices.erase(iterator);
+		}
 
 		if (DeviceManager::instance()->disconnectedDeviceCallback() != NULL)
 		{
@@ -23,6 +23,7 @@
 #include "DebugConnection.h"
 
 #include "InstalledApp.h"
+#include "DeviceSession.h"
 
 class DeviceManager
 {
@@ -77,14 +78,28 @@ private:
 	std::function<void(std::shared_ptr<Device>)> _connectedDeviceCallback;
 	std::function<void(std::shared_ptr<Device>)> _disconnectedDeviceCallback;
 
-	std::map<std::string, std::shared_ptr<Device>> _cachedDevices;
-	std::map<std::string, std::shared_ptr<Device>>& cachedDevices();
+	// Lockdown values of listed devices, so repeated listings skip the round trips. Cleared by connection events.
+	mutable std::mutex _cachedDevicesMutex;
+	mutable std::map<std::string, std::shared_ptr<Device>> _cachedDevices;
+
+	// Bumped by InvalidateCachedDevice, so lookups that started before a connection event aren't cached after it.
+	mutable std::map<std::string, uint64_t> _cachedDeviceGenerations;
+
+	// Devices reported to connectedDeviceCallback, so each is only announced once.
+	std::mutex _announcedDevicesMutex;
+	std::map<std::string, std::shared_ptr<Device>> _announcedDevices;
+
+	std::mutex _sessionsMutex;
+	std::map<std::string, std::shared_ptr<DeviceSession>> _sessions;
+
+	// Returns the device's pooled lockdown session, reconnecting if it went stale.
+	std::shared_ptr<DeviceSession> SessionForDevice(std::string udid);
+	void InvalidateSession(std::string udid);
     
     std::vector<std::shared_ptr<Device>> availableDevices(bool includeNetworkDevices) const;
+    std::shared_ptr<Device> FetchDevice(std::string udid, bool includeNetworkDevices) const;
+    void InvalidateCachedDevice(std::string udid);
     
-    void WriteDirectory(afc_client_t client, std::string directoryPath, std::string destinationPath, std::function<void(std::string)> wroteFileCallback);
-    void WriteFile(afc_client_t client, std::string filepath, std::string destinationPath, std::function<void(std::string)> wroteFileCallback);
-
 	void InstallProvisioningProfile(std::shared_ptr<ProvisioningProfile> provisioningProfile, misagent_client_t mis);
 	void RemoveProvisioningProfile(std::shared_ptr<ProvisioningProfile> provisioningProfile, misagent_client_t mis);
 	std::vector<std::shared_ptr<ProvisioningProfile>> CopyProvisioningProfiles(misagent_client_t mis);
@@ -0,0 +1,342 @@
+#include "DeviceSession.h"
+
+#include <libimobiledevice/src/idevice.h>
+
+#include "ServerError.hpp"
+#include "ConnectionError.hpp"
+
+DeviceSession::DeviceSession(std::string udid) : _udid(udid), _device(NULL), _client(NULL), _isValid(true), _lastUsedDate(std::chrono::steady_clock::now())
+{
+	/* Find Device */
+	if (idevice_new_with_options(&_device, udid.c_str(), (enum idevice_options)((int)IDEVICE_LOOKUP_NETWORK | (int)IDEVICE_LOOKUP_USBMUX)) != IDEVICE_E_SUCCESS)
+	{
+		throw ServerError(ServerErrorCode::DeviceNotFound);
+	}
+
+	try
+	{
+		this->Connect();
+	}
+	catch (std::exception& exception)
+	{
+		idevice_free(_device);
+		throw;
+	}
+}
+
+DeviceSession::~DeviceSession()
+{
+	for (auto& pair : _idleClients)
+	{
+		this->FreeIdleClients(pair.first, pair.second);
+	}
+
+	if (_client)
+	{
+		lockdownd_client_free(_client);
+	}
+
+	idevice_free(_device);
+}
+
+std::string DeviceSession::udid() const
+{
+	return _udid;
+}
+
+idevice_t DeviceSession::device() const
+{
+	return _device;
+}
+
+bool DeviceSession::isWired() const
+{
+	return _device->conn_type == CONNECTION_USBMUXD;
+}
+
+bool DeviceSession::isValid() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _isValid;
+}
+
+void DeviceSession::Connect()
+{
+	if (_client)
+	{
+		lockdownd_client_free(_client);
+		_client = NULL;
+	}
+
+	/* Connect to Device */
+	if (lockdownd_client_new_with_handshake(_device, &_client, "miniappBuilder") != LOCKDOWN_E_SUCCESS)
+	{
+		_client = NULL;
+		throw ServerError(ServerErrorCode::ConnectionFailed);
+	}
+}
+
+void DeviceSession::Reconnect()
+{
+	// Whatever dropped the lockdown session may have dropped parked service connections too.
+	for (auto& pair : _idleClients)
+	{
+		this->FreeIdleClients(pair.first, pair.second);
+	}
+
+	this->Connect();
+}
+
+bool DeviceSession::IsHealthy(std::chrono::seconds idleInterval)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (!_isValid)
+	{
+		return false;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if (_client != NULL && now - _lastUsedDate < idleInterval)
+	{
+		return true;
+	}
+
+	// QueryType is answered without a session, so ask for a value to tell whether the session is still alive.
+	plist_t node = NULL;
+	if (_client != NULL && lockdownd_get_value(_client, NULL, "ProductVersion", &node) == LOCKDOWN_E_SUCCESS)
+	{
+		plist_free(node);
+		_lastUsedDate = now;
+
+		return true;
+	}
+
+	try
+	{
+		// lockdownd closes sessions that sit idle, so reconnect before giving up on the device.
+		this->Reconnect();
+	}
+	catch (std::exception& exception)
+	{
+		return false;
+	}
+
+	_lastUsedDate = now;
+	return true;
+}
+
+void DeviceSession::Invalidate()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	_isValid = false;
+
+	for (auto& pair : _idleClients)
+	{
+		this->FreeIdleClients(pair.first, pair.second);
+	}
+
+	_idleClients.clear();
+}
+
+lockdownd_service_descriptor_t DeviceSession::StartService(std::string serviceName)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return this->StartServiceLocked(serviceName);
+}
+
+lockdownd_service_descriptor_t DeviceSession::StartServiceLocked(const std::string& serviceName)
+{
+	lockdownd_service_descriptor_t service = NULL;
+
+	if (_client == NULL || lockdownd_start_service(_client, serviceName.c_str(), &service) != LOCKDOWN_E_SUCCESS || service == NULL)
+	{
+		if (service)
+		{
+			lockdownd_service_descriptor_free(service);
+			service = NULL;
+		}
+
+		// The lockdown session may have timed out since it was last used, so retry once on a fresh one.
+		this->Reconnect();
+
+		if ((lockdownd_start_service(_client, serviceName.c_str(), &service) != LOCKDOWN_E_SUCCESS) || service == NULL)
+		{
+			if (service)
+			{
+				lockdownd_service_descriptor_free(service);
+			}
+
+			throw ServerError(ServerErrorCode::ConnectionFailed);
+		}
+	}
+
+	_lastUsedDate = std::chrono::steady_clock::now();
+	return service;
+}
+
+template<typename Client>
+std::shared_ptr<ServiceClient<Client>> DeviceSession::LeaseClient(const std::string& serviceName, std::function<Client(idevice_t, lockdownd_service_descriptor_t)> createClient, std::function<void(Client)> freeClient)
+{
+	lockdownd_service_descriptor_t service = NULL;
+
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		if (_freeFunctions.count(serviceName) == 0)
+		{
+			_freeFunctions[serviceName] = [freeClient](void* client) {
+				freeClient((Client)client);
+			};
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		auto& idleClients = _idleClients[serviceName];
+
+		while (!idleClients.empty())
+		{
+			// Most recently parked client is the least likely to have been dropped by the device.
+			IdleClient idleClient = idleClients.back();
+			idleClients.pop_back();
+
+			if (now - idleClient.idleDate > MaximumIdleClientAge)
+			{
+				freeClient((Client)idleClient.client);
+				continue;
+			}
+
+			_lastUsedDate = now;
+			return std::make_shared<ServiceClient<Client>>(this->shared_from_this(), serviceName, (Client)idleClient.client);
+		}
+
+		service = this->StartServiceLocked(serviceName);
+	}
+
+	Client client = NULL;
+
+	try
+	{
+		client = createClient(_device, service);
+	}
+	catch (std::exception& exception)
+	{
+		lockdownd_service_descriptor_free(service);
+		throw;
+	}
+
+	lockdownd_service_descriptor_free(service);
+
+	return std::make_shared<ServiceClient<Client>>(this->shared_from_this(), serviceName, client);
+}
+
+void DeviceSession::ReturnClient(const std::string& serviceName, void* client, bool isReusable)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	if (isReusable && _isValid)
+	{
+		_idleClients[serviceName].push_back({ client, std::chrono::steady_clock::now() });
+	}
+	else
+	{
+		_freeFunctions[serviceName](client);
+	}
+}
+
+void DeviceSession::FreeIdleClients(const std::string& serviceName, std::vector<IdleClient>& idleClients)
+{
+	for (auto& idleClient : idleClients)
+	{
+		_freeFunctions[serviceName](idleClient.client);
+	}
+
+	idleClients.clear();
+}
+
+std::shared_ptr<ServiceClient<instproxy_client_t>> DeviceSession::StartInstallationProxy(std::shared_ptr<Device> altDevice)
+{
+	return this->LeaseClient<instproxy_client_t>("com.apple.mobile.installation_proxy", [altDevice](idevice_t device, lockdownd_service_descriptor_t service) {
+		instproxy_client_t ipc = NULL;
+
+		instproxy_error_t err = instproxy_client_new(device, service, &ipc);
+		if (err != INSTPROXY_E_SUCCESS)
+		{
+			auto error = ConnectionError::errorForInstallationProxyError(err, altDevice);
+			if (altDevice != nullptr && error.has_value())
+			{
+				throw *error;
+			}
+
+			throw ServerError(ServerErrorCode::ConnectionFailed);
+		}
+
+		return ipc;
+	}, [](instproxy_client_t ipc) {
+		instproxy_client_free(ipc);
+	});
+}
+
+std::shared_ptr<ServiceClient<misagent_client_t>> DeviceSession::StartMisagent()
+{
+	return this->LeaseClient<misagent_client_t>("com.apple.misagent", [](idevice_t device, lockdownd_service_descriptor_t service) {
+		misagent_client_t mis = NULL;
+
+		if (misagent_client_new(device, service, &mis) != MISAGENT_E_SUCCESS)
+		{
+			throw ServerError(ServerErrorCode::ConnectionFailed);
+		}
+
+		return mis;
+	}, [](misagent_client_t mis) {
+		misagent_client_free(mis);
+	});
+}
+
+std::shared_ptr<ServiceClient<afc_client_t>> DeviceSession::StartAFC()
+{
+	return this->LeaseClient<afc_client_t>("com.apple.afc", [](idevice_t device, lockdownd_service_descriptor_t service) {
+		afc_client_t afc = NULL;
+
+		if (afc_client_new(device, service, &afc) != AFC_E_SUCCESS)
+		{
+			throw ServerError(ServerErrorCode::ConnectionFailed);
+		}
+
+		return afc;
+	}, [](afc_client_t afc) {
+		afc_client_free(afc);
+	});
+}
+
+std::shared_ptr<ServiceClient<mobile_image_mounter_client_t>> DeviceSession::StartMobileImageMounter(std::shared_ptr<Device> altDevice)
+{
+	bool isWired = this->isWired();
+
+	return this->LeaseClient<mobile_image_mounter_client_t>("com.apple.mobile.mobile_image_mounter", [altDevice](idevice_t device, lockdownd_service_descriptor_t service) {
+		mobile_image_mounter_client_t mim = NULL;
+
+		mobile_image_mounter_error_t err = mobile_image_mounter_new(device, service, &mim);
+		if (err != MOBILE_IMAGE_MOUNTER_E_SUCCESS)
+		{
+			auto error = ConnectionError::errorForMobileImageMounterError(err, altDevice);
+			if (error.has_value())
+			{
+				throw *error;
+			}
+
+			throw ServerError(ServerErrorCode::ConnectionFailed);
+		}
+
+		return mim;
+	}, [isWired](mobile_image_mounter_client_t mim) {
+		if (isWired)
+		{
+			// For some reason, calling this method over WiFi may freeze MiniappBuilder.
+			// Nothing bad *seems* to happen if we don't call it though, so just limit it to wired connections.
+			mobile_image_mounter_hangup(mim);
+		}
+
+		mobile_image_mounter_free(mim);
+	});
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <libimobiledevice/installation_proxy.h>
+#include <libimobiledevice/misagent.h>
+#include <libimobiledevice/afc.h>
+#include <libimobiledevice/mobile_image_mounter.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Device.hpp"
+
+template<typename Client> class ServiceClient;
+
+// A paired lockdown session with a device that outlives a single DeviceManager call.
+//
+// The device lookup, pairing and lockdown TLS handshake happen once per session instead of once per call,
+// and service clients are leased rather than created: releasing a lease parks its client in the session,
+// so the next call for the same service skips lockdownd_start_service as well.
+// If lockdownd dropped the session in the meantime, the lockdown client is reconnected on the same device
+// and parked clients are thrown away.
+class DeviceSession : public std::enable_shared_from_this<DeviceSession>
+{
+public:
+	// Parked clients idle for longer than this are freed rather than handed out again.
+	static constexpr std::chrono::seconds MaximumIdleClientAge = std::chrono::seconds(60);
+
+	DeviceSession(std::string udid);
+	~DeviceSession();
+
+	std::string udid() const;
+	idevice_t device() const;
+
+	bool isWired() const;
+	bool isValid() const;
+
+	// Pings lockdownd if the session hasn't been used for idleInterval, reconnecting the lockdown client once if needed.
+	bool IsHealthy(std::chrono::seconds idleInterval);
+
+	// Frees parked clients; leases still out are freed when released instead of being parked again.
+	void Invalidate();
+
+	// altDevice is used to describe connection errors, when provided.
+	std::shared_ptr<ServiceClient<instproxy_client_t>> StartInstallationProxy(std::shared_ptr<Device> altDevice = nullptr);
+	std::shared_ptr<ServiceClient<misagent_client_t>> StartMisagent();
+	std::shared_ptr<ServiceClient<afc_client_t>> StartAFC();
+	std::shared_ptr<ServiceClient<mobile_image_mounter_client_t>> StartMobileImageMounter(std::shared_ptr<Device> altDevice = nullptr);
+
+	// Starts a service whose client isn't pooled, such as long-lived notification proxies. Caller frees the descriptor.
+	lockdownd_service_descriptor_t StartService(std::string serviceName);
+
+private:
+	std::string _udid;
+
+	idevice_t _device;
+	lockdownd_client_t _client;
+
+	bool _isValid;
+	std::chrono::steady_clock::time_point _lastUsedDate;
+
+	struct IdleClient
+	{
+		void* client;
+		std::chrono::steady_clock::time_point idleDate;
+	};
+
+	std::map<std::string, std::vector<IdleClient>> _idleClients;
+	std::map<std::string, std::function<void(void*)>> _freeFunctions;
+
+	mutable std::mutex _mutex;
+
+	void Connect();
+
+	// Connects again after lockdownd dropped the session, freeing every parked client.
+	void Reconnect();
+	lockdownd_service_descriptor_t StartServiceLocked(const std::string& serviceName);
+
+	template<typename Client>
+	std::shared_ptr<ServiceClient<Client>> LeaseClient(const std::string& serviceName, std::function<Client(idevice_t, lockdownd_service_descriptor_t)> createClient, std::function<void(Client)> freeClient);
+
+	void ReturnClient(const std::string& serviceName, void* client, bool isReusable);
+	void FreeIdleClients(const std::string& serviceName, std::vector<IdleClient>& idleClients);
+
+	template<typename Client> friend class ServiceClient;
+};
+
+// A service client leased from a DeviceSession. Releasing the lease hands the client back to the session.
+template<typename Client>
+class ServiceClient
+{
+public:
+	ServiceClient(std::shared_ptr<DeviceSession> session, std::string serviceName, Client client) : _session(session), _serviceName(serviceName), _client(client), _isReusable(true)
+	{
+	}
+
+	~ServiceClient()
+	{
+		_session->ReturnClient(_serviceName, (void*)_client, _isReusable);
+	}
+
+	ServiceClient(const ServiceClient&) = delete;
+	ServiceClient& operator=(const ServiceClient&) = delete;
+
+	Client client() const
+	{
+		return _client;
+	}
+
+	// Frees the client on release instead of handing it back, e.g. after its connection failed.
+	void Invalidate()
+	{
+		_isReusable = false;
+	}
+
+private:
+	std::shared_ptr<DeviceSession> _session;
+	std::string _serviceName;
+
+	Client _client;
+	bool _isReusable;
+};
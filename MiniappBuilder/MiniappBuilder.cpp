@@ -280,11 +280,11 @@ std::map<std::string, std::string> queryStringToDictionary(const std::string& qu
 	return dict;
 }
 
-pplx::task<void> signCallback(SignResult signResult, std::shared_ptr<Device> selectedDevice, std::string outputDir,  bool install) {
+pplx::task<void> signCallback(SignResult signResult, std::shared_ptr<Device> selectedDevice, std::string outputDir, int compressionLevel, bool install) {
 	Application app = signResult.application;
 	fs::path appBundlePath = app.path();
 	if (!outputDir.empty()) {
-		std::string ipaPath = ZipAppBundle(appBundlePath.string());
+		std::string ipaPath = ZipAppBundle(appBundlePath.string(), signResult.sourceArchivePath, compressionLevel);
 		fs::path src_path(ipaPath);
 		fs::path dist_path(outputDir);
 		fs::path filename = src_path.filename(); // 获取文件名
@@ -334,6 +334,7 @@ int main(int argc, char* argv[])
 		("certificatePassword", po::value<std::string>()->default_value(""), "certificate password")
 		("profilePath", po::value<std::string>()->default_value(""), "profile path")
 		("output", po::value<std::string>()->default_value(""), "output dir")
+		("compression", po::value<int>()->default_value(-1), "output ipa compression level, 0 (store only)-9, -1 for zlib default")
 		("install", po::value<bool>()->default_value(false), "whether if install instantly to device")
 		("extension", po::value<bool>()->default_value(false), "enable extension profile path");
 
@@ -364,10 +365,16 @@ int main(int argc, char* argv[])
 	std::string entitlementsStr = vm["entitlements"].as<std::string>();
 
 	std::string outputDir = vm["output"].as<std::string>();
+	int compressionLevel = vm["compression"].as<int>();
 	bool install = vm["install"].as<bool>();
 	bool enableExtensionProfilePath = vm["extension"].as<bool>();
 	std::string extensionProfilePath = "";
 
+	if (compressionLevel < -1 || compressionLevel > 9) {
+		stderrlog("Error: compression must be between -1 and 9");
+		return -1;
+	}
+
 	if (action == "getDevices") {
 		auto devices = DeviceManager::instance()->availableDevices();
 		if (devices.size() == 0) {
@@ -500,12 +507,12 @@ int main(int argc, char* argv[])
 	if (signType == "appleId") {
 		task = MiniappBuilderCore::instance()->SignWithAppleId(ipaFilepath, selectedDevice, appleID, password, bundleId, entitlements)
 			.then([=](SignResult signResult) {
-				return signCallback(signResult, selectedDevice, outputDir, install);
+				return signCallback(signResult, selectedDevice, outputDir, compressionLevel, install);
 			});
 	} else {
 		task = MiniappBuilderCore::instance()->SignWithCertificate(ipaFilepath, certificatePath, certificatePassword, profilePath, extensionProfilePath, entitlements)
 			.then([=](SignResult signResult) {
-				return signCallback(signResult, selectedDevice, outputDir, install);
+				return signCallback(signResult, selectedDevice, outputDir, compressionLevel, install);
 			});
 	}
 	try
@@ -679,6 +679,7 @@ pplx::task<SignResult> MiniappBuilderCore::SignWithAppleId(std::string ipapath,
 				SignResult result;
 				result.application = *app.get();
 				result.activeProfiles = activeProfiles;
+				result.sourceArchivePath = ipapath;
 				return result;
 			}
 			catch (LocalizedError& error)
@@ -753,6 +754,7 @@ pplx::task<SignResult> MiniappBuilderCore::SignWithCertificate(std::string ipapa
 				SignResult result;
 				result.application = *app.get();
 				result.activeProfiles = activeProfiles;
+				result.sourceArchivePath = ipapath;
 				return result;
 			}
 			catch (LocalizedError& error)
@@ -41,6 +41,7 @@ namespace fs = boost::filesystem;
 struct SignResult {
     Application application;
     std::optional<std::set<std::string>> activeProfiles;
+    std::string sourceArchivePath;
 
 };
 
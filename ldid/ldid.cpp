@@ -33,15 +33,22 @@
 
 #include <direct.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <exception>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <stdio.h>
@@ -1338,6 +1345,30 @@ public:
 		return std::string(static_cast<char*>(data_), size_);
 	}
 };
+
+// reads straight out of a mapped file, so callers that know about it can skip the copy
+class MapBuffer :
+	public std::streambuf
+{
+private:
+	Map map_;
+
+public:
+	MapBuffer(const std::string& path) :
+		map_(path, false)
+	{
+		auto data(static_cast<char*>(map_.data()));
+		setg(data, data, data + map_.size());
+	}
+
+	const char* data() const {
+		return static_cast<const char*>(map_.data());
+	}
+
+	size_t size() const {
+		return map_.size();
+	}
+};
 #endif
 
 namespace ldid {
@@ -1725,12 +1756,12 @@ private:
 public:
 	// CMS signed attribute logic heavily based on zsign:
 	// https://github.com/zhlynn/zsign/blob/44f15cae53e4a5a000fa7486dd72f472a4c75ee4/openssl.cpp#L211
-	Signature(const Stuff& stuff, const Buffer& data, const std::string& xml, const std::vector<char>& alternateCDSHA256)
+	Signature(const ldid::Identity& identity, const Buffer& data, const std::string& xml, const std::vector<char>& alternateCDSHA256)
 	{
 		int flags = CMS_PARTIAL | CMS_DETACHED | CMS_NOSMIMECAP | CMS_BINARY;
 
-		CMS_ContentInfo* stream = CMS_sign(NULL, NULL, stuff, NULL, flags);
-		CMS_SignerInfo* info = CMS_add1_signer(stream, stuff, stuff, EVP_sha256(), flags);
+		CMS_ContentInfo* stream = CMS_sign(NULL, NULL, identity.chain(), NULL, flags);
+		CMS_SignerInfo* info = CMS_add1_signer(stream, identity.cert(), identity.key(), EVP_sha256(), flags);
 
 		// Hash Agility
 		ASN1_OBJECT* obj = OBJ_txt2obj("1.2.840.113635.100.9.1", 1);
@@ -1848,6 +1879,173 @@ public:
 	}
 };
 
+static std::atomic<unsigned> Threads_(0);
+
+static unsigned Threads() {
+	unsigned threads(Threads_);
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	return threads == 0 ? 1 : threads;
+}
+
+// a grow-only pool shared by everything in here that wants to fan out; threads
+// that wait on a group run queued tasks themselves, so nested use cannot deadlock
+class Workers {
+public:
+	class Group {
+		friend class Workers;
+
+	private:
+		size_t pending_;
+		size_t total_;
+		std::exception_ptr error_;
+
+	public:
+		Group() :
+			pending_(0),
+			total_(0)
+		{
+		}
+	};
+
+private:
+	std::mutex mutex_;
+	std::condition_variable ready_;
+	std::condition_variable done_;
+	std::deque<std::pair<Group*, std::function<void()>>> tasks_;
+	std::vector<std::thread> threads_;
+
+	// lock is held on entry and on exit
+	void Run(std::unique_lock<std::mutex>& lock) {
+		auto task(std::move(tasks_.front()));
+		tasks_.pop_front();
+		lock.unlock();
+
+		std::exception_ptr error;
+		try {
+			task.second();
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+
+		lock.lock();
+		auto& group(*task.first);
+		if (error != NULL && group.error_ == NULL)
+			group.error_ = error;
+		--group.pending_;
+		done_.notify_all();
+	}
+
+	void Loop(size_t index) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		for (;;) {
+			// the calling thread counts as one of the workers
+			ready_.wait(lock, [&]() { return !tasks_.empty() && index + 1 < Threads(); });
+			Run(lock);
+		}
+	}
+
+public:
+	void Post(Group& group, std::function<void()> code) {
+		size_t limit(Threads());
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (threads_.size() + 1 < limit) {
+			threads_.emplace_back(&Workers::Loop, this, threads_.size());
+			threads_.back().detach();
+		}
+		++group.pending_;
+		++group.total_;
+		tasks_.emplace_back(&group, std::move(code));
+		ready_.notify_one();
+	}
+
+	void Wait(Group& group, const ldid::Functor<void(double)>& percent) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		for (;;) {
+			size_t pending(group.pending_), total(group.total_);
+			lock.unlock();
+			percent(total == 0 ? 1 : double(total - pending) / total);
+			lock.lock();
+
+			if (group.pending_ == 0)
+				break;
+			if (group.pending_ != pending)
+				continue;
+			if (!tasks_.empty())
+				Run(lock);
+			else
+				done_.wait(lock);
+		}
+
+		group.total_ = 0;
+		if (group.error_ != NULL) {
+			auto error(group.error_);
+			group.error_ = NULL;
+			std::rethrow_exception(error);
+		}
+	}
+};
+
+static Workers& GetWorkers() {
+	// never destroyed: the threads are detached and simply die with the process
+	static Workers* workers(new Workers());
+	return *workers;
+}
+
+// calls code over [0, count) in slices of at most chunk items, spread across the pool
+static void Parallel(size_t count, size_t chunk, const ldid::Functor<void(size_t, size_t)>& code, const ldid::Functor<void(double)>& percent) {
+	if (count <= chunk || Threads() == 1) {
+		percent(0);
+		code(0, count);
+		percent(1);
+		return;
+	}
+
+	auto& workers(GetWorkers());
+	Workers::Group group;
+	for (size_t begin(0); begin < count; begin += chunk) {
+		size_t end(std::min(count, begin + chunk));
+		workers.Post(group, [&code, begin, end]() { code(begin, end); });
+	}
+	workers.Wait(group, percent);
+}
+
+// pages handed to a single task; large enough to amortize the queue, small enough to balance
+static const size_t PageChunk_(256);
+
+// hashes every page of the code with every algorithm, walking each page only once
+static std::vector<std::vector<uint8_t>> HashPages(const std::string& overlap, const char* top, size_t limit, const ldid::Functor<void(double)>& percent) {
+	const auto& algorithms(GetAlgorithms());
+	uint32_t normal((limit + PageSize_ - 1) / PageSize_);
+
+	std::vector<std::vector<uint8_t>> hashes(algorithms.size());
+	for (size_t index(0); index != algorithms.size(); ++index)
+		hashes[index].resize(normal * algorithms[index]->size_);
+
+	Parallel(normal, PageChunk_, ldid::fun([&](size_t begin, size_t end) {
+		for (size_t i(begin); i != end; ++i) {
+			const char* data;
+			size_t size;
+			if (i != normal - 1) {
+				data = (PageSize_ * i < overlap.size() ? overlap.data() : top) + PageSize_ * i;
+				size = PageSize_;
+			}
+			else {
+				data = top + PageSize_ * i;
+				size = ((limit - 1) % PageSize_) + 1;
+			}
+
+			for (size_t index(0); index != algorithms.size(); ++index) {
+				const auto& algorithm(*algorithms[index]);
+				algorithm(hashes[index].data() + i * algorithm.size_, data, size);
+			}
+		}
+		}), percent);
+
+	return hashes;
+}
+
 #ifndef LDID_NOTOOLS
 static bool Starts(const std::string& lhs, const std::string& rhs) {
 	return lhs.size() >= rhs.size() && lhs.compare(0, rhs.size(), rhs) == 0;
@@ -1916,28 +2114,121 @@ static void Commit(const std::string& path, const std::string& temp) {
 
 namespace ldid {
 
-	Hash Sign(const void* idata, size_t isize, std::streambuf& output, const std::string& identifier, const std::string& entitlements, const std::string& requirement, const std::string& key, const Slots& slots, const Functor<void(double)>& percent) {
-		Hash hash;
+	void Threads(unsigned threads) {
+		Threads_ = threads;
+	}
 
-		std::string team;
+#ifndef LDID_NOSMIME
+	static std::string Team(X509* cert) {
+		auto name(X509_get_subject_name(cert));
+		_assert(name != NULL);
+		auto index(X509_NAME_get_index_by_NID(name, NID_organizationalUnitName, -1));
+		_assert(index >= 0);
+		auto next(X509_NAME_get_index_by_NID(name, NID_organizationalUnitName, index));
+		_assert(next == -1);
+		auto entry(X509_NAME_get_entry(name, index));
+		_assert(entry != NULL);
+		auto asn(X509_NAME_ENTRY_get_data(entry));
+		_assert(asn != NULL);
+		return std::string(reinterpret_cast<char*>(ASN1_STRING_data(asn)), ASN1_STRING_length(asn));
+	}
+#endif
+
+	Identity::Identity() :
+		key_(NULL),
+		cert_(NULL),
+		chain_(NULL)
+	{
+	}
 
 #ifndef LDID_NOSMIME
-		if (!key.empty()) {
-			Stuff stuff(key);
-			auto name(X509_get_subject_name(stuff));
-			_assert(name != NULL);
-			auto index(X509_NAME_get_index_by_NID(name, NID_organizationalUnitName, -1));
-			_assert(index >= 0);
-			auto next(X509_NAME_get_index_by_NID(name, NID_organizationalUnitName, index));
-			_assert(next == -1);
-			auto entry(X509_NAME_get_entry(name, index));
-			_assert(entry != NULL);
-			auto asn(X509_NAME_ENTRY_get_data(entry));
-			_assert(asn != NULL);
-			team.assign(reinterpret_cast<char*>(ASN1_STRING_data(asn)), ASN1_STRING_length(asn));
+	// own the parts of an Identity until its constructor has finished, so a throw doesn't leak them
+	struct IdentityParts {
+		std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key;
+		std::unique_ptr<X509, decltype(&X509_free)> cert;
+		std::unique_ptr<STACK_OF(X509), void (*)(STACK_OF(X509)*)> chain;
+
+		IdentityParts(EVP_PKEY* key, X509* cert, STACK_OF(X509)* chain) :
+			key(key, &EVP_PKEY_free),
+			cert(cert, &X509_free),
+			chain(chain, [](STACK_OF(X509)* chain) { sk_X509_pop_free(chain, X509_free); })
+		{
 		}
+	};
 #endif
 
+	Identity::Identity(const std::string& p12) :
+		Identity()
+	{
+		if (p12.empty())
+			return;
+#ifndef LDID_NOSMIME
+		Stuff stuff(p12);
+
+		EVP_PKEY* key(stuff);
+		_assert(EVP_PKEY_up_ref(key) != 0);
+		IdentityParts parts(key, NULL, NULL);
+
+		X509* cert(stuff);
+		_assert(X509_up_ref(cert) != 0);
+		parts.cert.reset(cert);
+
+		STACK_OF(X509)* chain(stuff);
+		if (chain != NULL) {
+			parts.chain.reset(X509_chain_up_ref(chain));
+			_assert(parts.chain != NULL);
+		}
+
+		team_ = Team(cert);
+
+		key_ = parts.key.release();
+		cert_ = parts.cert.release();
+		chain_ = parts.chain.release();
+#else
+		_assert(false);
+#endif
+	}
+
+	Identity::Identity(EVP_PKEY* key, X509* cert, STACK_OF(X509)* chain) :
+		Identity()
+	{
+#ifndef LDID_NOSMIME
+		IdentityParts parts(key, cert, chain);
+
+		_assert(key != NULL);
+		_assert(cert != NULL);
+		team_ = Team(cert);
+
+		key_ = parts.key.release();
+		cert_ = parts.cert.release();
+		chain_ = parts.chain.release();
+#else
+		key_ = key;
+		cert_ = cert;
+		chain_ = chain;
+		_assert(key_ != NULL);
+		_assert(cert_ != NULL);
+#endif
+	}
+
+	Identity::~Identity() {
+#ifndef LDID_NOSMIME
+		if (chain_ != NULL)
+			sk_X509_pop_free(chain_, X509_free);
+		X509_free(cert_);
+		EVP_PKEY_free(key_);
+#endif
+	}
+
+	Hash Sign(const void* idata, size_t isize, std::streambuf& output, const std::string& identifier, const std::string& entitlements, const std::string& requirement, const std::string& key, const Slots& slots, const Functor<void(double)>& percent) {
+		return Sign(idata, isize, output, identifier, entitlements, requirement, Identity(key), slots, percent);
+	}
+
+	Hash Sign(const void* idata, size_t isize, std::streambuf& output, const std::string& identifier, const std::string& entitlements, const std::string& requirement, const Identity& identity, const Slots& slots, const Functor<void(double)>& percent) {
+		Hash hash;
+
+		const std::string& team(identity.team());
+
 		// XXX: this is just a "sufficiently large number"
 		size_t certificate(0x3000);
 
@@ -1989,7 +2280,7 @@ namespace ldid {
 			for (Algorithm* algorithm : GetAlgorithms())
 				alloc = Align(alloc + directory + (special + normal) * algorithm->size_, 16);
 
-			if (!key.empty()) {
+			if (!identity.empty()) {
 				alloc += sizeof(struct BlobIndex);
 				alloc += sizeof(struct Blob);
 				alloc += certificate;
@@ -2122,6 +2413,8 @@ namespace ldid {
 					}
 					}));
 
+				auto pages(HashPages(overlap, top, limit, percent));
+
 				unsigned total(0);
 				for (Algorithm* pointer : GetAlgorithms()) {
 					Algorithm& algorithm(*pointer);
@@ -2188,15 +2481,7 @@ namespace ldid {
 					_foreach(slot, posts)
 						memcpy(hashes - slot.first * algorithm.size_, algorithm[slot.second], algorithm.size_);
 
-					percent(0);
-					if (normal != 1)
-						for (size_t i = 0; i != normal - 1; ++i) {
-							algorithm(hashes + i * algorithm.size_, (PageSize_ * i < overlap.size() ? overlap.data() : top) + PageSize_ * i, PageSize_);
-							percent(double(i) / normal);
-						}
-					if (normal != 0)
-						algorithm(hashes + (normal - 1) * algorithm.size_, top + PageSize_ * (normal - 1), ((limit - 1) % PageSize_) + 1);
-					percent(1);
+					memcpy(hashes, pages[total].data(), pages[total].size());
 
 					put(data, storage.data(), storage.size());
 
@@ -2207,7 +2492,7 @@ namespace ldid {
 				}
 
 #ifndef LDID_NOSMIME
-				if (!key.empty()) {
+				if (!identity.empty()) {
 					auto plist(plist_new_dict());
 					_scope({ plist_free(plist); });
 
@@ -2244,10 +2529,9 @@ namespace ldid {
 					std::stringbuf data;
 					const std::string& sign(blobs[CSSLOT_CODEDIRECTORY]);
 
-					Stuff stuff(key);
 					Buffer bio(sign);
 
-					Signature signature(stuff, sign, std::string(xml, size), alternateCDSHA256);
+					Signature signature(identity, sign, std::string(xml, size), alternateCDSHA256);
 					Buffer result(signature);
 					std::string value(result);
 					put(data, value.data(), value.size());
@@ -2276,8 +2560,9 @@ namespace ldid {
 		return path_ + "\\" + path;
 	}
 
-	DiskFolder::DiskFolder(const std::string& path) :
-		path_(path)
+	DiskFolder::DiskFolder(const std::string& path, bool map) :
+		path_(path),
+		map_(map)
 	{
 	}
 
@@ -2354,14 +2639,17 @@ namespace ldid {
 
 	void DiskFolder::Save(const std::string& path, bool edit, const void* flag, const Functor<void(std::streambuf&)>& code) {
 		if (!edit) {
-			// XXX: use nullbuf
-			std::stringbuf save;
+			NullBuffer save;
 			code(save);
 		}
 		else {
 			std::filebuf save;
 			auto from(Path(path));
-			commit_[from] = Temporary(save, from);
+			auto temp(Temporary(save, from));
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				commit_[from] = temp;
+			}
 			code(save);
 		}
 	}
@@ -2371,6 +2659,17 @@ namespace ldid {
 	}
 
 	void DiskFolder::Open(const std::string& path, const Functor<void(std::streambuf&, size_t, const void*)>& code) const {
+		if (map_) {
+			struct _stat info;
+			_syscall(_stat(Path(path).c_str(), &info));
+			// empty files cannot be mapped
+			if (info.st_size != 0) {
+				MapBuffer data(Path(path));
+				code(data, data.size(), NULL);
+				return;
+			}
+		}
+
 		std::filebuf data;
 		auto result(data.open(Path(path).c_str(), std::ios::binary | std::ios::in));
 		_assert_(result == &data, "DiskFolder::Open(%s)", path.c_str());
@@ -2477,12 +2776,13 @@ namespace ldid {
 	static void copy(std::streambuf& source, std::streambuf& target, size_t length, const ldid::Functor<void(double)>& percent) {
 		percent(0);
 		size_t total(0);
+		// large reads keep the disk busy; one extra byte lets the loop see the end of short files
+		std::vector<char> data(std::min(length, size_t(1 << 20)) + 1);
 		for (;;) {
-			char data[4096 * 4];
-			size_t writ(source.sgetn(data, sizeof(data)));
+			size_t writ(source.sgetn(data.data(), data.size()));
 			if (writ == 0)
 				break;
-			_assert(target.sputn(data, writ) == writ);
+			_assert(target.sputn(data.data(), writ) == writ);
 			total += writ;
 			percent(double(total) / length);
 		}
@@ -2603,7 +2903,20 @@ namespace ldid {
 	};
 
 #ifndef LDID_NOPLIST
-	static Hash Sign(const uint8_t* prefix, size_t size, std::streambuf& buffer, Hash& hash, std::streambuf& save, const std::string& identifier, const std::string& entitlements, const std::string& requirement, const std::string& key, const Slots& slots, size_t length, const Functor<void(double)>& percent) {
+	// the whole file when buffer came from a mapping, if the zero padding below fits in its last page
+	static const char* Mapped(std::streambuf& buffer, size_t length) {
+		auto mapped(dynamic_cast<MapBuffer*>(&buffer));
+		if (mapped == NULL || mapped->size() != length || length % PageSize_ == 0)
+			return NULL;
+		return mapped->data();
+	}
+
+	static Hash Sign(const uint8_t* prefix, size_t size, std::streambuf& buffer, Hash& hash, std::streambuf& save, const std::string& identifier, const std::string& entitlements, const std::string& requirement, const Identity& identity, const Slots& slots, size_t length, const Functor<void(double)>& percent) {
+		if (auto data = Mapped(buffer, length)) {
+			HashProxy proxy(hash, save);
+			return Sign(data, length + 0x10 - (length & 0xf), proxy, identifier, entitlements, requirement, identity, slots, percent);
+		}
+
 		// XXX: this is a miserable fail
 		std::stringbuf temp;
 		put(temp, prefix, size);
@@ -2613,10 +2926,10 @@ namespace ldid {
 		auto data(temp.str());
 
 		HashProxy proxy(hash, save);
-		return Sign(data.data(), data.size(), proxy, identifier, entitlements, requirement, key, slots, percent);
+		return Sign(data.data(), data.size(), proxy, identifier, entitlements, requirement, identity, slots, percent);
 	}
 
-	Bundle Sign(const std::string& root, Folder& folder, const std::string& key, std::map<std::string, Hash>& remote, const std::string& requirement, const Functor<std::string(const std::string&, const std::string&)>& alter, const Functor<void(const std::string&)>& progress, const Functor<void(double)>& percent) {
+	Bundle Sign(const std::string& root, Folder& folder, const Identity& identity, std::map<std::string, Hash>& remote, const std::string& requirement, const Functor<std::string(const std::string&, const std::string&)>& alter, const Functor<void(const std::string&)>& progress, const Functor<void(double)>& percent) {
 		std::string executable;
 		std::string identifier;
 
@@ -2642,6 +2955,11 @@ namespace ldid {
 
 		std::string entitlements;
 		folder.Open(executable, fun([&](std::streambuf& buffer, size_t length, const void* flag) {
+			if (auto data = Mapped(buffer, length)) {
+				entitlements = alter(root, Analyze(data, length + 0x10 - (length & 0xf)));
+				return;
+			}
+
 			// XXX: this is a miserable fail
 			std::stringbuf temp;
 			copy(buffer, temp, length, percent);
@@ -2695,19 +3013,67 @@ namespace ldid {
 		Expression nested("^(Frameworks\\\\[^\\\\]*\\.framework|PlugIns\\\\[^\\\\]*\\.appex(()|\\\\[^\\\\]*.app))\\\\(" + failure + ")Info\\.plist$");
 		std::map<std::string, Bundle> bundles;
 
+		struct Nested {
+			std::string name;
+			std::string path;
+			bool plugin;
+		};
+
+		std::vector<Nested> children;
+
 		folder.Find("", fun([&](const std::string& name) {
 			if (!nested(name))
 				return;
 			auto bundle(root + Split(name).dir);
 			bundle.resize(bundle.size() - resources.size());
-			SubFolder subfolder(folder, bundle);
-
-			bundles[nested[1]] = Sign(bundle, subfolder, key, local, "", Starts(name, "PlugIns\\") ? alter :
-				static_cast<const Functor<std::string(const std::string&, const std::string&)>&>(fun([&](const std::string&, const std::string& entitlements) -> std::string { return entitlements; }))
-				, progress, percent);
+			children.push_back(Nested{ nested[1], bundle, Starts(name, "PlugIns\\") });
 			}), fun([&](const std::string& name, const Functor<std::string()>& read) {
 				}));
 
+		// nested bundles only depend on their own children, so they are signed side by side;
+		// the callbacks are still only ever entered by one thread at a time
+		std::mutex mutex;
+
+		auto alter_([&](const std::string& path, const std::string& entitlements) -> std::string {
+			std::lock_guard<std::mutex> lock(mutex);
+			return alter(path, entitlements);
+			});
+		auto keep_([](const std::string&, const std::string& entitlements) -> std::string {
+			return entitlements;
+			});
+		auto progress_([&](const std::string& path) {
+			std::lock_guard<std::mutex> lock(mutex);
+			progress(path);
+			});
+		auto percent_([&](double value) {
+			std::lock_guard<std::mutex> lock(mutex);
+			percent(value);
+			});
+
+		auto alters(fun(alter_));
+		auto keeps(fun(keep_));
+		auto progresses(fun(progress_));
+		auto percents(fun(percent_));
+
+		auto& workers(GetWorkers());
+		Workers::Group group;
+
+		for (const auto& child : children)
+			workers.Post(group, [&, child]() {
+				SubFolder subfolder(folder, child.path);
+				std::map<std::string, Hash> hashes;
+				auto bundle(Sign(child.path, subfolder, identity, hashes, "", child.plugin ?
+					static_cast<const Functor<std::string(const std::string&, const std::string&)>&>(alters) : keeps
+					, progresses, percents));
+
+				std::lock_guard<std::mutex> lock(mutex);
+				bundles[child.name] = bundle;
+				for (const auto& hash : hashes)
+					local[hash.first] = hash.second;
+				});
+
+		workers.Wait(group, fun(dummy));
+
 		std::set<std::string> excludes;
 
 		auto exclude([&](const std::string& name) {
@@ -2725,6 +3091,7 @@ namespace ldid {
 			});
 
 		std::map<std::string, std::string> links;
+		std::vector<std::pair<std::string, Hash*>> contents;
 
 		folder.Find("", fun([&](const std::string& name) {
 			if (exclude(name))
@@ -2732,44 +3099,7 @@ namespace ldid {
 
 			if (local.find(name) != local.end())
 				return;
-			auto& hash(local[name]);
-
-			folder.Open(name, fun([&](std::streambuf& data, size_t length, const void* flag) {
-				progress(root + name);
-
-				union {
-					struct {
-						uint32_t magic;
-						uint32_t count;
-					};
-
-					uint8_t bytes[8];
-				} header;
-
-				auto size(most(data, &header.bytes, sizeof(header.bytes)));
-
-				if (name != "_WatchKitStub\\WK" && size == sizeof(header.bytes))
-					switch (Swap(header.magic)) {
-					case FAT_MAGIC:
-						// Java class file format
-						if (Swap(header.count) >= 40)
-							break;
-					case FAT_CIGAM:
-					case MH_MAGIC: case MH_MAGIC_64:
-					case MH_CIGAM: case MH_CIGAM_64:
-						folder.Save(name, true, flag, fun([&](std::streambuf& save) {
-							Slots slots;
-							Sign(header.bytes, size, data, hash, save, identifier, "", "", key, slots, length, percent);
-							}));
-						return;
-					}
-
-				folder.Save(name, false, flag, fun([&](std::streambuf& save) {
-					HashProxy proxy(hash, save);
-					put(proxy, header.bytes, size);
-					copy(data, proxy, length - size, percent);
-					}));
-				}));
+			contents.emplace_back(name, &local[name]);
 			}), fun([&](const std::string& name, const Functor<std::string()>& read) {
 				if (exclude(name))
 					return;
@@ -2777,6 +3107,60 @@ namespace ldid {
 				links[name] = read();
 				}));
 
+		// every slot in local already exists, so the files can be hashed in any order
+		// without touching the map itself, and CodeResources still comes out sorted
+		Workers::Group hashing;
+
+		for (const auto& file : contents)
+			workers.Post(hashing, [&, file]() {
+				const auto& name(file.first);
+				auto& hash(*file.second);
+
+				folder.Open(name, fun([&](std::streambuf& data, size_t length, const void* flag) {
+					progresses(root + name);
+
+					union {
+						struct {
+							uint32_t magic;
+							uint32_t count;
+						};
+
+						uint8_t bytes[8];
+					} header;
+
+					auto size(most(data, &header.bytes, sizeof(header.bytes)));
+
+					if (name != "_WatchKitStub\\WK" && size == sizeof(header.bytes))
+						switch (Swap(header.magic)) {
+						case FAT_MAGIC:
+							// Java class file format
+							if (Swap(header.count) >= 40)
+								break;
+						case FAT_CIGAM:
+						case MH_MAGIC: case MH_MAGIC_64:
+						case MH_CIGAM: case MH_CIGAM_64:
+							folder.Save(name, true, flag, fun([&](std::streambuf& save) {
+								Slots slots;
+								Sign(header.bytes, size, data, hash, save, identifier, "", "", identity, slots, length, percents);
+								}));
+							return;
+						}
+
+					folder.Save(name, false, flag, fun([&](std::streambuf& save) {
+						HashProxy proxy(hash, save);
+						// a mapped file is hashed where it lies, rather than being read through a buffer
+						if (auto mapped = dynamic_cast<MapBuffer*>(&data))
+							put(proxy, mapped->data(), mapped->size(), percents);
+						else {
+							put(proxy, header.bytes, size);
+							copy(data, proxy, length - size, percents);
+						}
+						}));
+					}));
+				});
+
+		workers.Wait(hashing, fun(dummy));
+
 		auto plist(plist_new_dict());
 		_scope({ plist_free(plist); });
 
@@ -2892,7 +3276,7 @@ namespace ldid {
 				Slots slots;
 				slots[1] = local.at(info);
 				slots[3] = local.at(signature);
-				bundle.hash = Sign(NULL, 0, buffer, local[executable], save, identifier, entitlements, requirement, key, slots, length, percent);
+				bundle.hash = Sign(NULL, 0, buffer, local[executable], save, identifier, entitlements, requirement, identity, slots, length, percent);
 				}));
 			}));
 
@@ -2902,9 +3286,13 @@ namespace ldid {
 		return bundle;
 	}
 
-	Bundle Sign(const std::string& root, Folder& folder, const std::string& key, const std::string& requirement, const Functor<std::string(const std::string&, const std::string&)>& alter, const Functor<void(const std::string&)>& progress, const Functor<void(double)>& percent) {
+	Bundle Sign(const std::string& root, Folder& folder, const Identity& identity, const std::string& requirement, const Functor<std::string(const std::string&, const std::string&)>& alter, const Functor<void(const std::string&)>& progress, const Functor<void(double)>& percent) {
 		std::map<std::string, Hash> local;
-		return Sign(root, folder, key, local, requirement, alter, progress, percent);
+		return Sign(root, folder, identity, local, requirement, alter, progress, percent);
+	}
+
+	Bundle Sign(const std::string& root, Folder& folder, const std::string& key, const std::string& requirement, const Functor<std::string(const std::string&, const std::string&)>& alter, const Functor<void(const std::string&)>& progress, const Functor<void(double)>& percent) {
+		return Sign(root, folder, Identity(key), requirement, alter, progress, percent);
 	}
 #endif
 
@@ -3158,6 +3546,12 @@ int main(int argc, char* argv[]) {
 			flag_I = argv[argi] + 2;
 		} break;
 
+		case 'j': {
+			char* arge;
+			ldid::Threads(strtoul(argv[argi] + 2, &arge, 0));
+			_assert(arge == argv[argi] + strlen(argv[argi]));
+		} break;
+
 		default:
 			goto usage;
 			break;
@@ -3170,6 +3564,8 @@ int main(int argc, char* argv[]) {
 		exit(0);
 	}
 
+	ldid::Identity identity(key.empty() ? std::string() : std::string(key));
+
 	size_t filei(0), filee(0);
 	_foreach(file, files) try {
 		std::string path(file);
@@ -3181,7 +3577,7 @@ int main(int argc, char* argv[]) {
 #ifndef LDID_NOPLIST
 			_assert(!flag_r);
 			ldid::DiskFolder folder(path);
-			path += "\\" + Sign("", folder, key, requirement, ldid::fun([&](const std::string&, const std::string&) -> std::string { return entitlements; })
+			path += "\\" + Sign("", folder, identity, requirement, ldid::fun([&](const std::string&, const std::string&) -> std::string { return entitlements; })
 				, ldid::fun([&](const std::string&) {}), ldid::fun(dummy)
 			).path;
 #else
@@ -3199,7 +3595,7 @@ int main(int argc, char* argv[]) {
 				ldid::Unsign(input.data(), input.size(), output, ldid::fun(dummy));
 			else {
 				std::string identifier(flag_I ? : split.base.c_str());
-				ldid::Sign(input.data(), input.size(), output, identifier, entitlements, requirement, key, slots, ldid::fun(dummy));
+				ldid::Sign(input.data(), input.size(), output, identifier, entitlements, requirement, identity, slots, ldid::fun(dummy));
 			}
 
 			Commit(path, temp);
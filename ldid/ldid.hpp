@@ -3,12 +3,18 @@
 
 #include <cstdlib>
 #include <map>
+#include <mutex>
 #include <set>
 #include <sstream>
 #include <streambuf>
 #include <string>
 #include <vector>
 
+// OpenSSL's EVP_PKEY, X509 and STACK_OF(X509)
+struct evp_pkey_st;
+struct x509_st;
+struct stack_st_X509;
+
 namespace ldid {
 
 // I wish Apple cared about providing quality toolchains :/
@@ -61,6 +67,8 @@ class __declspec(dllexport) DiskFolder :
 {
   private:
     const std::string path_;
+    const bool map_;
+    std::mutex mutex_;
     std::map<std::string, std::string> commit_;
 
   protected:
@@ -70,7 +78,8 @@ class __declspec(dllexport) DiskFolder :
     void Find(const std::string &root, const std::string &base, const Functor<void (const std::string &)> &code, const Functor<void (const std::string &, const Functor<std::string ()> &)> &link) const;
 
   public:
-    DiskFolder(const std::string &path);
+    // with map, Open hands out files as mapped views that Sign hashes in place
+    DiskFolder(const std::string &path, bool map = true);
     ~DiskFolder();
 
     virtual void Save(const std::string &path, bool edit, const void *flag, const Functor<void (std::streambuf &)> &code);
@@ -138,6 +147,48 @@ class __declspec(dllexport) UnionFolder :
     }
 };
 
+// the private key, leaf certificate, intermediate chain and team ID used to sign; parse it once
+// and hand the same object to every Sign call instead of a PKCS#12 blob that is parsed per binary
+class __declspec(dllexport) Identity {
+  private:
+    evp_pkey_st *key_;
+    x509_st *cert_;
+    stack_st_X509 *chain_;
+    std::string team_;
+
+  public:
+    // ad-hoc: no CMS signature and no team
+    Identity();
+    // a PKCS#12 with an empty password, as taken by -K; empty means ad-hoc
+    explicit Identity(const std::string &p12);
+    // takes ownership of all three; chain may be NULL
+    Identity(evp_pkey_st *key, x509_st *cert, stack_st_X509 *chain);
+    ~Identity();
+
+    Identity(const Identity &) = delete;
+    Identity &operator =(const Identity &) = delete;
+
+    bool empty() const {
+        return key_ == NULL;
+    }
+
+    evp_pkey_st *key() const {
+        return key_;
+    }
+
+    x509_st *cert() const {
+        return cert_;
+    }
+
+    stack_st_X509 *chain() const {
+        return chain_;
+    }
+
+    const std::string &team() const {
+        return team_;
+    }
+};
+
 struct __declspec(dllexport) Hash {
     uint8_t sha1_[0x14];
     uint8_t sha256_[0x20];
@@ -148,10 +199,17 @@ struct __declspec(dllexport) Bundle {
     Hash hash;
 };
 
+// nested bundles are signed concurrently, so folder must tolerate calls from several
+// threads; alter, progress and percent are serialized but may run on worker threads
+__declspec(dllexport) Bundle Sign(const std::string &root, Folder &folder, const Identity &identity, const std::string &requirement, const Functor<std::string (const std::string &, const std::string &)> &alter, const Functor<void (const std::string &)> &progress, const Functor<void (double)> &percent);
 __declspec(dllexport) Bundle Sign(const std::string &root, Folder &folder, const std::string &key, const std::string &requirement, const Functor<std::string (const std::string &, const std::string &)> &alter, const Functor<void (const std::string &)> &progress, const Functor<void (double)> &percent);
 
 typedef std::map<uint32_t, Hash> Slots;
 
+// caps the threads used while signing; 0 (the default) uses every hardware thread
+__declspec(dllexport) void Threads(unsigned threads);
+
+Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::string &identifier, const std::string &entitlements, const std::string &requirement, const Identity &identity, const Slots &slots, const Functor<void (double)> &percent);
 Hash Sign(const void *idata, size_t isize, std::streambuf &output, const std::string &identifier, const std::string &entitlements, const std::string &requirement, const std::string &key, const Slots &slots, const Functor<void (double)> &percent);
 
 __declspec(dllexport) std::string Entitlements(std::string path);
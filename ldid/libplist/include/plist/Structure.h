@@ -25,6 +25,7 @@
 #include <plist/Node.h>
 #include <string>
 #include <vector>
+#include <streambuf>
 
 namespace PList
 {
@@ -39,6 +40,10 @@ public :
     std::string ToXml() const;
     std::vector<char> ToBin() const;
 
+    // Stream the serialized plist into out without building it in memory first.
+    bool ToXml(std::streambuf& out) const;
+    bool ToBin(std::streambuf& out) const;
+
     virtual void Remove(Node* node) = 0;
 
     static Structure* FromXml(const std::string& xml);
@@ -75,6 +75,7 @@ extern "C"
 
 #include <sys/types.h>
 #include <stdarg.h>
+#include <stdio.h>
 
     /**
      * \mainpage libplist : A library to handle Apple Property Lists
@@ -98,6 +99,42 @@ extern "C"
      */
     typedef void* plist_array_iter;
 
+    /**
+     * An arena that plist nodes can be allocated from, see #plist_arena_new.
+     */
+    typedef void* plist_arena_t;
+
+    /**
+     * A function the streaming writers hand serialized output to, see
+     * #plist_to_xml_with_func. Returns 0 on success and a negative value
+     * to make the writer fail.
+     */
+    typedef int (*plist_write_func_t)(const void *buf, size_t length, void *user_data);
+
+    /**
+     * Options for #plist_to_bin_with_options.
+     */
+    typedef enum
+    {
+        PLIST_OPT_NONE = 0,            /**< Default behavior */
+        PLIST_OPT_NO_DEDUP = 1 << 0    /**< Write equal strings and numbers once per occurrence instead of sharing one object */
+    } plist_write_options_t;
+
+    /**
+     * A read-only view of a binary plist buffer, see #plist_bin_view_new.
+     */
+    typedef struct plist_bin_view_s* plist_bin_view_t;
+
+    /**
+     * Reference to an object inside a #plist_bin_view_t.
+     */
+    typedef uint64_t plist_view_ref_t;
+
+    /**
+     * The invalid #plist_view_ref_t, returned when a lookup fails.
+     */
+    #define PLIST_VIEW_REF_INVALID ((plist_view_ref_t)-1)
+
     /**
      * The enumeration of plist node types.
      */
@@ -214,11 +251,54 @@ extern "C"
     /**
      * Return a copy of passed node and it's children
      *
+     * Strings, data and other leaf values are shared with the original
+     * until either side modifies them, so only the containers are copied.
+     *
      * @param node the plist to copy
      * @return copied plist
      */
     plist_t plist_copy(plist_t node);
 
+    /********************************************
+     *                                          *
+     *                 Arenas                   *
+     *                                          *
+     ********************************************/
+
+    /**
+     * Create a new arena.
+     *
+     * While an arena is current on a thread (see #plist_arena_set_current),
+     * every node that thread creates through the plist_new_* functions,
+     * #plist_copy, #plist_from_xml, #plist_from_bin and #plist_from_memory
+     * is allocated from the arena instead of the heap. Such nodes can be read,
+     * modified and freed with the regular API, but their memory is only
+     * given back by #plist_arena_free, which releases the whole tree at once
+     * without walking it.
+     *
+     * Nodes of an arena may be inserted into heap-allocated trees, but not the
+     * other way around: insert a #plist_copy made with the arena current instead.
+     *
+     * @return the new arena, or NULL when out of memory
+     */
+    plist_arena_t plist_arena_new(void);
+
+    /**
+     * Make an arena the one new nodes on the calling thread are allocated from.
+     *
+     * @param arena the arena to allocate from, or NULL to go back to the heap
+     * @return the arena that was current before
+     */
+    plist_arena_t plist_arena_set_current(plist_arena_t arena);
+
+    /**
+     * Release an arena together with every node allocated from it.
+     * The arena must not be current on any thread.
+     *
+     * @param arena the arena to free
+     */
+    void plist_arena_free(plist_arena_t arena);
+
 
     /********************************************
      *                                          *
@@ -629,6 +709,77 @@ extern "C"
      */
     void plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length);
 
+    /**
+     * Export the #plist_t structure to binary format with options.
+     * #PLIST_OPT_NO_DEDUP makes serializing faster at the cost of a larger
+     * output, which suits small one-shot messages.
+     *
+     * @param plist the root node to export
+     * @param plist_bin a pointer to a char* buffer. This function allocates the memory,
+     *            caller is responsible for freeing it.
+     * @param length a pointer to an uint32_t variable. Represents the length of the allocated buffer.
+     * @param options a combination of #plist_write_options_t values
+     */
+    void plist_to_bin_with_options(plist_t plist, char **plist_bin, uint32_t * length, plist_write_options_t options);
+
+    /**
+     * Export the #plist_t structure to XML format, writing it out in pieces
+     * instead of building the whole document in memory.
+     *
+     * @param plist the root node to export
+     * @param write_func the function the output is passed to, in order
+     * @param user_data passed to write_func
+     * @return 0 on success, or -1 if plist is invalid or write_func failed
+     */
+    int plist_to_xml_with_func(plist_t plist, plist_write_func_t write_func, void *user_data);
+
+    /**
+     * Export the #plist_t structure to binary format, writing it out in
+     * pieces. Only the object and offset tables are kept in memory.
+     *
+     * @param plist the root node to export
+     * @param write_func the function the output is passed to, in order
+     * @param user_data passed to write_func
+     * @return 0 on success, or -1 if plist is invalid or write_func failed
+     */
+    int plist_to_bin_with_func(plist_t plist, plist_write_func_t write_func, void *user_data);
+
+    /**
+     * Export the #plist_t structure to XML format into a stdio stream.
+     *
+     * @param plist the root node to export
+     * @param file the stream to write to
+     * @return 0 on success, -1 on error
+     */
+    int plist_to_xml_file(plist_t plist, FILE *file);
+
+    /**
+     * Export the #plist_t structure to binary format into a stdio stream.
+     *
+     * @param plist the root node to export
+     * @param file the stream to write to
+     * @return 0 on success, -1 on error
+     */
+    int plist_to_bin_file(plist_t plist, FILE *file);
+
+    /**
+     * Export the #plist_t structure to XML format into a file descriptor.
+     *
+     * @param plist the root node to export
+     * @param fd the file descriptor to write to
+     * @return 0 on success, -1 on error
+     */
+    int plist_to_xml_fd(plist_t plist, int fd);
+
+    /**
+     * Export the #plist_t structure to binary format into a file descriptor.
+     *
+     * @param plist the root node to export
+     * @param fd the file descriptor to write to
+     * @return 0 on success, -1 on error
+     */
+    int plist_to_bin_fd(plist_t plist, int fd);
+
     /**
      * Import the #plist_t structure from XML format.
      *
@@ -672,6 +823,195 @@ extern "C"
      */
     int plist_is_binary(const char *plist_data, uint32_t length);
 
+    /********************************************
+     *                                          *
+     *           Binary plist views             *
+     *                                          *
+     ********************************************/
+
+    /**
+     * Open a read-only view of a binary plist.
+     *
+     * Unlike #plist_from_bin nothing is parsed up front: objects are decoded
+     * in place when they are accessed and no memory is allocated per object.
+     * Strings and data are handed out as pointers into plist_bin, which must
+     * stay valid and unchanged until the view is freed.
+     * Reference cycles are not detected, so callers that walk a view
+     * recursively have to bound the depth themselves.
+     *
+     * A view is not thread-safe: #plist_bin_view_dict_get_item caches the
+     * key indexes it builds in the view. Threads that read the same buffer
+     * concurrently should each open their own view of it.
+     *
+     * @param plist_bin a pointer to the binary plist buffer.
+     * @param length length of the buffer.
+     * @return the view, or NULL if the buffer is not a valid binary plist
+     */
+    plist_bin_view_t plist_bin_view_new(const char *plist_bin, uint32_t length);
+
+    /**
+     * Free a view created with #plist_bin_view_new. The buffer is not touched.
+     *
+     * @param view the view to free
+     */
+    void plist_bin_view_free(plist_bin_view_t view);
+
+    /**
+     * Get the root object of a view.
+     *
+     * @param view the view
+     * @return a reference to the root object
+     */
+    plist_view_ref_t plist_bin_view_get_root(plist_bin_view_t view);
+
+    /**
+     * Get the type of an object. Dictionary keys are of type #PLIST_STRING.
+     *
+     * @param view the view
+     * @param ref the object
+     * @return the type of the object, or #PLIST_NONE if it is invalid
+     */
+    plist_type plist_bin_view_get_node_type(plist_bin_view_t view, plist_view_ref_t ref);
+
+    /**
+     * Get the number of items of a #PLIST_ARRAY or entries of a #PLIST_DICT object.
+     *
+     * @param view the view
+     * @param ref the object
+     * @return the number of items, or 0 if the object is not an array or dictionary
+     */
+    uint32_t plist_bin_view_get_size(plist_bin_view_t view, plist_view_ref_t ref);
+
+    /**
+     * Get the nth item of a #PLIST_ARRAY object.
+     *
+     * @param view the view
+     * @param ref the array
+     * @param n the index of the item, 0 being the first
+     * @return the item, or #PLIST_VIEW_REF_INVALID if there is none
+     */
+    plist_view_ref_t plist_bin_view_array_get_item(plist_bin_view_t view, plist_view_ref_t ref, uint32_t n);
+
+    /**
+     * Get the nth entry of a #PLIST_DICT object, in the order of the buffer.
+     *
+     * @param view the view
+     * @param ref the dictionary
+     * @param n the index of the entry, 0 being the first
+     * @param key a location to store the key object in, or NULL
+     * @param val a location to store the value object in, or NULL
+     */
+    void plist_bin_view_dict_get_entry(plist_bin_view_t view, plist_view_ref_t ref, uint32_t n, plist_view_ref_t *key, plist_view_ref_t *val);
+
+    /**
+     * Look up the value for a key in a #PLIST_DICT object.
+     * Large dictionaries get a sorted key index on their first lookup, so
+     * later lookups are binary searches. The index is stored in the view,
+     * which is why a view must not be shared between threads.
+     *
+     * @param view the view
+     * @param ref the dictionary
+     * @param key the UTF-8 encoded key
+     * @return the value, or #PLIST_VIEW_REF_INVALID if the key is not present
+     */
+    plist_view_ref_t plist_bin_view_dict_get_item(plist_bin_view_t view, plist_view_ref_t ref, const char *key);
+
+    /**
+     * Get the value of a #PLIST_BOOLEAN object.
+     * This function does nothing if the object is of another type.
+     *
+     * @param view the view
+     * @param ref the object
+     * @param val a pointer to a uint8_t variable.
+     */
+    void plist_bin_view_get_bool_val(plist_bin_view_t view, plist_view_ref_t ref, uint8_t *val);
+
+    /**
+     * Get the value of a #PLIST_UINT object.
+     * This function does nothing if the object is of another type.
+     *
+     * @param view the view
+     * @param ref the object
+     * @param val a pointer to a uint64_t variable.
+     */
+    void plist_bin_view_get_uint_val(plist_bin_view_t view, plist_view_ref_t ref, uint64_t *val);
+
+    /**
+     * Get the value of a #PLIST_REAL object.
+     * This function does nothing if the object is of another type.
+     *
+     * @param view the view
+     * @param ref the object
+     * @param val a pointer to a double variable.
+     */
+    void plist_bin_view_get_real_val(plist_bin_view_t view, plist_view_ref_t ref, double *val);
+
+    /**
+     * Get the value of a #PLIST_DATE object.
+     * This function does nothing if the object is of another type.
+     *
+     * @param view the view
+     * @param ref the object
+     * @param sec a pointer to an int32_t variable. Represents the number of seconds since 01/01/2001.
+     * @param usec a pointer to an int32_t variable. Represents the number of microseconds
+     */
+    void plist_bin_view_get_date_val(plist_bin_view_t view, plist_view_ref_t ref, int32_t *sec, int32_t *usec);
+
+    /**
+     * Get the value of a #PLIST_UID object.
+     * This function does nothing if the object is of another type.
+     *
+     * @param view the view
+     * @param ref the object
+     * @param val a pointer to a uint64_t variable.
+     */
+    void plist_bin_view_get_uid_val(plist_bin_view_t view, plist_view_ref_t ref, uint64_t *val);
+
+    /**
+     * Get a pointer to the bytes of a #PLIST_STRING object inside the buffer.
+     * The string is not 0-terminated. Strings that are stored as UTF-16 can
+     * not be returned this way, use #plist_bin_view_get_string_val for them.
+     *
+     * @param view the view
+     * @param ref the object
+     * @param length a pointer to a uint64_t variable that receives the length in bytes
+     * @return a pointer into the buffer, or NULL if the object is not a
+     *     single-byte encoded string
+     */
+    const char* plist_bin_view_get_string_ptr(plist_bin_view_t view, plist_view_ref_t ref, uint64_t *length);
+
+    /**
+     * Get a UTF-8 copy of a #PLIST_STRING object.
+     * This function does nothing if the object is of another type.
+     *
+     * @param view the view
+     * @param ref the object
+     * @param val a pointer to a C-string. This function allocates the memory,
+     *            caller is responsible for freeing it.
+     */
+    void plist_bin_view_get_string_val(plist_bin_view_t view, plist_view_ref_t ref, char **val);
+
+    /**
+     * Get a pointer to the bytes of a #PLIST_DATA object inside the buffer.
+     *
+     * @param view the view
+     * @param ref the object
+     * @param length a pointer to a uint64_t variable that receives the length in bytes
+     * @return a pointer into the buffer, or NULL if the object is not data
+     */
+    const char* plist_bin_view_get_data_ptr(plist_bin_view_t view, plist_view_ref_t ref, uint64_t *length);
+
+    /**
+     * Parse an object of a view, including everything below it, into a
+     * #plist_t tree, as #plist_from_bin would.
+     *
+     * @param view the view
+     * @param ref the object
+     * @return the new tree, or NULL on error. The caller is responsible for
+     *     freeing it with #plist_free.
+     */
+    plist_t plist_bin_view_copy_node(plist_bin_view_t view, plist_view_ref_t ref);
+
     /********************************************
      *                                          *
      *                 Utils                    *
@@ -0,0 +1,120 @@
+/*
+ * arena.c
+ * simple bump allocator; everything allocated from an arena is released at once
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "arena.h"
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_MIN_BLOCK_SIZE (64 * 1024)
+#define ARENA_MAX_BLOCK_SIZE (4 * 1024 * 1024)
+
+#define ARENA_HEADER_SIZE ((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+arena_t* arena_new(void)
+{
+	arena_t *arena = (arena_t*)malloc(sizeof(arena_t));
+	if (!arena) {
+		return NULL;
+	}
+	arena->blocks = NULL;
+	arena->cleanups = NULL;
+	arena->block_size = ARENA_MIN_BLOCK_SIZE;
+	return arena;
+}
+
+void arena_free(arena_t *arena)
+{
+	if (!arena) return;
+
+	arena_cleanup_t *cleanup = arena->cleanups;
+	while (cleanup) {
+		cleanup->func(cleanup->ptr);
+		cleanup = cleanup->next;
+	}
+
+	arena_block_t *block = arena->blocks;
+	while (block) {
+		arena_block_t *next = block->next;
+		free(block);
+		block = next;
+	}
+	free(arena);
+}
+
+void* arena_alloc(arena_t *arena, size_t size)
+{
+	if (!arena) return NULL;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	if (size == 0) {
+		size = ARENA_ALIGN;
+	}
+
+	arena_block_t *block = arena->blocks;
+	if (!block || block->size - block->used < size) {
+		if (size > arena->block_size / 4) {
+			/* large allocations get a block of their own, behind the current one so it stays in use */
+			block = (arena_block_t*)malloc(ARENA_HEADER_SIZE + size);
+			if (!block) {
+				return NULL;
+			}
+			block->size = size;
+			block->used = size;
+			if (arena->blocks) {
+				block->next = arena->blocks->next;
+				arena->blocks->next = block;
+			} else {
+				block->next = NULL;
+				arena->blocks = block;
+			}
+			return (char*)block + ARENA_HEADER_SIZE;
+		}
+
+		block = (arena_block_t*)malloc(ARENA_HEADER_SIZE + arena->block_size);
+		if (!block) {
+			return NULL;
+		}
+		block->size = arena->block_size;
+		block->used = 0;
+		block->next = arena->blocks;
+		arena->blocks = block;
+
+		/* grow geometrically so big documents need few blocks */
+		if (arena->block_size < ARENA_MAX_BLOCK_SIZE) {
+			arena->block_size <<= 1;
+		}
+	}
+
+	void *ptr = (char*)block + ARENA_HEADER_SIZE + block->used;
+	block->used += size;
+	return ptr;
+}
+
+void arena_add_cleanup(arena_t *arena, arena_cleanup_func_t func, void *ptr)
+{
+	if (!arena || !func) return;
+
+	arena_cleanup_t *cleanup = (arena_cleanup_t*)arena_alloc(arena, sizeof(arena_cleanup_t));
+	if (!cleanup) {
+		return;
+	}
+	cleanup->func = func;
+	cleanup->ptr = ptr;
+	cleanup->next = arena->cleanups;
+	arena->cleanups = cleanup;
+}
@@ -0,0 +1,49 @@
+/*
+ * arena.h
+ * header file for a simple bump allocator
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef ARENA_H
+#define ARENA_H
+#include <stdlib.h>
+
+typedef void (*arena_cleanup_func_t)(void *ptr);
+
+typedef struct arena_block_t {
+	struct arena_block_t *next;
+	size_t size;
+	size_t used;
+} arena_block_t;
+
+typedef struct arena_cleanup_t {
+	struct arena_cleanup_t *next;
+	arena_cleanup_func_t func;
+	void *ptr;
+} arena_cleanup_t;
+
+typedef struct arena_t {
+	arena_block_t *blocks;
+	arena_cleanup_t *cleanups;
+	size_t block_size;
+} arena_t;
+
+arena_t* arena_new(void);
+void arena_free(arena_t *arena);
+
+void* arena_alloc(arena_t *arena, size_t size);
+void arena_add_cleanup(arena_t *arena, arena_cleanup_func_t func, void *ptr);
+
+#endif
@@ -28,6 +28,8 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+
 #include "object.h"
 
 #define NODE_TYPE 1;
@@ -45,10 +47,14 @@ typedef struct node_t {
 	void *data;
 	struct node_t* parent;
 	struct node_list_t* children;
+
+	// Arena the node and its child list were allocated from, NULL for the heap
+	void* arena;
 } node_t;
 
 void node_destroy(struct node_t* node);
 struct node_t* node_create(struct node_t* parent, void* data);
+struct node_t* node_create_in_arena(struct node_t* parent, void* data, void* arena);
 
 int node_attach(struct node_t* parent, struct node_t* child);
 int node_detach(struct node_t* parent, struct node_t* child);
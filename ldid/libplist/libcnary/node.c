@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "node.h"
 #include "node_list.h"
 
@@ -37,16 +38,36 @@ void node_destroy(node_t* node) {
 			node_destroy(ch);
 		}
 	}
-	node_list_destroy(node->children);
-	node->children = NULL;
 
-	free(node);
+	// Arena memory is released together with the arena
+	if (!node->arena) {
+		node_list_destroy(node->children);
+		node->children = NULL;
+
+		free(node);
+	}
+}
+
+static node_list_t* node_children_create(node_t* node) {
+	if (!node->arena) {
+		return node_list_create();
+	}
+
+	node_list_t* list = (node_list_t*) arena_alloc((arena_t*)node->arena, sizeof(node_list_t));
+	if (list) {
+		memset(list, '\0', sizeof(node_list_t));
+	}
+	return list;
 }
 
 node_t* node_create(node_t* parent, void* data) {
+	return node_create_in_arena(parent, data, NULL);
+}
+
+node_t* node_create_in_arena(node_t* parent, void* data, void* arena) {
 	int error = 0;
 
-	node_t* node = (node_t*) malloc(sizeof(node_t));
+	node_t* node = (node_t*) (arena ? arena_alloc((arena_t*)arena, sizeof(node_t)) : malloc(sizeof(node_t)));
 	if(node == NULL) {
 		return NULL;
 	}
@@ -58,6 +79,7 @@ node_t* node_create(node_t* parent, void* data) {
 	node->count = 0;
 	node->parent = NULL;
 	node->children = NULL;
+	node->arena = arena;
 
 	// Pass NULL to create a root node
 	if(parent != NULL) {
@@ -78,7 +100,7 @@ int node_attach(node_t* parent, node_t* child) {
 	if (!parent || !child) return -1;
 	child->parent = parent;
 	if(!parent->children) {
-		parent->children = node_list_create();
+		parent->children = node_children_create(parent);
 	}
 	int res = node_list_add(parent->children, child);
 	if (res == 0) {
@@ -101,7 +123,7 @@ int node_insert(node_t* parent, unsigned int node_index, node_t* child)
 	if (!parent || !child) return -1;
 	child->parent = parent;
 	if(!parent->children) {
-		parent->children = node_list_create();
+		parent->children = node_children_create(parent);
 	}
 	int res = node_list_insert(parent->children, node_index, child);
 	if (res == 0) {
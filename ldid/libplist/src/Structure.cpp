@@ -70,6 +70,23 @@ std::vector<char> Structure::ToBin() const
     return ret;
 }
 
+static int WriteToStreambuf(const void* buf, size_t length, void* user_data)
+{
+    std::streambuf* out = static_cast<std::streambuf*>(user_data);
+    std::streamsize written = out->sputn(static_cast<const char*>(buf), length);
+    return (written == static_cast<std::streamsize>(length)) ? 0 : -1;
+}
+
+bool Structure::ToXml(std::streambuf& out) const
+{
+    return plist_to_xml_with_func(_node, WriteToStreambuf, &out) == 0;
+}
+
+bool Structure::ToBin(std::streambuf& out) const
+{
+    return plist_to_bin_with_func(_node, WriteToStreambuf, &out) == 0;
+}
+
 void Structure::UpdateNodeParent(Node* node)
 {
     //Unlink node first
@@ -18,9 +18,29 @@
  * License along with this library; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
+#include <stdint.h>
 #include <string.h>
 #include "base64.h"
 
+#if defined(_MSC_VER)
+#include <windows.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define BASE64_SSSE3
+#define BASE64_AVX2
+#define BASE64_TARGET_SSSE3
+#define BASE64_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || __GNUC__ >= 5)
+#define BASE64_SSSE3
+#define BASE64_AVX2
+#define BASE64_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define BASE64_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
 static const char base64_str[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static const char base64_pad = '=';
 
@@ -43,14 +63,290 @@ static const signed char base64_table[256] = {
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
 };
 
+/*
+ * The block functions below work on whole groups only: encoders consume a
+ * multiple of 3 input bytes and return how many, decoders consume a multiple
+ * of 4 characters from the alphabet and stop at the first block holding
+ * anything else (padding, whitespace, garbage), leaving it to the scalar loop.
+ */
+typedef size_t (*base64_encode_func_t)(char *out, const unsigned char *in, size_t size);
+typedef size_t (*base64_decode_func_t)(unsigned char *out, const char *in, size_t len);
+
+static size_t base64_encode_none(char *out, const unsigned char *in, size_t size)
+{
+	(void)out;
+	(void)in;
+	(void)size;
+	return 0;
+}
+
+static size_t base64_decode_none(unsigned char *out, const char *in, size_t len)
+{
+	(void)out;
+	(void)in;
+	(void)len;
+	return 0;
+}
+
+#ifdef BASE64_SSSE3
+/* 12 bytes (in lanes of 3, spread over 16) to 16 six bit indexes */
+static BASE64_TARGET_SSSE3 __m128i base64_enc_reshuffle_ssse3(__m128i in)
+{
+	in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+	__m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+	__m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t0, t1);
+}
+
+/* six bit indexes to ASCII, by adding a per-range offset picked with pshufb */
+static BASE64_TARGET_SSSE3 __m128i base64_enc_translate_ssse3(__m128i in)
+{
+	const __m128i lut = _mm_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	__m128i idx = _mm_subs_epu8(in, _mm_set1_epi8(51));
+	__m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), in);
+	idx = _mm_or_si128(idx, _mm_and_si128(less, _mm_set1_epi8(13)));
+	return _mm_add_epi8(in, _mm_shuffle_epi8(lut, idx));
+}
+
+static BASE64_TARGET_SSSE3 size_t base64_encode_ssse3(char *out, const unsigned char *in, size_t size)
+{
+	size_t n = 0;
+	/* each step reads 16 bytes but only consumes 12 */
+	while (size - n >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + n));
+		v = base64_enc_translate_ssse3(base64_enc_reshuffle_ssse3(v));
+		_mm_storeu_si128((__m128i*)out, v);
+		out += 16;
+		n += 12;
+	}
+	return n;
+}
+
+/*
+ * ASCII to six bit values, in place; returns 0 if any byte is outside the
+ * alphabet. The nibble tables come from the well known pshufb decoder: a
+ * byte is valid only if the classes of its high and low nibble don't overlap.
+ */
+static BASE64_TARGET_SSSE3 int base64_dec_translate_ssse3(__m128i *v)
+{
+	const __m128i lut_lo = _mm_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	const __m128i lut_hi = _mm_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71,
+		0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+	__m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(*v, 4), mask_2f);
+	__m128i lo_nibbles = _mm_and_si128(*v, mask_2f);
+	__m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+	__m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+	if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0) {
+		return 0;
+	}
+	__m128i eq_2f = _mm_cmpeq_epi8(*v, mask_2f);
+	*v = _mm_add_epi8(*v, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles)));
+	return 1;
+}
+
+/* 16 six bit values to 12 bytes in the low part of the register */
+static BASE64_TARGET_SSSE3 __m128i base64_dec_reshuffle_ssse3(__m128i in)
+{
+	__m128i ab_bc = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+	__m128i out = _mm_madd_epi16(ab_bc, _mm_set1_epi32(0x00011000));
+	return _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+static BASE64_TARGET_SSSE3 size_t base64_decode_ssse3(unsigned char *out, const char *in, size_t len)
+{
+	size_t n = 0;
+	/* the 16 byte store writes 4 bytes past the block; keeping 16 more
+	 * characters in reserve guarantees the output buffer has room for it */
+	while (len - n >= 32) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + n));
+		if (!base64_dec_translate_ssse3(&v)) {
+			break;
+		}
+		_mm_storeu_si128((__m128i*)out, base64_dec_reshuffle_ssse3(v));
+		out += 12;
+		n += 16;
+	}
+	return n;
+}
+#endif
+
+#ifdef BASE64_AVX2
+static BASE64_TARGET_AVX2 size_t base64_encode_avx2(char *out, const unsigned char *in, size_t size)
+{
+	const __m256i shuf = _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i lut = _mm256_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	size_t n = 0;
+	/* two 12 byte groups, one per 128 bit lane; the upper load ends 4 bytes past the group */
+	while (size - n >= 28) {
+		__m256i v = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(in + n))),
+			_mm_loadu_si128((const __m128i*)(in + n + 12)), 1);
+		v = _mm256_shuffle_epi8(v, shuf);
+		__m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+		__m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+		v = _mm256_or_si256(t0, t1);
+		__m256i idx = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+		__m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), v);
+		idx = _mm256_or_si256(idx, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+		v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lut, idx));
+		_mm256_storeu_si256((__m256i*)out, v);
+		out += 32;
+		n += 24;
+	}
+	return n;
+}
+
+static BASE64_TARGET_AVX2 size_t base64_decode_avx2(unsigned char *out, const char *in, size_t len)
+{
+	const __m256i lut_lo = _mm256_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+	const __m256i lut_hi = _mm256_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71,
+		0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71,
+		0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i shuf = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+	size_t n = 0;
+	/* same reserve as the SSSE3 loop: the 32 byte store covers 8 bytes past the block */
+	while (len - n >= 48) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(in + n));
+		__m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask_2f);
+		__m256i lo_nibbles = _mm256_and_si256(v, mask_2f);
+		__m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+		__m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+		if (!_mm256_testz_si256(lo, hi)) {
+			break;
+		}
+		__m256i eq_2f = _mm256_cmpeq_epi8(v, mask_2f);
+		v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles)));
+		v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+		v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+		v = _mm256_shuffle_epi8(v, shuf);
+		/* each lane holds 12 bytes; pull them together into the low 24 */
+		v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+		_mm256_storeu_si256((__m256i*)out, v);
+		out += 24;
+		n += 32;
+	}
+	return n;
+}
+#endif
+
+#if defined(BASE64_SSSE3) || defined(BASE64_AVX2)
+/* cpuid leaf 1 ecx bit 9 is SSSE3; AVX2 additionally needs the OS to save the ymm registers */
+static int base64_cpu_features(int *ssse3, int *avx2)
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	*ssse3 = (info[2] & (1 << 9)) != 0;
+	*avx2 = 0;
+	if (max_leaf >= 7 && (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6) {
+		__cpuidex(info, 7, 0);
+		*avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	*ssse3 = __builtin_cpu_supports("ssse3");
+	*avx2 = __builtin_cpu_supports("avx2");
+#endif
+	return *ssse3 || *avx2;
+}
+#endif
+
+static size_t base64_encode_resolve(char *out, const unsigned char *in, size_t size);
+static size_t base64_decode_resolve(unsigned char *out, const char *in, size_t len);
+
+static base64_encode_func_t base64_encode_impl = base64_encode_resolve;
+static base64_decode_func_t base64_decode_impl = base64_decode_resolve;
+
+/* the first call swaps in the resolved functions while other threads may already be reading the pointers */
+#if defined(_MSC_VER)
+#define BASE64_ENCODE_IMPL_LOAD() ((base64_encode_func_t)InterlockedCompareExchangePointer((PVOID volatile*)&base64_encode_impl, NULL, NULL))
+#define BASE64_ENCODE_IMPL_STORE(f) InterlockedExchangePointer((PVOID volatile*)&base64_encode_impl, (PVOID)(f))
+#define BASE64_DECODE_IMPL_LOAD() ((base64_decode_func_t)InterlockedCompareExchangePointer((PVOID volatile*)&base64_decode_impl, NULL, NULL))
+#define BASE64_DECODE_IMPL_STORE(f) InterlockedExchangePointer((PVOID volatile*)&base64_decode_impl, (PVOID)(f))
+#else
+#define BASE64_ENCODE_IMPL_LOAD() __atomic_load_n(&base64_encode_impl, __ATOMIC_ACQUIRE)
+#define BASE64_ENCODE_IMPL_STORE(f) __atomic_store_n(&base64_encode_impl, (f), __ATOMIC_RELEASE)
+#define BASE64_DECODE_IMPL_LOAD() __atomic_load_n(&base64_decode_impl, __ATOMIC_ACQUIRE)
+#define BASE64_DECODE_IMPL_STORE(f) __atomic_store_n(&base64_decode_impl, (f), __ATOMIC_RELEASE)
+#endif
+
+static void base64_resolve(void)
+{
+	base64_encode_func_t enc = base64_encode_none;
+	base64_decode_func_t dec = base64_decode_none;
+#if defined(BASE64_SSSE3) || defined(BASE64_AVX2)
+	int ssse3 = 0, avx2 = 0;
+	if (base64_cpu_features(&ssse3, &avx2)) {
+#if defined(BASE64_SSSE3)
+		if (ssse3) {
+			enc = base64_encode_ssse3;
+			dec = base64_decode_ssse3;
+		}
+#endif
+#if defined(BASE64_AVX2)
+		if (avx2) {
+			enc = base64_encode_avx2;
+			dec = base64_decode_avx2;
+		}
+#endif
+	}
+#endif
+	BASE64_ENCODE_IMPL_STORE(enc);
+	BASE64_DECODE_IMPL_STORE(dec);
+}
+
+static size_t base64_encode_resolve(char *out, const unsigned char *in, size_t size)
+{
+	base64_resolve();
+	return BASE64_ENCODE_IMPL_LOAD()(out, in, size);
+}
+
+static size_t base64_decode_resolve(unsigned char *out, const char *in, size_t len)
+{
+	base64_resolve();
+	return BASE64_DECODE_IMPL_LOAD()(out, in, len);
+}
+
 size_t base64encode(char *outbuf, const unsigned char *buf, size_t size)
 {
 	if (!outbuf || !buf || (size <= 0)) {
 		return 0;
 	}
 
-	size_t n = 0;
-	size_t m = 0;
+	size_t n = BASE64_ENCODE_IMPL_LOAD()(outbuf, buf, size);
+	size_t m = n / 3 * 4;
 	unsigned char input[3];
 	unsigned int output[4];
 	while (n < size) {
@@ -84,6 +380,13 @@ unsigned char *base64decode(const char *buf, size_t *size)
 	int tmpcnt = 0;
 
 	do {
+		/* whole groups of plain alphabet characters go through the vector
+		 * path; it hands back at the first line break or padding */
+		if (tmpcnt == 0 && (size_t)(buf+len - ptr) >= 32) {
+			size_t n = BASE64_DECODE_IMPL_LOAD()(outbuf + p, ptr, (size_t)(buf+len - ptr));
+			ptr += n;
+			p += (int)(n / 4 * 3);
+		}
 		while (ptr < buf+len && (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r')) {
 			ptr++;
 		}
@@ -22,7 +22,15 @@
 #define BASE64_H
 #include <stdlib.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 size_t base64encode(char *outbuf, const unsigned char *buf, size_t size);
 unsigned char *base64decode(const char *buf, size_t *size);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
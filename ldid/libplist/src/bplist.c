@@ -31,6 +31,7 @@
 
 #include <ctype.h>
 #include <inttypes.h>
+#include <math.h>
 
 #include <plist/plist.h>
 #include "plist.h"
@@ -200,8 +201,9 @@ struct bplist_data {
     uint8_t ref_size;
     uint8_t offset_size;
     const char* offset_table;
-    uint32_t level;
-    plist_t used_indexes;
+    uint8_t *used_indexes;  /* bitset of the objects on the current path */
+    plist_t *strings;       /* string objects parsed so far, may be NULL */
+    plist_t *keys;          /* string objects used as dict keys so far, may be NULL */
 };
 
 #ifdef DEBUG
@@ -231,7 +233,7 @@ static plist_t parse_bin_node_at_index(struct bplist_data *bplist, uint32_t node
 
 static plist_t parse_uint_node(const char **bnode, uint8_t size)
 {
-    plist_data_t data = plist_new_plist_data();
+    plist_data_t data = NULL;
 
     size = 1 << size;			// make length less misleading
     switch (size)
@@ -240,50 +242,50 @@ static plist_t parse_uint_node(const char **bnode, uint8_t size)
     case sizeof(uint16_t):
     case sizeof(uint32_t):
     case sizeof(uint64_t):
-        data->length = sizeof(uint64_t);
-        break;
     case 16:
-        data->length = size;
         break;
     default:
-        free(data);
         PLIST_BIN_ERR("%s: Invalid byte size for integer node\n", __func__);
         return NULL;
     };
 
+    data = plist_new_plist_data();
+    data->length = (size == 16) ? size : sizeof(uint64_t);
     data->intval = UINT_TO_HOST(*bnode, size);
 
     (*bnode) += size;
     data->type = PLIST_UINT;
 
-    return node_create(NULL, data);
+    return plist_new_node(data);
 }
 
 static plist_t parse_real_node(const char **bnode, uint8_t size)
 {
-    plist_data_t data = plist_new_plist_data();
+    plist_data_t data = NULL;
     uint8_t buf[8];
+    double realval = 0;
 
     size = 1 << size;			// make length less misleading
     switch (size)
     {
     case sizeof(uint32_t):
         *(uint32_t*)buf = float_bswap32(get_unaligned((uint32_t*)*bnode));
-        data->realval = *(float *) buf;
+        realval = *(float *) buf;
         break;
     case sizeof(uint64_t):
         *(uint64_t*)buf = float_bswap64(get_unaligned((uint64_t*)*bnode));
-        data->realval = *(double *) buf;
+        realval = *(double *) buf;
         break;
     default:
-        free(data);
         PLIST_BIN_ERR("%s: Invalid byte size for real node\n", __func__);
         return NULL;
     }
+    data = plist_new_plist_data();
+    data->realval = realval;
     data->type = PLIST_REAL;
     data->length = sizeof(double);
 
-    return node_create(NULL, data);
+    return plist_new_node(data);
 }
 
 static plist_t parse_date_node(const char **bnode, uint8_t size)
@@ -299,11 +301,12 @@ static plist_t parse_date_node(const char **bnode, uint8_t size)
 static plist_t parse_string_node(const char **bnode, uint64_t size)
 {
     plist_data_t data = plist_new_plist_data();
+    plist_t node = plist_new_node(data);
 
     data->type = PLIST_STRING;
-    data->strval = (char *) malloc(sizeof(char) * (size + 1));
+    data->strval = (char *) plist_node_alloc(node, sizeof(char) * (size + 1));
     if (!data->strval) {
-        plist_free_data(data);
+        plist_free(node);
         PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, sizeof(char) * (size + 1));
         return NULL;
     }
@@ -311,7 +314,7 @@ static plist_t parse_string_node(const char **bnode, uint64_t size)
     data->strval[size] = '\0';
     data->length = strlen(data->strval);
 
-    return node_create(NULL, data);
+    return node;
 }
 
 static char *plist_utf16be_to_utf8(uint16_t *unistr, long len, long *items_read, long *items_written)
@@ -379,43 +382,45 @@ static char *plist_utf16be_to_utf8(uint16_t *unistr, long len, long *items_read,
 
 static plist_t parse_unicode_node(const char **bnode, uint64_t size)
 {
-    plist_data_t data = plist_new_plist_data();
+    plist_data_t data = NULL;
+    plist_t node = NULL;
     char *tmpstr = NULL;
     long items_read = 0;
     long items_written = 0;
 
-    data->type = PLIST_STRING;
-
     tmpstr = plist_utf16be_to_utf8((uint16_t*)(*bnode), size, &items_read, &items_written);
     if (!tmpstr) {
-        plist_free_data(data);
         return NULL;
     }
     tmpstr[items_written] = '\0';
 
+    data = plist_new_plist_data();
+    node = plist_new_node(data);
     data->type = PLIST_STRING;
     data->strval = realloc(tmpstr, items_written+1);
     if (!data->strval)
         data->strval = tmpstr;
+    data->strval = plist_node_adopt(node, data->strval, items_written+1);
     data->length = items_written;
-    return node_create(NULL, data);
+    return node;
 }
 
 static plist_t parse_data_node(const char **bnode, uint64_t size)
 {
     plist_data_t data = plist_new_plist_data();
+    plist_t node = plist_new_node(data);
 
     data->type = PLIST_DATA;
     data->length = size;
-    data->buff = (uint8_t *) malloc(sizeof(uint8_t) * size);
+    data->buff = (uint8_t *) plist_node_alloc(node, sizeof(uint8_t) * size);
     if (!data->strval) {
-        plist_free_data(data);
+        plist_free(node);
         PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, sizeof(uint8_t) * size);
         return NULL;
     }
     memcpy(data->buff, *bnode, sizeof(uint8_t) * size);
 
-    return node_create(NULL, data);
+    return node;
 }
 
 static plist_t parse_dict_node(struct bplist_data *bplist, const char** bnode, uint64_t size)
@@ -430,7 +435,7 @@ static plist_t parse_dict_node(struct bplist_data *bplist, const char** bnode, u
     data->type = PLIST_DICT;
     data->length = size;
 
-    plist_t node = node_create(NULL, data);
+    plist_t node = plist_new_node(data);
 
     for (j = 0; j < data->length; j++) {
         str_i = j * bplist->ref_size;
@@ -459,27 +464,49 @@ static plist_t parse_dict_node(struct bplist_data *bplist, const char** bnode, u
             return NULL;
         }
 
-        /* process key node */
-        plist_t key = parse_bin_node_at_index(bplist, index1);
-        if (!key) {
-            plist_free(node);
-            return NULL;
-        }
+        /* process key node; a key seen before shares the data of the first one */
+        plist_t key = NULL;
+        if (bplist->keys && bplist->keys[index1]) {
+            key = plist_copy(bplist->keys[index1]);
+            if (!key) {
+                plist_free(node);
+                return NULL;
+            }
+        } else {
+            key = parse_bin_node_at_index(bplist, index1);
+            if (!key) {
+                plist_free(node);
+                return NULL;
+            }
 
-        if (plist_get_data(key)->type != PLIST_STRING) {
-            PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": invalid node type for key\n", __func__, j);
-            plist_free(key);
-            plist_free(node);
-            return NULL;
-        }
+            /* a key copied from the string memo may be one already */
+            if (plist_get_data(key)->type != PLIST_STRING && plist_get_data(key)->type != PLIST_KEY) {
+                PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": invalid node type for key\n", __func__, j);
+                plist_free(key);
+                plist_free(node);
+                return NULL;
+            }
 
-        /* enforce key type */
-        plist_get_data(key)->type = PLIST_KEY;
-        if (!plist_get_data(key)->strval) {
-            PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": key must not be NULL\n", __func__, j);
-            plist_free(key);
-            plist_free(node);
-            return NULL;
+            /* enforce key type */
+            if (plist_get_data(key)->type != PLIST_KEY) {
+                plist_data_t keydata = plist_get_writable_data(key);
+                if (!keydata) {
+                    plist_free(key);
+                    plist_free(node);
+                    return NULL;
+                }
+                keydata->type = PLIST_KEY;
+            }
+            if (!plist_get_data(key)->strval) {
+                PLIST_BIN_ERR("%s: dict entry %" PRIu64 ": key must not be NULL\n", __func__, j);
+                plist_free(key);
+                plist_free(node);
+                return NULL;
+            }
+
+            if (bplist->keys) {
+                bplist->keys[index1] = key;
+            }
         }
 
         /* process value node */
@@ -508,7 +535,7 @@ static plist_t parse_array_node(struct bplist_data *bplist, const char** bnode,
     data->type = PLIST_ARRAY;
     data->length = size;
 
-    plist_t node = node_create(NULL, data);
+    plist_t node = plist_new_node(data);
 
     for (j = 0; j < data->length; j++) {
         str_j = j * bplist->ref_size;
@@ -543,20 +570,22 @@ static plist_t parse_array_node(struct bplist_data *bplist, const char** bnode,
 
 static plist_t parse_uid_node(const char **bnode, uint8_t size)
 {
-    plist_data_t data = plist_new_plist_data();
+    plist_data_t data = NULL;
+    uint64_t intval = 0;
     size = size + 1;
-    data->intval = UINT_TO_HOST(*bnode, size);
-    if (data->intval > UINT32_MAX) {
-        PLIST_BIN_ERR("%s: value %" PRIu64 " too large for UID node (must be <= %u)\n", __func__, (uint64_t)data->intval, UINT32_MAX);
-        free(data);
+    intval = UINT_TO_HOST(*bnode, size);
+    if (intval > UINT32_MAX) {
+        PLIST_BIN_ERR("%s: value %" PRIu64 " too large for UID node (must be <= %u)\n", __func__, intval, UINT32_MAX);
         return NULL;
     }
 
+    data = plist_new_plist_data();
+    data->intval = intval;
     (*bnode) += size;
     data->type = PLIST_UID;
     data->length = sizeof(uint64_t);
 
-    return node_create(NULL, data);
+    return plist_new_node(data);
 }
 
 static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
@@ -617,7 +646,7 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
             data->type = PLIST_BOOLEAN;
             data->boolval = TRUE;
             data->length = 1;
-            return node_create(NULL, data);
+            return plist_new_node(data);
         }
 
         case BPLIST_FALSE:
@@ -626,7 +655,7 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
             data->type = PLIST_BOOLEAN;
             data->boolval = FALSE;
             data->length = 1;
-            return node_create(NULL, data);
+            return plist_new_node(data);
         }
 
         case BPLIST_NULL:
@@ -715,7 +744,6 @@ static plist_t parse_bin_node(struct bplist_data *bplist, const char** object)
 
 static plist_t parse_bin_node_at_index(struct bplist_data *bplist, uint32_t node_index)
 {
-    int i = 0;
     const char* ptr = NULL;
     plist_t plist = NULL;
     const char* idx_ptr = NULL;
@@ -739,35 +767,42 @@ static plist_t parse_bin_node_at_index(struct bplist_data *bplist, uint32_t node
         return NULL;
     }
 
-    /* store node_index for current recursion level */
-    if (plist_array_get_size(bplist->used_indexes) < bplist->level+1) {
-        while (plist_array_get_size(bplist->used_indexes) < bplist->level+1) {
-            plist_array_append_item(bplist->used_indexes, plist_new_uint(node_index));
-        }
-    } else {
-        plist_array_set_item(bplist->used_indexes, plist_new_uint(node_index), bplist->level);
+    /* recursion check */
+    if (bplist->used_indexes[node_index >> 3] & (1 << (node_index & 7))) {
+        PLIST_BIN_ERR("recursion detected in binary plist\n");
+        return NULL;
     }
 
-    /* recursion check */
-    if (bplist->level > 0) {
-        for (i = bplist->level-1; i >= 0; i--) {
-            plist_t node_i = plist_array_get_item(bplist->used_indexes, i);
-            plist_t node_level = plist_array_get_item(bplist->used_indexes, bplist->level);
-            if (plist_compare_node_value(node_i, node_level)) {
-                PLIST_BIN_ERR("recursion detected in binary plist\n");
+    /* strings are often referenced many times, e.g. keys of dicts in an
+       array; copy the node parsed before instead of decoding it again */
+    if (bplist->strings && bplist->strings[node_index]) {
+        plist = plist_copy(bplist->strings[node_index]);
+        /* the first copy may have been turned into a key since; the copy
+           shares its data, so it has to be separated before changing it */
+        if (plist && plist_get_data(plist)->type == PLIST_KEY) {
+            plist_data_t data = plist_get_writable_data(plist);
+            if (!data) {
+                plist_free(plist);
                 return NULL;
             }
+            data->type = PLIST_STRING;
         }
+        return plist;
     }
 
     /* finally parse node */
-    bplist->level++;
+    bplist->used_indexes[node_index >> 3] |= (1 << (node_index & 7));
     plist = parse_bin_node(bplist, &ptr);
-    bplist->level--;
+    bplist->used_indexes[node_index >> 3] &= ~(1 << (node_index & 7));
+
+    if (plist && bplist->strings && plist_get_data(plist)->type == PLIST_STRING) {
+        bplist->strings[node_index] = plist;
+    }
     return plist;
 }
 
-PLIST_API void plist_from_bin(const char *plist_bin, uint32_t length, plist_t * plist)
+/* validate the header and trailer of plist_bin and set up bplist for it */
+static int bplist_data_init(struct bplist_data *bplist, uint64_t *root_object_index, const char *plist_bin, uint32_t length)
 {
     bplist_trailer_t *trailer = NULL;
     uint8_t offset_size = 0;
@@ -782,17 +817,17 @@ PLIST_API void plist_from_bin(const char *plist_bin, uint32_t length, plist_t *
     //first check we have enough data
     if (!(length >= BPLIST_MAGIC_SIZE + BPLIST_VERSION_SIZE + sizeof(bplist_trailer_t))) {
         PLIST_BIN_ERR("plist data is to small to hold a binary plist\n");
-        return;
+        return -1;
     }
     //check that plist_bin in actually a plist
     if (memcmp(plist_bin, BPLIST_MAGIC, BPLIST_MAGIC_SIZE) != 0) {
         PLIST_BIN_ERR("bplist magic mismatch\n");
-        return;
+        return -1;
     }
     //check for known version
     if (memcmp(plist_bin + BPLIST_MAGIC_SIZE, BPLIST_VERSION, BPLIST_VERSION_SIZE) != 0) {
         PLIST_BIN_ERR("unsupported binary plist version '%.2s\n", plist_bin+BPLIST_MAGIC_SIZE);
-        return;
+        return -1;
     }
 
     start_data = plist_bin + BPLIST_MAGIC_SIZE + BPLIST_VERSION_SIZE;
@@ -809,66 +844,706 @@ PLIST_API void plist_from_bin(const char *plist_bin, uint32_t length, plist_t *
 
     if (num_objects == 0) {
         PLIST_BIN_ERR("number of objects must be larger than 0\n");
-        return;
+        return -1;
     }
 
     if (offset_size == 0) {
         PLIST_BIN_ERR("offset size in trailer must be larger than 0\n");
-        return;
+        return -1;
     }
 
     if (ref_size == 0) {
         PLIST_BIN_ERR("object reference size in trailer must be larger than 0\n");
-        return;
+        return -1;
     }
 
     if (root_object >= num_objects) {
         PLIST_BIN_ERR("root object index (%" PRIu64 ") must be smaller than number of objects (%" PRIu64 ")\n", root_object, num_objects);
-        return;
+        return -1;
     }
 
     if (offset_table < start_data || offset_table >= end_data) {
         PLIST_BIN_ERR("offset table offset points outside of valid range\n");
-        return;
+        return -1;
     }
 
     if (uint64_mul_overflow(num_objects, offset_size, &offset_table_size)) {
         PLIST_BIN_ERR("integer overflow when calculating offset table size\n");
-        return;
+        return -1;
     }
 
     if ((offset_table + offset_table_size < offset_table) || (offset_table + offset_table_size > end_data)) {
         PLIST_BIN_ERR("offset table points outside of valid range\n");
-        return;
+        return -1;
+    }
+
+    bplist->data = plist_bin;
+    bplist->size = length;
+    bplist->num_objects = num_objects;
+    bplist->ref_size = ref_size;
+    bplist->offset_size = offset_size;
+    bplist->offset_table = offset_table;
+    bplist->used_indexes = NULL;
+    bplist->strings = NULL;
+    bplist->keys = NULL;
+    *root_object_index = root_object;
+
+    return 0;
+}
+
+/* allocate the per-parse bookkeeping of bplist */
+static int bplist_data_begin(struct bplist_data *bplist)
+{
+    bplist->used_indexes = (uint8_t*)calloc(1, (bplist->num_objects + 7) / 8);
+    if (!bplist->used_indexes) {
+        PLIST_BIN_ERR("failed to allocate bitset to hold used node indexes. Out of memory?\n");
+        return -1;
     }
+    /* the string memos are an optimization only, parse without them if they do not fit */
+    bplist->strings = (plist_t*)calloc(bplist->num_objects, sizeof(plist_t));
+    bplist->keys = (plist_t*)calloc(bplist->num_objects, sizeof(plist_t));
 
+    return 0;
+}
+
+static void bplist_data_end(struct bplist_data *bplist)
+{
+    free(bplist->used_indexes);
+    free(bplist->strings);
+    free(bplist->keys);
+    bplist->used_indexes = NULL;
+    bplist->strings = NULL;
+    bplist->keys = NULL;
+}
+
+PLIST_API void plist_from_bin(const char *plist_bin, uint32_t length, plist_t * plist)
+{
     struct bplist_data bplist;
-    bplist.data = plist_bin;
-    bplist.size = length;
-    bplist.num_objects = num_objects;
-    bplist.ref_size = ref_size;
-    bplist.offset_size = offset_size;
-    bplist.offset_table = offset_table;
-    bplist.level = 0;
-    bplist.used_indexes = plist_new_array();
-
-    if (!bplist.used_indexes) {
-        PLIST_BIN_ERR("failed to create array to hold used node indexes. Out of memory?\n");
+    uint64_t root_object = 0;
+
+    if (bplist_data_init(&bplist, &root_object, plist_bin, length) < 0) {
+        return;
+    }
+
+    if (bplist_data_begin(&bplist) < 0) {
         return;
     }
 
     *plist = parse_bin_node_at_index(&bplist, root_object);
 
-    plist_free(bplist.used_indexes);
+    bplist_data_end(&bplist);
+}
+
+/* dictionaries with more entries than this get a sorted key index */
+#define BPLIST_VIEW_INDEX_THRESHOLD 32
+
+struct plist_bin_view_s {
+    struct bplist_data bplist;
+    uint64_t root_object;
+    hashtable_t *dict_indexes; /* filled in by lookups without locking, views are single-threaded */
+};
+
+struct bplist_view_object {
+    uint8_t type;
+    uint64_t size;
+    const char *payload;
+};
+
+/* a key of an indexed dictionary; the index is sorted by key */
+struct bplist_view_key {
+    const char *str;
+    uint64_t length;
+    uint8_t unicode;
+    uint32_t entry;
+};
+
+struct bplist_view_index {
+    uint32_t count;
+    struct bplist_view_key keys[];
+};
+
+/* walks the UTF-8 encoding of a bplist string one byte at a time */
+struct bplist_view_str_cursor {
+    const uint8_t *str;
+    uint64_t length;
+    uint64_t pos;
+    uint8_t unicode;
+    uint8_t buf[4];
+    uint8_t buf_len;
+    uint8_t buf_pos;
+};
+
+/* look up object ref and decode its marker, checking that the payload is in range */
+static int bplist_view_get_object(plist_bin_view_t view, plist_view_ref_t ref, struct bplist_view_object *obj)
+{
+    struct bplist_data *bplist = &view->bplist;
+    const char *ptr = NULL;
+    uint64_t payload_size = 0;
+
+    if (ref >= bplist->num_objects) {
+        PLIST_BIN_ERR("%s: object reference (%" PRIu64 ") must be smaller than the number of objects (%" PRIu64 ")\n", __func__, ref, bplist->num_objects);
+        return -1;
+    }
+
+    ptr = bplist->data + UINT_TO_HOST(bplist->offset_table + ref * bplist->offset_size, bplist->offset_size);
+    if ((ptr < bplist->data) || (ptr >= bplist->offset_table)) {
+        PLIST_BIN_ERR("%s: offset for object %" PRIu64 " points outside of valid range\n", __func__, ref);
+        return -1;
+    }
+
+    obj->type = *ptr & BPLIST_MASK;
+    obj->size = *ptr & BPLIST_FILL;
+    ptr++;
+
+    if (obj->size == BPLIST_FILL) {
+        switch (obj->type) {
+        case BPLIST_DATA:
+        case BPLIST_STRING:
+        case BPLIST_UNICODE:
+        case BPLIST_ARRAY:
+        case BPLIST_SET:
+        case BPLIST_DICT:
+        {
+            uint16_t next_size = *ptr & BPLIST_FILL;
+            if (ptr >= bplist->offset_table || (*ptr & BPLIST_MASK) != BPLIST_UINT) {
+                PLIST_BIN_ERR("%s: invalid size node for object %" PRIu64 "\n", __func__, ref);
+                return -1;
+            }
+            ptr++;
+            next_size = 1 << next_size;
+            if (ptr + next_size > bplist->offset_table) {
+                PLIST_BIN_ERR("%s: size node data bytes for object %" PRIu64 " point outside of valid range\n", __func__, ref);
+                return -1;
+            }
+            obj->size = UINT_TO_HOST(ptr, next_size);
+            ptr += next_size;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    switch (obj->type) {
+    case BPLIST_NULL:
+        payload_size = 0;
+        break;
+    case BPLIST_UINT:
+    case BPLIST_REAL:
+    case BPLIST_DATE:
+        payload_size = 1ULL << obj->size;
+        break;
+    case BPLIST_UID:
+        payload_size = obj->size + 1;
+        break;
+    case BPLIST_DATA:
+    case BPLIST_STRING:
+        payload_size = obj->size;
+        break;
+    case BPLIST_UNICODE:
+        if (uint64_mul_overflow(obj->size, 2, &payload_size)) {
+            return -1;
+        }
+        break;
+    case BPLIST_ARRAY:
+    case BPLIST_SET:
+        if (uint64_mul_overflow(obj->size, bplist->ref_size, &payload_size)) {
+            return -1;
+        }
+        break;
+    case BPLIST_DICT:
+        if (uint64_mul_overflow(obj->size, 2 * bplist->ref_size, &payload_size)) {
+            return -1;
+        }
+        break;
+    default:
+        PLIST_BIN_ERR("%s: unexpected node type 0x%02x\n", __func__, obj->type);
+        return -1;
+    }
+
+    if ((uint64_t)(bplist->offset_table - ptr) < payload_size) {
+        PLIST_BIN_ERR("%s: data bytes of object %" PRIu64 " point outside of valid range\n", __func__, ref);
+        return -1;
+    }
+    obj->payload = ptr;
+
+    return 0;
+}
+
+static plist_view_ref_t bplist_view_get_ref(plist_bin_view_t view, const char *ptr)
+{
+    uint64_t ref = UINT_TO_HOST(ptr, view->bplist.ref_size);
+    return (ref < view->bplist.num_objects) ? ref : PLIST_VIEW_REF_INVALID;
+}
+
+static void bplist_view_str_cursor_init(struct bplist_view_str_cursor *cur, const char *str, uint64_t length, uint8_t unicode)
+{
+    cur->str = (const uint8_t*)str;
+    cur->length = unicode ? length * 2 : length;
+    cur->pos = 0;
+    cur->unicode = unicode;
+    cur->buf_len = 0;
+    cur->buf_pos = 0;
+}
+
+/* next byte of the string in UTF-8, or -1 at the end. Unpaired surrogates
+   are skipped, like plist_utf16be_to_utf8 does. */
+static int bplist_view_str_cursor_next(struct bplist_view_str_cursor *cur)
+{
+    if (!cur->unicode) {
+        return (cur->pos < cur->length) ? cur->str[cur->pos++] : -1;
+    }
+    while (cur->buf_pos == cur->buf_len) {
+        uint32_t w;
+        if (cur->pos + 2 > cur->length) {
+            return -1;
+        }
+        w = (cur->str[cur->pos] << 8) | cur->str[cur->pos+1];
+        cur->pos += 2;
+        if (w >= 0xDC00 && w <= 0xDFFF) {
+            continue;
+        }
+        if (w >= 0xD800 && w <= 0xDBFF) {
+            uint32_t trail;
+            if (cur->pos + 2 > cur->length) {
+                return -1;
+            }
+            trail = (cur->str[cur->pos] << 8) | cur->str[cur->pos+1];
+            if (trail < 0xDC00 || trail > 0xDFFF) {
+                continue;
+            }
+            cur->pos += 2;
+            w = 0x010000 + ((w & 0x3FF) << 10) + (trail & 0x3FF);
+            cur->buf[0] = (uint8_t)(0xF0 + ((w >> 18) & 0x7));
+            cur->buf[1] = (uint8_t)(0x80 + ((w >> 12) & 0x3F));
+            cur->buf[2] = (uint8_t)(0x80 + ((w >> 6) & 0x3F));
+            cur->buf[3] = (uint8_t)(0x80 + (w & 0x3F));
+            cur->buf_len = 4;
+        } else if (w >= 0x800) {
+            cur->buf[0] = (uint8_t)(0xE0 + ((w >> 12) & 0xF));
+            cur->buf[1] = (uint8_t)(0x80 + ((w >> 6) & 0x3F));
+            cur->buf[2] = (uint8_t)(0x80 + (w & 0x3F));
+            cur->buf_len = 3;
+        } else if (w >= 0x80) {
+            cur->buf[0] = (uint8_t)(0xC0 + ((w >> 6) & 0x1F));
+            cur->buf[1] = (uint8_t)(0x80 + (w & 0x3F));
+            cur->buf_len = 2;
+        } else {
+            cur->buf[0] = (uint8_t)w;
+            cur->buf_len = 1;
+        }
+        cur->buf_pos = 0;
+    }
+    return cur->buf[cur->buf_pos++];
+}
+
+/* compare a bplist string with a 0-terminated UTF-8 string, like strcmp */
+static int bplist_view_key_compare_str(const struct bplist_view_key *key, const char *str)
+{
+    struct bplist_view_str_cursor cur;
+    const uint8_t *s = (const uint8_t*)str;
+
+    if (!key->unicode) {
+        size_t len = strlen(str);
+        int res = memcmp(key->str, str, (key->length < len) ? key->length : len);
+        if (res != 0) return res;
+        return (key->length < len) ? -1 : (key->length > len);
+    }
+
+    bplist_view_str_cursor_init(&cur, key->str, key->length, key->unicode);
+    while (1) {
+        int c = bplist_view_str_cursor_next(&cur);
+        if (c < 0) {
+            return (*s) ? -1 : 0;
+        }
+        if (c != *s) {
+            return c - *s;
+        }
+        s++;
+    }
+}
+
+static int bplist_view_key_compare(const void *a, const void *b)
+{
+    const struct bplist_view_key *key_a = (const struct bplist_view_key*)a;
+    const struct bplist_view_key *key_b = (const struct bplist_view_key*)b;
+    struct bplist_view_str_cursor cur_a;
+    struct bplist_view_str_cursor cur_b;
+
+    bplist_view_str_cursor_init(&cur_a, key_a->str, key_a->length, key_a->unicode);
+    bplist_view_str_cursor_init(&cur_b, key_b->str, key_b->length, key_b->unicode);
+    while (1) {
+        int c_a = bplist_view_str_cursor_next(&cur_a);
+        int c_b = bplist_view_str_cursor_next(&cur_b);
+        if (c_a != c_b) {
+            return c_a - c_b;
+        }
+        if (c_a < 0) {
+            /* equal keys keep their order, so the first one wins like in a linear scan */
+            return (key_a->entry > key_b->entry) - (key_a->entry < key_b->entry);
+        }
+    }
+}
+
+/* resolve the nth key of a dictionary payload */
+static int bplist_view_dict_get_key(plist_bin_view_t view, const struct bplist_view_object *dict, uint32_t n, struct bplist_view_key *key)
+{
+    struct bplist_view_object key_obj;
+    plist_view_ref_t ref = bplist_view_get_ref(view, dict->payload + (uint64_t)n * view->bplist.ref_size);
+
+    if (ref == PLIST_VIEW_REF_INVALID || bplist_view_get_object(view, ref, &key_obj) < 0) {
+        return -1;
+    }
+    if (key_obj.type != BPLIST_STRING && key_obj.type != BPLIST_UNICODE) {
+        PLIST_BIN_ERR("%s: dict entry %u: invalid node type for key\n", __func__, n);
+        return -1;
+    }
+    key->str = key_obj.payload;
+    key->length = key_obj.size;
+    key->unicode = (key_obj.type == BPLIST_UNICODE);
+    key->entry = n;
+
+    return 0;
+}
+
+static unsigned int bplist_view_ref_hash(const void *key)
+{
+    return hash_bytes(&key, sizeof(key), 0);
+}
+
+static int bplist_view_ref_compare(const void *a, const void *b)
+{
+    return a == b;
+}
+
+/* the sorted key index of a dictionary, built on first use */
+static struct bplist_view_index* bplist_view_get_index(plist_bin_view_t view, plist_view_ref_t ref, const struct bplist_view_object *dict)
+{
+    /* refs are offset by one since the hash table uses NULL for empty slots */
+    void *ht_key = (void*)(uintptr_t)(ref + 1);
+    struct bplist_view_index *index = NULL;
+    uint32_t i;
+
+    if (!view->dict_indexes) {
+        view->dict_indexes = hash_table_new(bplist_view_ref_hash, bplist_view_ref_compare, free);
+        if (!view->dict_indexes) {
+            return NULL;
+        }
+    }
+    index = (struct bplist_view_index*)hash_table_lookup(view->dict_indexes, ht_key);
+    if (index) {
+        return index;
+    }
+
+    index = (struct bplist_view_index*)malloc(sizeof(struct bplist_view_index) + dict->size * sizeof(struct bplist_view_key));
+    if (!index) {
+        PLIST_BIN_ERR("%s: Could not allocate key index for %" PRIu64 " entries\n", __func__, dict->size);
+        return NULL;
+    }
+    index->count = 0;
+    for (i = 0; i < dict->size; i++) {
+        /* entries with invalid keys can never match, leave them out */
+        if (bplist_view_dict_get_key(view, dict, i, &index->keys[index->count]) == 0) {
+            index->count++;
+        }
+    }
+    qsort(index->keys, index->count, sizeof(struct bplist_view_key), bplist_view_key_compare);
+    hash_table_insert(view->dict_indexes, ht_key, index);
+
+    return index;
+}
+
+/* the plist type of a decoded object, with the checks parse_bin_node applies */
+static plist_type bplist_view_object_type(const struct bplist_view_object *obj)
+{
+    switch (obj->type) {
+    case BPLIST_NULL:
+        return (obj->size == BPLIST_TRUE || obj->size == BPLIST_FALSE) ? PLIST_BOOLEAN : PLIST_NONE;
+    case BPLIST_UINT:
+        return (obj->size <= 4) ? PLIST_UINT : PLIST_NONE;
+    case BPLIST_REAL:
+        return (obj->size == 2 || obj->size == 3) ? PLIST_REAL : PLIST_NONE;
+    case BPLIST_DATE:
+        return (obj->size == 3) ? PLIST_DATE : PLIST_NONE;
+    case BPLIST_DATA:
+        return PLIST_DATA;
+    case BPLIST_STRING:
+    case BPLIST_UNICODE:
+        return PLIST_STRING;
+    case BPLIST_UID:
+        return (obj->size < 8) ? PLIST_UID : PLIST_NONE;
+    case BPLIST_ARRAY:
+    case BPLIST_SET:
+        return PLIST_ARRAY;
+    case BPLIST_DICT:
+        return PLIST_DICT;
+    default:
+        return PLIST_NONE;
+    }
+}
+
+/* decode object ref if it is of the given type */
+static int bplist_view_get_typed_object(plist_bin_view_t view, plist_view_ref_t ref, plist_type type, struct bplist_view_object *obj)
+{
+    if (!view || bplist_view_get_object(view, ref, obj) < 0)
+        return -1;
+    return (bplist_view_object_type(obj) == type) ? 0 : -1;
+}
+
+PLIST_API plist_bin_view_t plist_bin_view_new(const char *plist_bin, uint32_t length)
+{
+    plist_bin_view_t view = (plist_bin_view_t)malloc(sizeof(struct plist_bin_view_s));
+    if (!view) {
+        return NULL;
+    }
+    if (!plist_bin || bplist_data_init(&view->bplist, &view->root_object, plist_bin, length) < 0) {
+        free(view);
+        return NULL;
+    }
+    view->dict_indexes = NULL;
+
+    return view;
+}
+
+PLIST_API void plist_bin_view_free(plist_bin_view_t view)
+{
+    if (!view)
+        return;
+    if (view->dict_indexes) {
+        hash_table_destroy(view->dict_indexes);
+    }
+    free(view);
+}
+
+PLIST_API plist_view_ref_t plist_bin_view_get_root(plist_bin_view_t view)
+{
+    return view ? view->root_object : PLIST_VIEW_REF_INVALID;
+}
+
+PLIST_API plist_type plist_bin_view_get_node_type(plist_bin_view_t view, plist_view_ref_t ref)
+{
+    struct bplist_view_object obj;
+
+    if (!view || bplist_view_get_object(view, ref, &obj) < 0)
+        return PLIST_NONE;
+    return bplist_view_object_type(&obj);
+}
+
+PLIST_API uint32_t plist_bin_view_get_size(plist_bin_view_t view, plist_view_ref_t ref)
+{
+    struct bplist_view_object obj;
+
+    if (!view || bplist_view_get_object(view, ref, &obj) < 0)
+        return 0;
+    switch (bplist_view_object_type(&obj)) {
+    case PLIST_ARRAY:
+    case PLIST_DICT:
+        return (obj.size > UINT32_MAX) ? UINT32_MAX : (uint32_t)obj.size;
+    default:
+        return 0;
+    }
+}
+
+PLIST_API plist_view_ref_t plist_bin_view_array_get_item(plist_bin_view_t view, plist_view_ref_t ref, uint32_t n)
+{
+    struct bplist_view_object obj;
+
+    if (bplist_view_get_typed_object(view, ref, PLIST_ARRAY, &obj) < 0 || n >= obj.size)
+        return PLIST_VIEW_REF_INVALID;
+    return bplist_view_get_ref(view, obj.payload + (uint64_t)n * view->bplist.ref_size);
+}
+
+PLIST_API void plist_bin_view_dict_get_entry(plist_bin_view_t view, plist_view_ref_t ref, uint32_t n, plist_view_ref_t *key, plist_view_ref_t *val)
+{
+    struct bplist_view_object obj;
+    plist_view_ref_t key_ref = PLIST_VIEW_REF_INVALID;
+    plist_view_ref_t val_ref = PLIST_VIEW_REF_INVALID;
+
+    if (bplist_view_get_typed_object(view, ref, PLIST_DICT, &obj) == 0 && n < obj.size) {
+        key_ref = bplist_view_get_ref(view, obj.payload + (uint64_t)n * view->bplist.ref_size);
+        val_ref = bplist_view_get_ref(view, obj.payload + (obj.size + n) * view->bplist.ref_size);
+    }
+    if (key)
+        *key = key_ref;
+    if (val)
+        *val = val_ref;
+}
+
+PLIST_API plist_view_ref_t plist_bin_view_dict_get_item(plist_bin_view_t view, plist_view_ref_t ref, const char *key)
+{
+    struct bplist_view_object obj;
+    struct bplist_view_key entry_key;
+    int64_t entry = -1;
+    uint32_t i;
+
+    if (!key || bplist_view_get_typed_object(view, ref, PLIST_DICT, &obj) < 0)
+        return PLIST_VIEW_REF_INVALID;
+
+    if (obj.size > BPLIST_VIEW_INDEX_THRESHOLD) {
+        struct bplist_view_index *index = bplist_view_get_index(view, ref, &obj);
+        if (index) {
+            uint32_t lo = 0;
+            uint32_t hi = index->count;
+            /* find the first matching key */
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (bplist_view_key_compare_str(&index->keys[mid], key) < 0) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            if (lo < index->count && bplist_view_key_compare_str(&index->keys[lo], key) == 0) {
+                entry = index->keys[lo].entry;
+            }
+            goto found;
+        }
+    }
+
+    for (i = 0; i < obj.size; i++) {
+        if (bplist_view_dict_get_key(view, &obj, i, &entry_key) == 0 && bplist_view_key_compare_str(&entry_key, key) == 0) {
+            entry = i;
+            break;
+        }
+    }
+
+found:
+    if (entry < 0)
+        return PLIST_VIEW_REF_INVALID;
+    return bplist_view_get_ref(view, obj.payload + (obj.size + entry) * view->bplist.ref_size);
+}
+
+PLIST_API void plist_bin_view_get_bool_val(plist_bin_view_t view, plist_view_ref_t ref, uint8_t *val)
+{
+    struct bplist_view_object obj;
+
+    if (!val || bplist_view_get_typed_object(view, ref, PLIST_BOOLEAN, &obj) < 0)
+        return;
+    *val = (obj.size == BPLIST_TRUE);
+}
+
+PLIST_API void plist_bin_view_get_uint_val(plist_bin_view_t view, plist_view_ref_t ref, uint64_t *val)
+{
+    struct bplist_view_object obj;
+
+    uint8_t size = 0;
+
+    if (!val || bplist_view_get_typed_object(view, ref, PLIST_UINT, &obj) < 0)
+        return;
+    size = 1 << obj.size;
+    *val = UINT_TO_HOST(obj.payload, size);
+}
+
+PLIST_API void plist_bin_view_get_real_val(plist_bin_view_t view, plist_view_ref_t ref, double *val)
+{
+    struct bplist_view_object obj;
+    uint8_t buf[8];
+
+    if (!val || bplist_view_get_typed_object(view, ref, PLIST_REAL, &obj) < 0)
+        return;
+    if (obj.size == 2) {
+        *(uint32_t*)buf = float_bswap32(get_unaligned((uint32_t*)obj.payload));
+        *val = *(float *) buf;
+    } else {
+        *(uint64_t*)buf = float_bswap64(get_unaligned((uint64_t*)obj.payload));
+        *val = *(double *) buf;
+    }
+}
+
+PLIST_API void plist_bin_view_get_date_val(plist_bin_view_t view, plist_view_ref_t ref, int32_t *sec, int32_t *usec)
+{
+    struct bplist_view_object obj;
+    uint8_t buf[8];
+    double val = 0;
+
+    if (bplist_view_get_typed_object(view, ref, PLIST_DATE, &obj) < 0)
+        return;
+    *(uint64_t*)buf = float_bswap64(get_unaligned((uint64_t*)obj.payload));
+    val = *(double *) buf;
+    if (sec)
+        *sec = (int32_t)val;
+    if (usec)
+        *usec = (int32_t)fabs((val - (int64_t)val) * 1000000);
+}
+
+PLIST_API void plist_bin_view_get_uid_val(plist_bin_view_t view, plist_view_ref_t ref, uint64_t *val)
+{
+    struct bplist_view_object obj;
+
+    if (!val || bplist_view_get_typed_object(view, ref, PLIST_UID, &obj) < 0)
+        return;
+    *val = UINT_TO_HOST(obj.payload, obj.size + 1);
+}
+
+PLIST_API const char* plist_bin_view_get_string_ptr(plist_bin_view_t view, plist_view_ref_t ref, uint64_t *length)
+{
+    struct bplist_view_object obj;
+
+    if (bplist_view_get_typed_object(view, ref, PLIST_STRING, &obj) < 0 || obj.type != BPLIST_STRING)
+        return NULL;
+    if (length)
+        *length = obj.size;
+    return obj.payload;
+}
+
+PLIST_API void plist_bin_view_get_string_val(plist_bin_view_t view, plist_view_ref_t ref, char **val)
+{
+    struct bplist_view_object obj;
+
+    if (!val || bplist_view_get_typed_object(view, ref, PLIST_STRING, &obj) < 0)
+        return;
+    if (obj.type == BPLIST_UNICODE) {
+        if (obj.size == 0) {
+            *val = strdup("");
+        } else {
+            *val = plist_utf16be_to_utf8((uint16_t*)obj.payload, obj.size, NULL, NULL);
+        }
+        return;
+    }
+    *val = (char*)malloc(obj.size + 1);
+    if (!*val) {
+        PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, obj.size + 1);
+        return;
+    }
+    memcpy(*val, obj.payload, obj.size);
+    (*val)[obj.size] = '\0';
+}
+
+PLIST_API const char* plist_bin_view_get_data_ptr(plist_bin_view_t view, plist_view_ref_t ref, uint64_t *length)
+{
+    struct bplist_view_object obj;
+
+    if (bplist_view_get_typed_object(view, ref, PLIST_DATA, &obj) < 0)
+        return NULL;
+    if (length)
+        *length = obj.size;
+    return obj.payload;
+}
+
+PLIST_API plist_t plist_bin_view_copy_node(plist_bin_view_t view, plist_view_ref_t ref)
+{
+    struct bplist_data bplist;
+    plist_t plist = NULL;
+
+    if (!view || ref >= view->bplist.num_objects)
+        return NULL;
+
+    bplist = view->bplist;
+    if (bplist_data_begin(&bplist) < 0) {
+        return NULL;
+    }
+
+    plist = parse_bin_node_at_index(&bplist, (uint32_t)ref);
+
+    bplist_data_end(&bplist);
+
+    return plist;
 }
 
 static unsigned int plist_data_hash(const void* key)
 {
     plist_data_t data = plist_get_data((plist_t) key);
 
-    unsigned int hash = data->type;
-    unsigned int i = 0;
-
     char *buff = NULL;
     unsigned int size = 0;
 
@@ -898,51 +1573,155 @@ static unsigned int plist_data_hash(const void* key)
         break;
     }
 
-    // now perform hash using djb2 hashing algorithm
-    // see: http://www.cse.yorku.ca/~oz/hash.html
-    hash += 5381;
-    for (i = 0; i < size; buff++, i++) {
-        hash = ((hash << 5) + hash) + *buff;
-    }
-
-    return hash;
+    return hash_bytes(buff, size, data->type);
 }
 
+/* an object of the binary plist; containers keep the range of their child
+   references in serialize_s.refs */
+struct serialize_object
+{
+    node_t* node;
+    uint64_t refs;
+};
+
+/* a slot of the dedup table, index is the object index + 1 and 0 if empty */
+struct serialize_entry
+{
+    uint64_t index;
+    unsigned int hash;
+};
+
 struct serialize_s
 {
-    ptrarray_t* objects;
-    hashtable_t* ref_table;
+    struct serialize_object* objects;
+    uint64_t num_objects;
+    uint64_t objects_capacity;
+    uint64_t* refs;
+    uint64_t num_refs;
+    uint64_t refs_capacity;
+    struct serialize_entry* table;
+    uint64_t table_capacity;
+    uint64_t table_count;
+    int dedup;
 };
 
-static void serialize_plist(node_t* node, void* data)
+#define SERIALIZE_FAILED UINT64_MAX
+
+static int serialize_reserve(void **buf, uint64_t *capacity, uint64_t needed, size_t item_size)
 {
-    uint64_t *index_val = NULL;
-    struct serialize_s *ser = (struct serialize_s *) data;
-    uint64_t current_index = ser->objects->len;
+    uint64_t new_capacity = *capacity;
+    void *new_buf = NULL;
+    if (needed <= *capacity)
+        return 0;
+    while (new_capacity < needed) {
+        new_capacity = (new_capacity) ? new_capacity * 2 : 256;
+    }
+    new_buf = realloc(*buf, new_capacity * item_size);
+    if (!new_buf) {
+        PLIST_BIN_ERR("%s: Could not allocate %" PRIu64 " bytes\n", __func__, new_capacity * item_size);
+        return -1;
+    }
+    *buf = new_buf;
+    *capacity = new_capacity;
+    return 0;
+}
 
-    //first check that node is not yet in objects
-    void* val = hash_table_lookup(ser->ref_table, node);
-    if (val)
-    {
-        //data is already in table
-        return;
+static int serialize_table_grow(struct serialize_s *ser)
+{
+    uint64_t new_capacity = (ser->table_capacity) ? ser->table_capacity * 2 : 256;
+    struct serialize_entry *table = (struct serialize_entry*)calloc(new_capacity, sizeof(struct serialize_entry));
+    uint64_t i;
+    if (!table) {
+        PLIST_BIN_ERR("%s: Could not allocate dedup table with %" PRIu64 " entries\n", __func__, new_capacity);
+        return -1;
+    }
+    for (i = 0; i < ser->table_capacity; i++) {
+        if (ser->table[i].index) {
+            uint64_t slot = ser->table[i].hash & (new_capacity - 1);
+            while (table[slot].index) {
+                slot = (slot + 1) & (new_capacity - 1);
+            }
+            table[slot] = ser->table[i];
+        }
     }
-    //insert new ref
-    index_val = (uint64_t *) malloc(sizeof(uint64_t));
-    assert(index_val != NULL);
-    *index_val = current_index;
-    hash_table_insert(ser->ref_table, node, index_val);
+    free(ser->table);
+    ser->table = table;
+    ser->table_capacity = new_capacity;
+    return 0;
+}
 
-    //now append current node to object array
-    ptr_array_add(ser->objects, node);
+/* add node and everything below it to the object list, return its object index */
+static uint64_t serialize_plist(struct serialize_s *ser, node_t* node)
+{
+    plist_data_t data = plist_get_data(node);
+    unsigned int hash = 0;
+    uint64_t slot = 0;
+    uint64_t index = 0;
+    uint64_t refs = 0;
+    uint64_t n = 0;
+    int dedup = 0;
+
+    /* only scalars are written once for all equal values; data and
+       containers are unique per node */
+    switch (data->type) {
+    case PLIST_BOOLEAN:
+    case PLIST_UINT:
+    case PLIST_REAL:
+    case PLIST_DATE:
+    case PLIST_UID:
+    case PLIST_KEY:
+    case PLIST_STRING:
+        dedup = ser->dedup;
+        break;
+    default:
+        break;
+    }
 
-    //now recurse on children
-    node_t *ch;
-    for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-        serialize_plist(ch, data);
+    if (dedup) {
+        if ((ser->table_count + 1) * 4 > ser->table_capacity * 3 && serialize_table_grow(ser) < 0) {
+            return SERIALIZE_FAILED;
+        }
+        hash = plist_data_hash(node);
+        for (slot = hash & (ser->table_capacity - 1); ser->table[slot].index; slot = (slot + 1) & (ser->table_capacity - 1)) {
+            struct serialize_entry *entry = &ser->table[slot];
+            if (entry->hash == hash && plist_data_compare(ser->objects[entry->index - 1].node, node)) {
+                return entry->index - 1;
+            }
+        }
     }
 
-    return;
+    if (serialize_reserve((void**)&ser->objects, &ser->objects_capacity, ser->num_objects + 1, sizeof(struct serialize_object)) < 0) {
+        return SERIALIZE_FAILED;
+    }
+    index = ser->num_objects++;
+    ser->objects[index].node = node;
+    ser->objects[index].refs = 0;
+
+    if (dedup) {
+        ser->table[slot].index = index + 1;
+        ser->table[slot].hash = hash;
+        ser->table_count++;
+    }
+
+    n = node_n_children(node);
+    if (n > 0) {
+        node_t *ch;
+        if (serialize_reserve((void**)&ser->refs, &ser->refs_capacity, ser->num_refs + n, sizeof(uint64_t)) < 0) {
+            return SERIALIZE_FAILED;
+        }
+        refs = ser->num_refs;
+        ser->num_refs += n;
+        ser->objects[index].refs = refs;
+        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
+            uint64_t child = serialize_plist(ser, ch);
+            if (child == SERIALIZE_FAILED) {
+                return SERIALIZE_FAILED;
+            }
+            ser->refs[refs++] = child;
+        }
+    }
+
+    return index;
 }
 
 #define Log2(x) (x == 8 ? 3 : (x == 4 ? 2 : (x == 2 ? 1 : 0)))
@@ -1085,9 +1864,14 @@ static void write_unicode(bytearray_t * bplist, char *val, uint64_t size)
     free(unicodestr);
 }
 
-static void write_array(bytearray_t * bplist, node_t* node, hashtable_t* ref_table, uint8_t ref_size)
+static void write_ref(bytearray_t * bplist, uint64_t idx, uint8_t ref_size)
+{
+    idx = be64toh(idx);
+    byte_array_append(bplist, (uint8_t*)&idx + (sizeof(uint64_t) - ref_size), ref_size);
+}
+
+static void write_array(bytearray_t * bplist, node_t* node, const uint64_t* refs, uint8_t ref_size)
 {
-    node_t* cur = NULL;
     uint64_t i = 0;
 
     uint64_t size = node_n_children(node);
@@ -1097,16 +1881,13 @@ static void write_array(bytearray_t * bplist, node_t* node, hashtable_t* ref_tab
         write_int(bplist, size);
     }
 
-    for (i = 0, cur = node_first_child(node); cur && i < size; cur = node_next_sibling(cur), i++) {
-        uint64_t idx = *(uint64_t *) (hash_table_lookup(ref_table, cur));
-        idx = be64toh(idx);
-        byte_array_append(bplist, (uint8_t*)&idx + (sizeof(uint64_t) - ref_size), ref_size);
+    for (i = 0; i < size; i++) {
+        write_ref(bplist, refs[i], ref_size);
     }
 }
 
-static void write_dict(bytearray_t * bplist, node_t* node, hashtable_t* ref_table, uint8_t ref_size)
+static void write_dict(bytearray_t * bplist, node_t* node, const uint64_t* refs, uint8_t ref_size)
 {
-    node_t* cur = NULL;
     uint64_t i = 0;
 
     uint64_t size = node_n_children(node) / 2;
@@ -1116,16 +1897,13 @@ static void write_dict(bytearray_t * bplist, node_t* node, hashtable_t* ref_tabl
         write_int(bplist, size);
     }
 
-    for (i = 0, cur = node_first_child(node); cur && i < size; cur = node_next_sibling(node_next_sibling(cur)), i++) {
-        uint64_t idx1 = *(uint64_t *) (hash_table_lookup(ref_table, cur));
-        idx1 = be64toh(idx1);
-        byte_array_append(bplist, (uint8_t*)&idx1 + (sizeof(uint64_t) - ref_size), ref_size);
+    /* refs alternate between keys and values */
+    for (i = 0; i < size; i++) {
+        write_ref(bplist, refs[2*i], ref_size);
     }
 
-    for (i = 0, cur = node_first_child(node); cur && i < size; cur = node_next_sibling(node_next_sibling(cur)), i++) {
-        uint64_t idx2 = *(uint64_t *) (hash_table_lookup(ref_table, cur->next));
-        idx2 = be64toh(idx2);
-        byte_array_append(bplist, (uint8_t*)&idx2 + (sizeof(uint64_t) - ref_size), ref_size);
+    for (i = 0; i < size; i++) {
+        write_ref(bplist, refs[2*i+1], ref_size);
     }
 }
 
@@ -1158,51 +1936,15 @@ static int is_ascii_string(char* s, int len)
   return ret;
 }
 
-PLIST_API void plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
+/* the size of the binary plist made of objects, to allocate the output buffer at once */
+static uint64_t estimate_bin_size(const struct serialize_s* ser, uint8_t ref_size)
 {
-    ptrarray_t* objects = NULL;
-    hashtable_t* ref_table = NULL;
-    struct serialize_s ser_s;
-    uint8_t offset_size = 0;
-    uint8_t ref_size = 0;
-    uint64_t num_objects = 0;
-    uint64_t root_object = 0;
-    uint64_t offset_table_index = 0;
-    bytearray_t *bplist_buff = NULL;
+    uint64_t num_objects = ser->num_objects;
     uint64_t i = 0;
-    uint8_t *buff = NULL;
-    uint64_t *offsets = NULL;
-    bplist_trailer_t trailer;
-    uint64_t objects_len = 0;
-    uint64_t buff_len = 0;
-
-    //check for valid input
-    if (!plist || !plist_bin || *plist_bin || !length)
-        return;
-
-    //list of objects
-    objects = ptr_array_new(4096);
-    //hashtable to write only once same nodes
-    ref_table = hash_table_new(plist_data_hash, plist_data_compare, free);
-
-    //serialize plist
-    ser_s.objects = objects;
-    ser_s.ref_table = ref_table;
-    serialize_plist(plist, &ser_s);
-
-    //now stream to output buffer
-    offset_size = 0;			//unknown yet
-    objects_len = objects->len;
-    ref_size = get_needed_bytes(objects_len);
-    num_objects = objects->len;
-    root_object = 0;			//root is first in list
-    offset_table_index = 0;		//unknown yet
-
-    //figure out the storage size required
     uint64_t req = 0;
     for (i = 0; i < num_objects; i++)
     {
-        node_t* node = ptr_array_index(objects, i);
+        node_t* node = ser->objects[i].node;
         plist_data_t data = plist_get_data(node);
         uint64_t size;
         uint8_t bsize;
@@ -1280,8 +2022,55 @@ PLIST_API void plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
     // add size of trailer
     req += sizeof(bplist_trailer_t);
 
+    return req;
+}
+
+static void serialize_free(struct serialize_s *ser)
+{
+    free(ser->objects);
+    free(ser->refs);
+    free(ser->table);
+}
+
+/* serialize plist into a new buffer, or stream it through flush_func if set */
+static bytearray_t* write_bin(plist_t plist, int dedup, bytearray_flush_func_t flush_func, void *user_data)
+{
+    struct serialize_s ser_s;
+    uint8_t offset_size = 0;
+    uint8_t ref_size = 0;
+    uint64_t num_objects = 0;
+    uint64_t root_object = 0;
+    uint64_t offset_table_index = 0;
+    bytearray_t *bplist_buff = NULL;
+    uint64_t i = 0;
+    uint8_t *buff = NULL;
+    uint64_t *offsets = NULL;
+    bplist_trailer_t trailer;
+    uint64_t objects_len = 0;
+    uint64_t buff_len = 0;
+
+    //serialize plist into a flat list of objects
+    memset(&ser_s, 0, sizeof(ser_s));
+    ser_s.dedup = dedup;
+    if (serialize_plist(&ser_s, plist) == SERIALIZE_FAILED) {
+        serialize_free(&ser_s);
+        return NULL;
+    }
+
+    //now stream to output buffer
+    offset_size = 0;			//unknown yet
+    objects_len = ser_s.num_objects;
+    ref_size = get_needed_bytes(objects_len);
+    num_objects = ser_s.num_objects;
+    root_object = 0;			//root is first in list
+    offset_table_index = 0;		//unknown yet
+
     //setup a dynamic bytes array to store bplist in
-    bplist_buff = byte_array_new(req);
+    if (flush_func) {
+        bplist_buff = byte_array_new_with_flush(PLIST_WRITE_BUFFER_SIZE, flush_func, user_data);
+    } else {
+        bplist_buff = byte_array_new(estimate_bin_size(&ser_s, ref_size));
+    }
 
     //set magic number and version
     byte_array_append(bplist_buff, BPLIST_MAGIC, BPLIST_MAGIC_SIZE);
@@ -1290,11 +2079,12 @@ PLIST_API void plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
     //write objects and table
     offsets = (uint64_t *) malloc(num_objects * sizeof(uint64_t));
     assert(offsets != NULL);
-    for (i = 0; i < num_objects; i++)
+    for (i = 0; i < num_objects && !bplist_buff->error; i++)
     {
 
-        plist_data_t data = plist_get_data(ptr_array_index(objects, i));
-        offsets[i] = bplist_buff->len;
+        node_t* node = ser_s.objects[i].node;
+        plist_data_t data = plist_get_data(node);
+        offsets[i] = bplist_buff->flushed + bplist_buff->len;
 
         switch (data->type)
         {
@@ -1332,10 +2122,10 @@ PLIST_API void plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
             write_data(bplist_buff, data->buff, data->length);
             break;
         case PLIST_ARRAY:
-            write_array(bplist_buff, ptr_array_index(objects, i), ref_table, ref_size);
+            write_array(bplist_buff, node, ser_s.refs + ser_s.objects[i].refs, ref_size);
             break;
         case PLIST_DICT:
-            write_dict(bplist_buff, ptr_array_index(objects, i), ref_table, ref_size);
+            write_dict(bplist_buff, node, ser_s.refs + ser_s.objects[i].refs, ref_size);
             break;
         case PLIST_DATE:
             write_date(bplist_buff, data->realval);
@@ -1349,13 +2139,12 @@ PLIST_API void plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
     }
 
     //free intermediate objects
-    ptr_array_free(objects);
-    hash_table_destroy(ref_table);
+    serialize_free(&ser_s);
 
     //write offsets
-    buff_len = bplist_buff->len;
+    buff_len = bplist_buff->flushed + bplist_buff->len;
     offset_size = get_needed_bytes(buff_len);
-    offset_table_index = bplist_buff->len;
+    offset_table_index = buff_len;
     for (i = 0; i < num_objects; i++) {
         uint64_t offset = be64toh(offsets[i]);
         byte_array_append(bplist_buff, (uint8_t*)&offset + (sizeof(uint64_t) - offset_size), offset_size);
@@ -1372,6 +2161,21 @@ PLIST_API void plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
 
     byte_array_append(bplist_buff, &trailer, sizeof(bplist_trailer_t));
 
+    return bplist_buff;
+}
+
+PLIST_API void plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
+{
+    bytearray_t *bplist_buff = NULL;
+
+    //check for valid input
+    if (!plist || !plist_bin || *plist_bin || !length)
+        return;
+
+    bplist_buff = write_bin(plist, 1, NULL, NULL);
+    if (!bplist_buff)
+        return;
+
     //set output buffer and size
     *plist_bin = bplist_buff->data;
     *length = bplist_buff->len;
@@ -1379,3 +2183,39 @@ PLIST_API void plist_to_bin(plist_t plist, char **plist_bin, uint32_t * length)
     bplist_buff->data = NULL; // make sure we don't free the output buffer
     byte_array_free(bplist_buff);
 }
+
+PLIST_API void plist_to_bin_with_options(plist_t plist, char **plist_bin, uint32_t * length, plist_write_options_t options)
+{
+    bytearray_t *bplist_buff = NULL;
+
+    //check for valid input
+    if (!plist || !plist_bin || *plist_bin || !length)
+        return;
+
+    bplist_buff = write_bin(plist, !(options & PLIST_OPT_NO_DEDUP), NULL, NULL);
+    if (!bplist_buff)
+        return;
+
+    *plist_bin = bplist_buff->data;
+    *length = bplist_buff->len;
+
+    bplist_buff->data = NULL; // make sure we don't free the output buffer
+    byte_array_free(bplist_buff);
+}
+
+PLIST_API int plist_to_bin_with_func(plist_t plist, plist_write_func_t write_func, void *user_data)
+{
+    bytearray_t *bplist_buff = NULL;
+    int res = 0;
+
+    if (!plist || !write_func)
+        return -1;
+
+    bplist_buff = write_bin(plist, 1, write_func, user_data);
+    if (!bplist_buff)
+        return -1;
+    res = byte_array_flush(bplist_buff);
+    byte_array_free(bplist_buff);
+
+    return res;
+}
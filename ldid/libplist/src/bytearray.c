@@ -29,9 +29,35 @@ bytearray_t *byte_array_new(size_t initial)
 	a->capacity = (initial > PAGE_SIZE) ? (initial+(PAGE_SIZE-1)) & (~(PAGE_SIZE-1)) : PAGE_SIZE;
 	a->data = malloc(a->capacity);
 	a->len = 0;
+	a->flush_func = NULL;
+	a->flush_data = NULL;
+	a->flushed = 0;
+	a->error = 0;
 	return a;
 }
 
+bytearray_t *byte_array_new_with_flush(size_t capacity, bytearray_flush_func_t flush_func, void *user_data)
+{
+	bytearray_t *a = byte_array_new(capacity);
+	if (!a) return NULL;
+	a->flush_func = flush_func;
+	a->flush_data = user_data;
+	return a;
+}
+
+int byte_array_flush(bytearray_t *ba)
+{
+	if (!ba || !ba->flush_func) return -1;
+	if (ba->len > 0 && !ba->error) {
+		if (ba->flush_func(ba->data, ba->len, ba->flush_data) < 0) {
+			ba->error = 1;
+		}
+	}
+	ba->flushed += ba->len;
+	ba->len = 0;
+	return ba->error ? -1 : 0;
+}
+
 void byte_array_free(bytearray_t *ba)
 {
 	if (!ba) return;
@@ -43,6 +69,14 @@ void byte_array_free(bytearray_t *ba)
 
 void byte_array_grow(bytearray_t *ba, size_t amount)
 {
+	if (ba->flush_func) {
+		/* make room by writing out what we have, only grow for a single large append */
+		byte_array_flush(ba);
+		if (amount <= ba->capacity) {
+			return;
+		}
+		amount -= ba->capacity;
+	}
 	size_t increase = (amount > PAGE_SIZE) ? (amount+(PAGE_SIZE-1)) & (~(PAGE_SIZE-1)) : PAGE_SIZE;
 	ba->data = realloc(ba->data, ba->capacity + increase);
 	ba->capacity += increase;
@@ -50,9 +84,19 @@ void byte_array_grow(bytearray_t *ba, size_t amount)
 
 void byte_array_append(bytearray_t *ba, void *buf, size_t len)
 {
-	if (!ba || !ba->data || (len <= 0)) return;
+	if (!ba || !ba->data || (len <= 0) || ba->error) return;
 	size_t remaining = ba->capacity-ba->len;
-	if (len > remaining) {
+	if (len > remaining && ba->flush_func) {
+		byte_array_flush(ba);
+		if (len > ba->capacity) {
+			/* too large to buffer, pass it through */
+			if (!ba->error && ba->flush_func(buf, len, ba->flush_data) < 0) {
+				ba->error = 1;
+			}
+			ba->flushed += len;
+			return;
+		}
+	} else if (len > remaining) {
 		size_t needed = len - remaining;
 		byte_array_grow(ba, needed);
 	}
@@ -22,13 +22,23 @@
 #define BYTEARRAY_H
 #include <stdlib.h>
 
+typedef int (*bytearray_flush_func_t)(const void *buf, size_t len, void *user_data);
+
+/* with a flush function set, the buffer is handed to it whenever it fills
+   up instead of growing; flushed counts the bytes written out so far */
 typedef struct bytearray_t {
 	void *data;
 	size_t len;
 	size_t capacity;
+	bytearray_flush_func_t flush_func;
+	void *flush_data;
+	size_t flushed;
+	int error;
 } bytearray_t;
 
 bytearray_t *byte_array_new(size_t initial);
+bytearray_t *byte_array_new_with_flush(size_t capacity, bytearray_flush_func_t flush_func, void *user_data);
+int byte_array_flush(bytearray_t *ba);
 void byte_array_free(bytearray_t *ba);
 void byte_array_grow(bytearray_t *ba, size_t amount);
 void byte_array_append(bytearray_t *ba, void *buf, size_t len);
@@ -0,0 +1,240 @@
+/*
+ * charscan.c
+ * vectorized character class scanning, selected at runtime
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdint.h>
+#include "charscan.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHAR_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define CHAR_SCAN_AVX2
+#define CHAR_SCAN_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || __GNUC__ >= 5)
+#define CHAR_SCAN_AVX2
+#define CHAR_SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define CHAR_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <windows.h>
+#include <intrin.h>
+static unsigned int ctz32(uint32_t x)
+{
+	unsigned long idx;
+	_BitScanForward(&idx, x);
+	return (unsigned int)idx;
+}
+#if defined(CHAR_SCAN_NEON)
+static unsigned int ctz64(uint64_t x)
+{
+	unsigned long idx;
+	_BitScanForward64(&idx, x);
+	return (unsigned int)idx;
+}
+#endif
+#else
+#define ctz32(x) ((unsigned int)__builtin_ctz(x))
+#define ctz64(x) ((unsigned int)__builtin_ctzll(x))
+#endif
+
+typedef const char* (*char_scan_func_t)(const char *p, const char *end, const char *set, size_t nset, int invert);
+
+static const char* char_scan_scalar(const char *p, const char *end, const char *set, size_t nset, int invert)
+{
+	size_t i;
+	for (; p < end; p++) {
+		int match = 0;
+		for (i = 0; i < nset; i++) {
+			if (*p == set[i]) {
+				match = 1;
+				break;
+			}
+		}
+		if (match != invert) {
+			break;
+		}
+	}
+	return p;
+}
+
+#ifdef CHAR_SCAN_SSE2
+static const char* char_scan_sse2(const char *p, const char *end, const char *set, size_t nset, int invert)
+{
+	__m128i needles[CHAR_SCAN_MAX_SET];
+	unsigned int flip = (invert) ? 0xFFFF : 0;
+	size_t i;
+
+	for (i = 0; i < nset; i++) {
+		needles[i] = _mm_set1_epi8(set[i]);
+	}
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		__m128i m = _mm_cmpeq_epi8(v, needles[0]);
+		for (i = 1; i < nset; i++) {
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, needles[i]));
+		}
+		unsigned int bits = (unsigned int)_mm_movemask_epi8(m) ^ flip;
+		if (bits) {
+			return p + ctz32(bits);
+		}
+		p += 16;
+	}
+	return char_scan_scalar(p, end, set, nset, invert);
+}
+#endif
+
+#ifdef CHAR_SCAN_AVX2
+static CHAR_SCAN_TARGET_AVX2 const char* char_scan_avx2(const char *p, const char *end, const char *set, size_t nset, int invert)
+{
+	__m256i needles[CHAR_SCAN_MAX_SET];
+	uint32_t flip = (invert) ? 0xFFFFFFFF : 0;
+	size_t i;
+
+	for (i = 0; i < nset; i++) {
+		needles[i] = _mm256_set1_epi8(set[i]);
+	}
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		__m256i m = _mm256_cmpeq_epi8(v, needles[0]);
+		for (i = 1; i < nset; i++) {
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, needles[i]));
+		}
+		uint32_t bits = (uint32_t)_mm256_movemask_epi8(m) ^ flip;
+		if (bits) {
+			return p + ctz32(bits);
+		}
+		p += 32;
+	}
+	return char_scan_scalar(p, end, set, nset, invert);
+}
+
+static int char_scan_has_avx2(void)
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return 0;
+	}
+	__cpuid(info, 1);
+	/* the OS has to save the ymm registers too (OSXSAVE, AVX, XCR0 bits 1 and 2) */
+	if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6) {
+		return 0;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#ifdef CHAR_SCAN_NEON
+static const char* char_scan_neon(const char *p, const char *end, const char *set, size_t nset, int invert)
+{
+	uint8x16_t needles[CHAR_SCAN_MAX_SET];
+	size_t i;
+
+	for (i = 0; i < nset; i++) {
+		needles[i] = vdupq_n_u8((uint8_t)set[i]);
+	}
+	while (end - p >= 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t*)p);
+		uint8x16_t m = vceqq_u8(v, needles[0]);
+		for (i = 1; i < nset; i++) {
+			m = vorrq_u8(m, vceqq_u8(v, needles[i]));
+		}
+		if (invert) {
+			m = vmvnq_u8(m);
+		}
+		/* narrow to 4 bits per byte, NEON has no movemask */
+		uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+		if (bits) {
+			return p + (ctz64(bits) >> 2);
+		}
+		p += 16;
+	}
+	return char_scan_scalar(p, end, set, nset, invert);
+}
+#endif
+
+static const char* char_scan_resolve(const char *p, const char *end, const char *set, size_t nset, int invert);
+
+static char_scan_func_t char_scan_impl = char_scan_resolve;
+
+/* the first scan swaps in the resolved function while other threads may already be reading the pointer */
+#if defined(_MSC_VER)
+#define CHAR_SCAN_IMPL_LOAD() ((char_scan_func_t)InterlockedCompareExchangePointer((PVOID volatile*)&char_scan_impl, NULL, NULL))
+#define CHAR_SCAN_IMPL_STORE(f) InterlockedExchangePointer((PVOID volatile*)&char_scan_impl, (PVOID)(f))
+#else
+#define CHAR_SCAN_IMPL_LOAD() __atomic_load_n(&char_scan_impl, __ATOMIC_ACQUIRE)
+#define CHAR_SCAN_IMPL_STORE(f) __atomic_store_n(&char_scan_impl, (f), __ATOMIC_RELEASE)
+#endif
+
+static const char* char_scan_resolve(const char *p, const char *end, const char *set, size_t nset, int invert)
+{
+	char_scan_func_t impl = char_scan_scalar;
+#if defined(CHAR_SCAN_NEON)
+	impl = char_scan_neon;
+#else
+#if defined(CHAR_SCAN_SSE2)
+	impl = char_scan_sse2;
+#endif
+#if defined(CHAR_SCAN_AVX2)
+	if (char_scan_has_avx2()) {
+		impl = char_scan_avx2;
+	}
+#endif
+#endif
+	/* every thread resolves to the same function, so it doesn't matter whose store wins */
+	CHAR_SCAN_IMPL_STORE(impl);
+	return impl(p, end, set, nset, invert);
+}
+
+const char* char_scan_find(const char *p, const char *end, const char *set, size_t nset)
+{
+	if (p >= end) {
+		return p;
+	}
+	if (nset == 0 || nset > CHAR_SCAN_MAX_SET) {
+		return char_scan_scalar(p, end, set, nset, 0);
+	}
+	return CHAR_SCAN_IMPL_LOAD()(p, end, set, nset, 0);
+}
+
+const char* char_scan_skip(const char *p, const char *end, const char *set, size_t nset)
+{
+	if (p >= end) {
+		return p;
+	}
+	if (nset == 0 || nset > CHAR_SCAN_MAX_SET) {
+		return char_scan_scalar(p, end, set, nset, 1);
+	}
+	return CHAR_SCAN_IMPL_LOAD()(p, end, set, nset, 1);
+}
@@ -0,0 +1,31 @@
+/*
+ * charscan.h
+ * header file for vectorized character class scanning
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef CHARSCAN_H
+#define CHARSCAN_H
+#include <stdlib.h>
+
+#define CHAR_SCAN_MAX_SET 8
+
+/* first byte in [p, end) that is one of the nset bytes in set, or end (p if p >= end) */
+const char* char_scan_find(const char *p, const char *end, const char *set, size_t nset);
+
+/* first byte in [p, end) that is none of the nset bytes in set, or end (p if p >= end) */
+const char* char_scan_skip(const char *p, const char *end, const char *set, size_t nset);
+
+#endif
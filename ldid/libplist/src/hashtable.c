@@ -18,15 +18,22 @@
  * License along with this library; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
+#include <stdint.h>
+#include <string.h>
 #include "hashtable.h"
 
+#define HASH_TABLE_INITIAL_CAPACITY 16
+
 hashtable_t* hash_table_new(hash_func_t hash_func, compare_func_t compare_func, free_func_t free_func)
 {
 	hashtable_t* ht = (hashtable_t*)malloc(sizeof(hashtable_t));
-	int i;
-	for (i = 0; i < 4096; i++) {
-		ht->entries[i] = NULL;
+	if (!ht) return NULL;
+	ht->entries = (hashentry_t*)calloc(HASH_TABLE_INITIAL_CAPACITY, sizeof(hashentry_t));
+	if (!ht->entries) {
+		free(ht);
+		return NULL;
 	}
+	ht->capacity = HASH_TABLE_INITIAL_CAPACITY;
 	ht->count = 0;
 	ht->hash_func = hash_func;
 	ht->compare_func = compare_func;
@@ -38,56 +45,78 @@ void hash_table_destroy(hashtable_t *ht)
 {
 	if (!ht) return;
 
-	int i = 0;
-	for (i = 0; i < 4096; i++) {
-		if (ht->entries[i]) {
-			hashentry_t* e = ht->entries[i];
-			while (e) {
-				if (ht->free_func) {
-					ht->free_func(e->value);
-				}
-				hashentry_t* old = e;
-				e = e->next;
-				free(old);
+	if (ht->free_func) {
+		size_t i;
+		for (i = 0; i < ht->capacity; i++) {
+			if (ht->entries[i].key) {
+				ht->free_func(ht->entries[i].value);
 			}
 		}
 	}
+	free(ht->entries);
 	free(ht);
 }
 
+static size_t hash_table_find(hashtable_t* ht, void *key, unsigned int hash)
+{
+	size_t mask = ht->capacity - 1;
+	size_t i = hash & mask;
+
+	// the table is never full, so this stops at an empty slot at the latest
+	while (ht->entries[i].key) {
+		if (ht->entries[i].hash == hash && ht->compare_func(ht->entries[i].key, key)) {
+			break;
+		}
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+static int hash_table_grow(hashtable_t* ht)
+{
+	size_t capacity = ht->capacity * 2;
+	hashentry_t* entries = (hashentry_t*)calloc(capacity, sizeof(hashentry_t));
+	size_t i;
+	if (!entries) return -1;
+
+	for (i = 0; i < ht->capacity; i++) {
+		hashentry_t* e = &ht->entries[i];
+		if (e->key) {
+			size_t j = e->hash & (capacity - 1);
+			while (entries[j].key) {
+				j = (j + 1) & (capacity - 1);
+			}
+			entries[j] = *e;
+		}
+	}
+	free(ht->entries);
+	ht->entries = entries;
+	ht->capacity = capacity;
+	return 0;
+}
+
 void hash_table_insert(hashtable_t* ht, void *key, void *value)
 {
 	if (!ht || !key) return;
 
 	unsigned int hash = ht->hash_func(key);
 
-	int idx0 = hash & 0xFFF;
-
-	// get the idx0 list
-	hashentry_t* e = ht->entries[idx0];
-	while (e) {
-		if (ht->compare_func(e->key, key)) {
-			// element already present. replace value.
-			e->value = value;
-			return;
-		}
-		e = e->next;
+	size_t i = hash_table_find(ht, key, hash);
+	if (ht->entries[i].key) {
+		// element already present. replace value.
+		ht->entries[i].value = value;
+		return;
 	}
 
-	// if we get here, the element is not yet in the list.
-
-	// make a new entry.
-	hashentry_t* entry = (hashentry_t*)malloc(sizeof(hashentry_t));
-	entry->key = key;
-	entry->value = value;
-	if (!ht->entries[idx0]) {
-		// first entry
-		entry->next = NULL;
-	} else {
-		// add to list
-		entry->next = ht->entries[idx0];
+	// keep the load factor below 3/4 so probe sequences stay short
+	if ((ht->count + 1) * 4 > ht->capacity * 3) {
+		if (hash_table_grow(ht) < 0) return;
+		i = hash_table_find(ht, key, hash);
 	}
-	ht->entries[idx0] = entry;
+
+	ht->entries[i].key = key;
+	ht->entries[i].value = value;
+	ht->entries[i].hash = hash;
 	ht->count++;
 }
 
@@ -96,16 +125,8 @@ void* hash_table_lookup(hashtable_t* ht, void *key)
 	if (!ht || !key) return NULL;
 	unsigned int hash = ht->hash_func(key);
 
-	int idx0 = hash & 0xFFF;
-
-	hashentry_t* e = ht->entries[idx0];
-	while (e) {
-		if (ht->compare_func(e->key, key)) {
-			return e->value;
-		}
-		e = e->next;
-	}
-	return NULL;
+	size_t i = hash_table_find(ht, key, hash);
+	return ht->entries[i].key ? ht->entries[i].value : NULL;
 }
 
 void hash_table_remove(hashtable_t* ht, void *key)
@@ -114,27 +135,79 @@ void hash_table_remove(hashtable_t* ht, void *key)
 
 	unsigned int hash = ht->hash_func(key);
 
-	int idx0 = hash & 0xFFF;
-
-	// get the idx0 list
-	hashentry_t* e = ht->entries[idx0];
-	hashentry_t* last = e;
-	while (e) {
-		if (ht->compare_func(e->key, key)) {
-			// found element, remove it from the list
-			hashentry_t* old = e;
-			if (e == ht->entries[idx0]) {
-				ht->entries[idx0] = e->next;
-			} else {
-				last->next = e->next;
-			}
-			if (ht->free_func) {
-				ht->free_func(old->value);
-			}
-			free(old);
-			return;
+	size_t mask = ht->capacity - 1;
+	size_t i = hash_table_find(ht, key, hash);
+	size_t j = i;
+	if (!ht->entries[i].key) return;
+
+	if (ht->free_func) {
+		ht->free_func(ht->entries[i].value);
+	}
+	ht->count--;
+
+	// shift the following entries of the probe run back instead of leaving a tombstone
+	while (1) {
+		j = (j + 1) & mask;
+		if (!ht->entries[j].key) break;
+		size_t k = ht->entries[j].hash & mask;
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+			ht->entries[i] = ht->entries[j];
+			i = j;
 		}
-		last = e;
-		e = e->next;
 	}
+	ht->entries[i].key = NULL;
+	ht->entries[i].value = NULL;
+}
+
+static uint32_t rotl32(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+// MurmurHash3 (x86, 32 bit), public domain
+unsigned int hash_bytes(const void *data, size_t size, unsigned int seed)
+{
+	const unsigned char *p = (const unsigned char*)data;
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	uint32_t h = seed;
+	uint32_t k = 0;
+	size_t i = 0;
+
+	for (i = 0; i + 4 <= size; i += 4) {
+		memcpy(&k, p + i, 4);
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+		h ^= k;
+		h = rotl32(h, 13);
+		h = h * 5 + 0xe6546b64;
+	}
+
+	k = 0;
+	switch (size & 3) {
+	case 3:
+		k ^= (uint32_t)p[i + 2] << 16;
+		/* fall through */
+	case 2:
+		k ^= (uint32_t)p[i + 1] << 8;
+		/* fall through */
+	case 1:
+		k ^= p[i];
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+		h ^= k;
+		break;
+	default:
+		break;
+	}
+
+	h ^= (uint32_t)size;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
 }
@@ -25,15 +25,17 @@
 typedef struct hashentry_t {
 	void *key;
 	void *value;
-	void *next;
+	unsigned int hash;
 } hashentry_t;
 
 typedef unsigned int(*hash_func_t)(const void* key);
 typedef int (*compare_func_t)(const void *a, const void *b);
 typedef void (*free_func_t)(void *ptr);
 
+/* open addressing with linear probing, a NULL key marks an empty slot */
 typedef struct hashtable_t {
-	hashentry_t *entries[4096];
+	hashentry_t *entries;
+	size_t capacity;
 	size_t count;
 	hash_func_t hash_func;
 	compare_func_t compare_func;
@@ -47,4 +49,6 @@ void hash_table_insert(hashtable_t* ht, void *key, void *value);
 void* hash_table_lookup(hashtable_t* ht, void *key);
 void hash_table_remove(hashtable_t* ht, void *key);
 
+unsigned int hash_bytes(const void *data, size_t size, unsigned int seed);
+
 #endif
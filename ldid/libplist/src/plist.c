@@ -29,16 +29,40 @@
 #include <math.h>
 #include <assert.h>
 #include <limits.h>
+#include <errno.h>
 
 #ifdef WIN32
 #include <windows.h>
+#include <io.h>
 #else
 #include <pthread.h>
+#include <unistd.h>
 #endif
 
 #include <node.h>
 #include <hashtable.h>
 #include <ptrarray.h>
+#include <arena.h>
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+/* the data of one tree may be shared with copies used on other threads */
+#ifdef WIN32
+#define ATOMIC_LOAD(p) (*(uint32_t volatile*)(p))
+#define ATOMIC_INC(p) ((uint32_t)InterlockedIncrement((LONG volatile*)(p)))
+#define ATOMIC_DEC(p) ((uint32_t)InterlockedDecrement((LONG volatile*)(p)))
+#else
+#define ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_INC(p) __sync_add_and_fetch((p), 1)
+#define ATOMIC_DEC(p) __sync_sub_and_fetch((p), 1)
+#endif
+
+/* arena new nodes on this thread are allocated from, see plist_arena_set_current() */
+static THREAD_LOCAL arena_t *current_arena = NULL;
 
 extern void plist_xml_init(void);
 extern void plist_xml_deinit(void);
@@ -136,9 +160,115 @@ PLIST_API void plist_from_memory(const char *plist_data, uint32_t length, plist_
     }
 }
 
+static int plist_write_to_file(const void *buf, size_t length, void *user_data)
+{
+    return (fwrite(buf, 1, length, (FILE*)user_data) == length) ? 0 : -1;
+}
+
+static int plist_write_to_fd(const void *buf, size_t length, void *user_data)
+{
+    int fd = *(int*)user_data;
+    while (length > 0) {
+        unsigned int chunk = (length > INT_MAX) ? INT_MAX : (unsigned int)length;
+        long written = write(fd, buf, chunk);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf = (const char*)buf + written;
+        length -= written;
+    }
+    return 0;
+}
+
+PLIST_API int plist_to_xml_file(plist_t plist, FILE *file)
+{
+    if (!file)
+        return -1;
+    return plist_to_xml_with_func(plist, plist_write_to_file, file);
+}
+
+PLIST_API int plist_to_bin_file(plist_t plist, FILE *file)
+{
+    if (!file)
+        return -1;
+    return plist_to_bin_with_func(plist, plist_write_to_file, file);
+}
+
+PLIST_API int plist_to_xml_fd(plist_t plist, int fd)
+{
+    if (fd < 0)
+        return -1;
+    return plist_to_xml_with_func(plist, plist_write_to_fd, &fd);
+}
+
+PLIST_API int plist_to_bin_fd(plist_t plist, int fd)
+{
+    if (fd < 0)
+        return -1;
+    return plist_to_bin_with_func(plist, plist_write_to_fd, &fd);
+}
+
 plist_t plist_new_node(plist_data_t data)
 {
-    return (plist_t) node_create(NULL, data);
+    return (plist_t) node_create_in_arena(NULL, data, current_arena);
+}
+
+void *plist_node_alloc(plist_t node, size_t size)
+{
+    arena_t *arena = ((node_t*)node)->arena;
+    return (arena) ? arena_alloc(arena, size) : malloc(size);
+}
+
+void *plist_node_adopt(plist_t node, void *buf, size_t size)
+{
+    arena_t *arena = ((node_t*)node)->arena;
+    if (!arena || !buf) {
+        return buf;
+    }
+    void *copy = arena_alloc(arena, size);
+    if (copy) {
+        memcpy(copy, buf, size);
+    }
+    free(buf);
+    return copy;
+}
+
+/* lookup tables of arena nodes are malloc'd, so the arena frees them when it goes away */
+static void plist_node_add_cleanup(plist_t node, arena_cleanup_func_t func, void *ptr)
+{
+    arena_t *arena = ((node_t*)node)->arena;
+    if (arena) {
+        arena_add_cleanup(arena, func, ptr);
+    }
+}
+
+static void plist_hash_table_destroy(void *ht)
+{
+    hash_table_destroy((hashtable_t*)ht);
+}
+
+static void plist_ptr_array_free(void *pa)
+{
+    ptr_array_free((ptrarray_t*)pa);
+}
+
+PLIST_API plist_arena_t plist_arena_new(void)
+{
+    return arena_new();
+}
+
+PLIST_API plist_arena_t plist_arena_set_current(plist_arena_t arena)
+{
+    arena_t *previous = current_arena;
+    current_arena = (arena_t*)arena;
+    return previous;
+}
+
+PLIST_API void plist_arena_free(plist_arena_t arena)
+{
+    arena_free((arena_t*)arena);
 }
 
 plist_data_t plist_get_data(const plist_t node)
@@ -150,20 +280,22 @@ plist_data_t plist_get_data(const plist_t node)
 
 plist_data_t plist_new_plist_data(void)
 {
-    plist_data_t data = (plist_data_t) calloc(sizeof(struct plist_data_s), 1);
+    plist_data_t data = NULL;
+    if (current_arena) {
+        data = (plist_data_t) arena_alloc(current_arena, sizeof(struct plist_data_s));
+        if (data) {
+            memset(data, '\0', sizeof(struct plist_data_s));
+        }
+    } else {
+        data = (plist_data_t) calloc(sizeof(struct plist_data_s), 1);
+    }
     return data;
 }
 
 static unsigned int dict_key_hash(const void *data)
 {
     plist_data_t keydata = (plist_data_t)data;
-    unsigned int hash = 5381;
-    size_t i;
-    char *str = keydata->strval;
-    for (i = 0; i < keydata->length; str++, i++) {
-        hash = ((hash << 5) + hash) + *str;
-    }
-    return hash;
+    return hash_bytes(keydata->strval, keydata->length, 0);
 }
 
 static int dict_key_compare(const void* a, const void* b)
@@ -181,6 +313,11 @@ static int dict_key_compare(const void* a, const void* b)
 
 void plist_free_data(plist_data_t data)
 {
+    /* a result of UINT32_MAX means the other owners let go first */
+    if (data && ATOMIC_LOAD(&data->refcount) > 0 && ATOMIC_DEC(&data->refcount) != UINT32_MAX)
+    {
+        return;
+    }
     if (data)
     {
         switch (data->type)
@@ -205,10 +342,55 @@ void plist_free_data(plist_data_t data)
     }
 }
 
+/* the data of node, first copied if other nodes share it, so it can be modified */
+plist_data_t plist_get_writable_data(plist_t node)
+{
+    plist_data_t data = plist_get_data(node);
+    plist_data_t copy = NULL;
+
+    if (!data || ATOMIC_LOAD(&data->refcount) == 0)
+        return data;
+
+    /* shared data only ever lives on the heap, see plist_copy_node() */
+    copy = (plist_data_t) malloc(sizeof(struct plist_data_s));
+    if (!copy)
+        return NULL;
+    memcpy(copy, data, sizeof(struct plist_data_s));
+    copy->refcount = 0;
+    switch (data->type) {
+        case PLIST_KEY:
+        case PLIST_STRING:
+            copy->strval = strdup(data->strval);
+            if (!copy->strval) {
+                free(copy);
+                return NULL;
+            }
+            break;
+        case PLIST_DATA:
+            copy->buff = (uint8_t *) malloc(data->length > 0 ? data->length : 1);
+            if (!copy->buff) {
+                free(copy);
+                return NULL;
+            }
+            memcpy(copy->buff, data->buff, data->length);
+            break;
+        default:
+            break;
+    }
+    plist_free_data(data);
+    ((node_t*)node)->data = copy;
+    return copy;
+}
+
 static int plist_free_node(node_t* node)
 {
     plist_data_t data = NULL;
     int node_index = node_detach(node->parent, node);
+    if (node->arena) {
+        /* the node, its payload and its children are released with the arena */
+        node->parent = NULL;
+        return node_index;
+    }
     data = plist_get_data(node);
     plist_free_data(data);
     node->data = NULL;
@@ -243,19 +425,23 @@ PLIST_API plist_t plist_new_array(void)
 static plist_t plist_new_key(const char *val)
 {
     plist_data_t data = plist_new_plist_data();
+    plist_t node = plist_new_node(data);
     data->type = PLIST_KEY;
-    data->strval = strdup(val);
     data->length = strlen(val);
-    return plist_new_node(data);
+    data->strval = plist_node_alloc(node, data->length + 1);
+    memcpy(data->strval, val, data->length + 1);
+    return node;
 }
 
 PLIST_API plist_t plist_new_string(const char *val)
 {
     plist_data_t data = plist_new_plist_data();
+    plist_t node = plist_new_node(data);
     data->type = PLIST_STRING;
-    data->strval = strdup(val);
     data->length = strlen(val);
-    return plist_new_node(data);
+    data->strval = plist_node_alloc(node, data->length + 1);
+    memcpy(data->strval, val, data->length + 1);
+    return node;
 }
 
 PLIST_API plist_t plist_new_bool(uint8_t val)
@@ -297,11 +483,12 @@ PLIST_API plist_t plist_new_real(double val)
 PLIST_API plist_t plist_new_data(const char *val, uint64_t length)
 {
     plist_data_t data = plist_new_plist_data();
+    plist_t node = plist_new_node(data);
     data->type = PLIST_DATA;
-    data->buff = (uint8_t *) malloc(length);
+    data->buff = (uint8_t *) plist_node_alloc(node, length);
     memcpy(data->buff, val, length);
     data->length = length;
-    return plist_new_node(data);
+    return node;
 }
 
 PLIST_API plist_t plist_new_date(int32_t sec, int32_t usec)
@@ -326,35 +513,74 @@ static void plist_copy_node(node_t *node, void *parent_node_ptr)
     plist_type node_type = PLIST_NONE;
     plist_t newnode = NULL;
     plist_data_t data = plist_get_data(node);
-    plist_data_t newdata = plist_new_plist_data();
+    plist_data_t newdata = NULL;
 
     assert(data);				// plist should always have data
-    assert(newdata);
-
-    memcpy(newdata, data, sizeof(struct plist_data_s));
 
     node_type = plist_get_node_type(node);
-    switch (node_type) {
+    if (!current_arena && !node->arena && node_type != PLIST_ARRAY && node_type != PLIST_DICT) {
+        /* leaves are immutable until plist_get_writable_data(), so heap
+           nodes can point at the same data; arena data can't outlive its arena */
+        ATOMIC_INC(&data->refcount);
+        newnode = plist_new_node(data);
+    } else {
+        newdata = plist_new_plist_data();
+        assert(newdata);
+        memcpy(newdata, data, sizeof(struct plist_data_s));
+        newdata->refcount = 0;
+        newnode = plist_new_node(newdata);
+    }
+
+    switch ((newdata) ? node_type : PLIST_NONE) {
         case PLIST_DATA:
-            newdata->buff = (uint8_t *) malloc(data->length);
+            newdata->buff = (uint8_t *) plist_node_alloc(newnode, data->length);
             memcpy(newdata->buff, data->buff, data->length);
             break;
         case PLIST_KEY:
         case PLIST_STRING:
-            newdata->strval = strdup((char *) data->strval);
+            {
+                size_t len = strlen((char *) data->strval);
+                newdata->strval = plist_node_alloc(newnode, len + 1);
+                memcpy(newdata->strval, data->strval, len + 1);
+            }
             break;
+        case PLIST_ARRAY:
+        case PLIST_DICT:
+            newdata->hashtable = NULL;
+            break;
+        default:
+            break;
+    }
+
+    if (*(plist_t*)parent_node_ptr)
+    {
+        node_attach(*(plist_t*)parent_node_ptr, newnode);
+    }
+    else
+    {
+        *(plist_t*)parent_node_ptr = newnode;
+    }
+
+    node_t *ch;
+    for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
+        plist_copy_node(ch, &newnode);
+    }
+
+    /* lookup tables have to point at the copied children, so build them last */
+    switch (node_type) {
         case PLIST_ARRAY:
             if (data->hashtable) {
                 ptrarray_t* pa = ptr_array_new(((ptrarray_t*)data->hashtable)->capacity);
                 assert(pa);
                 plist_t current = NULL;
-                for (current = (plist_t)node_first_child(node);
+                for (current = (plist_t)node_first_child(newnode);
                      pa && current;
                      current = (plist_t)node_next_sibling(current))
                 {
                     ptr_array_add(pa, current);
                 }
                 newdata->hashtable = pa;
+                plist_node_add_cleanup(newnode, plist_ptr_array_free, pa);
             }
             break;
         case PLIST_DICT:
@@ -362,33 +588,19 @@ static void plist_copy_node(node_t *node, void *parent_node_ptr)
                 hashtable_t* ht = hash_table_new(dict_key_hash, dict_key_compare, NULL);
                 assert(ht);
                 plist_t current = NULL;
-                for (current = (plist_t)node_first_child(node);
+                for (current = (plist_t)node_first_child(newnode);
                      ht && current;
                      current = (plist_t)node_next_sibling(node_next_sibling(current)))
                 {
                     hash_table_insert(ht, ((node_t*)current)->data, node_next_sibling(current));
                 }
                 newdata->hashtable = ht;
+                plist_node_add_cleanup(newnode, plist_hash_table_destroy, ht);
             }
             break;
         default:
             break;
     }
-    newnode = plist_new_node(newdata);
-
-    if (*(plist_t*)parent_node_ptr)
-    {
-        node_attach(*(plist_t*)parent_node_ptr, newnode);
-    }
-    else
-    {
-        *(plist_t*)parent_node_ptr = newnode;
-    }
-
-    node_t *ch;
-    for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
-        plist_copy_node(ch, &newnode);
-    }
 }
 
 PLIST_API plist_t plist_copy(plist_t node)
@@ -451,6 +663,7 @@ static void _plist_array_post_insert(plist_t node, plist_t item, long n)
                 ptr_array_add(pa, current);
             }
             ((plist_data_t)((node_t*)node)->data)->hashtable = pa;
+            plist_node_add_cleanup(node, plist_ptr_array_free, pa);
         }
     }
 }
@@ -687,8 +900,8 @@ PLIST_API void plist_dict_set_item(plist_t node, const char* key, plist_t item)
             /* store pointer to item in hash table */
             hash_table_insert(ht, (plist_data_t)((node_t*)key_node)->data, item);
         } else {
-            if (((node_t*)node)->count > 500) {
-                /* make new hash table */
+            if (((node_t*)node)->count > 32) {
+                /* make new hash table; it starts small and grows, so even medium dicts get one */
                 ht = hash_table_new(dict_key_hash, dict_key_compare, NULL);
                 /* calculate the hashes for all entries we have so far */
                 plist_t current = NULL;
@@ -699,6 +912,7 @@ PLIST_API void plist_dict_set_item(plist_t node, const char* key, plist_t item)
                     hash_table_insert(ht, ((node_t*)current)->data, node_next_sibling(current));
                 }
                 ((plist_data_t)((node_t*)node)->data)->hashtable = ht;
+                plist_node_add_cleanup(node, plist_hash_table_destroy, ht);
             }
         }
     }
@@ -1014,18 +1228,24 @@ PLIST_API char plist_compare_node_value(plist_t node_l, plist_t node_r)
 static void plist_set_element_val(plist_t node, plist_type type, const void *value, uint64_t length)
 {
     //free previous allocated buffer
-    plist_data_t data = plist_get_data(node);
+    plist_data_t data = plist_get_writable_data(node);
     assert(data);				// a node should always have data attached
+    if (!data)
+        return;
 
     switch (data->type)
     {
     case PLIST_KEY:
     case PLIST_STRING:
-        free(data->strval);
+        if (!((node_t*)node)->arena) {
+            free(data->strval);
+        }
         data->strval = NULL;
         break;
     case PLIST_DATA:
-        free(data->buff);
+        if (!((node_t*)node)->arena) {
+            free(data->buff);
+        }
         data->buff = NULL;
         break;
     default:
@@ -1052,10 +1272,11 @@ static void plist_set_element_val(plist_t node, plist_type type, const void *val
         break;
     case PLIST_KEY:
     case PLIST_STRING:
-        data->strval = strdup((char *) value);
+        data->strval = plist_node_alloc(node, length + 1);
+        memcpy(data->strval, value, length + 1);
         break;
     case PLIST_DATA:
-        data->buff = (uint8_t *) malloc(length);
+        data->buff = (uint8_t *) plist_node_alloc(node, length);
         memcpy(data->buff, value, length);
         break;
     case PLIST_ARRAY:
@@ -1069,10 +1290,23 @@ PLIST_API void plist_set_key_val(plist_t node, const char *val)
 {
     plist_t father = plist_get_parent(node);
     plist_t item = plist_dict_get_item(father, val);
+    hashtable_t *ht = NULL;
     if (item) {
         return;
     }
+    /* the lookup table is keyed by the data of the key node, which may be
+       replaced below and is hashed by content anyway */
+    if (PLIST_DICT == plist_get_node_type(father)) {
+        ht = (hashtable_t*)plist_get_data(father)->hashtable;
+    }
+    item = (plist_t)node_next_sibling(node);
+    if (ht) {
+        hash_table_remove(ht, plist_get_data(node));
+    }
     plist_set_element_val(node, PLIST_KEY, val, strlen(val));
+    if (ht && item) {
+        hash_table_insert(ht, plist_get_data(node), item);
+    }
 }
 
 PLIST_API void plist_set_string_val(plist_t node, const char *val)
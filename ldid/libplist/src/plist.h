@@ -60,12 +60,20 @@ struct plist_data_s
     };
     uint64_t length;
     plist_type type;
+    /* nodes besides the first one sharing this data, see plist_copy() */
+    uint32_t refcount;
 };
 
 typedef struct plist_data_s *plist_data_t;
 
+/* size of the buffer the streaming writers collect output in */
+#define PLIST_WRITE_BUFFER_SIZE (64 * 1024)
+
 plist_t plist_new_node(plist_data_t data);
+void *plist_node_alloc(plist_t node, size_t size);
+void *plist_node_adopt(plist_t node, void *buf, size_t size);
 plist_data_t plist_get_data(const plist_t node);
+plist_data_t plist_get_writable_data(plist_t node);
 plist_data_t plist_new_plist_data(void);
 void plist_free_data(plist_data_t data);
 int plist_data_compare(const void *a, const void *b);
@@ -44,6 +44,7 @@
 
 #include "plist.h"
 #include "base64.h"
+#include "charscan.h"
 #include "strbuf.h"
 #include "time64.h"
 
@@ -308,7 +309,8 @@ static void node_to_xml(node_t* node, bytearray_t **outbuf, uint32_t depth)
             uint32_t maxread = MAX_DATA_BYTES_PER_LINE(indent);
             size_t count = 0;
             size_t amount = (node_data->length / 3 * 4) + 4 + (((node_data->length / maxread) + 1) * (indent+1));
-            if ((*outbuf)->len + amount > (*outbuf)->capacity) {
+            /* a streaming buffer only needs room for one line at a time */
+            if (!(*outbuf)->flush_func && (*outbuf)->len + amount > (*outbuf)->capacity) {
                 str_buf_grow(*outbuf, amount);
             }
             while (j < node_data->length) {
@@ -316,7 +318,11 @@ static void node_to_xml(node_t* node, bytearray_t **outbuf, uint32_t depth)
                     str_buf_append(*outbuf, "\t", 1);
                 }
                 count = (node_data->length-j < maxread) ? node_data->length-j : maxread;
-                assert((*outbuf)->len + count < (*outbuf)->capacity);
+                /* base64encode writes a terminating 0 after the line */
+                amount = (count + 2) / 3 * 4 + 1;
+                if ((*outbuf)->len + amount > (*outbuf)->capacity) {
+                    str_buf_grow(*outbuf, amount);
+                }
                 (*outbuf)->len += base64encode((char*)(*outbuf)->data + (*outbuf)->len, node_data->buff + j, count);
                 str_buf_append(*outbuf, "\n", 1);
                 j+=count;
@@ -372,7 +378,8 @@ static void node_to_xml(node_t* node, bytearray_t **outbuf, uint32_t depth)
             assert((node->children->count % 2) == 0);
         }
         node_t *ch;
-        for (ch = node_first_child(node); ch; ch = node_next_sibling(ch)) {
+        /* stop early once a streaming write failed */
+        for (ch = node_first_child(node); ch && !(*outbuf)->error; ch = node_next_sibling(ch)) {
             node_to_xml(ch, outbuf, depth+1);
         }
 
@@ -531,6 +538,27 @@ static void node_estimate_size(node_t *node, uint64_t *size, uint32_t depth)
     }
 }
 
+PLIST_API int plist_to_xml_with_func(plist_t plist, plist_write_func_t write_func, void *user_data)
+{
+    if (!plist || !write_func)
+        return -1;
+
+    strbuf_t *outbuf = byte_array_new_with_flush(PLIST_WRITE_BUFFER_SIZE, write_func, user_data);
+    if (!outbuf)
+        return -1;
+
+    str_buf_append(outbuf, XML_PLIST_PROLOG, sizeof(XML_PLIST_PROLOG)-1);
+
+    node_to_xml(plist, &outbuf, 0);
+
+    str_buf_append(outbuf, XML_PLIST_EPILOG, sizeof(XML_PLIST_EPILOG)-1);
+
+    int res = byte_array_flush(outbuf);
+    str_buf_free(outbuf);
+
+    return res;
+}
+
 PLIST_API void plist_to_xml(plist_t plist, char **plist_xml, uint32_t * length)
 {
     uint64_t size = 0;
@@ -561,25 +589,28 @@ typedef struct _parse_ctx* parse_ctx;
 
 static void parse_skip_ws(parse_ctx ctx)
 {
-    while (ctx->pos < ctx->end && ((*(ctx->pos) == ' ') || (*(ctx->pos) == '\t') || (*(ctx->pos) == '\r') || (*(ctx->pos) == '\n'))) {
-        ctx->pos++;
-    }
+    ctx->pos = char_scan_skip(ctx->pos, ctx->end, " \t\r\n", 4);
 }
 
 static void find_char(parse_ctx ctx, char c, int skip_quotes)
 {
-    while (ctx->pos < ctx->end && (*(ctx->pos) != c)) {
-        if (skip_quotes && (c != '"') && (*(ctx->pos) == '"')) {
-            ctx->pos++;
-            find_char(ctx, '"', 0);
-            if (ctx->pos >= ctx->end) {
-                PLIST_XML_ERR("EOF while looking for matching double quote\n");
-                return;
-            }
-            if (*(ctx->pos) != '"') {
-                PLIST_XML_ERR("Unmatched double quote\n");
-                return;
-            }
+    const char set[2] = { c, '"' };
+    size_t nset = (skip_quotes && (c != '"')) ? 2 : 1;
+    while (ctx->pos < ctx->end) {
+        ctx->pos = char_scan_find(ctx->pos, ctx->end, set, nset);
+        if (ctx->pos >= ctx->end || *(ctx->pos) == c) {
+            return;
+        }
+        /* a double quote, skip the quoted string */
+        ctx->pos++;
+        find_char(ctx, '"', 0);
+        if (ctx->pos >= ctx->end) {
+            PLIST_XML_ERR("EOF while looking for matching double quote\n");
+            return;
+        }
+        if (*(ctx->pos) != '"') {
+            PLIST_XML_ERR("Unmatched double quote\n");
+            return;
         }
         ctx->pos++;
     }
@@ -587,7 +618,14 @@ static void find_char(parse_ctx ctx, char c, int skip_quotes)
 
 static void find_str(parse_ctx ctx, const char *str, size_t len, int skip_quotes)
 {
+    /* only positions holding the first character (or a quote) can start a match */
+    const char set[2] = { str[0], '"' };
+    size_t nset = (skip_quotes && (str[0] != '"')) ? 2 : 1;
     while (ctx->pos < (ctx->end - len)) {
+        ctx->pos = char_scan_find(ctx->pos, ctx->end - len, set, nset);
+        if (ctx->pos >= (ctx->end - len)) {
+            break;
+        }
         if (!strncmp(ctx->pos, str, len)) {
             break;
         }
@@ -609,8 +647,18 @@ static void find_str(parse_ctx ctx, const char *str, size_t len, int skip_quotes
 
 static void find_next(parse_ctx ctx, const char *nextchars, int numchars, int skip_quotes)
 {
-    int i = 0;
+    char set[CHAR_SCAN_MAX_SET];
+    size_t nset = numchars;
+    assert(numchars < CHAR_SCAN_MAX_SET);
+    memcpy(set, nextchars, numchars);
+    if (skip_quotes) {
+        set[nset++] = '"';
+    }
     while (ctx->pos < ctx->end) {
+        ctx->pos = char_scan_find(ctx->pos, ctx->end, set, nset);
+        if (ctx->pos >= ctx->end) {
+            return;
+        }
         if (skip_quotes && (*(ctx->pos) == '"')) {
             ctx->pos++;
             find_char(ctx, '"', 0);
@@ -622,13 +670,13 @@ static void find_next(parse_ctx ctx, const char *nextchars, int numchars, int sk
                 PLIST_XML_ERR("Unmatched double quote\n");
                 return;
             }
-        }
-        for (i = 0; i < numchars; i++) {
-            if (*(ctx->pos) == nextchars[i]) {
+            if (memchr(nextchars, '"', numchars)) {
                 return;
             }
+            ctx->pos++;
+            continue;
         }
-        ctx->pos++;
+        return;
     }
 }
 
@@ -884,7 +932,7 @@ static int unescape_entities(char *str, size_t *length)
                 return -1;
             }
         }
-        i++;
+        i = char_scan_find(str + i + 1, str + len - 1, "&", 1) - str;
     }
     *length = len;
     return 0;
@@ -1251,11 +1299,11 @@ static void node_from_xml(parse_ctx ctx, plist_t *plist)
                         subnode = NULL;
                         continue;
                     } else {
-                        data->strval = str;
+                        data->strval = plist_node_adopt(subnode, str, length + 1);
                         data->length = length;
                     }
                 } else {
-                    data->strval = strdup("");
+                    data->strval = plist_node_adopt(subnode, strdup(""), 1);
                     data->length = 0;
                 }
                 data->type = PLIST_STRING;
@@ -1280,7 +1328,8 @@ static void node_from_xml(parse_ctx ctx, plist_t *plist)
                         }
                         size_t size = tp->length;
                         if (size > 0) {
-                            data->buff = base64decode(str_content, &size);
+                            unsigned char *buff = base64decode(str_content, &size);
+                            data->buff = plist_node_adopt(subnode, buff, size);
                             data->length = size;
                         }
 
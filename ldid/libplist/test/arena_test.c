@@ -0,0 +1,218 @@
+/*
+ * arena_test.c
+ * arena allocator regression test
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "plist/plist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <arena.h>
+
+#include "test_check.h"
+
+static int cleanup_count = 0;
+
+static void count_cleanup(void *ptr)
+{
+    cleanup_count++;
+    free(ptr);
+}
+
+static int test_alloc_free(void)
+{
+    arena_t *arena = arena_new();
+    CHECK(arena != NULL);
+
+    /* small allocations are aligned and don't overlap */
+    char *prev = NULL;
+    size_t i;
+    for (i = 0; i < 100000; i++) {
+        size_t size = 1 + (i % 97);
+        char *p = (char*)arena_alloc(arena, size);
+        CHECK(p != NULL);
+        CHECK(((uintptr_t)p & 15) == 0);
+        memset(p, (int)(i & 0xff), size);
+        if (prev) {
+            CHECK(p != prev);
+        }
+        prev = p;
+    }
+
+    /* zero-sized and large allocations */
+    CHECK(arena_alloc(arena, 0) != NULL);
+    char *big = (char*)arena_alloc(arena, 8 * 1024 * 1024);
+    CHECK(big != NULL);
+    memset(big, 0xab, 8 * 1024 * 1024);
+    char *after = (char*)arena_alloc(arena, 32);
+    CHECK(after != NULL);
+    memset(after, 0xcd, 32);
+    CHECK((unsigned char)big[8 * 1024 * 1024 - 1] == 0xab);
+
+    CHECK(arena_alloc(NULL, 16) == NULL);
+
+    /* cleanups run once each when the arena goes away */
+    cleanup_count = 0;
+    for (i = 0; i < 10; i++) {
+        arena_add_cleanup(arena, count_cleanup, malloc(16));
+    }
+    arena_free(arena);
+    CHECK(cleanup_count == 10);
+
+    arena_free(NULL);
+    return 1;
+}
+
+static plist_t build_tree(void)
+{
+    plist_t root = plist_new_dict();
+    plist_t array = plist_new_array();
+    char key[32];
+    int i;
+
+    /* enough entries for the dict to grow a lookup table */
+    for (i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        plist_dict_set_item(root, key, plist_new_uint(i));
+        plist_array_append_item(array, plist_new_string(key));
+    }
+    plist_dict_set_item(root, "array", array);
+    plist_dict_set_item(root, "data", plist_new_data("\x00\x01\x02\x03", 4));
+    plist_dict_set_item(root, "real", plist_new_real(1.5));
+    plist_dict_set_item(root, "bool", plist_new_bool(1));
+    return root;
+}
+
+static int check_tree(plist_t root)
+{
+    char key[32];
+    uint64_t value = 0;
+    int i;
+
+    CHECK(plist_get_node_type(root) == PLIST_DICT);
+    CHECK(plist_dict_get_size(root) == 1004);
+    for (i = 0; i < 1000; i += 37) {
+        snprintf(key, sizeof(key), "key%d", i);
+        plist_t node = plist_dict_get_item(root, key);
+        CHECK(node != NULL);
+        plist_get_uint_val(node, &value);
+        CHECK(value == (uint64_t)i);
+    }
+
+    plist_t array = plist_dict_get_item(root, "array");
+    CHECK(plist_array_get_size(array) == 1000);
+    char *str = NULL;
+    plist_get_string_val(plist_array_get_item(array, 999), &str);
+    CHECK(str && strcmp(str, "key999") == 0);
+    free(str);
+
+    char *data = NULL;
+    uint64_t length = 0;
+    plist_get_data_val(plist_dict_get_item(root, "data"), &data, &length);
+    CHECK(length == 4 && memcmp(data, "\x00\x01\x02\x03", 4) == 0);
+    free(data);
+    return 1;
+}
+
+static int test_copy_across_arenas(void)
+{
+    plist_arena_t a = plist_arena_new();
+    plist_arena_t b = plist_arena_new();
+    CHECK(a != NULL && b != NULL);
+
+    CHECK(plist_arena_set_current(a) == NULL);
+    plist_t in_a = build_tree();
+    CHECK(check_tree(in_a));
+
+    /* copy into a second arena, then drop the first one */
+    CHECK(plist_arena_set_current(b) == a);
+    plist_t in_b = plist_copy(in_a);
+
+    /* and onto the heap, which has to outlive both arenas */
+    CHECK(plist_arena_set_current(NULL) == b);
+    plist_t on_heap = plist_copy(in_b);
+
+    plist_arena_free(a);
+    CHECK(check_tree(in_b));
+
+    /* arena nodes can be modified with the regular API */
+    plist_arena_set_current(b);
+    plist_dict_set_item(in_b, "key0", plist_new_string("replaced"));
+    plist_dict_remove_item(in_b, "key1");
+    plist_arena_set_current(NULL);
+    CHECK(plist_dict_get_size(in_b) == 1003);
+
+    plist_arena_free(b);
+    CHECK(check_tree(on_heap));
+
+    /* arena nodes may be inserted into heap trees */
+    plist_arena_t c = plist_arena_new();
+    plist_arena_set_current(c);
+    plist_t child = plist_new_string("from arena");
+    plist_arena_set_current(NULL);
+    plist_dict_set_item(on_heap, "child", child);
+    CHECK(plist_dict_get_item(on_heap, "child") == child);
+    plist_dict_remove_item(on_heap, "child");
+    plist_arena_free(c);
+
+    plist_free(on_heap);
+    return 1;
+}
+
+static int test_free_arena(void)
+{
+    plist_arena_t arena = plist_arena_new();
+    CHECK(arena != NULL);
+
+    /* parse straight into the arena and free nodes out of it piecemeal */
+    plist_t heap = build_tree();
+    char *xml = NULL;
+    uint32_t length = 0;
+    plist_to_xml(heap, &xml, &length);
+    CHECK(xml != NULL);
+
+    plist_arena_set_current(arena);
+    plist_t parsed = NULL;
+    plist_from_xml(xml, length, &parsed);
+    plist_dict_remove_item(parsed, "array");
+    plist_free(plist_new_string("freed before the arena"));
+    plist_arena_set_current(NULL);
+
+    CHECK(parsed != NULL);
+    CHECK(plist_dict_get_size(parsed) == 1003);
+    CHECK(plist_compare_node_value(plist_dict_get_item(parsed, "key5"), plist_dict_get_item(heap, "key5")));
+
+    /* releasing the arena frees the whole tree, including the dict lookup table */
+    plist_arena_free(arena);
+
+    free(xml);
+    plist_free(heap);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_alloc_free()) return 1;
+    if (!test_copy_across_arenas()) return 2;
+    if (!test_free_arena()) return 3;
+
+    printf("arena tests passed\n");
+    return 0;
+}
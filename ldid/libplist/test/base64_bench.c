@@ -0,0 +1,214 @@
+/*
+ * base64_bench.c
+ * base64 micro-benchmark, vectorized implementation against the scalar one
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "base64.h"
+
+#ifdef _MSC_VER
+#pragma warning(disable:4996)
+#endif
+
+/* the byte-at-a-time coder libplist used before, kept as the baseline */
+static const char ref_str[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t ref_encode(char *outbuf, const unsigned char *buf, size_t size)
+{
+	size_t n = 0;
+	size_t m = 0;
+	while (n < size) {
+		unsigned char i0 = buf[n];
+		unsigned char i1 = (n+1 < size) ? buf[n+1] : 0;
+		unsigned char i2 = (n+2 < size) ? buf[n+2] : 0;
+		outbuf[m++] = ref_str[i0 >> 2];
+		outbuf[m++] = ref_str[((i0 & 3) << 4) + (i1 >> 4)];
+		outbuf[m++] = (n+1 < size) ? ref_str[((i1 & 15) << 2) + (i2 >> 6)] : '=';
+		outbuf[m++] = (n+2 < size) ? ref_str[i2 & 63] : '=';
+		n += 3;
+	}
+	outbuf[m] = 0;
+	return m;
+}
+
+static size_t ref_decode(unsigned char *outbuf, const char *buf, size_t len)
+{
+	signed char table[256];
+	int tmpval[4];
+	int tmpcnt = 0;
+	size_t p = 0;
+	size_t i;
+
+	memset(table, -1, sizeof(table));
+	for (i = 0; i < 64; i++) {
+		table[(unsigned char)ref_str[i]] = (signed char)i;
+	}
+	table['='] = -2;
+	for (i = 0; i < len; i++) {
+		int wv;
+		char c = buf[i];
+		if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+			continue;
+		}
+		if ((wv = table[(unsigned char)c]) == -1) {
+			continue;
+		}
+		tmpval[tmpcnt++] = wv;
+		if (tmpcnt == 4) {
+			tmpcnt = 0;
+			if (tmpval[0] >= 0 && tmpval[1] >= 0) {
+				outbuf[p++] = (unsigned char)((tmpval[0] << 2) + (tmpval[1] >> 4));
+			}
+			if (tmpval[1] >= 0 && tmpval[2] >= 0) {
+				outbuf[p++] = (unsigned char)((tmpval[1] << 4) + (tmpval[2] >> 2));
+			}
+			if (tmpval[2] >= 0 && tmpval[3] >= 0) {
+				outbuf[p++] = (unsigned char)((tmpval[2] << 6) + tmpval[3]);
+			}
+		}
+	}
+	return p;
+}
+
+static double now(void)
+{
+#ifdef WIN32
+	LARGE_INTEGER freq, count;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+static void report(const char *name, size_t bytes, int iterations, double seconds)
+{
+	printf("%-24s %10.1f MB/s\n", name, (double)bytes * iterations / seconds / (1024.0 * 1024.0));
+}
+
+int main(int argc, char *argv[])
+{
+	size_t size = (argc > 1) ? (size_t)strtoul(argv[1], NULL, 10) : 1024 * 1024;
+	int iterations = (argc > 2) ? atoi(argv[2]) : 50;
+	size_t enc_size = (size + 2) / 3 * 4;
+	size_t wrapped_size;
+	unsigned char *data;
+	char *encoded;
+	char *ref_encoded;
+	char *wrapped;
+	unsigned char *decoded;
+	double start;
+	size_t i, j;
+	int n;
+	int ret = 0;
+
+	if (size == 0 || iterations <= 0) {
+		printf("usage: %s [size] [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	data = (unsigned char*)malloc(size);
+	encoded = (char*)malloc(enc_size + 1);
+	ref_encoded = (char*)malloc(enc_size + 1);
+	/* the XML writer wraps data lines at 68 characters at depth one */
+	wrapped = (char*)malloc(enc_size + enc_size / 68 + 2);
+	decoded = (unsigned char*)malloc(size + 3);
+	if (!data || !encoded || !ref_encoded || !wrapped || !decoded) {
+		printf("out of memory\n");
+		return 1;
+	}
+	srand(1);
+	for (i = 0; i < size; i++) {
+		data[i] = (unsigned char)rand();
+	}
+
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		ref_encode(ref_encoded, data, size);
+	}
+	report("encode (scalar)", size, iterations, now() - start);
+
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		base64encode(encoded, data, size);
+	}
+	report("encode", size, iterations, now() - start);
+
+	if (memcmp(encoded, ref_encoded, enc_size + 1) != 0) {
+		printf("encode mismatch\n");
+		ret = 1;
+	}
+
+	for (i = 0, j = 0; i < enc_size; i++) {
+		if (i > 0 && i % 68 == 0) {
+			wrapped[j++] = '\n';
+		}
+		wrapped[j++] = encoded[i];
+	}
+	wrapped[j] = 0;
+	wrapped_size = j;
+
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		ref_decode(decoded, encoded, enc_size);
+	}
+	report("decode (scalar)", size, iterations, now() - start);
+
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		size_t len = enc_size;
+		free(base64decode(encoded, &len));
+	}
+	report("decode", size, iterations, now() - start);
+
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		ref_decode(decoded, wrapped, wrapped_size);
+	}
+	report("decode wrapped (scalar)", size, iterations, now() - start);
+
+	start = now();
+	for (n = 0; n < iterations; n++) {
+		size_t len = wrapped_size;
+		unsigned char *out = base64decode(wrapped, &len);
+		if (n == 0 && (len != size || memcmp(out, data, size) != 0)) {
+			printf("decode mismatch\n");
+			ret = 1;
+		}
+		free(out);
+	}
+	report("decode wrapped", size, iterations, now() - start);
+
+	free(data);
+	free(encoded);
+	free(ref_encoded);
+	free(wrapped);
+	free(decoded);
+	return ret;
+}
@@ -0,0 +1,172 @@
+/*
+ * bin_dedup_test.c
+ * regression test for sharing equal objects when writing binary plists
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "plist/plist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "test_check.h"
+
+#define COPIES 50
+
+/* the object count from the 32 byte trailer */
+static uint64_t object_count(const char *bin, uint32_t length)
+{
+    const unsigned char *trailer = (const unsigned char*)bin + length - 32;
+    uint64_t count = 0;
+    int i;
+    for (i = 8; i < 16; i++) {
+        count = (count << 8) | trailer[i];
+    }
+    return count;
+}
+
+static plist_t build_repeated(void)
+{
+    plist_t root = plist_new_array();
+    int i;
+
+    for (i = 0; i < COPIES; i++) {
+        plist_t dict = plist_new_dict();
+        plist_dict_set_item(dict, "string", plist_new_string("same"));
+        plist_dict_set_item(dict, "uint", plist_new_uint(42));
+        plist_dict_set_item(dict, "real", plist_new_real(0.5));
+        plist_dict_set_item(dict, "bool", plist_new_bool(1));
+        plist_dict_set_item(dict, "date", plist_new_date(1000, 0));
+        plist_dict_set_item(dict, "uid", plist_new_uid(7));
+        plist_dict_set_item(dict, "data", plist_new_data("blob", 4));
+        plist_array_append_item(root, dict);
+    }
+    return root;
+}
+
+/* many different values, so the dedup table has to grow several times */
+static plist_t build_distinct(void)
+{
+    plist_t root = plist_new_dict();
+    char key[32];
+    int i;
+
+    for (i = 0; i < 5000; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        plist_t item = plist_new_array();
+        plist_array_append_item(item, plist_new_string(key));
+        plist_array_append_item(item, plist_new_uint(i));
+        plist_array_append_item(item, plist_new_uint(i % 10));
+        plist_array_append_item(item, plist_new_real(i / 3.0));
+        plist_dict_set_item(root, key, item);
+    }
+    return root;
+}
+
+static int check_round_trip(plist_t doc, plist_write_options_t options, char **out, uint32_t *out_length)
+{
+    char *bin = NULL;
+    char *bin2 = NULL;
+    char *xml = NULL;
+    char *xml2 = NULL;
+    uint32_t length = 0;
+    uint32_t length2 = 0;
+    uint32_t xml_length = 0;
+    uint32_t xml2_length = 0;
+    plist_t parsed = NULL;
+
+    plist_to_bin_with_options(doc, &bin, &length, options);
+    CHECK(bin != NULL && length > 40);
+    plist_from_bin(bin, length, &parsed);
+    CHECK(parsed != NULL);
+    plist_to_xml(doc, &xml, &xml_length);
+    plist_to_xml(parsed, &xml2, &xml2_length);
+    CHECK(xml2_length == xml_length && memcmp(xml, xml2, xml_length) == 0);
+
+    /* writing what was read gives the same bytes again */
+    plist_to_bin_with_options(parsed, &bin2, &length2, options);
+    CHECK(length2 == length && memcmp(bin, bin2, length) == 0);
+
+    plist_free(parsed);
+    free(bin2);
+    free(xml);
+    free(xml2);
+    *out = bin;
+    *out_length = length;
+    return 1;
+}
+
+static int test_repeated(void)
+{
+    plist_t doc = build_repeated();
+    char *shared = NULL;
+    char *unshared = NULL;
+    char *plain = NULL;
+    uint32_t shared_length = 0;
+    uint32_t unshared_length = 0;
+    uint32_t plain_length = 0;
+
+    CHECK(check_round_trip(doc, PLIST_OPT_NONE, &shared, &shared_length));
+    CHECK(check_round_trip(doc, PLIST_OPT_NO_DEDUP, &unshared, &unshared_length));
+
+    /* no options is what plist_to_bin does */
+    plist_to_bin(doc, &plain, &plain_length);
+    CHECK(plain_length == shared_length && memcmp(plain, shared, plain_length) == 0);
+
+    /* the array, then per dict the dict and its data; everything else once */
+    CHECK(object_count(shared, shared_length) == 1 + COPIES * 2 + 7 + 6);
+    /* every node is an object of its own */
+    CHECK(object_count(unshared, unshared_length) == 1 + COPIES * (1 + 7 + 7));
+    CHECK(unshared_length > shared_length);
+
+    free(shared);
+    free(unshared);
+    free(plain);
+    plist_free(doc);
+    return 1;
+}
+
+static int test_distinct(void)
+{
+    plist_t doc = build_distinct();
+    char *shared = NULL;
+    char *unshared = NULL;
+    uint32_t shared_length = 0;
+    uint32_t unshared_length = 0;
+
+    CHECK(check_round_trip(doc, PLIST_OPT_NONE, &shared, &shared_length));
+    CHECK(check_round_trip(doc, PLIST_OPT_NO_DEDUP, &unshared, &unshared_length));
+
+    /* only the uints below 10 repeat; a key and the equal string stay two objects */
+    CHECK(object_count(shared, shared_length) == 1 + 5000 * 5);
+    CHECK(object_count(unshared, unshared_length) == 1 + 5000 * 6);
+
+    free(shared);
+    free(unshared);
+    plist_free(doc);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_repeated()) return 1;
+    if (!test_distinct()) return 2;
+
+    printf("binary dedup tests passed\n");
+    return 0;
+}
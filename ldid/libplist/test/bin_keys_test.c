@@ -0,0 +1,182 @@
+/*
+ * bin_keys_test.c
+ * regression test for binary plists with many repeated keys
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "plist/plist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_check.h"
+
+#define KEY_COUNT 20
+
+#ifdef __GLIBC__
+/* count the allocations libplist makes, glibc lets programs wrap its allocator.
+   The wrappers have to be visible to libplist, whatever -fvisibility says. */
+#define ALLOC_WRAPPER __attribute__((visibility("default")))
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static size_t alloc_count = 0;
+
+ALLOC_WRAPPER void *malloc(size_t size)
+{
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+ALLOC_WRAPPER void *calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    return __libc_calloc(nmemb, size);
+}
+
+ALLOC_WRAPPER void *realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+/* count dicts with the same keys; every third value repeats a key as a string */
+static plist_t build_records(int count)
+{
+    plist_t root = plist_new_array();
+    char key[32];
+    int i, k;
+
+    for (i = 0; i < count; i++) {
+        plist_t dict = plist_new_dict();
+        for (k = 0; k < KEY_COUNT; k++) {
+            snprintf(key, sizeof(key), "RepeatedKey%d", k);
+            if (k % 3 == 0) {
+                plist_dict_set_item(dict, key, plist_new_string(key));
+            } else {
+                plist_dict_set_item(dict, key, plist_new_uint(i * KEY_COUNT + k));
+            }
+        }
+        plist_array_append_item(root, dict);
+    }
+    return root;
+}
+
+static int check_round_trip(plist_t records)
+{
+    char *bin = NULL;
+    char *bin2 = NULL;
+    char *xml = NULL;
+    char *xml2 = NULL;
+    uint32_t bin_length = 0, bin2_length = 0, xml_length = 0, xml2_length = 0;
+    plist_t parsed = NULL;
+
+    plist_to_bin(records, &bin, &bin_length);
+    CHECK(bin != NULL);
+    plist_from_bin(bin, bin_length, &parsed);
+    CHECK(parsed != NULL);
+
+    plist_to_bin(parsed, &bin2, &bin2_length);
+    CHECK(bin2_length == bin_length && memcmp(bin, bin2, bin_length) == 0);
+    plist_to_xml(records, &xml, &xml_length);
+    plist_to_xml(parsed, &xml2, &xml2_length);
+    CHECK(xml2_length == xml_length && memcmp(xml, xml2, xml_length) == 0);
+
+    /* a string value equal to a key stays a string */
+    plist_t value = plist_dict_get_item(plist_array_get_item(parsed, 5), "RepeatedKey3");
+    CHECK(plist_get_node_type(value) == PLIST_STRING);
+
+    /* renaming a key of one dict leaves the keys it shares data with alone */
+    plist_t dict = plist_array_get_item(parsed, 7);
+    plist_dict_iter it = NULL;
+    plist_t item = NULL;
+    plist_dict_new_iter(dict, &it);
+    plist_dict_next_item(dict, it, NULL, &item);
+    free(it);
+    plist_set_key_val(plist_dict_item_get_key(item), "Renamed");
+    char *name = NULL;
+    plist_get_key_val(plist_dict_item_get_key(item), &name);
+    CHECK(name && strcmp(name, "Renamed") == 0);
+    free(name);
+    CHECK(plist_dict_get_item(plist_array_get_item(parsed, 6), "RepeatedKey0") != NULL);
+    CHECK(plist_dict_get_item(plist_array_get_item(parsed, 8), "RepeatedKey0") != NULL);
+    plist_get_key_val(plist_dict_item_get_key(plist_dict_get_item(plist_array_get_item(parsed, 8), "RepeatedKey0")), &name);
+    CHECK(name && strcmp(name, "RepeatedKey0") == 0);
+    free(name);
+
+    plist_free(parsed);
+    free(bin);
+    free(bin2);
+    free(xml);
+    free(xml2);
+    return 1;
+}
+
+#ifdef __GLIBC__
+static size_t count_parse_allocations(int count)
+{
+    plist_t records = build_records(count);
+    char *bin = NULL;
+    uint32_t length = 0;
+    plist_t parsed = NULL;
+
+    plist_to_bin(records, &bin, &length);
+    size_t before = alloc_count;
+    plist_from_bin(bin, length, &parsed);
+    size_t allocations = alloc_count - before;
+
+    plist_free(parsed);
+    plist_free(records);
+    free(bin);
+    return allocations;
+}
+#endif
+
+static int check_allocations(void)
+{
+#ifdef __GLIBC__
+    /* the records differ in nothing but their uint values, so each extra one costs
+       the same: its dict (node, data and child list), a node per key and string
+       and a node and data per uint. Repeated keys and strings share their data. */
+    size_t small = count_parse_allocations(1000);
+    size_t large = count_parse_allocations(2000);
+    size_t per_record = (large - small) / 1000;
+    size_t uints = KEY_COUNT - (KEY_COUNT + 2) / 3;
+    printf("%zu allocations per record\n", per_record);
+    /* zero means the wrappers weren't called, so nothing was measured */
+    CHECK(per_record >= KEY_COUNT);
+    CHECK(per_record <= 3 + KEY_COUNT + KEY_COUNT + uints);
+#else
+    printf("allocation count not checked on this platform\n");
+#endif
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    plist_t records = build_records(100);
+    if (!check_round_trip(records)) return 1;
+    plist_free(records);
+
+    if (!check_allocations()) return 2;
+
+    printf("repeated key tests passed\n");
+    return 0;
+}
@@ -0,0 +1,390 @@
+/*
+ * bin_view_test.c
+ * binary plist view regression test with hand-made malformed input
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "plist/plist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "test_check.h"
+
+#define MAX_OBJECTS 128
+
+/* assembles a binary plist object by object, then writes the offset table and trailer */
+typedef struct bplist_builder {
+    uint8_t buf[8192];
+    size_t len;
+    uint64_t offsets[MAX_OBJECTS];
+    uint64_t num_objects;
+} bplist_builder;
+
+static void builder_init(bplist_builder *b)
+{
+    memcpy(b->buf, "bplist00", 8);
+    b->len = 8;
+    b->num_objects = 0;
+}
+
+static void put_be(bplist_builder *b, uint64_t value, unsigned int size)
+{
+    unsigned int i;
+    for (i = 0; i < size; i++) {
+        b->buf[b->len++] = (i + 8 < size) ? 0 : (uint8_t)(value >> ((size - 1 - i) * 8));
+    }
+}
+
+/* start a new object and return its ref */
+static uint64_t object(bplist_builder *b)
+{
+    b->offsets[b->num_objects] = b->len;
+    return b->num_objects++;
+}
+
+static void put_bytes(bplist_builder *b, const void *data, size_t size)
+{
+    memcpy(b->buf + b->len, data, size);
+    b->len += size;
+}
+
+static uint64_t add_string(bplist_builder *b, const char *str)
+{
+    uint64_t ref = object(b);
+    size_t len = strlen(str);
+    if (len < 15) {
+        b->buf[b->len++] = 0x50 | (uint8_t)len;
+    } else {
+        b->buf[b->len++] = 0x5F;
+        b->buf[b->len++] = 0x10;
+        b->buf[b->len++] = (uint8_t)len;
+    }
+    put_bytes(b, str, len);
+    return ref;
+}
+
+static uint64_t add_uint(bplist_builder *b, uint8_t value)
+{
+    uint64_t ref = object(b);
+    b->buf[b->len++] = 0x10;
+    b->buf[b->len++] = value;
+    return ref;
+}
+
+/* write the offset table and trailer; offset_table_offset 0 means right after the objects */
+static uint32_t finish(bplist_builder *b, unsigned int offset_size, unsigned int ref_size, uint64_t root, uint64_t num_objects, uint64_t offset_table_offset)
+{
+    uint64_t table = b->len;
+    uint64_t i;
+
+    for (i = 0; i < b->num_objects; i++) {
+        put_be(b, b->offsets[i], offset_size);
+    }
+    memset(b->buf + b->len, 0, 6);
+    b->len += 6;
+    b->buf[b->len++] = (uint8_t)offset_size;
+    b->buf[b->len++] = (uint8_t)ref_size;
+    put_be(b, num_objects, 8);
+    put_be(b, root, 8);
+    put_be(b, offset_table_offset ? offset_table_offset : table, 8);
+    return (uint32_t)b->len;
+}
+
+/* a dict of count string keys and uint values, the last value being the dict itself if cyclic */
+static void build_dict_objects(bplist_builder *b, unsigned int count, int cyclic)
+{
+    uint64_t keys[MAX_OBJECTS];
+    uint64_t values[MAX_OBJECTS];
+    char key[16];
+    unsigned int i;
+
+    builder_init(b);
+    uint64_t dict = object(b);
+    b->buf[b->len++] = 0xDF;
+    b->buf[b->len++] = 0x10;
+    b->buf[b->len++] = (uint8_t)count;
+    size_t refs = b->len;
+    b->len += 2 * count;
+    for (i = 0; i < count; i++) {
+        snprintf(key, sizeof(key), "key%u", count - i);
+        keys[i] = add_string(b, key);
+        values[i] = add_uint(b, (uint8_t)i);
+    }
+    if (cyclic) {
+        values[count - 1] = dict;
+    }
+    for (i = 0; i < count; i++) {
+        b->buf[refs + i] = (uint8_t)keys[i];
+        b->buf[refs + count + i] = (uint8_t)values[i];
+    }
+}
+
+static uint32_t build_dict(bplist_builder *b, unsigned int count, int cyclic)
+{
+    build_dict_objects(b, count, cyclic);
+    return finish(b, 2, 1, 0, b->num_objects, 0);
+}
+
+static int test_valid(void)
+{
+    bplist_builder b;
+    uint32_t length = build_dict(&b, 40, 0);
+
+    plist_bin_view_t view = plist_bin_view_new((const char*)b.buf, length);
+    CHECK(view != NULL);
+    plist_view_ref_t root = plist_bin_view_get_root(view);
+    CHECK(plist_bin_view_get_node_type(view, root) == PLIST_DICT);
+    CHECK(plist_bin_view_get_size(view, root) == 40);
+
+    /* both the linear scan and the key index agree with plist_from_bin */
+    plist_t parsed = NULL;
+    plist_from_bin((const char*)b.buf, length, &parsed);
+    CHECK(parsed != NULL);
+    uint64_t value = 0;
+    plist_view_ref_t item = plist_bin_view_dict_get_item(view, root, "key7");
+    plist_bin_view_get_uint_val(view, item, &value);
+    CHECK(value == 33);
+    uint64_t expected = 0;
+    plist_get_uint_val(plist_dict_get_item(parsed, "key7"), &expected);
+    CHECK(value == expected);
+    CHECK(plist_bin_view_dict_get_item(view, root, "missing") == PLIST_VIEW_REF_INVALID);
+    CHECK(plist_bin_view_dict_get_item(view, root, "key") == PLIST_VIEW_REF_INVALID);
+
+    plist_t copy = plist_bin_view_copy_node(view, root);
+    CHECK(copy != NULL && plist_dict_get_size(copy) == 40);
+    plist_free(copy);
+    plist_free(parsed);
+    plist_bin_view_free(view);
+    return 1;
+}
+
+static int test_truncated_offsets(void)
+{
+    bplist_builder b;
+    uint32_t length = build_dict(&b, 4, 0);
+    uint32_t cut;
+
+    /* every truncation of a valid plist is rejected up front */
+    for (cut = 0; cut < length; cut++) {
+        CHECK(plist_bin_view_new((const char*)b.buf, cut) == NULL);
+    }
+
+    /* an offset table running into the trailer */
+    build_dict_objects(&b, 4, 0);
+    uint64_t table = b.len;
+    length = finish(&b, 2, 1, 0, b.num_objects + 20, 0);
+    CHECK(plist_bin_view_new((const char*)b.buf, length) == NULL);
+
+    /* an offset table outside of the buffer, or overlapping the header */
+    build_dict_objects(&b, 4, 0);
+    length = finish(&b, 2, 1, 0, b.num_objects, 0xFFFFFFFFFFFFFFF0ULL);
+    CHECK(plist_bin_view_new((const char*)b.buf, length) == NULL);
+    build_dict_objects(&b, 4, 0);
+    length = finish(&b, 2, 1, 0, b.num_objects, 4);
+    CHECK(plist_bin_view_new((const char*)b.buf, length) == NULL);
+
+    /* object offsets pointing into the offset table, the trailer or past the buffer */
+    uint64_t bad_offsets[] = { table, length - 10, 0xFFFF, 0 };
+    size_t i;
+    for (i = 0; i < sizeof(bad_offsets) / sizeof(bad_offsets[0]); i++) {
+        build_dict_objects(&b, 4, 0);
+        b.offsets[2] = bad_offsets[i];
+        length = finish(&b, 2, 1, 0, b.num_objects, 0);
+        plist_bin_view_t view = plist_bin_view_new((const char*)b.buf, length);
+        CHECK(view != NULL);
+        plist_view_ref_t root = plist_bin_view_get_root(view);
+        plist_view_ref_t key = 0;
+        plist_view_ref_t val = 0;
+        plist_bin_view_dict_get_entry(view, root, 0, &key, &val);
+        CHECK(key == 1 && val == 2);
+        if (bad_offsets[i] != 0) {
+            CHECK(plist_bin_view_get_node_type(view, val) == PLIST_NONE);
+        }
+        uint64_t value = 12345;
+        plist_bin_view_get_uint_val(view, val, &value);
+        CHECK(bad_offsets[i] == 0 || value == 12345);
+        /* the copy fails or gets a value, either way without reading out of bounds */
+        plist_free(plist_bin_view_copy_node(view, root));
+        plist_bin_view_free(view);
+    }
+    return 1;
+}
+
+static int test_cyclic_refs(void)
+{
+    bplist_builder b;
+    uint32_t length;
+
+    /* an array holding itself */
+    builder_init(&b);
+    object(&b);
+    b.buf[b.len++] = 0xA2;
+    b.buf[b.len++] = 0;
+    b.buf[b.len++] = 1;
+    add_uint(&b, 7);
+    length = finish(&b, 1, 1, 0, b.num_objects, 0);
+
+    plist_bin_view_t view = plist_bin_view_new((const char*)b.buf, length);
+    CHECK(view != NULL);
+    plist_view_ref_t root = plist_bin_view_get_root(view);
+    CHECK(plist_bin_view_array_get_item(view, root, 0) == root);
+    CHECK(plist_bin_view_array_get_item(view, plist_bin_view_array_get_item(view, root, 0), 1) == 1);
+    CHECK(plist_bin_view_array_get_item(view, root, 2) == PLIST_VIEW_REF_INVALID);
+    /* the view doesn't detect cycles, but copying into a tree does */
+    CHECK(plist_bin_view_copy_node(view, root) == NULL);
+    plist_bin_view_free(view);
+
+    /* an indexed dict holding itself */
+    length = build_dict(&b, 40, 1);
+    view = plist_bin_view_new((const char*)b.buf, length);
+    CHECK(view != NULL);
+    root = plist_bin_view_get_root(view);
+    CHECK(plist_bin_view_dict_get_item(view, root, "key1") == root);
+    CHECK(plist_bin_view_dict_get_item(view, plist_bin_view_dict_get_item(view, root, "key1"), "key1") == root);
+    CHECK(plist_bin_view_copy_node(view, root) == NULL);
+    plist_bin_view_free(view);
+    return 1;
+}
+
+static int test_object_sizes(void)
+{
+    bplist_builder b;
+    uint32_t length;
+    uint64_t len = 0;
+
+    /* a string, data and array claiming more bytes than there are */
+    builder_init(&b);
+    uint64_t array = object(&b);
+    b.buf[b.len++] = 0xA3;
+    b.buf[b.len++] = 1;
+    b.buf[b.len++] = 2;
+    b.buf[b.len++] = 3;
+    object(&b);
+    b.buf[b.len++] = 0x5F;
+    b.buf[b.len++] = 0x13;
+    put_be(&b, 0xFFFFFFFFFFFFFFFFULL, 8);
+    object(&b);
+    b.buf[b.len++] = 0x4E;
+    put_bytes(&b, "short", 5);
+    object(&b);
+    b.buf[b.len++] = 0xAF;
+    b.buf[b.len++] = 0x12;
+    put_be(&b, 0x7FFFFFFF, 4);
+    length = finish(&b, 1, 1, array, b.num_objects, 0);
+
+    plist_bin_view_t view = plist_bin_view_new((const char*)b.buf, length);
+    CHECK(view != NULL);
+    CHECK(plist_bin_view_get_node_type(view, 1) == PLIST_NONE);
+    CHECK(plist_bin_view_get_string_ptr(view, 1, &len) == NULL);
+    CHECK(plist_bin_view_get_node_type(view, 2) == PLIST_NONE);
+    CHECK(plist_bin_view_get_data_ptr(view, 2, &len) == NULL);
+    CHECK(plist_bin_view_get_size(view, 3) == 0);
+    CHECK(plist_bin_view_array_get_item(view, 3, 1000) == PLIST_VIEW_REF_INVALID);
+    CHECK(plist_bin_view_copy_node(view, array) == NULL);
+    plist_bin_view_free(view);
+
+    /* size nodes that aren't integers, or whose bytes run past the objects */
+    builder_init(&b);
+    object(&b);
+    b.buf[b.len++] = 0x5F;
+    b.buf[b.len++] = 0x5F;
+    object(&b);
+    b.buf[b.len++] = 0x4F;
+    b.buf[b.len++] = 0x13;
+    length = finish(&b, 1, 1, 0, b.num_objects, 0);
+    view = plist_bin_view_new((const char*)b.buf, length);
+    CHECK(view != NULL);
+    CHECK(plist_bin_view_get_node_type(view, 0) == PLIST_NONE);
+    CHECK(plist_bin_view_get_node_type(view, 1) == PLIST_NONE);
+    plist_bin_view_free(view);
+
+    /* refs beyond the number of objects */
+    CHECK(plist_bin_view_get_node_type(NULL, 0) == PLIST_NONE);
+    length = build_dict(&b, 4, 0);
+    view = plist_bin_view_new((const char*)b.buf, length);
+    CHECK(view != NULL);
+    CHECK(plist_bin_view_get_node_type(view, 9) == PLIST_NONE);
+    CHECK(plist_bin_view_get_node_type(view, PLIST_VIEW_REF_INVALID) == PLIST_NONE);
+    CHECK(plist_bin_view_copy_node(view, 9) == NULL);
+    plist_bin_view_free(view);
+    return 1;
+}
+
+static int test_offset_sizes(void)
+{
+    bplist_builder b;
+    uint32_t length;
+    unsigned int size;
+
+    /* zero offset and ref sizes */
+    build_dict_objects(&b, 4, 0);
+    length = finish(&b, 0, 1, 0, b.num_objects, 0);
+    CHECK(plist_bin_view_new((const char*)b.buf, length) == NULL);
+    build_dict_objects(&b, 4, 0);
+    length = finish(&b, 2, 0, 0, b.num_objects, 0);
+    CHECK(plist_bin_view_new((const char*)b.buf, length) == NULL);
+
+    /* a root ref beyond the number of objects */
+    build_dict_objects(&b, 4, 0);
+    length = finish(&b, 2, 1, 9, b.num_objects, 0);
+    CHECK(plist_bin_view_new((const char*)b.buf, length) == NULL);
+
+    /* offset tables too large for the buffer */
+    for (size = 9; size < 256; size += 41) {
+        build_dict_objects(&b, 4, 0);
+        length = finish(&b, 2, 1, 0, b.num_objects, 0);
+        b.buf[length - 26] = (uint8_t)size;
+        CHECK(plist_bin_view_new((const char*)b.buf, length) == NULL);
+    }
+
+    /* every offset size from 1 to 8 bytes, plus wider ones the buffer has room for */
+    for (size = 1; size <= 16; size++) {
+        build_dict_objects(&b, 4, 0);
+        length = finish(&b, size, 1, 0, b.num_objects, 0);
+        plist_bin_view_t view = plist_bin_view_new((const char*)b.buf, length);
+        CHECK(view != NULL);
+        uint64_t value = 0;
+        plist_bin_view_get_uint_val(view, plist_bin_view_dict_get_item(view, 0, "key4"), &value);
+        CHECK(value == 0);
+        plist_bin_view_free(view);
+    }
+
+    /* a ref size wider than the refs actually are */
+    build_dict_objects(&b, 4, 0);
+    length = finish(&b, 2, 2, 0, b.num_objects, 0);
+    plist_bin_view_t view = plist_bin_view_new((const char*)b.buf, length);
+    CHECK(view != NULL);
+    plist_view_ref_t key = 0;
+    plist_bin_view_dict_get_entry(view, 0, 3, &key, NULL);
+    CHECK(key == PLIST_VIEW_REF_INVALID || key < b.num_objects);
+    plist_bin_view_free(view);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_valid()) return 1;
+    if (!test_truncated_offsets()) return 2;
+    if (!test_cyclic_refs()) return 3;
+    if (!test_object_sizes()) return 4;
+    if (!test_offset_sizes()) return 5;
+
+    printf("binary plist view tests passed\n");
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * charscan_test.c
+ * differential test of the vectorized character scanners
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* the scanners are static, so test them from within the same translation unit */
+#include "charscan.c"
+
+#define MAX_ALIGN 64
+#define MAX_LENGTH 100
+#define PADDING 64
+
+typedef struct scanner {
+    const char *name;
+    char_scan_func_t func;
+} scanner;
+
+typedef struct char_set {
+    const char *chars;
+    size_t nset;
+} char_set;
+
+static const char_set sets[] = {
+    { "<", 1 },
+    { "<&", 2 },
+    { "\t\n\r ", 4 },
+    { "<&>\"'\x80\xff\x00", 8 },
+};
+
+static char buffer[MAX_ALIGN + MAX_LENGTH + PADDING];
+
+/* a byte that is not in set, varied so the scanners see more than one filler value */
+static char filler(const char_set *cs, size_t i)
+{
+    char c = (char)('a' + (i % 26));
+    if (memchr(cs->chars, c, cs->nset)) {
+        c = 'Z';
+    }
+    return c;
+}
+
+static int check_scanner(const scanner *sc, const char_set *cs, int invert)
+{
+    size_t align, length, pos, i;
+
+    for (align = 0; align < MAX_ALIGN; align++) {
+        for (length = 0; length <= MAX_LENGTH; length++) {
+            const char *p = buffer + align;
+            const char *end = p + length;
+
+            /* bytes past end would stop the scan, so reading them is caught */
+            for (i = 0; i < sizeof(buffer); i++) {
+                int stop = (i >= align + length);
+                buffer[i] = (stop != invert) ? cs->chars[i % cs->nset] : filler(cs, i);
+            }
+
+            /* pos == length means nothing stops the scan before end */
+            for (pos = 0; pos <= length; pos++) {
+                char saved = buffer[align + pos];
+                if (pos < length) {
+                    buffer[align + pos] = (invert) ? filler(cs, align + pos) : cs->chars[pos % cs->nset];
+                }
+
+                const char *found = sc->func(p, end, cs->chars, cs->nset, invert);
+                if (found != p + pos) {
+                    fprintf(stderr, "%s: set %zu invert %d align %zu length %zu pos %zu: got %td\n",
+                            sc->name, cs->nset, invert, align, length, pos, found - p);
+                    return 0;
+                }
+                buffer[align + pos] = saved;
+            }
+        }
+    }
+    return 1;
+}
+
+static const char* char_scan_public(const char *p, const char *end, const char *set, size_t nset, int invert)
+{
+    return (invert) ? char_scan_skip(p, end, set, nset) : char_scan_find(p, end, set, nset);
+}
+
+int main(int argc, char *argv[])
+{
+    scanner scanners[5];
+    size_t nscanners = 0;
+    size_t s, c;
+    int invert;
+
+    scanners[nscanners].name = "scalar";
+    scanners[nscanners++].func = char_scan_scalar;
+#ifdef CHAR_SCAN_SSE2
+    scanners[nscanners].name = "sse2";
+    scanners[nscanners++].func = char_scan_sse2;
+#endif
+#ifdef CHAR_SCAN_AVX2
+    if (char_scan_has_avx2()) {
+        scanners[nscanners].name = "avx2";
+        scanners[nscanners++].func = char_scan_avx2;
+    } else {
+        printf("avx2 not supported, skipping\n");
+    }
+#endif
+#ifdef CHAR_SCAN_NEON
+    scanners[nscanners].name = "neon";
+    scanners[nscanners++].func = char_scan_neon;
+#endif
+    /* whatever the dispatcher picks, through the public entry points */
+    scanners[nscanners].name = "dispatch";
+    scanners[nscanners++].func = char_scan_public;
+
+    for (s = 0; s < nscanners; s++) {
+        for (c = 0; c < sizeof(sets) / sizeof(sets[0]); c++) {
+            for (invert = 0; invert <= 1; invert++) {
+                if (!check_scanner(&scanners[s], &sets[c], invert)) {
+                    return 1;
+                }
+            }
+        }
+        printf("%s ok\n", scanners[s].name);
+    }
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * copy_test.c
+ * regression test for plists sharing leaf data with their copies
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* the internal headers, to look at the data nodes share */
+#include "plist.h"
+#include "node.h"
+
+#include "test_check.h"
+
+static plist_data_t data_of(plist_t node)
+{
+    return (plist_data_t)((node_t*)node)->data;
+}
+
+static int string_is(plist_t node, const char *expected)
+{
+    char *val = NULL;
+    int ret = 0;
+    if (plist_get_node_type(node) == PLIST_KEY) {
+        plist_get_key_val(node, &val);
+    } else {
+        plist_get_string_val(node, &val);
+    }
+    ret = (val && strcmp(val, expected) == 0);
+    free(val);
+    return ret;
+}
+
+static int test_refcount(void)
+{
+    plist_t orig = plist_new_string("shared");
+    plist_t copy1 = plist_copy(orig);
+    CHECK(data_of(copy1) == data_of(orig));
+    CHECK(data_of(orig)->refcount == 1);
+
+    plist_t copy2 = plist_copy(copy1);
+    CHECK(data_of(copy2) == data_of(orig));
+    CHECK(data_of(orig)->refcount == 2);
+
+    /* whichever owner goes first, the others keep the data */
+    plist_free(orig);
+    CHECK(data_of(copy1)->refcount == 1);
+    CHECK(string_is(copy2, "shared"));
+    plist_free(copy2);
+    CHECK(data_of(copy1)->refcount == 0);
+    CHECK(string_is(copy1, "shared"));
+    plist_free(copy1);
+
+    /* containers are copied, their leaves are shared */
+    plist_t dict = plist_new_dict();
+    plist_dict_set_item(dict, "data", plist_new_data("\0\1\2\3", 4));
+    plist_dict_set_item(dict, "uint", plist_new_uint(7));
+    plist_t copy = plist_copy(dict);
+    CHECK(data_of(copy) != data_of(dict));
+    CHECK(data_of(plist_dict_get_item(copy, "data")) == data_of(plist_dict_get_item(dict, "data")));
+    CHECK(data_of(plist_dict_get_item(copy, "uint")) == data_of(plist_dict_get_item(dict, "uint")));
+    CHECK(data_of(plist_dict_item_get_key(plist_dict_get_item(copy, "uint")))->refcount == 1);
+    plist_free(dict);
+    CHECK(data_of(plist_dict_get_item(copy, "data"))->refcount == 0);
+    plist_free(copy);
+    return 1;
+}
+
+static int test_writable_data(void)
+{
+    plist_t dict = plist_new_dict();
+    plist_t inner = plist_new_array();
+    plist_array_append_item(inner, plist_new_string("leaf"));
+    plist_array_append_item(inner, plist_new_data("abcd", 4));
+    plist_dict_set_item(dict, "inner", inner);
+    plist_dict_set_item(dict, "uint", plist_new_uint(1));
+
+    plist_t copy = plist_copy(dict);
+    plist_t copy_inner = plist_dict_get_item(copy, "inner");
+
+    /* modifying a shared leaf of the copy gives it data of its own */
+    plist_t leaf = plist_array_get_item(copy_inner, 0);
+    plist_data_t shared = data_of(leaf);
+    plist_set_string_val(leaf, "changed");
+    CHECK(data_of(leaf) != shared);
+    CHECK(data_of(leaf)->refcount == 0);
+    CHECK(shared->refcount == 0);
+    CHECK(string_is(leaf, "changed"));
+    CHECK(string_is(plist_array_get_item(inner, 0), "leaf"));
+
+    /* and the same from the side of the original */
+    plist_t blob = plist_array_get_item(inner, 1);
+    plist_set_data_val(blob, "wxyz", 4);
+    char *val = NULL;
+    uint64_t length = 0;
+    plist_get_data_val(plist_array_get_item(copy_inner, 1), &val, &length);
+    CHECK(length == 4 && memcmp(val, "abcd", 4) == 0);
+    free(val);
+    plist_get_data_val(blob, &val, &length);
+    CHECK(length == 4 && memcmp(val, "wxyz", 4) == 0);
+    free(val);
+
+    /* scalars too, and a leaf nobody shares keeps its data */
+    plist_set_uint_val(plist_dict_get_item(copy, "uint"), 2);
+    uint64_t num = 0;
+    plist_get_uint_val(plist_dict_get_item(dict, "uint"), &num);
+    CHECK(num == 1);
+    plist_data_t own = data_of(plist_dict_get_item(copy, "uint"));
+    plist_set_uint_val(plist_dict_get_item(copy, "uint"), 3);
+    CHECK(data_of(plist_dict_get_item(copy, "uint")) == own);
+
+    plist_free(dict);
+    plist_free(copy);
+    return 1;
+}
+
+static int test_arenas(void)
+{
+    plist_t heap = plist_new_string("heap");
+    plist_arena_t arena = plist_arena_new();
+    CHECK(arena != NULL);
+
+    /* copies made into an arena don't share with the heap */
+    plist_arena_t previous = plist_arena_set_current(arena);
+    plist_t in_arena = plist_copy(heap);
+    plist_t arena_node = plist_new_string("arena");
+    plist_arena_set_current(previous);
+    CHECK(data_of(in_arena) != data_of(heap));
+    CHECK(data_of(heap)->refcount == 0);
+    CHECK(string_is(in_arena, "heap"));
+
+    /* nor do heap copies of arena nodes, they outlive the arena */
+    plist_t out_of_arena = plist_copy(arena_node);
+    plist_t out_of_arena2 = plist_copy(in_arena);
+    CHECK(data_of(out_of_arena) != data_of(arena_node));
+    CHECK(data_of(out_of_arena)->refcount == 0);
+    plist_arena_free(arena);
+    CHECK(string_is(out_of_arena, "arena"));
+    CHECK(string_is(out_of_arena2, "heap"));
+
+    /* heap copies of those share again */
+    plist_t copy = plist_copy(out_of_arena);
+    CHECK(data_of(copy) == data_of(out_of_arena));
+
+    plist_free(copy);
+    plist_free(out_of_arena);
+    plist_free(out_of_arena2);
+    plist_free(heap);
+    return 1;
+}
+
+static int check_rekey(int count)
+{
+    plist_t dict = plist_new_dict();
+    char key[32];
+    int i;
+
+    for (i = 0; i < count; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        plist_dict_set_item(dict, key, plist_new_uint(i));
+    }
+    plist_t copy = plist_copy(dict);
+
+    /* the key of the copy shares data with the original until it is renamed */
+    plist_t item = plist_dict_get_item(copy, "key1");
+    plist_t key_node = plist_dict_item_get_key(item);
+    CHECK(data_of(key_node) == data_of(plist_dict_item_get_key(plist_dict_get_item(dict, "key1"))));
+    plist_set_key_val(key_node, "renamed");
+    CHECK(string_is(key_node, "renamed"));
+    CHECK(plist_dict_get_item(copy, "renamed") == item);
+    CHECK(plist_dict_get_item(copy, "key1") == NULL);
+    CHECK(plist_dict_get_item(dict, "key1") != NULL);
+    CHECK(plist_dict_get_item(dict, "renamed") == NULL);
+
+    /* renaming the original's key afterwards leaves the copy alone */
+    key_node = plist_dict_item_get_key(plist_dict_get_item(dict, "key2"));
+    plist_set_key_val(key_node, "other");
+    CHECK(plist_dict_get_item(dict, "other") != NULL);
+    CHECK(plist_dict_get_item(copy, "key2") != NULL);
+    CHECK(plist_dict_get_item(copy, "other") == NULL);
+
+    /* renaming to a key that exists does nothing */
+    key_node = plist_dict_item_get_key(plist_dict_get_item(copy, "key0"));
+    plist_set_key_val(key_node, "renamed");
+    CHECK(string_is(key_node, "key0"));
+    CHECK(plist_dict_get_item(copy, "key0") != NULL);
+
+    for (i = 3; i < count; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        CHECK(plist_dict_get_item(dict, key) != NULL);
+        CHECK(plist_dict_get_item(copy, key) != NULL);
+    }
+    CHECK(plist_dict_get_size(copy) == (uint32_t)count);
+
+    plist_free(dict);
+    plist_free(copy);
+    return 1;
+}
+
+static int test_rekey(void)
+{
+    /* small dicts are searched in order, larger ones have a lookup table */
+    if (!check_rekey(4)) return 0;
+    if (!check_rekey(100)) return 0;
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_refcount()) return 1;
+    if (!test_writable_data()) return 2;
+    if (!test_arenas()) return 3;
+    if (!test_rekey()) return 4;
+
+    printf("copy tests passed\n");
+    return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * hashtable_test.c
+ * hash table regression test
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtable.h"
+
+#include "test_check.h"
+
+#define KEY_COUNT 512
+
+/* keys carry their own hash so the tests decide which ones collide */
+typedef struct test_key {
+    unsigned int hash;
+    int id;
+} test_key;
+
+static test_key keys[KEY_COUNT];
+static int values[KEY_COUNT];
+static int free_count = 0;
+
+static unsigned int key_hash(const void *key)
+{
+    return ((const test_key*)key)->hash;
+}
+
+static int key_compare(const void *a, const void *b)
+{
+    return ((const test_key*)a)->id == ((const test_key*)b)->id;
+}
+
+static void value_free(void *value)
+{
+    free_count++;
+}
+
+static void setup_keys(unsigned int (*hash)(int id))
+{
+    int i;
+    for (i = 0; i < KEY_COUNT; i++) {
+        keys[i].id = i;
+        keys[i].hash = hash(i);
+        values[i] = i;
+    }
+}
+
+static unsigned int same_hash(int id)
+{
+    return 5;
+}
+
+static unsigned int last_slot_hash(int id)
+{
+    /* every key starts probing in the last slot and wraps around, whatever the capacity */
+    return (unsigned int)-1;
+}
+
+static unsigned int clustered_hash(int id)
+{
+    return (unsigned int)(id % 7) * 3;
+}
+
+static int check_contents(hashtable_t *ht, const char *present)
+{
+    size_t count = 0;
+    int i;
+    for (i = 0; i < KEY_COUNT; i++) {
+        void *value = hash_table_lookup(ht, &keys[i]);
+        if (present[i]) {
+            CHECK(value == &values[i]);
+            count++;
+        } else {
+            CHECK(value == NULL);
+        }
+    }
+    CHECK(ht->count == count);
+    return 1;
+}
+
+static int test_colliding_keys(void)
+{
+    char present[KEY_COUNT];
+    int i;
+
+    setup_keys(same_hash);
+    memset(present, 0, sizeof(present));
+
+    hashtable_t *ht = hash_table_new(key_hash, key_compare, value_free);
+    CHECK(ht != NULL);
+    for (i = 0; i < 200; i++) {
+        hash_table_insert(ht, &keys[i], &values[i]);
+        present[i] = 1;
+    }
+    CHECK(check_contents(ht, present));
+
+    /* remove from the front, middle and end of one long probe run */
+    free_count = 0;
+    for (i = 0; i < 200; i += 3) {
+        hash_table_remove(ht, &keys[i]);
+        present[i] = 0;
+    }
+    hash_table_remove(ht, &keys[199]);
+    present[199] = 0;
+    CHECK(free_count == 68);
+    CHECK(check_contents(ht, present));
+
+    /* removing a missing key leaves everything alone */
+    hash_table_remove(ht, &keys[0]);
+    hash_table_remove(ht, &keys[300]);
+    CHECK(free_count == 68);
+
+    /* slots freed by removal are reused */
+    for (i = 0; i < 200; i += 3) {
+        hash_table_insert(ht, &keys[i], &values[i]);
+        present[i] = 1;
+    }
+    CHECK(check_contents(ht, present));
+
+    free_count = 0;
+    hash_table_destroy(ht);
+    CHECK(free_count == 199);
+    return 1;
+}
+
+static int test_wrap_around(void)
+{
+    char present[KEY_COUNT];
+    int i, j;
+
+    setup_keys(last_slot_hash);
+
+    /* at capacity 16 up to 12 keys fit, so the run wraps from slot 15 over 0..10 */
+    for (j = 0; j < 12; j++) {
+        memset(present, 0, sizeof(present));
+        hashtable_t *ht = hash_table_new(key_hash, key_compare, NULL);
+        CHECK(ht != NULL);
+        for (i = 0; i < 12; i++) {
+            hash_table_insert(ht, &keys[i], &values[i]);
+            present[i] = 1;
+        }
+        CHECK(ht->capacity == 16);
+
+        hash_table_remove(ht, &keys[j]);
+        present[j] = 0;
+        CHECK(check_contents(ht, present));
+
+        /* the slot the run starts in has to stay reachable for new keys */
+        hash_table_insert(ht, &keys[100], &values[100]);
+        present[100] = 1;
+        CHECK(check_contents(ht, present));
+        hash_table_destroy(ht);
+    }
+    return 1;
+}
+
+static int test_resize_mid_insert(void)
+{
+    char present[KEY_COUNT];
+    int i;
+
+    setup_keys(same_hash);
+    memset(present, 0, sizeof(present));
+
+    hashtable_t *ht = hash_table_new(key_hash, key_compare, NULL);
+    CHECK(ht != NULL);
+    for (i = 0; i < 12; i++) {
+        hash_table_insert(ht, &keys[i], &values[i]);
+        present[i] = 1;
+    }
+    CHECK(ht->capacity == 16);
+
+    /* replacing a value at the load limit does not grow the table */
+    hash_table_insert(ht, &keys[3], &values[3]);
+    CHECK(ht->capacity == 16);
+    CHECK(ht->count == 12);
+
+    /* the next new key grows the table before it is placed */
+    hash_table_insert(ht, &keys[12], &values[12]);
+    present[12] = 1;
+    CHECK(ht->capacity == 32);
+    CHECK(check_contents(ht, present));
+
+    /* keep growing while keys are being removed in between */
+    for (i = 13; i < KEY_COUNT; i++) {
+        hash_table_insert(ht, &keys[i], &values[i]);
+        present[i] = 1;
+        if (i % 5 == 0) {
+            hash_table_remove(ht, &keys[i / 2]);
+            present[i / 2] = 0;
+        }
+    }
+    CHECK(ht->count * 4 <= ht->capacity * 3);
+    CHECK(check_contents(ht, present));
+    hash_table_destroy(ht);
+    return 1;
+}
+
+static int test_random_operations(void)
+{
+    char present[KEY_COUNT];
+    int n;
+
+    setup_keys(clustered_hash);
+    memset(present, 0, sizeof(present));
+    srand(1);
+
+    hashtable_t *ht = hash_table_new(key_hash, key_compare, NULL);
+    CHECK(ht != NULL);
+    for (n = 0; n < 200000; n++) {
+        int i = rand() % KEY_COUNT;
+        if (rand() % 3) {
+            hash_table_insert(ht, &keys[i], &values[i]);
+            present[i] = 1;
+        } else {
+            hash_table_remove(ht, &keys[i]);
+            present[i] = 0;
+        }
+        if (n % 997 == 0) {
+            CHECK(check_contents(ht, present));
+        }
+    }
+    CHECK(check_contents(ht, present));
+    hash_table_destroy(ht);
+    return 1;
+}
+
+static int test_hash_bytes(void)
+{
+    /* MurmurHash3_x86_32 reference values, covering each tail length */
+    CHECK(hash_bytes("", 0, 0) == 0);
+    CHECK(hash_bytes("", 0, 1) == 0x514e28b7);
+    CHECK(hash_bytes("a", 1, 0x9747b28c) == 0x7fa09ea6);
+    CHECK(hash_bytes("aa", 2, 0x9747b28c) == 0x5d211726);
+    CHECK(hash_bytes("aaa", 3, 0x9747b28c) == 0x283e0130);
+    CHECK(hash_bytes("aaaa", 4, 0x9747b28c) == 0x5a97808a);
+    CHECK(hash_bytes("abc", 3, 0x9747b28c) == 0xc84a62dd);
+    CHECK(hash_bytes("Hello, world!", 13, 0x9747b28c) == 0x24884cba);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_colliding_keys()) return 1;
+    if (!test_wrap_around()) return 2;
+    if (!test_resize_mid_insert()) return 3;
+    if (!test_random_operations()) return 4;
+    if (!test_hash_bytes()) return 5;
+
+    printf("hash table tests passed\n");
+    return 0;
+}
@@ -0,0 +1,577 @@
+/*
+ * plist_bench.c
+ * throughput benchmark for the parse, serialize, copy and lookup paths
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Every document (the files in a data directory plus two synthetic ones
+ * shaped like a bundle's CodeResources and a provisioning profile) is run
+ * through each operation for at least the given time. One JSON object per
+ * line goes to stdout, diagnostics go to stderr:
+ *
+ *   {"doc":"...","op":"xml2tree","iterations":N,"bytes":B,"ops":K,
+ *    "seconds":S,"mb_s":M,"ops_s":O,"allocs":A,"alloc_bytes":AB,"peak_rss_kb":R}
+ *
+ * bytes and ops are per iteration, allocs and alloc_bytes are averaged over
+ * the iterations (-1 where heap calls cannot be counted), and peak_rss_kb is
+ * the process high-water mark after the run.
+ */
+
+#include "plist/plist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <dirent.h>
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+#ifdef _MSC_VER
+#pragma warning(disable:4996)
+#endif
+
+/* glibc lets a program replace the allocator, which is all it takes to count heap calls */
+#if defined(__GLIBC__) && !defined(PLIST_BENCH_NO_ALLOC_COUNT)
+#define PLIST_BENCH_ALLOC_COUNT
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long long alloc_count = 0;
+static unsigned long long alloc_bytes = 0;
+
+void *malloc(size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    alloc_bytes += nmemb * size;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+static double min_seconds = 0.25;
+
+static double now(void)
+{
+#ifdef WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+static long peak_rss_kb(void)
+{
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return -1;
+    }
+    return (long)(pmc.PeakWorkingSetSize / 1024);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+/* one document in its three forms */
+typedef struct {
+    const char *name;
+    plist_t root;
+    char *xml;
+    uint32_t xml_len;
+    char *bin;
+    uint32_t bin_len;
+    uint64_t nodes;
+    /* every dict in the tree and its keys, for the lookup storm */
+    plist_t *dicts;
+    char ***keys;
+    uint32_t *nkeys;
+    size_t ndicts;
+} bench_doc_t;
+
+typedef void (*bench_func_t)(bench_doc_t *doc);
+
+static void bench_xml2tree(bench_doc_t *doc)
+{
+    plist_t root = NULL;
+    plist_from_xml(doc->xml, doc->xml_len, &root);
+    plist_free(root);
+}
+
+static void bench_bin2tree(bench_doc_t *doc)
+{
+    plist_t root = NULL;
+    plist_from_bin(doc->bin, doc->bin_len, &root);
+    plist_free(root);
+}
+
+static void bench_tree2xml(bench_doc_t *doc)
+{
+    char *xml = NULL;
+    uint32_t len = 0;
+    plist_to_xml(doc->root, &xml, &len);
+    free(xml);
+}
+
+static void bench_tree2bin(bench_doc_t *doc)
+{
+    char *bin = NULL;
+    uint32_t len = 0;
+    plist_to_bin(doc->root, &bin, &len);
+    free(bin);
+}
+
+static void bench_copy(bench_doc_t *doc)
+{
+    plist_free(plist_copy(doc->root));
+}
+
+static volatile uintptr_t lookup_sink;
+
+static void bench_lookup(bench_doc_t *doc)
+{
+    size_t i;
+    uint32_t j;
+    uintptr_t found = 0;
+    for (i = 0; i < doc->ndicts; i++) {
+        for (j = 0; j < doc->nkeys[i]; j++) {
+            found += (uintptr_t)plist_dict_get_item(doc->dicts[i], doc->keys[i][j]);
+        }
+    }
+    lookup_sink = found;
+}
+
+static void bench_run(bench_doc_t *doc, const char *op, bench_func_t func, uint64_t bytes, uint64_t ops)
+{
+    unsigned long long iterations = 0;
+    double start, elapsed;
+#ifdef PLIST_BENCH_ALLOC_COUNT
+    unsigned long long count_before, bytes_before;
+#endif
+
+    /* warm up caches and the allocator before timing */
+    func(doc);
+
+#ifdef PLIST_BENCH_ALLOC_COUNT
+    count_before = alloc_count;
+    bytes_before = alloc_bytes;
+#endif
+    start = now();
+    do {
+        func(doc);
+        iterations++;
+        elapsed = now() - start;
+    } while (elapsed < min_seconds || iterations < 3);
+
+    printf("{\"doc\":\"%s\",\"op\":\"%s\",\"iterations\":%llu,\"bytes\":%llu,\"ops\":%llu,\"seconds\":%.6f,\"mb_s\":%.2f,\"ops_s\":%.0f,",
+        doc->name, op, iterations, (unsigned long long)bytes, (unsigned long long)ops, elapsed,
+        (double)bytes * iterations / elapsed / (1024.0 * 1024.0), (double)ops * iterations / elapsed);
+#ifdef PLIST_BENCH_ALLOC_COUNT
+    printf("\"allocs\":%.1f,\"alloc_bytes\":%.0f,",
+        (double)(alloc_count - count_before) / iterations, (double)(alloc_bytes - bytes_before) / iterations);
+#else
+    printf("\"allocs\":-1,\"alloc_bytes\":-1,");
+#endif
+    printf("\"peak_rss_kb\":%ld}\n", peak_rss_kb());
+    fflush(stdout);
+}
+
+static void doc_collect(bench_doc_t *doc, plist_t node)
+{
+    plist_type type = plist_get_node_type(node);
+    doc->nodes++;
+    if (type == PLIST_ARRAY) {
+        uint32_t i;
+        for (i = 0; i < plist_array_get_size(node); i++) {
+            doc_collect(doc, plist_array_get_item(node, i));
+        }
+    } else if (type == PLIST_DICT) {
+        size_t n = doc->ndicts++;
+        uint32_t count = plist_dict_get_size(node);
+        plist_dict_iter iter = NULL;
+        plist_t val = NULL;
+        char *key = NULL;
+
+        doc->dicts = (plist_t*)realloc(doc->dicts, sizeof(plist_t) * doc->ndicts);
+        doc->keys = (char***)realloc(doc->keys, sizeof(char**) * doc->ndicts);
+        doc->nkeys = (uint32_t*)realloc(doc->nkeys, sizeof(uint32_t) * doc->ndicts);
+        doc->dicts[n] = node;
+        /* each key once as a hit and once more as a miss */
+        doc->keys[n] = (char**)malloc(sizeof(char*) * count * 2);
+        doc->nkeys[n] = 0;
+
+        plist_dict_new_iter(node, &iter);
+        do {
+            key = NULL;
+            val = NULL;
+            plist_dict_next_item(node, iter, &key, &val);
+            if (key) {
+                size_t len = strlen(key);
+                char *miss = (char*)malloc(len + 2);
+                memcpy(miss, key, len);
+                miss[len] = '~';
+                miss[len + 1] = '\0';
+                doc->keys[n][doc->nkeys[n]++] = key;
+                doc->keys[n][doc->nkeys[n]++] = miss;
+                doc_collect(doc, val);
+            }
+        } while (key);
+        free(iter);
+    }
+}
+
+static void doc_run(const char *name, plist_t root)
+{
+    bench_doc_t doc;
+    uint64_t lookups = 0;
+    size_t i;
+    uint32_t j;
+
+    memset(&doc, 0, sizeof(doc));
+    doc.name = name;
+    doc.root = root;
+    plist_to_xml(root, &doc.xml, &doc.xml_len);
+    plist_to_bin(root, &doc.bin, &doc.bin_len);
+    if (!doc.xml || !doc.bin) {
+        fprintf(stderr, "%s: could not serialize, skipped\n", name);
+        free(doc.xml);
+        free(doc.bin);
+        return;
+    }
+    doc_collect(&doc, root);
+    for (i = 0; i < doc.ndicts; i++) {
+        lookups += doc.nkeys[i];
+    }
+
+    bench_run(&doc, "xml2tree", bench_xml2tree, doc.xml_len, doc.nodes);
+    bench_run(&doc, "bin2tree", bench_bin2tree, doc.bin_len, doc.nodes);
+    bench_run(&doc, "tree2xml", bench_tree2xml, doc.xml_len, doc.nodes);
+    bench_run(&doc, "tree2bin", bench_tree2bin, doc.bin_len, doc.nodes);
+    bench_run(&doc, "copy", bench_copy, doc.bin_len, doc.nodes);
+    if (lookups > 0) {
+        bench_run(&doc, "dict_lookup", bench_lookup, 0, lookups);
+    }
+
+    for (i = 0; i < doc.ndicts; i++) {
+        for (j = 0; j < doc.nkeys[i]; j++) {
+            free(doc.keys[i][j]);
+        }
+        free(doc.keys[i]);
+    }
+    free(doc.dicts);
+    free(doc.keys);
+    free(doc.nkeys);
+    free(doc.xml);
+    free(doc.bin);
+}
+
+static void file_run(const char *dir, const char *filename)
+{
+    char path[1024];
+    FILE *f;
+    long size;
+    char *buf;
+    plist_t root = NULL;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, filename);
+    f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "%s: could not open, skipped\n", path);
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = (char*)malloc(size > 0 ? size : 1);
+    if (size <= 0 || fread(buf, 1, size, f) != (size_t)size) {
+        fprintf(stderr, "%s: could not read, skipped\n", path);
+        fclose(f);
+        free(buf);
+        return;
+    }
+    fclose(f);
+
+    if (plist_is_binary(buf, (uint32_t)size)) {
+        plist_from_bin(buf, (uint32_t)size, &root);
+    } else {
+        plist_from_xml(buf, (uint32_t)size, &root);
+    }
+    free(buf);
+    if (!root) {
+        fprintf(stderr, "%s: not a valid plist, skipped\n", path);
+        return;
+    }
+    doc_run(filename, root);
+    plist_free(root);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/* the test suite leaves its .out/.bin/.xml round trips next to the inputs */
+static int is_plist_name(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+    return name[0] != '.' && ext && (!strcmp(ext, ".plist") || !strcmp(ext, ".bplist"));
+}
+
+/* runs the files of a directory in name order, so runs are comparable */
+static void dir_run(const char *dir)
+{
+    char **names = NULL;
+    size_t count = 0;
+    size_t i;
+#ifdef WIN32
+    char pattern[1024];
+    WIN32_FIND_DATAA fd;
+    HANDLE h;
+
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    h = FindFirstFileA(pattern, &fd);
+    if (h == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "%s: could not open directory\n", dir);
+        return;
+    }
+    do {
+        if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || !is_plist_name(fd.cFileName)) {
+            continue;
+        }
+        names = (char**)realloc(names, sizeof(char*) * (count + 1));
+        names[count++] = strdup(fd.cFileName);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+#else
+    DIR *d = opendir(dir);
+    struct dirent *ent;
+
+    if (!d) {
+        fprintf(stderr, "%s: could not open directory\n", dir);
+        return;
+    }
+    while ((ent = readdir(d)) != NULL) {
+        if (!is_plist_name(ent->d_name)) {
+            continue;
+        }
+        names = (char**)realloc(names, sizeof(char*) * (count + 1));
+        names[count++] = strdup(ent->d_name);
+    }
+    closedir(d);
+#endif
+    if (count > 0) {
+        qsort(names, count, sizeof(char*), compare_names);
+    }
+    for (i = 0; i < count; i++) {
+        file_run(dir, names[i]);
+        free(names[i]);
+    }
+    free(names);
+}
+
+static plist_t random_data(size_t len, unsigned int *seed)
+{
+    char *buf = (char*)malloc(len);
+    plist_t node;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        *seed = *seed * 1103515245 + 12345;
+        buf[i] = (char)(*seed >> 16);
+    }
+    node = plist_new_data(buf, len);
+    free(buf);
+    return node;
+}
+
+/* files/files2/rules/rules2 of a CodeResources for an app with nfiles resources */
+static plist_t make_code_resources(int nfiles)
+{
+    static const char *dirs[] = { "", "Base.lproj/", "en.lproj/", "Assets.car/", "Frameworks/Foo.framework/", "PlugIns/Widget.appex/" };
+    static const char *exts[] = { "png", "nib", "strings", "plist", "car", "json" };
+    plist_t root = plist_new_dict();
+    plist_t files = plist_new_dict();
+    plist_t files2 = plist_new_dict();
+    plist_t rules = plist_new_dict();
+    plist_t rules2 = plist_new_dict();
+    plist_t rule;
+    unsigned int seed = 1;
+    char path[256];
+    int i;
+
+    for (i = 0; i < nfiles; i++) {
+        plist_t entry = plist_new_dict();
+        snprintf(path, sizeof(path), "%sresource_%05d@2x.%s", dirs[i % 6], i, exts[(i / 6) % 6]);
+        plist_dict_set_item(files, path, random_data(20, &seed));
+        plist_dict_set_item(entry, "hash", random_data(20, &seed));
+        plist_dict_set_item(entry, "hash2", random_data(32, &seed));
+        if (i % 17 == 0) {
+            plist_dict_set_item(entry, "optional", plist_new_bool(1));
+        }
+        plist_dict_set_item(files2, path, entry);
+    }
+
+    plist_dict_set_item(rules, "^.*", plist_new_bool(1));
+    rule = plist_new_dict();
+    plist_dict_set_item(rule, "optional", plist_new_bool(1));
+    plist_dict_set_item(rule, "weight", plist_new_real(1000));
+    plist_dict_set_item(rules, "^.*\\.lproj/", rule);
+    rule = plist_new_dict();
+    plist_dict_set_item(rule, "omit", plist_new_bool(1));
+    plist_dict_set_item(rule, "weight", plist_new_real(1100));
+    plist_dict_set_item(rules, "^.*\\.lproj/locversion.plist$", rule);
+    plist_dict_set_item(rules, "^version.plist$", plist_new_bool(1));
+
+    rule = plist_new_dict();
+    plist_dict_set_item(rule, "weight", plist_new_real(11));
+    plist_dict_set_item(rules2, ".*\\.dSYM($|/)", rule);
+    plist_dict_set_item(rules2, "^(.*/)?\\.DS_Store$", plist_copy(plist_dict_get_item(rules, "^.*\\.lproj/locversion.plist$")));
+    plist_dict_set_item(rules2, "^.*", plist_new_bool(1));
+    plist_dict_set_item(rules2, "^.*\\.lproj/", plist_copy(plist_dict_get_item(rules, "^.*\\.lproj/")));
+    rule = plist_new_dict();
+    plist_dict_set_item(rule, "nested", plist_new_bool(1));
+    plist_dict_set_item(rule, "weight", plist_new_real(10));
+    plist_dict_set_item(rules2, "^[^/]+$", rule);
+
+    plist_dict_set_item(root, "files", files);
+    plist_dict_set_item(root, "files2", files2);
+    plist_dict_set_item(root, "rules", rules);
+    plist_dict_set_item(root, "rules2", rules2);
+    return root;
+}
+
+/* the plist inside a development .mobileprovision */
+static plist_t make_profile(int ndevices)
+{
+    plist_t root = plist_new_dict();
+    plist_t prefixes = plist_new_array();
+    plist_t certs = plist_new_array();
+    plist_t ent = plist_new_dict();
+    plist_t groups = plist_new_array();
+    plist_t devices = plist_new_array();
+    plist_t teams = plist_new_array();
+    plist_t platforms = plist_new_array();
+    unsigned int seed = 2;
+    char udid[41];
+    int i, j;
+
+    plist_dict_set_item(root, "AppIDName", plist_new_string("XC com example app"));
+    plist_array_append_item(prefixes, plist_new_string("ABCDE12345"));
+    plist_dict_set_item(root, "ApplicationIdentifierPrefix", prefixes);
+    plist_dict_set_item(root, "CreationDate", plist_new_date(600000000, 0));
+    plist_array_append_item(platforms, plist_new_string("iOS"));
+    plist_dict_set_item(root, "Platform", platforms);
+    plist_dict_set_item(root, "IsXcodeManaged", plist_new_bool(0));
+    for (i = 0; i < 3; i++) {
+        plist_array_append_item(certs, random_data(1400, &seed));
+    }
+    plist_dict_set_item(root, "DeveloperCertificates", certs);
+
+    plist_dict_set_item(ent, "application-identifier", plist_new_string("ABCDE12345.com.example.app"));
+    plist_array_append_item(groups, plist_new_string("ABCDE12345.*"));
+    plist_array_append_item(groups, plist_new_string("com.apple.token"));
+    plist_dict_set_item(ent, "keychain-access-groups", groups);
+    plist_dict_set_item(ent, "get-task-allow", plist_new_bool(1));
+    plist_dict_set_item(ent, "com.apple.developer.team-identifier", plist_new_string("ABCDE12345"));
+    groups = plist_new_array();
+    plist_array_append_item(groups, plist_new_string("group.com.example.app"));
+    plist_dict_set_item(ent, "com.apple.security.application-groups", groups);
+    plist_dict_set_item(ent, "aps-environment", plist_new_string("development"));
+    plist_dict_set_item(root, "Entitlements", ent);
+
+    plist_dict_set_item(root, "ExpirationDate", plist_new_date(600604800, 0));
+    plist_dict_set_item(root, "Name", plist_new_string("iOS Team Provisioning Profile: com.example.app"));
+    for (i = 0; i < ndevices; i++) {
+        for (j = 0; j < 40; j++) {
+            seed = seed * 1103515245 + 12345;
+            udid[j] = "0123456789abcdef"[(seed >> 16) & 15];
+        }
+        udid[40] = '\0';
+        plist_array_append_item(devices, plist_new_string(udid));
+    }
+    plist_dict_set_item(root, "ProvisionedDevices", devices);
+    plist_array_append_item(teams, plist_new_string("ABCDE12345"));
+    plist_dict_set_item(root, "TeamIdentifier", teams);
+    plist_dict_set_item(root, "TeamName", plist_new_string("Example Developer"));
+    plist_dict_set_item(root, "TimeToLive", plist_new_uint(7));
+    plist_dict_set_item(root, "UUID", plist_new_string("6f1c4e2a-8d3b-4c5e-9a7f-0b1d2e3f4a5b"));
+    plist_dict_set_item(root, "Version", plist_new_uint(1));
+    return root;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = NULL;
+    plist_t root;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            min_seconds = atof(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [-t seconds] [datadir]\n", argv[0]);
+            return 1;
+        } else {
+            dir = argv[i];
+        }
+    }
+
+    if (dir) {
+        dir_run(dir);
+    }
+
+    root = make_code_resources(5000);
+    doc_run("synthetic:CodeResources", root);
+    plist_free(root);
+
+    root = make_profile(100);
+    doc_run("synthetic:profile", root);
+    plist_free(root);
+
+    return 0;
+}
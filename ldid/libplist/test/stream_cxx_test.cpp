@@ -0,0 +1,129 @@
+/*
+ * stream_cxx_test.cpp
+ * regression test for writing Structure to a std::streambuf
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <plist/plist++.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "test_check.h"
+
+// accepts limit bytes, then refuses everything
+class LimitedBuf : public std::streambuf
+{
+public:
+    LimitedBuf(size_t limit) : _limit(limit), _calls(0), _failed_call(0) {}
+
+    size_t Calls() const { return _calls; }
+    size_t FailedCall() const { return _failed_call; }
+
+protected:
+    virtual std::streamsize xsputn(const char* s, std::streamsize n)
+    {
+        _calls++;
+        std::streamsize accepted = (static_cast<size_t>(n) > _limit) ? _limit : n;
+        _data.append(s, accepted);
+        _limit -= accepted;
+        if (accepted < n && !_failed_call) {
+            _failed_call = _calls;
+        }
+        return accepted;
+    }
+
+    virtual int_type overflow(int_type c)
+    {
+        return traits_type::eof();
+    }
+
+private:
+    size_t _limit;
+    size_t _calls;
+    size_t _failed_call;
+    std::string _data;
+};
+
+static plist_t build_document()
+{
+    plist_t root = plist_new_dict();
+    plist_t items = plist_new_array();
+    char name[32];
+
+    for (int i = 0; i < 10000; i++) {
+        plist_t item = plist_new_dict();
+        snprintf(name, sizeof(name), "item %d", i);
+        plist_dict_set_item(item, "name", plist_new_string(name));
+        plist_dict_set_item(item, "index", plist_new_uint(i));
+        plist_array_append_item(items, item);
+    }
+    plist_dict_set_item(root, "items", items);
+
+    std::vector<char> big(200 * 1024);
+    for (size_t i = 0; i < big.size(); i++) {
+        big[i] = static_cast<char>(i * 13);
+    }
+    plist_dict_set_item(root, "big", plist_new_data(&big[0], big.size()));
+    return root;
+}
+
+static int test_matches(const PList::Dictionary& dict)
+{
+    std::stringbuf xml;
+    CHECK(dict.ToXml(xml));
+    CHECK(xml.str() == dict.ToXml());
+
+    std::stringbuf bin;
+    CHECK(dict.ToBin(bin));
+    std::vector<char> expected = dict.ToBin();
+    std::string written = bin.str();
+    CHECK(written.size() == expected.size());
+    CHECK(std::equal(written.begin(), written.end(), expected.begin()));
+    return 1;
+}
+
+static int test_failure(const PList::Dictionary& dict)
+{
+    // a short write fails the whole call, and nothing is written after it
+    LimitedBuf xml(100000);
+    CHECK(!dict.ToXml(xml));
+    CHECK(xml.FailedCall() >= 2);
+    CHECK(xml.Calls() == xml.FailedCall());
+
+    LimitedBuf bin(100000);
+    CHECK(!dict.ToBin(bin));
+    CHECK(bin.FailedCall() >= 2);
+    CHECK(bin.Calls() == bin.FailedCall());
+
+    LimitedBuf none(0);
+    CHECK(!dict.ToXml(none));
+    CHECK(none.Calls() == 1);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    PList::Dictionary dict(build_document());
+    if (!test_matches(dict)) return 1;
+    if (!test_failure(dict)) return 2;
+
+    printf("streambuf tests passed\n");
+    return 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * stream_test.c
+ * regression test for the streaming plist writers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "plist/plist.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bytearray.h"
+
+#include "test_check.h"
+
+/* collects everything written to it, optionally failing on the nth call */
+typedef struct sink {
+    char *data;
+    size_t len;
+    size_t capacity;
+    int calls;
+    int fail_at;
+    size_t max_chunk;
+} sink;
+
+static int sink_write(const void *buf, size_t length, void *user_data)
+{
+    sink *s = (sink*)user_data;
+    s->calls++;
+    if (s->fail_at && s->calls >= s->fail_at) {
+        return -1;
+    }
+    if (s->len + length > s->capacity) {
+        s->capacity = (s->len + length) * 2;
+        s->data = (char*)realloc(s->data, s->capacity);
+    }
+    memcpy(s->data + s->len, buf, length);
+    s->len += length;
+    if (length > s->max_chunk) {
+        s->max_chunk = length;
+    }
+    return 0;
+}
+
+static void sink_init(sink *s, int fail_at)
+{
+    memset(s, 0, sizeof(sink));
+    s->fail_at = fail_at;
+}
+
+static int test_byte_array_flush(void)
+{
+    sink s;
+    char pattern[10000];
+    size_t i;
+    size_t lengths[] = { 1, 7, 100, 4095, 4096, 4097, 9999, 3, 0, 2048 };
+    size_t total = 0;
+
+    for (i = 0; i < sizeof(pattern); i++) {
+        pattern[i] = (char)(i * 31 + 7);
+    }
+
+    /* appends smaller than, as large as and larger than the buffer */
+    sink_init(&s, 0);
+    bytearray_t *ba = byte_array_new_with_flush(16, sink_write, &s);
+    CHECK(ba != NULL);
+    size_t capacity = ba->capacity;
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        byte_array_append(ba, pattern, lengths[i]);
+        total += lengths[i];
+        CHECK(ba->flushed + ba->len == total);
+        CHECK(ba->capacity == capacity);
+    }
+    CHECK(byte_array_flush(ba) == 0);
+    CHECK(ba->flushed == total && ba->len == 0);
+    CHECK(s.len == total);
+    size_t pos = 0;
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        CHECK(memcmp(s.data + pos, pattern, lengths[i]) == 0);
+        pos += lengths[i];
+    }
+    /* flushing an empty buffer writes nothing */
+    int calls = s.calls;
+    CHECK(byte_array_flush(ba) == 0);
+    CHECK(s.calls == calls);
+    byte_array_free(ba);
+    free(s.data);
+
+    /* a failed flush sets error, and nothing is written after it */
+    sink_init(&s, 2);
+    ba = byte_array_new_with_flush(16, sink_write, &s);
+    for (i = 0; i < 10; i++) {
+        byte_array_append(ba, pattern, 3000);
+    }
+    CHECK(ba->error);
+    CHECK(s.calls == 2);
+    CHECK(byte_array_flush(ba) == -1);
+    CHECK(s.calls == 2);
+    byte_array_append(ba, pattern, sizeof(pattern));
+    CHECK(s.calls == 2);
+    byte_array_free(ba);
+    free(s.data);
+
+    /* a buffer without a flush function can't be flushed */
+    ba = byte_array_new(16);
+    CHECK(byte_array_flush(ba) == -1);
+    byte_array_free(ba);
+    return 1;
+}
+
+/* large enough to go through the write buffer many times, with data larger than it */
+static plist_t build_document(void)
+{
+    plist_t root = plist_new_dict();
+    plist_t items = plist_new_array();
+    char key[32];
+    int i;
+
+    for (i = 0; i < 20000; i++) {
+        plist_t item = plist_new_dict();
+        snprintf(key, sizeof(key), "item %d & <more>", i);
+        plist_dict_set_item(item, "name", plist_new_string(key));
+        plist_dict_set_item(item, "index", plist_new_uint(i));
+        plist_dict_set_item(item, "ratio", plist_new_real(i / 7.0));
+        plist_dict_set_item(item, "enabled", plist_new_bool(i & 1));
+        plist_array_append_item(items, item);
+    }
+    plist_dict_set_item(root, "items", items);
+
+    size_t big_size = 300 * 1024;
+    char *big = (char*)malloc(big_size);
+    for (i = 0; i < (int)big_size; i++) {
+        big[i] = (char)(i * 13);
+    }
+    plist_dict_set_item(root, "big", plist_new_data(big, big_size));
+    free(big);
+    plist_dict_set_item(root, "unicode", plist_new_string("\xc3\xa4\xc3\xb6\xc3\xbc \xe2\x82\xac"));
+    return root;
+}
+
+static int test_writers_match(plist_t doc)
+{
+    char *xml = NULL;
+    char *bin = NULL;
+    uint32_t xml_length = 0;
+    uint32_t bin_length = 0;
+    sink s;
+
+    plist_to_xml(doc, &xml, &xml_length);
+    plist_to_bin(doc, &bin, &bin_length);
+    CHECK(xml && bin);
+
+    sink_init(&s, 0);
+    CHECK(plist_to_xml_with_func(doc, sink_write, &s) == 0);
+    CHECK(s.calls > 10);
+    CHECK(s.len == xml_length && memcmp(s.data, xml, xml_length) == 0);
+    free(s.data);
+
+    sink_init(&s, 0);
+    CHECK(plist_to_bin_with_func(doc, sink_write, &s) == 0);
+    CHECK(s.calls > 10);
+    CHECK(s.len == bin_length && memcmp(s.data, bin, bin_length) == 0);
+    /* the data node is passed through rather than buffered whole */
+    CHECK(s.max_chunk >= 300 * 1024);
+    free(s.data);
+
+    /* small documents fit the buffer and are written at once */
+    plist_t small = plist_new_string("small");
+    sink_init(&s, 0);
+    CHECK(plist_to_bin_with_func(small, sink_write, &s) == 0);
+    CHECK(s.calls == 1);
+    free(s.data);
+    plist_free(small);
+
+    CHECK(plist_to_xml_with_func(NULL, sink_write, &s) == -1);
+    CHECK(plist_to_bin_with_func(doc, NULL, NULL) == -1);
+
+    free(xml);
+    free(bin);
+    return 1;
+}
+
+static int test_writers_fail(plist_t doc)
+{
+    sink s;
+
+    /* the writer reports the failure and stops calling write_func */
+    sink_init(&s, 3);
+    CHECK(plist_to_xml_with_func(doc, sink_write, &s) == -1);
+    CHECK(s.calls == 3);
+    free(s.data);
+
+    sink_init(&s, 3);
+    CHECK(plist_to_bin_with_func(doc, sink_write, &s) == -1);
+    CHECK(s.calls == 3);
+    free(s.data);
+
+    sink_init(&s, 1);
+    CHECK(plist_to_xml_with_func(doc, sink_write, &s) == -1);
+    CHECK(s.calls == 1 && s.len == 0);
+    free(s.data);
+    return 1;
+}
+
+static int read_back(int fd, char **data, size_t *length)
+{
+    off_t size = lseek(fd, 0, SEEK_END);
+    CHECK(size >= 0);
+    CHECK(lseek(fd, 0, SEEK_SET) == 0);
+    *data = (char*)malloc(size + 1);
+    *length = 0;
+    while (*length < (size_t)size) {
+        ssize_t n = read(fd, *data + *length, size - *length);
+        CHECK(n > 0);
+        *length += n;
+    }
+    return 1;
+}
+
+static int test_file_and_fd(plist_t doc)
+{
+    char *xml = NULL;
+    char *bin = NULL;
+    uint32_t xml_length = 0;
+    uint32_t bin_length = 0;
+    char *data = NULL;
+    size_t length = 0;
+
+    plist_to_xml(doc, &xml, &xml_length);
+    plist_to_bin(doc, &bin, &bin_length);
+
+    FILE *file = tmpfile();
+    CHECK(file != NULL);
+    CHECK(plist_to_xml_file(doc, file) == 0);
+    CHECK(fflush(file) == 0);
+    CHECK(read_back(fileno(file), &data, &length));
+    CHECK(length == xml_length && memcmp(data, xml, xml_length) == 0);
+    free(data);
+    fclose(file);
+
+    file = tmpfile();
+    CHECK(file != NULL);
+    CHECK(plist_to_bin_file(doc, file) == 0);
+    CHECK(fflush(file) == 0);
+    CHECK(read_back(fileno(file), &data, &length));
+    CHECK(length == bin_length && memcmp(data, bin, bin_length) == 0);
+    free(data);
+    fclose(file);
+
+    file = tmpfile();
+    CHECK(file != NULL);
+    CHECK(plist_to_xml_fd(doc, fileno(file)) == 0);
+    CHECK(read_back(fileno(file), &data, &length));
+    CHECK(length == xml_length && memcmp(data, xml, xml_length) == 0);
+    free(data);
+    fclose(file);
+
+    file = tmpfile();
+    CHECK(file != NULL);
+    CHECK(plist_to_bin_fd(doc, fileno(file)) == 0);
+    CHECK(read_back(fileno(file), &data, &length));
+    CHECK(length == bin_length && memcmp(data, bin, bin_length) == 0);
+    free(data);
+    fclose(file);
+
+    /* invalid or read-only destinations fail */
+    CHECK(plist_to_xml_file(doc, NULL) == -1);
+    CHECK(plist_to_bin_fd(doc, -1) == -1);
+    int fd = open("/dev/null", O_RDONLY);
+    CHECK(fd >= 0);
+    CHECK(plist_to_xml_fd(doc, fd) == -1);
+    CHECK(plist_to_bin_fd(doc, fd) == -1);
+    close(fd);
+    file = fopen("/dev/null", "r");
+    CHECK(file != NULL);
+    CHECK(plist_to_bin_file(doc, file) == -1);
+    fclose(file);
+
+    free(xml);
+    free(bin);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test_byte_array_flush()) return 1;
+
+    plist_t doc = build_document();
+    if (!test_writers_match(doc)) return 2;
+    if (!test_writers_fail(doc)) return 3;
+    if (!test_file_and_fd(doc)) return 4;
+    plist_free(doc);
+
+    printf("streaming writer tests passed\n");
+    return 0;
+}